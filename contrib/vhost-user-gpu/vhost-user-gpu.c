@@ -13,6 +13,7 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/drm.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "qemu/sockets.h"
 
@@ -29,6 +30,9 @@ enum {
     VHOST_USER_GPU_MAX_QUEUES = 2,
 };
 
+#define VHOST_USER_GPU_PROTOCOL_FEATURES \
+    (1ULL << VHOST_USER_GPU_PROTOCOL_F_SHM_SCANOUT)
+
 struct virtio_gpu_simple_resource {
     uint32_t resource_id;
     uint32_t width;
@@ -47,6 +51,7 @@ static int opt_fdnum = -1;
 static char *opt_socket_path;
 static char *opt_render_node;
 static gboolean opt_virgl;
+static int opt_bo_pool = 64;
 
 static void vg_handle_ctrl(VuDev *dev, int qidx);
 static void vg_cleanup_mapping(VuGpu *g,
@@ -376,6 +381,7 @@ vg_disable_scanout(VuGpu *g, int scanout_id)
 
     scanout->width = 0;
     scanout->height = 0;
+    scanout->shm = false;
 
     if (g->sock_fd >= 0) {
         VhostUserGpuMsg msg = {
@@ -662,6 +668,7 @@ vg_set_scanout(VuGpu *g,
     scanout->y = ss.r.y;
     scanout->width = ss.r.width;
     scanout->height = ss.r.height;
+    scanout->shm = false;
 
     struct vugbm_buffer *buffer = &res->buffer;
 
@@ -686,6 +693,27 @@ vg_set_scanout(VuGpu *g,
             vg_send_msg(g, &msg, fd);
             close(fd);
         }
+    } else if (g->protocol_features &
+               (1ULL << VHOST_USER_GPU_PROTOCOL_F_SHM_SCANOUT) &&
+               vugbm_buffer_get_shm_fd(buffer, &fd)) {
+        size_t bpp =
+            PIXMAN_FORMAT_BPP(pixman_image_get_format(res->image)) / 8;
+        VhostUserGpuMsg msg = {
+            .request = VHOST_USER_GPU_SHM_SCANOUT,
+            .size = sizeof(VhostUserGpuShmScanout),
+            .payload.shm_scanout = (VhostUserGpuShmScanout) {
+                .scanout_id = ss.scanout_id,
+                .width = scanout->width,
+                .height = scanout->height,
+                .format = res->format,
+                .stride = buffer->stride,
+                .offset = (uint64_t)ss.r.y * buffer->stride + ss.r.x * bpp,
+            }
+        };
+
+        /* the frontend displays the buffer, updates only carry damage */
+        vg_send_msg(g, &msg, fd);
+        scanout->shm = true;
     } else {
         VhostUserGpuMsg msg = {
             .request = VHOST_USER_GPU_SCANOUT,
@@ -770,6 +798,19 @@ vg_resource_flush(VuGpu *g,
             };
             vg_send_msg(g, &vmsg, -1);
             vg_wait_ok(g);
+        } else if (scanout->shm) {
+            VhostUserGpuMsg vmsg = {
+                .request = VHOST_USER_GPU_SHM_UPDATE,
+                .size = sizeof(VhostUserGpuUpdate),
+                .payload.update = (VhostUserGpuUpdate) {
+                    .scanout_id = i,
+                    .x = extents->x1 - scanout->x,
+                    .y = extents->y1 - scanout->y,
+                    .width = width,
+                    .height = height,
+                }
+            };
+            vg_send_msg(g, &vmsg, -1);
         } else {
             size_t bpp =
                 PIXMAN_FORMAT_BPP(pixman_image_get_format(res->image)) / 8;
@@ -1032,10 +1073,11 @@ protocol_features_cb(gint fd, GIOCondition condition, gpointer user_data)
         return G_SOURCE_CONTINUE;
     }
 
+    g->protocol_features = u64 & VHOST_USER_GPU_PROTOCOL_FEATURES;
     msg = (VhostUserGpuMsg) {
         .request = VHOST_USER_GPU_SET_PROTOCOL_FEATURES,
         .size = sizeof(uint64_t),
-        .payload.u64 = 0
+        .payload.u64 = g->protocol_features
     };
     vg_send_msg(g, &msg, -1);
 
@@ -1175,6 +1217,9 @@ static GOptionEntry entries[] = {
       "Specify DRM render node", "PATH" },
     { "virgl", 'v', 0, G_OPTION_ARG_NONE, &opt_virgl,
       "Turn virgl rendering on", NULL },
+    { "bo-pool", 'p', 0, G_OPTION_ARG_INT, &opt_bo_pool,
+      "Keep up to SIZE MiB of released buffers for reuse (default 64)",
+      "SIZE" },
     { NULL, }
 };
 
@@ -1216,6 +1261,7 @@ main(int argc, char *argv[])
     }
 
     vugbm_device_init(&g.gdev, g.drm_rnode_fd);
+    vugbm_device_set_pool_size(&g.gdev, (size_t)MAX(opt_bo_pool, 0) * MiB);
 
     if ((!!opt_socket_path + (opt_fdnum != -1)) != 1) {
         g_printerr("Please specify either --fd or --socket-path\n");
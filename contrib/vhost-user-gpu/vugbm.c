@@ -8,12 +8,21 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+#include "qemu/memfd.h"
 #include "vugbm.h"
 
 static bool
 mem_alloc_bo(struct vugbm_buffer *buf)
 {
-    buf->mmap = g_malloc(buf->width * buf->height * 4);
+    /* memfd backed memory can be shared with the frontend */
+    buf->mmap = qemu_memfd_alloc("vhost-user-gpu-bo", buf->size,
+                                 F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL,
+                                 &buf->memfd, NULL);
+    if (!buf->mmap) {
+        buf->memfd = -1;
+        buf->mmap = g_malloc(buf->size);
+    }
     buf->stride = buf->width * 4;
     return true;
 }
@@ -21,7 +30,11 @@ mem_alloc_bo(struct vugbm_buffer *buf)
 static void
 mem_free_bo(struct vugbm_buffer *buf)
 {
-    g_free(buf->mmap);
+    if (buf->memfd >= 0) {
+        qemu_memfd_free(buf->mmap, buf->size, buf->memfd);
+    } else {
+        g_free(buf->mmap);
+    }
 }
 
 static bool
@@ -50,12 +63,6 @@ struct udmabuf_create {
 
 #define UDMABUF_CREATE _IOW('u', 0x42, struct udmabuf_create)
 
-static size_t
-udmabuf_get_size(struct vugbm_buffer *buf)
-{
-    return ROUND_UP(buf->width * buf->height * 4, qemu_real_host_page_size);
-}
-
 static bool
 udmabuf_alloc_bo(struct vugbm_buffer *buf)
 {
@@ -66,7 +73,7 @@ udmabuf_alloc_bo(struct vugbm_buffer *buf)
         return false;
     }
 
-    ret = ftruncate(buf->memfd, udmabuf_get_size(buf));
+    ret = ftruncate(buf->memfd, buf->size);
     if (ret < 0) {
         close(buf->memfd);
         return false;
@@ -92,7 +99,7 @@ udmabuf_free_bo(struct vugbm_buffer *buf)
 static bool
 udmabuf_map_bo(struct vugbm_buffer *buf)
 {
-    buf->mmap = mmap(NULL, udmabuf_get_size(buf),
+    buf->mmap = mmap(NULL, buf->size,
                      PROT_READ | PROT_WRITE, MAP_SHARED, buf->memfd, 0);
     if (buf->mmap == MAP_FAILED) {
         return false;
@@ -107,7 +114,7 @@ udmabuf_get_fd(struct vugbm_buffer *buf, int *fd)
     struct udmabuf_create create = {
         .memfd = buf->memfd,
         .offset = 0,
-        .size = udmabuf_get_size(buf),
+        .size = buf->size,
     };
 
     *fd = ioctl(buf->dev->fd, UDMABUF_CREATE, &create);
@@ -118,7 +125,7 @@ udmabuf_get_fd(struct vugbm_buffer *buf, int *fd)
 static void
 udmabuf_unmap_bo(struct vugbm_buffer *buf)
 {
-    munmap(buf->mmap, udmabuf_get_size(buf));
+    munmap(buf->mmap, buf->size);
 }
 
 static void
@@ -142,6 +149,7 @@ alloc_bo(struct vugbm_buffer *buf)
 
     if (buf->bo) {
         buf->stride = gbm_bo_get_stride(buf->bo);
+        buf->size = buf->stride * buf->height;
         return true;
     }
 
@@ -189,6 +197,94 @@ device_destroy(struct vugbm_device *dev)
 }
 #endif
 
+static bool
+vugbm_buffer_map(struct vugbm_buffer *buf)
+{
+    struct vugbm_device *dev = buf->dev;
+
+    return dev->map_bo(buf);
+}
+
+static void
+vugbm_buffer_unmap(struct vugbm_buffer *buf)
+{
+    struct vugbm_device *dev = buf->dev;
+
+    dev->unmap_bo(buf);
+}
+
+/*
+ * Buffers are recycled through a pool of released bos, so that guests
+ * churning through resources don't pay for mmap and page faults each
+ * time.  Unless the device needs exact dimensions, sizes are rounded
+ * up to one of four classes per power of two, wasting at most 25%.
+ */
+static size_t
+vugbm_size_class(size_t size)
+{
+    size_t step = MAX(pow2floor(size) / 4, qemu_real_host_page_size);
+
+    return ROUND_UP(size, step);
+}
+
+static void
+vugbm_pool_log(struct vugbm_device *dev)
+{
+    g_debug("bo pool: %" PRIu64 " hits, %" PRIu64 " misses, "
+            "%zu/%zu bytes held", dev->pool_hits, dev->pool_misses,
+            dev->pool_size, dev->pool_max);
+}
+
+static void
+vugbm_pool_evict(struct vugbm_device *dev, struct vugbm_buffer *buf)
+{
+    QTAILQ_REMOVE(&dev->pool, buf, pool_next);
+    dev->pool_size -= buf->size;
+    vugbm_buffer_unmap(buf);
+    dev->free_bo(buf);
+    g_free(buf);
+}
+
+static void
+vugbm_pool_trim(struct vugbm_device *dev, size_t max)
+{
+    bool trimmed = false;
+
+    while (dev->pool_size > max) {
+        vugbm_pool_evict(dev, QTAILQ_LAST(&dev->pool));
+        trimmed = true;
+    }
+    if (trimmed) {
+        vugbm_pool_log(dev);
+    }
+}
+
+static struct vugbm_buffer *
+vugbm_pool_take(struct vugbm_device *dev, struct vugbm_buffer *want)
+{
+    struct vugbm_buffer *buf;
+
+    QTAILQ_FOREACH(buf, &dev->pool, pool_next) {
+        if (dev->fixed_layout ?
+            buf->width == want->width && buf->height == want->height :
+            buf->size == want->size) {
+            QTAILQ_REMOVE(&dev->pool, buf, pool_next);
+            dev->pool_size -= buf->size;
+            dev->pool_hits++;
+            return buf;
+        }
+    }
+    dev->pool_misses++;
+    return NULL;
+}
+
+void
+vugbm_device_set_pool_size(struct vugbm_device *dev, size_t size)
+{
+    dev->pool_max = size;
+    vugbm_pool_trim(dev, size);
+}
+
 void
 vugbm_device_destroy(struct vugbm_device *dev)
 {
@@ -196,6 +292,8 @@ vugbm_device_destroy(struct vugbm_device *dev)
         return;
     }
 
+    vugbm_pool_log(dev);
+    vugbm_pool_trim(dev, 0);
     dev->device_destroy(dev);
 }
 
@@ -204,6 +302,8 @@ vugbm_device_init(struct vugbm_device *dev, int fd)
 {
     assert(!dev->inited);
 
+    QTAILQ_INIT(&dev->pool);
+
 #ifdef CONFIG_GBM
     if (fd >= 0) {
         dev->dev = gbm_create_device(fd);
@@ -216,6 +316,7 @@ vugbm_device_init(struct vugbm_device *dev, int fd)
         dev->map_bo = map_bo;
         dev->unmap_bo = unmap_bo;
         dev->device_destroy = device_destroy;
+        dev->fixed_layout = true;
         dev->inited = true;
     }
 #endif
@@ -235,31 +336,26 @@ vugbm_device_init(struct vugbm_device *dev, int fd)
     }
 #endif
     if (!dev->inited) {
-        g_debug("Using mem fallback");
-        dev->alloc_bo = mem_alloc_bo;
-        dev->free_bo = mem_free_bo;
-        dev->map_bo = mem_map_bo;
-        dev->unmap_bo = mem_unmap_bo;
-        dev->device_destroy = mem_device_destroy;
-        dev->inited = true;
+        vugbm_device_init_mem(dev);
     }
     assert(dev->inited);
 }
 
-static bool
-vugbm_buffer_map(struct vugbm_buffer *buf)
-{
-    struct vugbm_device *dev = buf->dev;
-
-    return dev->map_bo(buf);
-}
-
-static void
-vugbm_buffer_unmap(struct vugbm_buffer *buf)
+/* Plain (memfd backed if possible) memory, needs no GPU at all */
+void
+vugbm_device_init_mem(struct vugbm_device *dev)
 {
-    struct vugbm_device *dev = buf->dev;
+    assert(!dev->inited);
 
-    dev->unmap_bo(buf);
+    g_debug("Using mem fallback");
+    QTAILQ_INIT(&dev->pool);
+    dev->fd = -1;
+    dev->alloc_bo = mem_alloc_bo;
+    dev->free_bo = mem_free_bo;
+    dev->map_bo = mem_map_bo;
+    dev->unmap_bo = mem_unmap_bo;
+    dev->device_destroy = mem_device_destroy;
+    dev->inited = true;
 }
 
 bool
@@ -286,6 +382,26 @@ vugbm_buffer_get_dmabuf_fd(struct vugbm_buffer *buffer, int *fd)
         return false;
     }
 
+    buffer->exported = true;
+    return true;
+}
+
+/*
+ * Without a dmabuf, memfd backed buffers can still be shared with the
+ * frontend, which maps them directly.  The fd remains owned by the buffer.
+ *
+ * Either way the frontend may keep showing the buffer after it has been
+ * released here, so it is freed rather than pooled for another resource.
+ */
+bool
+vugbm_buffer_get_shm_fd(struct vugbm_buffer *buffer, int *fd)
+{
+    if (buffer->memfd < 0) {
+        return false;
+    }
+
+    *fd = buffer->memfd;
+    buffer->exported = true;
     return true;
 }
 
@@ -293,11 +409,31 @@ bool
 vugbm_buffer_create(struct vugbm_buffer *buffer, struct vugbm_device *dev,
                     uint32_t width, uint32_t height)
 {
+    struct vugbm_buffer *pooled;
+
     buffer->dev = dev;
     buffer->width = width;
     buffer->height = height;
     buffer->format = GBM_FORMAT_XRGB8888;
     buffer->stride = 0; /* modified during alloc */
+    buffer->memfd = -1;
+    buffer->size = vugbm_size_class(width * height * 4);
+    buffer->exported = false;
+
+    pooled = vugbm_pool_take(dev, buffer);
+    if (pooled) {
+        *buffer = *pooled;
+        g_free(pooled);
+        if (!dev->fixed_layout) {
+            buffer->width = width;
+            buffer->height = height;
+            buffer->stride = width * 4;
+        }
+        /* don't leak the previous contents into the new resource */
+        memset(buffer->mmap, 0, buffer->stride * height);
+        return true;
+    }
+
     if (!dev->alloc_bo(buffer)) {
         g_warning("alloc_bo failed");
         return false;
@@ -319,6 +455,15 @@ void
 vugbm_buffer_destroy(struct vugbm_buffer *buffer)
 {
     struct vugbm_device *dev = buffer->dev;
+    struct vugbm_buffer *pooled;
+
+    if (!buffer->exported && buffer->size <= dev->pool_max) {
+        pooled = g_memdup(buffer, sizeof(*buffer));
+        QTAILQ_INSERT_HEAD(&dev->pool, pooled, pool_next);
+        dev->pool_size += pooled->size;
+        vugbm_pool_trim(dev, dev->pool_max);
+        return;
+    }
 
     vugbm_buffer_unmap(buffer);
     dev->free_bo(buffer);
@@ -10,6 +10,7 @@
 #ifndef VHOST_USER_GPU_VUGBM_H
 #define VHOST_USER_GPU_VUGBM_H
 
+#include "qemu/queue.h"
 
 #ifdef CONFIG_MEMFD
 #include <sys/ioctl.h>
@@ -27,6 +28,18 @@ struct vugbm_device {
 #ifdef CONFIG_GBM
     struct gbm_device *dev;
 #endif
+    /* bos can only be reused for the very same dimensions */
+    bool fixed_layout;
+
+    /*
+     * released buffers, most recently used first; never the ones shared
+     * with the frontend, it may still show them
+     */
+    QTAILQ_HEAD(, vugbm_buffer) pool;
+    size_t pool_size;
+    size_t pool_max;
+    uint64_t pool_hits;
+    uint64_t pool_misses;
 
     bool (*alloc_bo)(struct vugbm_buffer *buf);
     void (*free_bo)(struct vugbm_buffer *buf);
@@ -39,28 +52,34 @@ struct vugbm_device {
 struct vugbm_buffer {
     struct vugbm_device *dev;
 
-#ifdef CONFIG_MEMFD
     int memfd;
-#endif
 #ifdef CONFIG_GBM
     struct gbm_bo *bo;
     void *mmap_data;
 #endif
 
     uint8_t *mmap;
+    size_t size;
     uint32_t width;
     uint32_t height;
     uint32_t stride;
     uint32_t format;
+    /* an fd of it went to the frontend */
+    bool exported;
+
+    QTAILQ_ENTRY(vugbm_buffer) pool_next;
 };
 
 void vugbm_device_init(struct vugbm_device *dev, int fd);
+void vugbm_device_init_mem(struct vugbm_device *dev);
 void vugbm_device_destroy(struct vugbm_device *dev);
+void vugbm_device_set_pool_size(struct vugbm_device *dev, size_t size);
 
 bool vugbm_buffer_create(struct vugbm_buffer *buffer, struct vugbm_device *dev,
                          uint32_t width, uint32_t height);
 bool vugbm_buffer_can_get_dmabuf_fd(struct vugbm_buffer *buffer);
 bool vugbm_buffer_get_dmabuf_fd(struct vugbm_buffer *buffer, int *fd);
+bool vugbm_buffer_get_shm_fd(struct vugbm_buffer *buffer, int *fd);
 void vugbm_buffer_destroy(struct vugbm_buffer *buffer);
 
 #endif
@@ -36,8 +36,12 @@ typedef enum VhostUserGpuRequest {
     VHOST_USER_GPU_UPDATE,
     VHOST_USER_GPU_DMABUF_SCANOUT,
     VHOST_USER_GPU_DMABUF_UPDATE,
+    VHOST_USER_GPU_SHM_SCANOUT,
+    VHOST_USER_GPU_SHM_UPDATE,
 } VhostUserGpuRequest;
 
+#define VHOST_USER_GPU_PROTOCOL_F_SHM_SCANOUT 0
+
 typedef struct VhostUserGpuDisplayInfoReply {
     struct virtio_gpu_resp_display_info info;
 } VhostUserGpuDisplayInfoReply;
@@ -83,6 +87,15 @@ typedef struct VhostUserGpuDMABUFScanout {
     int fd_drm_fourcc;
 } QEMU_PACKED VhostUserGpuDMABUFScanout;
 
+typedef struct VhostUserGpuShmScanout {
+    uint32_t scanout_id;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t stride;
+    uint64_t offset;
+} QEMU_PACKED VhostUserGpuShmScanout;
+
 typedef struct VhostUserGpuMsg {
     uint32_t request; /* VhostUserGpuRequest */
     uint32_t flags;
@@ -93,6 +106,7 @@ typedef struct VhostUserGpuMsg {
         VhostUserGpuScanout scanout;
         VhostUserGpuUpdate update;
         VhostUserGpuDMABUFScanout dmabuf_scanout;
+        VhostUserGpuShmScanout shm_scanout;
         struct virtio_gpu_resp_display_info display_info;
         uint64_t u64;
     } payload;
@@ -109,6 +123,7 @@ struct virtio_gpu_scanout {
     int x, y;
     int invalidate;
     uint32_t resource_id;
+    bool shm;
 };
 
 typedef struct VuGpu {
@@ -123,6 +138,7 @@ typedef struct VuGpu {
     bool virgl;
     bool virgl_inited;
     uint32_t inflight;
+    uint64_t protocol_features;
 
     struct virtio_gpu_scanout scanout[VIRTIO_GPU_MAX_SCANOUTS];
     QTAILQ_HEAD(, virtio_gpu_simple_resource) reslist;
@@ -244,17 +244,18 @@ ERST
 
     {
         .name       = "screendump",
-        .args_type  = "filename:F,device:s?,head:i?",
-        .params     = "filename [device [head]]",
+        .args_type  = "png:-p,filename:F,device:s?,head:i?",
+        .params     = "[-p] filename [device [head]]",
         .help       = "save screen from head 'head' of display device 'device' "
-                      "into PPM image 'filename'",
+                      "into PPM image 'filename' "
+                      "(PNG image with -p)",
         .cmd        = hmp_screendump,
         .coroutine  = true,
     },
 
 SRST
-``screendump`` *filename*
-  Save screen into PPM image *filename*.
+``screendump [-p]`` *filename*
+  Save screen into PPM image *filename*, or PNG image with ``-p``.
 ERST
 
     {
@@ -41,6 +41,9 @@ GlobalProperty hw_compat_6_0[] = {
     { "gpex-pcihost", "allow-unmapped-accesses", "false" },
     { "i8042", "extended-state", "false"},
     { "nvme-ns", "eui64-default", "off"},
+    { "virtio-gpu-device", "x-live-migration", "false" },
+    { "virtio-gpu-device", "pace-flush", "false" },
+    { "virtio-gpu-device", "flush-on-idle", "false" },
 };
 const size_t hw_compat_6_0_len = G_N_ELEMENTS(hw_compat_6_0);
 
@@ -306,6 +306,102 @@ static inline uint32_t cirrus_src32(CirrusVGAState *s, uint32_t srcaddr)
     return *src;
 }
 
+/*
+ * Fast paths: the blit is done a row at a time on host pointers, eight
+ * bytes at a time where possible, instead of masking every address.  They
+ * must give exactly the same result as the byte by byte loops, which stay
+ * as the fallback for rows that wrap around vram or the blit buffer.
+ */
+
+/* for each run of 64 / depth pixels, 0xff in the bytes of the set bits */
+static uint64_t cirrus_expand_mask[3][256];
+
+static void cirrus_expand_mask_init(void)
+{
+    int depth, bits, i, ppw;
+    uint8_t b[8];
+
+    for (depth = 8; depth <= 32; depth *= 2) {
+        ppw = 64 / depth;
+        for (bits = 0; bits < (1 << ppw); bits++) {
+            for (i = 0; i < 8; i++) {
+                b[i] = (bits << (i / (depth / 8))) & (1 << (ppw - 1)) ?
+                    0xff : 0;
+            }
+            memcpy(&cirrus_expand_mask[depth / 16][bits], b, 8);
+        }
+    }
+}
+
+/* 0xff in every byte of x that is not zero */
+static inline uint64_t cirrus_nonzero8(uint64_t x)
+{
+    const uint64_t lo = 0x7f7f7f7f7f7f7f7fULL;
+
+    return (((((x & lo) + lo) | x) & ~lo) >> 7) * 0xff;
+}
+
+/* 0xffff in every 16 bit lane of x that is not zero */
+static inline uint64_t cirrus_nonzero16(uint64_t x)
+{
+    const uint64_t lo = 0x7fff7fff7fff7fffULL;
+
+    return (((((x & lo) + lo) | x) & ~lo) >> 15) * 0xffff;
+}
+
+/* col in every depth bits of a word */
+static inline uint64_t cirrus_rep(uint32_t col, int depth)
+{
+    switch (depth) {
+    case 8:
+        return (uint8_t)col * 0x0101010101010101ULL;
+    case 16:
+        return (uint16_t)col * 0x0001000100010001ULL;
+    default:
+        return col * 0x0000000100000001ULL;
+    }
+}
+
+/* the len bytes of vram at addr, unless they wrap around */
+static uint8_t *cirrus_blt_dst_row(CirrusVGAState *s, uint32_t addr, int len)
+{
+    addr &= s->cirrus_addr_mask;
+    if (!s->blitter_accel || addr + len > s->cirrus_addr_mask + 1) {
+        return NULL;
+    }
+    return s->vga.vram_ptr + addr;
+}
+
+/*
+ * The destination and source of a len bytes row starting at dstaddr and
+ * srcaddr.  Rows closer than a word to each other in vram are left to the
+ * byte by byte loops, which read back what they wrote just before.
+ */
+static bool cirrus_blt_row(CirrusVGAState *s, uint32_t dstaddr,
+                           uint32_t srcaddr, int len,
+                           uint8_t **dst, const uint8_t **src)
+{
+    *dst = cirrus_blt_dst_row(s, dstaddr, len);
+    if (!*dst) {
+        return false;
+    }
+    if (s->cirrus_srccounter) {
+        /* cputovideo */
+        srcaddr &= CIRRUS_BLTBUFSIZE - 1;
+        if (srcaddr + len > CIRRUS_BLTBUFSIZE) {
+            return false;
+        }
+        *src = s->cirrus_bltbuf + srcaddr;
+    } else {
+        /* videotovideo */
+        *src = cirrus_blt_dst_row(s, srcaddr, len);
+        if (!*src || (*src != *dst && ABS(*src - *dst) < 8)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 #define ROP_NAME 0
 #define ROP_FN(d, s) 0
 #include "cirrus_vga_rop.h"
@@ -2863,6 +2959,7 @@ void cirrus_init_common(CirrusVGAState *s, Object *owner,
         rop_to_index[CIRRUS_ROP_NOTSRC] = 13;
         rop_to_index[CIRRUS_ROP_NOTSRC_OR_DST] = 14;
         rop_to_index[CIRRUS_ROP_NOTSRC_AND_NOTDST] = 15;
+        cirrus_expand_mask_init();
         s->device_id = device_id;
         if (is_pci)
             s->bustype = CIRRUS_BUSTYPE_PCI;
@@ -2983,6 +3080,8 @@ static Property pci_vga_cirrus_properties[] = {
                        cirrus_vga.vga.vram_size_mb, 4),
     DEFINE_PROP_BOOL("blitter", struct PCICirrusVGAState,
                      cirrus_vga.enable_blitter, true),
+    DEFINE_PROP_BOOL("x-blitter-accel", struct PCICirrusVGAState,
+                     cirrus_vga.blitter_accel, true),
     DEFINE_PROP_BOOL("global-vmstate", struct PCICirrusVGAState,
                      cirrus_vga.vga.global_vmstate, false),
     DEFINE_PROP_END_OF_LIST(),
@@ -68,6 +68,7 @@ typedef struct CirrusVGAState {
     uint32_t cirrus_bank_limit[2];
     uint8_t cirrus_hidden_palette[48];
     bool enable_blitter;
+    bool blitter_accel;
     int cirrus_blt_pixelwidth;
     int cirrus_blt_width;
     int cirrus_blt_height;
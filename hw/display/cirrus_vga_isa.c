@@ -71,6 +71,8 @@ static Property isa_cirrus_vga_properties[] = {
                        cirrus_vga.vga.vram_size_mb, 4),
     DEFINE_PROP_BOOL("blitter", struct ISACirrusVGAState,
                      cirrus_vga.enable_blitter, true),
+    DEFINE_PROP_BOOL("x-blitter-accel", struct ISACirrusVGAState,
+                     cirrus_vga.blitter_accel, true),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -73,7 +73,84 @@ static inline void glue(rop_32_, ROP_NAME)(CirrusVGAState *s,
 #define ROP_OP_16(st, d, s)        glue(rop_16_, ROP_NAME)(st, d, s)
 #define ROP_OP_TR_16(st, d, s, t)  glue(rop_tr_16_, ROP_NAME)(st, d, s, t)
 #define ROP_OP_32(st, d, s)        glue(rop_32_, ROP_NAME)(st, d, s)
-#undef ROP_FN
+
+static inline void glue(rop_row_, ROP_NAME)(uint8_t *dst, const uint8_t *src,
+                                            int len, bool bkwd)
+{
+    int x, n = len & ~7;
+
+    if (!bkwd) {
+        for (x = 0; x < n; x += 8) {
+            stq_he_p(dst + x, ROP_FN(ldq_he_p(dst + x), ldq_he_p(src + x)));
+        }
+        for (; x < len; x++) {
+            dst[x] = ROP_FN(dst[x], src[x]);
+        }
+    } else {
+        for (x = len - 1; x >= n; x--) {
+            dst[x] = ROP_FN(dst[x], src[x]);
+        }
+        for (x = n - 8; x >= 0; x -= 8) {
+            stq_he_p(dst + x, ROP_FN(ldq_he_p(dst + x), ldq_he_p(src + x)));
+        }
+    }
+}
+
+static inline void glue(rop_tr_word_, ROP_NAME)(uint8_t *dst,
+                                                const uint8_t *src,
+                                                int bpp, uint64_t transp)
+{
+    uint64_t d = ldq_he_p(dst);
+    uint64_t pixel = ROP_FN(d, ldq_he_p(src));
+    uint64_t m = bpp == 1 ? cirrus_nonzero8(pixel ^ transp)
+                          : cirrus_nonzero16(pixel ^ transp);
+
+    stq_he_p(dst, (pixel & m) | (d & ~m));
+}
+
+static inline void glue(rop_tr_pixel_, ROP_NAME)(uint8_t *dst,
+                                                 const uint8_t *src,
+                                                 int bpp, uint16_t transp)
+{
+    if (bpp == 1) {
+        uint8_t pixel = ROP_FN(*dst, *src);
+        if (pixel != transp) {
+            *dst = pixel;
+        }
+    } else {
+        uint16_t pixel = ROP_FN(lduw_he_p(dst), lduw_he_p(src));
+        if (pixel != transp) {
+            stw_he_p(dst, pixel);
+        }
+    }
+}
+
+/* len is a multiple of bpp */
+static inline void glue(rop_tr_row_, ROP_NAME)(uint8_t *dst,
+                                               const uint8_t *src,
+                                               int len, int bpp,
+                                               uint16_t transp, bool bkwd)
+{
+    uint64_t transp64 = transp * (bpp == 1 ? 0x0101010101010101ULL
+                                           : 0x0001000100010001ULL);
+    int x, n = len & ~7;
+
+    if (!bkwd) {
+        for (x = 0; x < n; x += 8) {
+            glue(rop_tr_word_, ROP_NAME)(dst + x, src + x, bpp, transp64);
+        }
+        for (; x < len; x += bpp) {
+            glue(rop_tr_pixel_, ROP_NAME)(dst + x, src + x, bpp, transp);
+        }
+    } else {
+        for (x = len - bpp; x >= n; x -= bpp) {
+            glue(rop_tr_pixel_, ROP_NAME)(dst + x, src + x, bpp, transp);
+        }
+        for (x = n - 8; x >= 0; x -= 8) {
+            glue(rop_tr_word_, ROP_NAME)(dst + x, src + x, bpp, transp64);
+        }
+    }
+}
 
 static void
 glue(cirrus_bitblt_rop_fwd_, ROP_NAME)(CirrusVGAState *s,
@@ -83,6 +160,8 @@ glue(cirrus_bitblt_rop_fwd_, ROP_NAME)(CirrusVGAState *s,
                                        int bltwidth, int bltheight)
 {
     int x,y;
+    uint8_t *d;
+    const uint8_t *src;
     dstpitch -= bltwidth;
     srcpitch -= bltwidth;
 
@@ -91,10 +170,16 @@ glue(cirrus_bitblt_rop_fwd_, ROP_NAME)(CirrusVGAState *s,
     }
 
     for (y = 0; y < bltheight; y++) {
-        for (x = 0; x < bltwidth; x++) {
-            ROP_OP(s, dstaddr, cirrus_src(s, srcaddr));
-            dstaddr++;
-            srcaddr++;
+        if (cirrus_blt_row(s, dstaddr, srcaddr, bltwidth, &d, &src)) {
+            glue(rop_row_, ROP_NAME)(d, src, bltwidth, false);
+            dstaddr += bltwidth;
+            srcaddr += bltwidth;
+        } else {
+            for (x = 0; x < bltwidth; x++) {
+                ROP_OP(s, dstaddr, cirrus_src(s, srcaddr));
+                dstaddr++;
+                srcaddr++;
+            }
         }
         dstaddr += dstpitch;
         srcaddr += srcpitch;
@@ -109,13 +194,22 @@ glue(cirrus_bitblt_rop_bkwd_, ROP_NAME)(CirrusVGAState *s,
                                         int bltwidth, int bltheight)
 {
     int x,y;
+    uint8_t *d;
+    const uint8_t *src;
     dstpitch += bltwidth;
     srcpitch += bltwidth;
     for (y = 0; y < bltheight; y++) {
-        for (x = 0; x < bltwidth; x++) {
-            ROP_OP(s, dstaddr, cirrus_src(s, srcaddr));
-            dstaddr--;
-            srcaddr--;
+        if (cirrus_blt_row(s, dstaddr - (bltwidth - 1),
+                           srcaddr - (bltwidth - 1), bltwidth, &d, &src)) {
+            glue(rop_row_, ROP_NAME)(d, src, bltwidth, true);
+            dstaddr -= bltwidth;
+            srcaddr -= bltwidth;
+        } else {
+            for (x = 0; x < bltwidth; x++) {
+                ROP_OP(s, dstaddr, cirrus_src(s, srcaddr));
+                dstaddr--;
+                srcaddr--;
+            }
         }
         dstaddr += dstpitch;
         srcaddr += srcpitch;
@@ -132,6 +226,8 @@ glue(glue(cirrus_bitblt_rop_fwd_transp_, ROP_NAME),_8)(CirrusVGAState *s,
                                                        int bltheight)
 {
     int x,y;
+    uint8_t *d;
+    const uint8_t *src;
     uint8_t transp = s->vga.gr[0x34];
     dstpitch -= bltwidth;
     srcpitch -= bltwidth;
@@ -141,10 +237,16 @@ glue(glue(cirrus_bitblt_rop_fwd_transp_, ROP_NAME),_8)(CirrusVGAState *s,
     }
 
     for (y = 0; y < bltheight; y++) {
-        for (x = 0; x < bltwidth; x++) {
-            ROP_OP_TR(s, dstaddr, cirrus_src(s, srcaddr), transp);
-            dstaddr++;
-            srcaddr++;
+        if (cirrus_blt_row(s, dstaddr, srcaddr, bltwidth, &d, &src)) {
+            glue(rop_tr_row_, ROP_NAME)(d, src, bltwidth, 1, transp, false);
+            dstaddr += bltwidth;
+            srcaddr += bltwidth;
+        } else {
+            for (x = 0; x < bltwidth; x++) {
+                ROP_OP_TR(s, dstaddr, cirrus_src(s, srcaddr), transp);
+                dstaddr++;
+                srcaddr++;
+            }
         }
         dstaddr += dstpitch;
         srcaddr += srcpitch;
@@ -161,14 +263,23 @@ glue(glue(cirrus_bitblt_rop_bkwd_transp_, ROP_NAME),_8)(CirrusVGAState *s,
                                                         int bltheight)
 {
     int x,y;
+    uint8_t *d;
+    const uint8_t *src;
     uint8_t transp = s->vga.gr[0x34];
     dstpitch += bltwidth;
     srcpitch += bltwidth;
     for (y = 0; y < bltheight; y++) {
-        for (x = 0; x < bltwidth; x++) {
-            ROP_OP_TR(s, dstaddr, cirrus_src(s, srcaddr), transp);
-            dstaddr--;
-            srcaddr--;
+        if (cirrus_blt_row(s, dstaddr - (bltwidth - 1),
+                           srcaddr - (bltwidth - 1), bltwidth, &d, &src)) {
+            glue(rop_tr_row_, ROP_NAME)(d, src, bltwidth, 1, transp, true);
+            dstaddr -= bltwidth;
+            srcaddr -= bltwidth;
+        } else {
+            for (x = 0; x < bltwidth; x++) {
+                ROP_OP_TR(s, dstaddr, cirrus_src(s, srcaddr), transp);
+                dstaddr--;
+                srcaddr--;
+            }
         }
         dstaddr += dstpitch;
         srcaddr += srcpitch;
@@ -185,6 +296,8 @@ glue(glue(cirrus_bitblt_rop_fwd_transp_, ROP_NAME),_16)(CirrusVGAState *s,
                                                         int bltheight)
 {
     int x,y;
+    uint8_t *d;
+    const uint8_t *src;
     uint16_t transp = s->vga.gr[0x34] | (uint16_t)s->vga.gr[0x35] << 8;
     dstpitch -= bltwidth;
     srcpitch -= bltwidth;
@@ -194,10 +307,18 @@ glue(glue(cirrus_bitblt_rop_fwd_transp_, ROP_NAME),_16)(CirrusVGAState *s,
     }
 
     for (y = 0; y < bltheight; y++) {
-        for (x = 0; x < bltwidth; x+=2) {
-            ROP_OP_TR_16(s, dstaddr, cirrus_src16(s, srcaddr), transp);
-            dstaddr += 2;
-            srcaddr += 2;
+        /* the byte by byte loop rounds odd addresses down */
+        if (!((dstaddr | srcaddr | bltwidth) & 1) &&
+            cirrus_blt_row(s, dstaddr, srcaddr, bltwidth, &d, &src)) {
+            glue(rop_tr_row_, ROP_NAME)(d, src, bltwidth, 2, transp, false);
+            dstaddr += bltwidth;
+            srcaddr += bltwidth;
+        } else {
+            for (x = 0; x < bltwidth; x+=2) {
+                ROP_OP_TR_16(s, dstaddr, cirrus_src16(s, srcaddr), transp);
+                dstaddr += 2;
+                srcaddr += 2;
+            }
         }
         dstaddr += dstpitch;
         srcaddr += srcpitch;
@@ -214,14 +335,26 @@ glue(glue(cirrus_bitblt_rop_bkwd_transp_, ROP_NAME),_16)(CirrusVGAState *s,
                                                          int bltheight)
 {
     int x,y;
+    uint8_t *d;
+    const uint8_t *src;
     uint16_t transp = s->vga.gr[0x34] | (uint16_t)s->vga.gr[0x35] << 8;
     dstpitch += bltwidth;
     srcpitch += bltwidth;
     for (y = 0; y < bltheight; y++) {
-        for (x = 0; x < bltwidth; x+=2) {
-            ROP_OP_TR_16(s, dstaddr - 1, cirrus_src16(s, srcaddr - 1), transp);
-            dstaddr -= 2;
-            srcaddr -= 2;
+        /* the byte by byte loop rounds odd addresses down */
+        if (((dstaddr & srcaddr) & 1) && !(bltwidth & 1) &&
+            cirrus_blt_row(s, dstaddr - (bltwidth - 1),
+                           srcaddr - (bltwidth - 1), bltwidth, &d, &src)) {
+            glue(rop_tr_row_, ROP_NAME)(d, src, bltwidth, 2, transp, true);
+            dstaddr -= bltwidth;
+            srcaddr -= bltwidth;
+        } else {
+            for (x = 0; x < bltwidth; x+=2) {
+                ROP_OP_TR_16(s, dstaddr - 1, cirrus_src16(s, srcaddr - 1),
+                             transp);
+                dstaddr -= 2;
+                srcaddr -= 2;
+            }
         }
         dstaddr += dstpitch;
         srcaddr += srcpitch;
@@ -241,6 +374,7 @@ glue(glue(cirrus_bitblt_rop_bkwd_transp_, ROP_NAME),_16)(CirrusVGAState *s,
 #include "cirrus_vga_rop2.h"
 
 #undef ROP_NAME
+#undef ROP_FN
 #undef ROP_OP
 #undef ROP_OP_16
 #undef ROP_OP_32
@@ -38,6 +38,100 @@
 #error unsupported DEPTH
 #endif
 
+#if DEPTH != 24
+/*
+ * Writes the eight pixels at d for one byte of colour expansion bits,
+ * fg where a bit is set and, unless transp, bg where it is clear.
+ */
+static inline void
+glue(glue(glue(cirrus_expand_byte_, ROP_NAME), _),DEPTH)
+     (uint8_t *d, unsigned bits, uint64_t fg, uint64_t bg, bool transp)
+{
+    const uint64_t *table = cirrus_expand_mask[DEPTH / 16];
+    const int ppw = 64 / DEPTH;
+    uint64_t m, w, dv;
+    int i;
+
+    for (i = 0; i < DEPTH / 8; i++, d += 8) {
+        m = table[(bits >> (8 - (i + 1) * ppw)) & ((1 << ppw) - 1)];
+        /* the pixels to write */
+        w = transp ? m : ~0ULL;
+        if (!w) {
+            continue;
+        }
+        dv = ldq_he_p(d);
+        stq_he_p(d, ((ROP_FN(dv, (fg & m) | (bg & ~m))) & w) | (dv & ~w));
+    }
+}
+
+/*
+ * One row of colour expansion, pixel j taking bit 7 - j % 8 of byte
+ * j / 8 * srcstep at srcaddr.  Whole bytes of bits go through
+ * cirrus_expand_byte, the pixels before and after them through PUTPIXEL.
+ * Returns false if the whole bytes are not contiguous in vram.
+ */
+static bool
+glue(glue(glue(cirrus_expand_row_, ROP_NAME), _),DEPTH)
+     (CirrusVGAState *s, uint32_t dstaddr, uint32_t srcaddr, int srcstep,
+      int skipleft, int bltwidth, unsigned bits_xor, uint32_t fgcol,
+      uint32_t bgcol, bool transp)
+{
+    const int bpp = DEPTH / 8;
+    int npix = DIV_ROUND_UP(bltwidth, bpp);
+    int first = skipleft ? 1 : 0, end = npix / 8;
+    int head_end = first ? MIN(8, npix) : 0;
+    int tail = MAX(head_end, end * 8);
+    uint64_t fg, bg;
+    unsigned bits = 0;
+    uint8_t *d = NULL;
+    int j, k;
+
+    if (dstaddr & (bpp - 1)) {
+        /* PUTPIXEL rounds unaligned addresses down */
+        return false;
+    }
+    if (end > first) {
+        d = cirrus_blt_dst_row(s, dstaddr + first * 8 * bpp,
+                               (end - first) * 8 * bpp);
+        if (!d) {
+            return false;
+        }
+    } else if (!s->blitter_accel) {
+        return false;
+    }
+
+    if (!srcstep) {
+        bits = cirrus_src(s, srcaddr) ^ bits_xor;
+    }
+    for (j = skipleft; j < npix; j++) {
+        if (j == head_end && end > first) {
+            fg = cirrus_rep(fgcol, DEPTH);
+            bg = cirrus_rep(bgcol, DEPTH);
+            for (k = first; k < end; k++, d += 8 * bpp) {
+                if (srcstep) {
+                    bits = cirrus_src(s, srcaddr + k * srcstep) ^ bits_xor;
+                }
+                glue(glue(glue(cirrus_expand_byte_, ROP_NAME), _),DEPTH)
+                    (d, bits, fg, bg, transp);
+            }
+            j = tail;
+            if (j >= npix) {
+                break;
+            }
+        }
+        if (srcstep && (j == skipleft || !(j & 7))) {
+            bits = cirrus_src(s, srcaddr + j / 8 * srcstep) ^ bits_xor;
+        }
+        if ((bits >> (7 - (j & 7))) & 1) {
+            PUTPIXEL(s, dstaddr + j * bpp, fgcol);
+        } else if (!transp) {
+            PUTPIXEL(s, dstaddr + j * bpp, bgcol);
+        }
+    }
+    return true;
+}
+#endif
+
 static void
 glue(glue(glue(cirrus_patternfill_, ROP_NAME), _),DEPTH)
      (CirrusVGAState *s, uint32_t dstaddr,
@@ -125,6 +219,14 @@ glue(glue(glue(cirrus_colorexpand_transp_, ROP_NAME), _),DEPTH)
     }
 
     for(y = 0; y < bltheight; y++) {
+#if DEPTH != 24
+        if (glue(glue(glue(cirrus_expand_row_, ROP_NAME), _),DEPTH)(s, dstaddr, srcaddr, 1, srcskipleft, bltwidth, bits_xor,
+                col, 0, true)) {
+            srcaddr += DIV_ROUND_UP(DIV_ROUND_UP(bltwidth, DEPTH / 8), 8);
+            dstaddr += dstpitch;
+            continue;
+        }
+#endif
         bitmask = 0x80 >> srcskipleft;
         bits = cirrus_src(s, srcaddr++) ^ bits_xor;
         addr = dstaddr + dstskipleft;
@@ -163,6 +265,14 @@ glue(glue(glue(cirrus_colorexpand_, ROP_NAME), _),DEPTH)
     colors[0] = s->cirrus_blt_bgcol;
     colors[1] = s->cirrus_blt_fgcol;
     for(y = 0; y < bltheight; y++) {
+#if DEPTH != 24
+        if (glue(glue(glue(cirrus_expand_row_, ROP_NAME), _),DEPTH)(s, dstaddr, srcaddr, 1, srcskipleft, bltwidth, 0,
+                colors[1], colors[0], false)) {
+            srcaddr += DIV_ROUND_UP(DIV_ROUND_UP(bltwidth, DEPTH / 8), 8);
+            dstaddr += dstpitch;
+            continue;
+        }
+#endif
         bitmask = 0x80 >> srcskipleft;
         bits = cirrus_src(s, srcaddr++);
         addr = dstaddr + dstskipleft;
@@ -209,6 +319,14 @@ glue(glue(glue(cirrus_colorexpand_pattern_transp_, ROP_NAME), _),DEPTH)
     pattern_y = s->cirrus_blt_srcaddr & 7;
 
     for(y = 0; y < bltheight; y++) {
+#if DEPTH != 24
+        if (glue(glue(glue(cirrus_expand_row_, ROP_NAME), _),DEPTH)(s, dstaddr, srcaddr + pattern_y, 0, srcskipleft, bltwidth,
+                bits_xor, col, 0, true)) {
+            pattern_y = (pattern_y + 1) & 7;
+            dstaddr += dstpitch;
+            continue;
+        }
+#endif
         bits = cirrus_src(s, srcaddr + pattern_y) ^ bits_xor;
         bitpos = 7 - srcskipleft;
         addr = dstaddr + dstskipleft;
@@ -244,6 +362,14 @@ glue(glue(glue(cirrus_colorexpand_pattern_, ROP_NAME), _),DEPTH)
     pattern_y = s->cirrus_blt_srcaddr & 7;
 
     for(y = 0; y < bltheight; y++) {
+#if DEPTH != 24
+        if (glue(glue(glue(cirrus_expand_row_, ROP_NAME), _),DEPTH)(s, dstaddr, srcaddr + pattern_y, 0, srcskipleft, bltwidth,
+                0, colors[1], colors[0], false)) {
+            pattern_y = (pattern_y + 1) & 7;
+            dstaddr += dstpitch;
+            continue;
+        }
+#endif
         bits = cirrus_src(s, srcaddr + pattern_y);
         bitpos = 7 - srcskipleft;
         addr = dstaddr + dstskipleft;
@@ -267,10 +393,30 @@ glue(glue(glue(cirrus_fill_, ROP_NAME), _),DEPTH)
     uint32_t addr;
     uint32_t col;
     int x, y;
+#if DEPTH != 24
+    uint8_t *d;
+#endif
 
     col = s->cirrus_blt_fgcol;
 
     for(y = 0; y < height; y++) {
+#if DEPTH != 24
+        d = NULL;
+        if (!(dstaddr & (DEPTH / 8 - 1))) {
+            d = cirrus_blt_dst_row(s, dstaddr, width & ~(8 * DEPTH / 8 - 1));
+        }
+        if (d) {
+            for (x = 0; x + 8 * DEPTH / 8 <= width; x += 8 * DEPTH / 8) {
+                glue(glue(glue(cirrus_expand_byte_, ROP_NAME), _),DEPTH)
+                    (d + x, 0xff, cirrus_rep(col, DEPTH), 0, false);
+            }
+            for (; x < width; x += (DEPTH / 8)) {
+                PUTPIXEL(s, dstaddr + x, col);
+            }
+            dstaddr += dst_pitch;
+            continue;
+        }
+#endif
         addr = dstaddr;
         for(x = 0; x < width; x += (DEPTH / 8)) {
             PUTPIXEL(s, addr, col);
@@ -22,6 +22,7 @@
 #include "ui/console.h"
 #include "hw/arm/omap.h"
 #include "framebuffer.h"
+#include "pixconv.h"
 #include "ui/pixel_ops.h"
 
 struct omap_lcd_panel_s {
@@ -182,18 +183,7 @@ static void draw_line12_32(void *opaque, uint8_t *d, const uint8_t *s,
 static void draw_line16_32(void *opaque, uint8_t *d, const uint8_t *s,
                            int width, int deststep)
 {
-    uint16_t v;
-    uint8_t r, g, b;
-
-    do {
-        v = lduw_le_p((void *) s);
-        r = (v >> 8) & 0xf8;
-        g = (v >> 3) & 0xfc;
-        b = (v << 3) & 0xf8;
-        ((uint32_t *) d)[0] = rgb_to_pixel32(r, g, b);
-        s += 2;
-        d += 4;
-    } while (-- width != 0);
+    pixconv_565(d, s, width, 0);
 }
 
 static void omap_update_display(void *opaque)
@@ -0,0 +1,377 @@
+/*
+ * Scanline conversion to 32 bpp
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * Most display devices draw a scanline of guest pixels into a 32 bpp
+ * surface with the same handful of loops: palette lookup for 8 bpp,
+ * widening of 15 and 16 bit pixels and byte shuffling for 24 and 32 bpp.
+ * They are kept here, free of device state, so that every device and
+ * the tests share the vector versions.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/host-isa.h"
+#include "ui/pixel_ops.h"
+#include "pixconv.h"
+
+typedef struct PixconvFormat16 {
+    int hshift;     /* right shift of the high channel to bits 7..3 */
+    int gshift;     /* right shift of green to bits 7..2 */
+    int gmask;
+    bool be;
+    bool swap;      /* the high channel is blue */
+} PixconvFormat16;
+
+typedef struct PixconvAccel {
+    const char *name;
+    void (*pal8)(uint8_t *d, const uint8_t *s, int width,
+                 const uint32_t *palette);
+    void (*conv16)(uint8_t *d, const uint8_t *s, int width,
+                   const PixconvFormat16 *f);
+    void (*conv24)(uint8_t *d, const uint8_t *s, int width,
+                   const uint8_t *shuf);
+    void (*conv32)(uint8_t *d, const uint8_t *s, int width,
+                   const uint8_t *shuf);
+} PixconvAccel;
+
+static void pal8_int(uint8_t *d, const uint8_t *s, int width,
+                     const uint32_t *palette)
+{
+    uint32_t *p = (uint32_t *)d;
+    int i;
+
+    for (i = 0; i < width; i++) {
+        p[i] = palette[s[i]];
+    }
+}
+
+static void conv16_int(uint8_t *d, const uint8_t *s, int width,
+                       const PixconvFormat16 *f)
+{
+    uint32_t *p = (uint32_t *)d;
+    unsigned int v, hi, g, lo;
+    int i;
+
+    for (i = 0; i < width; i++, s += 2) {
+        v = f->be ? lduw_be_p(s) : lduw_le_p(s);
+        hi = (v >> f->hshift) & 0xf8;
+        g = (v >> f->gshift) & f->gmask;
+        lo = (v << 3) & 0xf8;
+        p[i] = f->swap ? rgb_to_pixel32(lo, g, hi) : rgb_to_pixel32(hi, g, lo);
+    }
+}
+
+/* shuf[0..2] are the offsets of blue, green and red in a source pixel */
+static void conv_bytes_int(uint8_t *d, const uint8_t *s, int width,
+                           int bpp, const uint8_t *shuf)
+{
+    uint32_t *p = (uint32_t *)d;
+    int i;
+
+    for (i = 0; i < width; i++, s += bpp) {
+        p[i] = rgb_to_pixel32(s[shuf[2]], s[shuf[1]], s[shuf[0]]);
+    }
+}
+
+static void conv24_int(uint8_t *d, const uint8_t *s, int width,
+                       const uint8_t *shuf)
+{
+    conv_bytes_int(d, s, width, 3, shuf);
+}
+
+static void conv32_int(uint8_t *d, const uint8_t *s, int width,
+                       const uint8_t *shuf)
+{
+    conv_bytes_int(d, s, width, 4, shuf);
+}
+
+static const PixconvAccel accel_int = {
+    .name = "int",
+    .pal8 = pal8_int,
+    .conv16 = conv16_int,
+    .conv24 = conv24_int,
+    .conv32 = conv32_int,
+};
+
+#ifdef CONFIG_AVX2_OPT
+/* Note that due to restrictions/bugs wrt __builtin functions in gcc <= 4.8,
+ * the includes have to be within the corresponding push_options region, and
+ * therefore the regions themselves have to be ordered with increasing ISA.
+ */
+#pragma GCC push_options
+#pragma GCC target("ssse3")
+#include <tmmintrin.h>
+
+static void conv16_ssse3(uint8_t *d, const uint8_t *s, int width,
+                         const PixconvFormat16 *f)
+{
+    const __m128i bswap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+                                        9, 8, 11, 10, 13, 12, 15, 14);
+    const __m128i hshift = _mm_cvtsi32_si128(f->hshift);
+    const __m128i gshift = _mm_cvtsi32_si128(f->gshift);
+    const __m128i gmask = _mm_set1_epi16(f->gmask);
+    const __m128i mask = _mm_set1_epi16(0xf8);
+    int x;
+
+    for (x = 0; x + 8 <= width; x += 8, s += 16, d += 32) {
+        __m128i v = _mm_loadu_si128((__m128i *)s);
+        __m128i hi, g, lo, r, b, bg;
+
+        if (f->be) {
+            v = _mm_shuffle_epi8(v, bswap);
+        }
+        hi = _mm_and_si128(_mm_srl_epi16(v, hshift), mask);
+        g = _mm_and_si128(_mm_srl_epi16(v, gshift), gmask);
+        lo = _mm_and_si128(_mm_slli_epi16(v, 3), mask);
+        r = f->swap ? lo : hi;
+        b = f->swap ? hi : lo;
+
+        /* b | g << 8 in the low half of each pixel, r in the high one */
+        bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+        _mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi16(bg, r));
+        _mm_storeu_si128((__m128i *)(d + 16), _mm_unpackhi_epi16(bg, r));
+    }
+    conv16_int(d, s, width - x, f);
+}
+
+static void conv24_ssse3(uint8_t *d, const uint8_t *s, int width,
+                         const uint8_t *shuf)
+{
+    __m128i mask = _mm_loadu_si128((__m128i *)shuf);
+    int x;
+
+    /* 16 byte loads for 12 bytes of pixels, stay off the end of the line */
+    for (x = 0; x + 6 <= width; x += 4, s += 12, d += 16) {
+        _mm_storeu_si128((__m128i *)d,
+                         _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)s),
+                                          mask));
+    }
+    conv24_int(d, s, width - x, shuf);
+}
+
+static void conv32_ssse3(uint8_t *d, const uint8_t *s, int width,
+                         const uint8_t *shuf)
+{
+    __m128i mask = _mm_loadu_si128((__m128i *)shuf);
+    int x;
+
+    for (x = 0; x + 4 <= width; x += 4, s += 16, d += 16) {
+        _mm_storeu_si128((__m128i *)d,
+                         _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)s),
+                                          mask));
+    }
+    conv32_int(d, s, width - x, shuf);
+}
+
+static const PixconvAccel accel_ssse3 = {
+    .name = "ssse3",
+    .pal8 = pal8_int,
+    .conv16 = conv16_ssse3,
+    .conv24 = conv24_ssse3,
+    .conv32 = conv32_ssse3,
+};
+
+#pragma GCC pop_options
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static void pal8_avx2(uint8_t *d, const uint8_t *s, int width,
+                      const uint32_t *palette)
+{
+    int x;
+
+    for (x = 0; x + 8 <= width; x += 8, s += 8, d += 32) {
+        __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *)s));
+
+        _mm256_storeu_si256((__m256i *)d,
+                            _mm256_i32gather_epi32((const int *)palette,
+                                                   idx, 4));
+    }
+    pal8_int(d, s, width - x, palette);
+}
+
+static void conv16_avx2(uint8_t *d, const uint8_t *s, int width,
+                        const PixconvFormat16 *f)
+{
+    const __m128i bswap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+                                        9, 8, 11, 10, 13, 12, 15, 14);
+    const __m128i hshift = _mm_cvtsi32_si128(f->hshift);
+    const __m128i gshift = _mm_cvtsi32_si128(f->gshift);
+    const __m256i gmask = _mm256_set1_epi32(f->gmask);
+    const __m256i mask = _mm256_set1_epi32(0xf8);
+    int x;
+
+    for (x = 0; x + 8 <= width; x += 8, s += 16, d += 32) {
+        __m128i w = _mm_loadu_si128((__m128i *)s);
+        __m256i v, hi, g, lo, r, b;
+
+        if (f->be) {
+            w = _mm_shuffle_epi8(w, bswap);
+        }
+        v = _mm256_cvtepu16_epi32(w);
+        hi = _mm256_and_si256(_mm256_srl_epi32(v, hshift), mask);
+        g = _mm256_and_si256(_mm256_srl_epi32(v, gshift), gmask);
+        lo = _mm256_and_si256(_mm256_slli_epi32(v, 3), mask);
+        r = f->swap ? lo : hi;
+        b = f->swap ? hi : lo;
+        _mm256_storeu_si256((__m256i *)d,
+                            _mm256_or_si256(_mm256_or_si256(
+                                                _mm256_slli_epi32(r, 16),
+                                                _mm256_slli_epi32(g, 8)),
+                                            b));
+    }
+    conv16_int(d, s, width - x, f);
+}
+
+static void conv24_avx2(uint8_t *d, const uint8_t *s, int width,
+                        const uint8_t *shuf)
+{
+    __m256i mask = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((__m128i *)shuf));
+    int x;
+
+    /* two 16 byte loads 12 bytes apart, stay off the end of the line */
+    for (x = 0; x + 10 <= width; x += 8, s += 24, d += 32) {
+        __m256i v = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((__m128i *)s)),
+            _mm_loadu_si128((__m128i *)(s + 12)), 1);
+
+        _mm256_storeu_si256((__m256i *)d, _mm256_shuffle_epi8(v, mask));
+    }
+    conv24_ssse3(d, s, width - x, shuf);
+}
+
+static void conv32_avx2(uint8_t *d, const uint8_t *s, int width,
+                        const uint8_t *shuf)
+{
+    __m256i mask = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((__m128i *)shuf));
+    int x;
+
+    for (x = 0; x + 8 <= width; x += 8, s += 32, d += 32) {
+        _mm256_storeu_si256((__m256i *)d,
+                            _mm256_shuffle_epi8(
+                                _mm256_loadu_si256((__m256i *)s), mask));
+    }
+    conv32_int(d, s, width - x, shuf);
+}
+
+static const PixconvAccel accel_avx2 = {
+    .name = "avx2",
+    .pal8 = pal8_avx2,
+    .conv16 = conv16_avx2,
+    .conv24 = conv24_avx2,
+    .conv32 = conv32_avx2,
+};
+
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+static const HostIsaImpl pixconv_impls[] = {
+#ifdef CONFIG_AVX2_OPT
+    { HOST_ISA_AVX2, &accel_avx2 },
+    { HOST_ISA_SSSE3, &accel_ssse3 },
+#endif
+    { 0, &accel_int },
+};
+
+static HostIsaDispatch pixconv_dispatch;
+
+static void __attribute__((constructor)) init_pixconv_accel(void)
+{
+    host_isa_dispatch_init(&pixconv_dispatch, pixconv_impls,
+                           ARRAY_SIZE(pixconv_impls));
+}
+
+#define ACCEL \
+    ((const PixconvAccel *)host_isa_dispatch_get(&pixconv_dispatch))
+
+/*
+ * pshufb mask for four pixels of bpp bytes; its first three bytes double
+ * as the channel offsets for the plain C loop.
+ */
+static void pixconv_shuffle(uint8_t *shuf, int bpp, int flags)
+{
+    int b = 0, g = 1, r = 2, t, p;
+
+    if (flags & PIXCONV_BE) {
+        b = bpp - 1;
+        g = bpp - 2;
+        r = bpp - 3;
+    }
+    if (flags & PIXCONV_SWAP_RB) {
+        t = r;
+        r = b;
+        b = t;
+    }
+    for (p = 0; p < 4; p++) {
+        shuf[p * 4] = p * bpp + b;
+        shuf[p * 4 + 1] = p * bpp + g;
+        shuf[p * 4 + 2] = p * bpp + r;
+        shuf[p * 4 + 3] = 0x80;
+    }
+}
+
+void pixconv_pal8(uint8_t *d, const uint8_t *s, int width,
+                  const uint32_t *palette)
+{
+    ACCEL->pal8(d, s, width, palette);
+}
+
+void pixconv_555(uint8_t *d, const uint8_t *s, int width, int flags)
+{
+    PixconvFormat16 f = {
+        .hshift = 7,
+        .gshift = 2,
+        .gmask = 0xf8,
+        .be = flags & PIXCONV_BE,
+        .swap = flags & PIXCONV_SWAP_RB,
+    };
+
+    ACCEL->conv16(d, s, width, &f);
+}
+
+void pixconv_565(uint8_t *d, const uint8_t *s, int width, int flags)
+{
+    PixconvFormat16 f = {
+        .hshift = 8,
+        .gshift = 3,
+        .gmask = 0xfc,
+        .be = flags & PIXCONV_BE,
+        .swap = flags & PIXCONV_SWAP_RB,
+    };
+
+    ACCEL->conv16(d, s, width, &f);
+}
+
+void pixconv_888(uint8_t *d, const uint8_t *s, int width, int flags)
+{
+    uint8_t shuf[16];
+
+    pixconv_shuffle(shuf, 3, flags);
+    ACCEL->conv24(d, s, width, shuf);
+}
+
+void pixconv_8888(uint8_t *d, const uint8_t *s, int width, int flags)
+{
+    uint8_t shuf[16];
+
+    pixconv_shuffle(shuf, 4, flags);
+    ACCEL->conv32(d, s, width, shuf);
+}
+
+bool pixconv_next_accel(void)
+{
+    return host_isa_dispatch_next(&pixconv_dispatch);
+}
+
+const char *pixconv_accel(void)
+{
+    return ACCEL->name;
+}
@@ -0,0 +1,36 @@
+/*
+ * Scanline conversion to 32 bpp
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef HW_DISPLAY_PIXCONV_H
+#define HW_DISPLAY_PIXCONV_H
+
+/*
+ * Converters from the guest framebuffer formats most display devices
+ * share to x8r8g8b8 in host byte order, as rgb_to_pixel32() builds them.
+ * Channels are widened by shifting, like the per device code always did.
+ *
+ * Without flags, 15 and 16 bit pixels are little endian with blue in the
+ * low bits, 24 and 32 bit pixels are stored blue first.
+ */
+
+/* 15/16 bpp: big endian words; 24/32 bpp: red first, 32 bpp padding first */
+#define PIXCONV_BE          (1 << 0)
+/* red and blue exchange places */
+#define PIXCONV_SWAP_RB     (1 << 1)
+
+void pixconv_pal8(uint8_t *d, const uint8_t *s, int width,
+                  const uint32_t *palette);
+void pixconv_555(uint8_t *d, const uint8_t *s, int width, int flags);
+void pixconv_565(uint8_t *d, const uint8_t *s, int width, int flags);
+void pixconv_888(uint8_t *d, const uint8_t *s, int width, int flags);
+void pixconv_8888(uint8_t *d, const uint8_t *s, int width, int flags);
+
+/* For tests: walk through the accelerators available on the host */
+bool pixconv_next_accel(void);
+const char *pixconv_accel(void);
+
+#endif
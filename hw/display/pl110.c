@@ -13,6 +13,7 @@
 #include "migration/vmstate.h"
 #include "ui/console.h"
 #include "framebuffer.h"
+#include "pixconv.h"
 #include "ui/pixel_ops.h"
 #include "qemu/timer.h"
 #include "qemu/log.h"
@@ -31,6 +31,12 @@
 #endif
 #endif
 
+#ifdef RGB
+#define PIXCONV_FLAGS PIXCONV_SWAP_RB
+#else
+#define PIXCONV_FLAGS 0
+#endif
+
 #define FN_2(x, y) FN(x, y) FN(x+1, y)
 #define FN_4(x, y) FN_2(x, y) FN_2(x+2, y)
 #define FN_8(y) FN_4(0, y) FN_4(4, y)
@@ -121,6 +127,9 @@ static void glue(pl110_draw_line4_,NAME)(void *opaque, uint8_t *d, const uint8_t
 
 static void glue(pl110_draw_line8_,NAME)(void *opaque, uint8_t *d, const uint8_t *src, int width, int deststep)
 {
+#if ORDER == 0
+    pixconv_pal8(d, src, width, opaque);
+#else
     uint32_t *palette = opaque;
     uint32_t data;
     while (width > 0) {
@@ -141,10 +150,14 @@ static void glue(pl110_draw_line8_,NAME)(void *opaque, uint8_t *d, const uint8_t
         width -= 4;
         src += 4;
     }
+#endif
 }
 
 static void glue(pl110_draw_line16_,NAME)(void *opaque, uint8_t *d, const uint8_t *src, int width, int deststep)
 {
+#if ORDER == 0
+    pixconv_565(d, src, width, PIXCONV_FLAGS);
+#else
     uint32_t data;
     unsigned int r, g, b;
     while (width > 0) {
@@ -187,10 +200,14 @@ static void glue(pl110_draw_line16_,NAME)(void *opaque, uint8_t *d, const uint8_
         width -= 2;
         src += 4;
     }
+#endif
 }
 
 static void glue(pl110_draw_line32_,NAME)(void *opaque, uint8_t *d, const uint8_t *src, int width, int deststep)
 {
+#if ORDER == 0
+    pixconv_8888(d, src, width, PIXCONV_FLAGS);
+#else
     uint32_t data;
     unsigned int r, g, b;
     while (width > 0) {
@@ -217,10 +234,14 @@ static void glue(pl110_draw_line32_,NAME)(void *opaque, uint8_t *d, const uint8_
         width--;
         src += 4;
     }
+#endif
 }
 
 static void glue(pl110_draw_line16_555_,NAME)(void *opaque, uint8_t *d, const uint8_t *src, int width, int deststep)
 {
+#if ORDER == 0
+    pixconv_555(d, src, width, PIXCONV_FLAGS);
+#else
     /* RGB 555 plus an intensity bit (which we ignore) */
     uint32_t data;
     unsigned int r, g, b;
@@ -255,6 +276,7 @@ static void glue(pl110_draw_line16_555_,NAME)(void *opaque, uint8_t *d, const ui
         width -= 2;
         src += 4;
     }
+#endif
 }
 
 static void glue(pl110_draw_line12_,NAME)(void *opaque, uint8_t *d, const uint8_t *src, int width, int deststep)
@@ -295,6 +317,7 @@ static void glue(pl110_draw_line12_,NAME)(void *opaque, uint8_t *d, const uint8_
     }
 }
 
+#undef PIXCONV_FLAGS
 #undef SWAP_PIXELS
 #undef NAME
 #undef SWAP_WORDS
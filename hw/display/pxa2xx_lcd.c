@@ -21,6 +21,7 @@
 /* FIXME: For graphic_rotate. Should probably be done in common code.  */
 #include "sysemu/sysemu.h"
 #include "framebuffer.h"
+#include "pixconv.h"
 
 struct DMAChannel {
     uint32_t branch;
@@ -261,6 +262,11 @@ static void pxa2xx_draw_line8(void *opaque, uint8_t *dest, const uint8_t *src,
 {
     uint32_t *palette = opaque;
     uint32_t data;
+
+    if (deststep == DEST_PIXEL_WIDTH) {
+        pixconv_pal8(dest, src, ROUND_UP(width, 4), palette);
+        return;
+    }
     while (width > 0) {
         data = *(uint32_t *) src;
 #define FN(x) COPY_PIXEL(dest, palette[(data >> (x)) & 0xff]);
@@ -286,6 +292,11 @@ static void pxa2xx_draw_line16(void *opaque, uint8_t *dest, const uint8_t *src,
 {
     uint32_t data;
     unsigned int r, g, b;
+
+    if (deststep == DEST_PIXEL_WIDTH) {
+        pixconv_565(dest, src, ROUND_UP(width, 2), 0);
+        return;
+    }
     while (width > 0) {
         data = *(uint32_t *) src;
 #ifdef SWAP_WORDS
@@ -517,6 +528,11 @@ static void pxa2xx_draw_line24(void *opaque, uint8_t *dest, const uint8_t *src,
 {
     uint32_t data;
     unsigned int r, g, b;
+
+    if (deststep == DEST_PIXEL_WIDTH) {
+        pixconv_8888(dest, src, width, 0);
+        return;
+    }
     while (width > 0) {
         data = *(uint32_t *) src;
 #ifdef SWAP_WORDS
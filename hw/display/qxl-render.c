@@ -20,43 +20,122 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/main-loop.h"
+#include "qemu/units.h"
+#include "block/thread-pool.h"
 #include "qxl.h"
 #include "sysemu/runstate.h"
 #include "trace.h"
 
-static void qxl_blit(PCIQXLDevice *qxl, QXLRect *rect)
+/*
+ * Copying the dirty rectangles of a flipped primary surface goes to the
+ * thread pool once there is enough of it to pay for the round trip;
+ * smaller updates are done right away.
+ */
+#define QXL_RENDER_THREAD_MIN (256 * KiB)
+
+typedef struct QXLRenderBlit {
+    PCIQXLDevice   *qxl;
+    uint32_t       generation;
+    /* NULL if the console surface shares guest memory */
+    pixman_image_t *image;
+    uint8_t        *src;
+    int32_t        qxl_stride;
+    uint32_t       abs_stride;
+    uint32_t       bytes_pp;
+    uint32_t       height;
+    size_t         bytes;
+    int            num_rects;
+    QXLRect        rects[QXL_NUM_DIRTY_RECTS];
+} QXLRenderBlit;
+
+static void qxl_blit(QXLRenderBlit *blit, QXLRect *rect)
 {
-    DisplaySurface *surface = qemu_console_surface(qxl->vga.con);
-    uint8_t *dst = surface_data(surface);
+    uint8_t *dst = (uint8_t *)pixman_image_get_data(blit->image);
     uint8_t *src;
     int len, i;
 
-    if (is_buffer_shared(surface)) {
-        return;
-    }
-    trace_qxl_render_blit(qxl->guest_primary.qxl_stride,
+    trace_qxl_render_blit(blit->qxl_stride,
             rect->left, rect->right, rect->top, rect->bottom);
-    src = qxl->guest_primary.data;
-    if (qxl->guest_primary.qxl_stride < 0) {
+    src = blit->src;
+    if (blit->qxl_stride < 0) {
         /* qxl surface is upside down, walk src scanlines
          * in reverse order to flip it */
-        src += (qxl->guest_primary.surface.height - rect->top - 1) *
-            qxl->guest_primary.abs_stride;
+        src += (blit->height - rect->top - 1) * blit->abs_stride;
     } else {
-        src += rect->top * qxl->guest_primary.abs_stride;
+        src += rect->top * blit->abs_stride;
     }
-    dst += rect->top  * qxl->guest_primary.abs_stride;
-    src += rect->left * qxl->guest_primary.bytes_pp;
-    dst += rect->left * qxl->guest_primary.bytes_pp;
-    len  = (rect->right - rect->left) * qxl->guest_primary.bytes_pp;
+    dst += rect->top  * blit->abs_stride;
+    src += rect->left * blit->bytes_pp;
+    dst += rect->left * blit->bytes_pp;
+    len  = (rect->right - rect->left) * blit->bytes_pp;
 
     for (i = rect->top; i < rect->bottom; i++) {
         memcpy(dst, src, len);
-        dst += qxl->guest_primary.abs_stride;
-        src += qxl->guest_primary.qxl_stride;
+        dst += blit->abs_stride;
+        src += blit->qxl_stride;
+    }
+}
+
+static int qxl_render_blit_worker(void *opaque)
+{
+    QXLRenderBlit *blit = opaque;
+    int i;
+
+    for (i = 0; i < blit->num_rects; i++) {
+        qxl_blit(blit, &blit->rects[i]);
+    }
+    return 0;
+}
+
+static void qxl_render_blit_flush(QXLRenderBlit *blit)
+{
+    QemuConsole *con = blit->qxl->vga.con;
+    int i;
+
+    for (i = 0; i < blit->num_rects; i++) {
+        dpy_gfx_update(con, blit->rects[i].left, blit->rects[i].top,
+                       blit->rects[i].right - blit->rects[i].left,
+                       blit->rects[i].bottom - blit->rects[i].top);
+    }
+}
+
+static void qxl_render_blit_release(QXLRenderBlit *blit)
+{
+    if (blit->image) {
+        pixman_image_unref(blit->image);
     }
 }
 
+static void qxl_render_update_area_unlocked(PCIQXLDevice *qxl);
+
+/* called from the main loop once the thread pool has done the copy */
+static void qxl_render_blit_done(void *opaque, int ret)
+{
+    QXLRenderBlit *blit = opaque;
+    PCIQXLDevice *qxl = blit->qxl;
+
+    qemu_mutex_lock(&qxl->ssd.lock);
+    qxl->render_blit_running = false;
+    if (blit->generation != qxl->render_generation) {
+        /*
+         * The primary went away during the copy, the console may show
+         * another surface by now.  Nothing to show, just complete.
+         */
+        trace_qxl_render_blit_stale(blit->num_rects);
+        if (qxl->render_update_cookie_num == 0) {
+            graphic_hw_update_done(qxl->ssd.dcl.con);
+        }
+    } else {
+        qxl_render_blit_flush(blit);
+        /* pick up what got dirty in the meantime, and complete the update */
+        qxl_render_update_area_unlocked(qxl);
+    }
+    qemu_mutex_unlock(&qxl->ssd.lock);
+    qxl_render_blit_release(blit);
+    g_free(blit);
+}
+
 void qxl_render_resize(PCIQXLDevice *qxl)
 {
     QXLSurfaceCreate *sc = &qxl->guest_primary.surface;
@@ -99,10 +178,16 @@ static void qxl_render_update_area_unlocked(PCIQXLDevice *qxl)
 {
     VGACommonState *vga = &qxl->vga;
     DisplaySurface *surface;
+    QXLRenderBlit inline_blit, *blit = &inline_blit;
     int width = qxl->guest_head0_width ?: qxl->guest_primary.surface.width;
     int height = qxl->guest_head0_height ?: qxl->guest_primary.surface.height;
     int i;
 
+    if (qxl->render_blit_running) {
+        /* qxl_render_blit_done() comes back here */
+        return;
+    }
+
     if (qxl->guest_primary.resized) {
         qxl->guest_primary.resized = 0;
         qxl->guest_primary.data = qxl_phys2virt(qxl,
@@ -139,26 +224,62 @@ static void qxl_render_update_area_unlocked(PCIQXLDevice *qxl)
     if (!qxl->guest_primary.data) {
         goto end;
     }
+
+    /*
+     * The running blit holds its own reference to the pixels, and is
+     * dropped on completion if the primary went away in the meantime.
+     */
+    surface = qemu_console_surface(vga->con);
+    /* never write outside of what the console shows */
+    width = MIN(width, surface_width(surface));
+    height = MIN(height, surface_height(surface));
+    blit->qxl = qxl;
+    blit->generation = qxl->render_generation;
+    blit->image = is_buffer_shared(surface) ?
+                  NULL : pixman_image_ref(surface->image);
+    blit->src = qxl->guest_primary.data;
+    blit->qxl_stride = qxl->guest_primary.qxl_stride;
+    blit->abs_stride = qxl->guest_primary.abs_stride;
+    blit->bytes_pp = qxl->guest_primary.bytes_pp;
+    blit->height = qxl->guest_primary.surface.height;
+    blit->bytes = 0;
+    blit->num_rects = 0;
     for (i = 0; i < qxl->num_dirty_rects; i++) {
-        if (qemu_spice_rect_is_empty(qxl->dirty+i)) {
+        QXLRect *rect = &qxl->dirty[i];
+
+        if (qemu_spice_rect_is_empty(rect)) {
             break;
         }
-        if (qxl->dirty[i].left < 0 ||
-            qxl->dirty[i].top < 0 ||
-            qxl->dirty[i].left > qxl->dirty[i].right ||
-            qxl->dirty[i].top > qxl->dirty[i].bottom ||
-            qxl->dirty[i].right > width ||
-            qxl->dirty[i].bottom > height) {
+        if (rect->left < 0 ||
+            rect->top < 0 ||
+            rect->left > rect->right ||
+            rect->top > rect->bottom ||
+            rect->right > width ||
+            rect->bottom > height) {
             continue;
         }
-        qxl_blit(qxl, qxl->dirty+i);
-        dpy_gfx_update(vga->con,
-                       qxl->dirty[i].left, qxl->dirty[i].top,
-                       qxl->dirty[i].right - qxl->dirty[i].left,
-                       qxl->dirty[i].bottom - qxl->dirty[i].top);
+        blit->rects[blit->num_rects++] = *rect;
+        blit->bytes += (size_t)(rect->right - rect->left) *
+                       (rect->bottom - rect->top) * blit->bytes_pp;
     }
     qxl->num_dirty_rects = 0;
 
+    if (blit->image && blit->bytes >= QXL_RENDER_THREAD_MIN) {
+        trace_qxl_render_blit_thread(blit->num_rects, blit->bytes);
+        /* only these outlive the call, the inline ones stay on the stack */
+        blit = g_memdup(blit, sizeof(*blit));
+        qxl->render_blit_running = true;
+        thread_pool_submit_aio(aio_get_thread_pool(qemu_get_aio_context()),
+                               qxl_render_blit_worker, blit,
+                               qxl_render_blit_done, blit);
+        return;
+    }
+    if (blit->image) {
+        qxl_render_blit_worker(blit);
+    }
+    qxl_render_blit_flush(blit);
+    qxl_render_blit_release(blit);
+
 end:
     if (qxl->render_update_cookie_num == 0) {
         graphic_hw_update_done(qxl->ssd.dcl.con);
@@ -174,14 +295,19 @@ end:
 void qxl_render_update(PCIQXLDevice *qxl)
 {
     QXLCookie *cookie;
+    bool done;
 
     qemu_mutex_lock(&qxl->ssd.lock);
 
     if (!runstate_is_running() || !qxl->guest_primary.commands ||
         qxl->mode == QXL_MODE_UNDEFINED) {
         qxl_render_update_area_unlocked(qxl);
+        /* otherwise qxl_render_blit_done() completes the update */
+        done = !qxl->render_blit_running;
         qemu_mutex_unlock(&qxl->ssd.lock);
-        graphic_hw_update_done(qxl->ssd.dcl.con);
+        if (done) {
+            graphic_hw_update_done(qxl->ssd.dcl.con);
+        }
         return;
     }
 
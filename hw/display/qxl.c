@@ -450,6 +450,22 @@ static void qxl_ring_set_dirty(PCIQXLDevice *qxl)
     qxl_set_dirty(&qxl->vga.vram, addr, end);
 }
 
+/*
+ * Commands are popped off the rings one at a time, but the ring header
+ * only needs to be marked dirty once per batch: when the batch is full,
+ * when the ring runs empty, and before the VM stops.
+ */
+#define QXL_RING_POP_BATCH 32
+
+/* called from spice server thread context only */
+static void qxl_ring_popped(PCIQXLDevice *qxl, bool empty)
+{
+    if (empty || ++qxl->ring_pops == QXL_RING_POP_BATCH) {
+        qxl->ring_pops = 0;
+        qxl_ring_set_dirty(qxl);
+    }
+}
+
 /*
  * keep track of some command state, for savevm/loadvm.
  * called from spice server thread context only
@@ -658,7 +674,7 @@ static int interface_get_command(QXLInstance *sin, struct QXLCommandExt *ext)
         ext->group_id = MEMSLOT_GROUP_GUEST;
         ext->flags    = qxl->cmdflags;
         SPICE_RING_POP(ring, notify);
-        qxl_ring_set_dirty(qxl);
+        qxl_ring_popped(qxl, SPICE_RING_IS_EMPTY(ring));
         if (notify) {
             qxl_send_events(qxl, QXL_INTERRUPT_DISPLAY);
         }
@@ -817,7 +833,7 @@ static int interface_get_cursor_command(QXLInstance *sin, struct QXLCommandExt *
         ext->group_id = MEMSLOT_GROUP_GUEST;
         ext->flags    = qxl->cmdflags;
         SPICE_RING_POP(ring, notify);
-        qxl_ring_set_dirty(qxl);
+        qxl_ring_popped(qxl, SPICE_RING_IS_EMPTY(ring));
         if (notify) {
             qxl_send_events(qxl, QXL_INTERRUPT_CURSOR);
         }
@@ -942,14 +958,6 @@ static void interface_update_area_complete(QXLInstance *sin,
     trace_qxl_interface_update_area_complete(qxl->id, surface_id, dirty->left,
             dirty->right, dirty->top, dirty->bottom);
     trace_qxl_interface_update_area_complete_rest(qxl->id, num_updated_rects);
-    if (qxl->num_dirty_rects + num_updated_rects > QXL_NUM_DIRTY_RECTS) {
-        /*
-         * overflow - treat this as a full update. Not expected to be common.
-         */
-        trace_qxl_interface_update_area_complete_overflow(qxl->id,
-                                                          QXL_NUM_DIRTY_RECTS);
-        qxl->guest_primary.resized = 1;
-    }
     if (qxl->guest_primary.resized) {
         /*
          * Don't bother copying or scheduling the bh since we will flip
@@ -957,6 +965,34 @@ static void interface_update_area_complete(QXLInstance *sin,
          */
         return;
     }
+    if (qxl->num_dirty_rects + num_updated_rects > QXL_NUM_DIRTY_RECTS) {
+        /*
+         * overflow - merge everything into its bounding box, which is
+         * still only the damaged part of the surface.  Happens with busy
+         * guests while a blit is running in the background.
+         */
+        trace_qxl_interface_update_area_complete_overflow(qxl->id,
+                                                          QXL_NUM_DIRTY_RECTS);
+        if (!qxl->num_dirty_rects) {
+            memset(&qxl->dirty[0], 0, sizeof(qxl->dirty[0]));
+        }
+        for (i = 1; i < qxl->num_dirty_rects; i++) {
+            qemu_spice_rect_union(&qxl->dirty[0], &qxl->dirty[i]);
+        }
+        for (i = 0; i < num_updated_rects; i++) {
+            qemu_spice_rect_union(&qxl->dirty[0], &dirty[i]);
+        }
+        qxl->num_dirty_rects = 1;
+        if (qxl->dirty[0].left < 0 || qxl->dirty[0].top < 0 ||
+            qxl->dirty[0].right > qxl->guest_primary.surface.width ||
+            qxl->dirty[0].bottom > qxl->guest_primary.surface.height) {
+            /* a bogus rectangle got merged in, flip the whole area */
+            qxl->guest_primary.resized = 1;
+            return;
+        }
+        qemu_bh_schedule(qxl->update_area_bh);
+        return;
+    }
     qxl_i = qxl->num_dirty_rects;
     for (i = 0; i < num_updated_rects; i++) {
         qxl->dirty[qxl_i++] = dirty[i];
@@ -1163,6 +1199,9 @@ static void qxl_enter_vga_mode(PCIQXLDevice *d)
         return;
     }
     trace_qxl_enter_vga_mode(d->id);
+    qemu_mutex_lock(&d->ssd.lock);
+    d->render_generation++;
+    qemu_mutex_unlock(&d->ssd.lock);
     spice_qxl_driver_unload(&d->ssd.qxl);
     graphic_console_set_hwops(d->ssd.dcl.con, d->vga.hw_ops, &d->vga);
     update_displaychangelistener(&d->ssd.dcl, GUI_REFRESH_INTERVAL_DEFAULT);
@@ -1240,6 +1279,11 @@ static void qxl_hard_reset(PCIQXLDevice *d, int loadvm)
 
     trace_qxl_hard_reset(d->id, loadvm);
 
+    qemu_mutex_lock(&d->ssd.lock);
+    d->guest_primary.data = NULL;
+    d->render_generation++;
+    qemu_mutex_unlock(&d->ssd.lock);
+
     if (startstop) {
         qemu_spice_display_stop();
     }
@@ -1539,6 +1583,10 @@ static int qxl_destroy_primary(PCIQXLDevice *d, qxl_async_io async)
     }
     trace_qxl_destroy_primary(d->id);
     d->mode = QXL_MODE_UNDEFINED;
+    qemu_mutex_lock(&d->ssd.lock);
+    d->guest_primary.data = NULL;
+    d->render_generation++;
+    qemu_mutex_unlock(&d->ssd.lock);
     qemu_spice_destroy_primary_surface(&d->ssd, 0, async);
     qxl_spice_reset_cursor(d);
     return 1;
@@ -1934,6 +1982,9 @@ static void qxl_dirty_surfaces(PCIQXLDevice *qxl)
 {
     int i;
 
+    /* flush what qxl_ring_popped() has been batching up */
+    qxl_ring_set_dirty(qxl);
+
     if (qxl->mode != QXL_MODE_NATIVE && qxl->mode != QXL_MODE_COMPAT) {
         return;
     }
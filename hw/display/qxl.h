@@ -126,6 +126,12 @@ struct PCIQXLDevice {
     int                num_dirty_rects;
     QXLRect            dirty[QXL_NUM_DIRTY_RECTS];
     QEMUBH            *update_area_bh;
+    bool               render_blit_running;
+    /* bumped when the primary goes away, stale blits are dropped */
+    uint32_t           render_generation;
+
+    /* ring pops since the rings were last marked dirty */
+    uint32_t           ring_pops;
 };
 
 #define TYPE_PCI_QXL "pci-qxl"
@@ -47,3 +47,18 @@ static inline uint32_t vga_read_dword_le(VGACommonState *vga, uint32_t addr)
     uint32_t *ptr = (uint32_t *)(vga->vram_ptr + offset);
     return ldl_le_p(ptr);
 }
+
+/*
+ * The len bytes at addr as one piece of vram, or NULL if they wrap around
+ * the end of it and have to be read one at a time.
+ */
+static inline const uint8_t *vga_read_span(VGACommonState *vga,
+                                           uint32_t addr, uint32_t len)
+{
+    uint32_t offset = addr & vga->vbe_size_mask;
+
+    if (offset + len > vga->vbe_size) {
+        return NULL;
+    }
+    return vga->vram_ptr + offset;
+}
@@ -260,9 +260,16 @@ static void vga_draw_line8(VGACommonState *vga, uint8_t *d,
                            uint32_t addr, int width)
 {
     uint32_t *palette;
+    const uint8_t *s;
     int x;
 
     palette = vga->last_palette;
+    width &= ~7;
+    s = vga_read_span(vga, addr, width);
+    if (s) {
+        pixconv_pal8(d, s, width, palette);
+        return;
+    }
     width >>= 3;
     for(x = 0; x < width; x++) {
         ((uint32_t *)d)[0] = palette[vga_read_byte(vga, addr + 0)];
@@ -284,9 +291,15 @@ static void vga_draw_line8(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line15_le(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
+    const uint8_t *s;
     int w;
     uint32_t v, r, g, b;
 
+    s = vga_read_span(vga, addr & ~1, width * 2);
+    if (s) {
+        pixconv_555(d, s, width, 0);
+        return;
+    }
     w = width;
     do {
         v = vga_read_word_le(vga, addr);
@@ -302,9 +315,15 @@ static void vga_draw_line15_le(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line15_be(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
+    const uint8_t *s;
     int w;
     uint32_t v, r, g, b;
 
+    s = vga_read_span(vga, addr & ~1, width * 2);
+    if (s) {
+        pixconv_555(d, s, width, PIXCONV_BE);
+        return;
+    }
     w = width;
     do {
         v = vga_read_word_be(vga, addr);
@@ -323,9 +342,15 @@ static void vga_draw_line15_be(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line16_le(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
+    const uint8_t *s;
     int w;
     uint32_t v, r, g, b;
 
+    s = vga_read_span(vga, addr & ~1, width * 2);
+    if (s) {
+        pixconv_565(d, s, width, 0);
+        return;
+    }
     w = width;
     do {
         v = vga_read_word_le(vga, addr);
@@ -341,9 +366,15 @@ static void vga_draw_line16_le(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line16_be(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
+    const uint8_t *s;
     int w;
     uint32_t v, r, g, b;
 
+    s = vga_read_span(vga, addr & ~1, width * 2);
+    if (s) {
+        pixconv_565(d, s, width, PIXCONV_BE);
+        return;
+    }
     w = width;
     do {
         v = vga_read_word_be(vga, addr);
@@ -362,9 +393,15 @@ static void vga_draw_line16_be(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line24_le(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
+    const uint8_t *s;
     int w;
     uint32_t r, g, b;
 
+    s = vga_read_span(vga, addr, width * 3);
+    if (s) {
+        pixconv_888(d, s, width, 0);
+        return;
+    }
     w = width;
     do {
         b = vga_read_byte(vga, addr + 0);
@@ -379,9 +416,15 @@ static void vga_draw_line24_le(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line24_be(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
+    const uint8_t *s;
     int w;
     uint32_t r, g, b;
 
+    s = vga_read_span(vga, addr, width * 3);
+    if (s) {
+        pixconv_888(d, s, width, PIXCONV_BE);
+        return;
+    }
     w = width;
     do {
         r = vga_read_byte(vga, addr + 0);
@@ -399,9 +442,15 @@ static void vga_draw_line24_be(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line32_le(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
+    const uint8_t *s;
     int w;
     uint32_t r, g, b;
 
+    s = vga_read_span(vga, addr, width * 4);
+    if (s) {
+        pixconv_8888(d, s, width, 0);
+        return;
+    }
     w = width;
     do {
         b = vga_read_byte(vga, addr + 0);
@@ -416,9 +465,15 @@ static void vga_draw_line32_le(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line32_be(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
+    const uint8_t *s;
     int w;
     uint32_t r, g, b;
 
+    s = vga_read_span(vga, addr, width * 4);
+    if (s) {
+        pixconv_8888(d, s, width, PIXCONV_BE);
+        return;
+    }
     w = width;
     do {
         r = vga_read_byte(vga, addr + 1);
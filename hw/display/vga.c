@@ -30,6 +30,7 @@
 #include "hw/pci/pci.h"
 #include "vga_int.h"
 #include "vga_regs.h"
+#include "pixconv.h"
 #include "ui/pixel_ops.h"
 #include "qemu/timer.h"
 #include "hw/xen/xen.h"
@@ -1470,6 +1471,7 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
     int y1, y, update, linesize, y_start, double_scan, mask, depth;
     int width, height, shift_control, bwidth, bits;
     ram_addr_t page0, page1, region_start, region_end;
+    ram_addr_t clean_start, dirty_start;
     DirtyBitmapSnapshot *snap = NULL;
     int disp_width, multi_scan, multi_run;
     uint8_t *d;
@@ -1491,14 +1493,13 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
 
     region_start = (s->start_addr * 4);
     region_end = region_start + (ram_addr_t)s->line_offset * height;
-    region_end += width * depth / 8; /* scanline length */
+    /* scanline length: 15 bpp pixels take two bytes, palette modes half */
+    region_end += depth ? width * DIV_ROUND_UP(depth, 8)
+                        : DIV_ROUND_UP(width, 2);
     region_end -= s->line_offset;
-    if (region_end > s->vbe_size || depth == 0 || depth == 15) {
+    if (region_end > s->vbe_size) {
         /*
-         * We land here on:
-         *  - wraps around (can happen with cirrus vbe modes)
-         *  - depth == 0 (256 color palette video mode)
-         *  - depth == 15
+         * We land here on wraps around (can happen with cirrus vbe modes).
          *
          * Take the safe and slow route:
          *   - create a dirty bitmap snapshot for all vga memory.
@@ -1512,6 +1513,10 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
         region_start = 0;
         region_end = s->vbe_size;
         force_shadow = true;
+    } else if ((s->cr[VGA_CRTC_MODE] & 3) != 3) {
+        /* CGA compatible addressing scatters scanlines outside the region */
+        region_start = 0;
+        region_end = s->vbe_size;
     }
 
     shift_control = (s->gr[VGA_GFX_MODE] >> 5) & 3;
@@ -1665,6 +1670,7 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
                                                       region_end - region_start,
                                                       DIRTY_MEMORY_VGA);
     }
+    clean_start = dirty_start = region_end;
 
     for(y = 0; y < height; y++) {
         addr = addr1;
@@ -1683,14 +1689,24 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
             update = 1;
         } else if (page1 < page0) {
             /* scanline wraps from end of video memory to the start */
-            assert(force_shadow);
+            assert(region_start == 0 && region_end == s->vbe_size);
             update = memory_region_snapshot_get_dirty(&s->vram, snap,
                                                       page0, s->vbe_size - page0);
             update |= memory_region_snapshot_get_dirty(&s->vram, snap,
                                                        0, page1);
         } else {
-            update = memory_region_snapshot_get_dirty(&s->vram, snap,
-                                                      page0, page1 - page0);
+            /*
+             * [clean_start, dirty_start) is known to be clean and
+             * dirty_start is the next dirty page (or region_end).  Lines
+             * mostly come in increasing address order, so the bitmap is
+             * only searched again once a line starts past dirty_start.
+             */
+            if (page0 < clean_start || page0 > dirty_start) {
+                clean_start = page0;
+                dirty_start = memory_region_snapshot_next_dirty(
+                    &s->vram, snap, page0, region_end - page0);
+            }
+            update = dirty_start < page1;
         }
         /* explicit invalidation for the hardware cursor (cirrus only) */
         update |= vga_scanline_invalidated(s, y);
@@ -11,8 +11,10 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/memfd.h"
 #include "hw/qdev-properties.h"
 #include "hw/virtio/virtio-gpu.h"
+#include "hw/virtio/virtio-gpu-pixman.h"
 #include "chardev/char-fe.h"
 #include "qapi/error.h"
 #include "migration/blocker.h"
@@ -29,8 +31,12 @@ typedef enum VhostUserGpuRequest {
     VHOST_USER_GPU_UPDATE,
     VHOST_USER_GPU_DMABUF_SCANOUT,
     VHOST_USER_GPU_DMABUF_UPDATE,
+    VHOST_USER_GPU_SHM_SCANOUT,
+    VHOST_USER_GPU_SHM_UPDATE,
 } VhostUserGpuRequest;
 
+#define VHOST_USER_GPU_PROTOCOL_F_SHM_SCANOUT 0
+
 typedef struct VhostUserGpuDisplayInfoReply {
     struct virtio_gpu_resp_display_info info;
 } VhostUserGpuDisplayInfoReply;
@@ -76,6 +82,15 @@ typedef struct VhostUserGpuDMABUFScanout {
     int fd_drm_fourcc;
 } QEMU_PACKED VhostUserGpuDMABUFScanout;
 
+typedef struct VhostUserGpuShmScanout {
+    uint32_t scanout_id;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t stride;
+    uint64_t offset;
+} QEMU_PACKED VhostUserGpuShmScanout;
+
 typedef struct VhostUserGpuMsg {
     uint32_t request; /* VhostUserGpuRequest */
     uint32_t flags;
@@ -86,6 +101,7 @@ typedef struct VhostUserGpuMsg {
         VhostUserGpuScanout scanout;
         VhostUserGpuUpdate update;
         VhostUserGpuDMABUFScanout dmabuf_scanout;
+        VhostUserGpuShmScanout shm_scanout;
         struct virtio_gpu_resp_display_info display_info;
         uint64_t u64;
     } payload;
@@ -99,6 +115,99 @@ static VhostUserGpuMsg m __attribute__ ((unused));
 
 static void vhost_user_gpu_update_blocked(VhostUserGPU *g, bool blocked);
 
+/* Drop the backend mapping once the console stopped showing it */
+static void
+vhost_user_gpu_shm_release(VhostUserGPU *g, uint32_t scanout_id)
+{
+    QemuConsole *con = g->parent_obj.scanout[scanout_id].con;
+
+    if (!g->shm[scanout_id].ptr ||
+        qemu_console_surface(con) == g->shm[scanout_id].ds) {
+        return;
+    }
+
+    munmap(g->shm[scanout_id].ptr, g->shm[scanout_id].size);
+    g->shm[scanout_id].ptr = NULL;
+    g->shm[scanout_id].ds = NULL;
+}
+
+/* Take the shm scanouts off their consoles and unmap them */
+static void
+vhost_user_gpu_shm_release_all(VhostUserGPU *g)
+{
+    struct virtio_gpu_scanout *s;
+    int i;
+
+    for (i = 0; i < g->parent_obj.conf.max_outputs; i++) {
+        if (!g->shm[i].ptr) {
+            continue;
+        }
+        s = &g->parent_obj.scanout[i];
+        if (qemu_console_surface(s->con) == g->shm[i].ds) {
+            dpy_gfx_replace_surface(s->con, NULL);
+        }
+        if (s->ds == g->shm[i].ds) {
+            s->ds = NULL;
+        }
+        vhost_user_gpu_shm_release(g, i);
+    }
+}
+
+static void
+vhost_user_gpu_shm_scanout(VhostUserGPU *g, VhostUserGpuShmScanout *m,
+                           int fd)
+{
+    struct virtio_gpu_scanout *s = &g->parent_obj.scanout[m->scanout_id];
+    pixman_format_code_t format = virtio_gpu_get_pixman_format(m->format);
+    uint32_t bpp = format ? PIXMAN_FORMAT_BPP(format) / 8 : 0;
+    uint64_t len;
+    struct stat st;
+    int seals;
+    void *ptr;
+
+    if (!format || !m->width || !m->height ||
+        m->stride < (uint64_t)m->width * bpp ||
+        m->stride % 4 || m->offset % 4 ||
+        fstat(fd, &st) < 0 || m->offset > st.st_size) {
+        error_report("invalid shm scanout: %d", m->scanout_id);
+        return;
+    }
+    /* cannot overflow: all 32 bit quantities */
+    len = (uint64_t)m->stride * (m->height - 1) + (uint64_t)m->width * bpp;
+    if (len > st.st_size - m->offset) {
+        error_report("invalid shm scanout: %d", m->scanout_id);
+        return;
+    }
+
+    /* the surface is read for as long as it is shown, it must not shrink */
+    seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+        error_report("shm scanout %d: memfd is not sealed against shrinking",
+                     m->scanout_id);
+        return;
+    }
+
+    ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        error_report("failed to map shm scanout: %s", strerror(errno));
+        return;
+    }
+
+    if (s->ds && qemu_console_surface(s->con) != s->ds) {
+        /* configured by VHOST_USER_GPU_SCANOUT but never shown */
+        qemu_free_displaysurface(s->ds);
+    }
+    s->ds = qemu_create_displaysurface_from(m->width, m->height, format,
+                                            m->stride,
+                                            (uint8_t *)ptr + m->offset);
+    dpy_gfx_replace_surface(s->con, s->ds);
+    vhost_user_gpu_shm_release(g, m->scanout_id);
+
+    g->shm[m->scanout_id].ptr = ptr;
+    g->shm[m->scanout_id].size = st.st_size;
+    g->shm[m->scanout_id].ds = s->ds;
+}
+
 static void
 vhost_user_gpu_handle_cursor(VhostUserGPU *g, VhostUserGpuMsg *msg)
 {
@@ -159,6 +268,7 @@ vhost_user_gpu_handle_display(VhostUserGPU *g, VhostUserGpuMsg *msg)
             .request = msg->request,
             .flags = VHOST_USER_GPU_MSG_FLAG_REPLY,
             .size = sizeof(uint64_t),
+            .payload.u64 = 1ULL << VHOST_USER_GPU_PROTOCOL_F_SHM_SCANOUT,
         };
 
         vhost_user_gpu_send_msg(g, &reply);
@@ -193,8 +303,15 @@ vhost_user_gpu_handle_display(VhostUserGPU *g, VhostUserGpuMsg *msg)
         s = &g->parent_obj.scanout[m->scanout_id];
         con = s->con;
 
+        if (s->ds && qemu_console_surface(con) != s->ds) {
+            /* configured by an earlier VHOST_USER_GPU_SCANOUT, never shown */
+            qemu_free_displaysurface(s->ds);
+        }
         if (m->width == 0) {
+            /* this frees the surface shown so far, shm backed or not */
             dpy_gfx_replace_surface(con, NULL);
+            s->ds = NULL;
+            vhost_user_gpu_shm_release(g, m->scanout_id);
         } else {
             s->ds = qemu_create_displaysurface(m->width, m->height);
             /* replace surface on next update */
@@ -258,6 +375,39 @@ vhost_user_gpu_handle_display(VhostUserGPU *g, VhostUserGpuMsg *msg)
         g->backend_blocked = true;
         break;
     }
+    case VHOST_USER_GPU_SHM_SCANOUT: {
+        VhostUserGpuShmScanout *m = &msg->payload.shm_scanout;
+        int fd = qemu_chr_fe_get_msgfd(&g->vhost_chr);
+
+        if (m->scanout_id >= g->parent_obj.conf.max_outputs || fd < 0) {
+            error_report("invalid shm scanout: %d", m->scanout_id);
+            if (fd >= 0) {
+                close(fd);
+            }
+            break;
+        }
+
+        g->parent_obj.enable = 1;
+        con = g->parent_obj.scanout[m->scanout_id].con;
+        vhost_user_gpu_shm_scanout(g, m, fd);
+        close(fd);
+        break;
+    }
+    case VHOST_USER_GPU_SHM_UPDATE: {
+        VhostUserGpuUpdate *m = &msg->payload.update;
+
+        if (m->scanout_id >= g->parent_obj.conf.max_outputs) {
+            break;
+        }
+        con = g->parent_obj.scanout[m->scanout_id].con;
+        if (!g->shm[m->scanout_id].ptr) {
+            error_report("shm update without shm scanout: %d", m->scanout_id);
+            break;
+        }
+        /* the pixels are already in place */
+        dpy_gfx_update(con, m->x, m->y, m->width, m->height);
+        break;
+    }
     case VHOST_USER_GPU_UPDATE: {
         VhostUserGpuUpdate *m = &msg->payload.update;
 
@@ -266,6 +416,12 @@ vhost_user_gpu_handle_display(VhostUserGPU *g, VhostUserGpuMsg *msg)
         }
         s = &g->parent_obj.scanout[m->scanout_id];
         con = s->con;
+        if (!s->ds || s->ds == g->shm[m->scanout_id].ds) {
+            /* the shm mapping is read-only, updates go to a new scanout */
+            error_report("update without scanout surface: %d",
+                         m->scanout_id);
+            break;
+        }
         pixman_image_t *image =
             pixman_image_create_bits(PIXMAN_x8r8g8b8,
                                      m->width,
@@ -280,6 +436,7 @@ vhost_user_gpu_handle_display(VhostUserGPU *g, VhostUserGpuMsg *msg)
         pixman_image_unref(image);
         if (qemu_console_surface(con) != s->ds) {
             dpy_gfx_replace_surface(con, s->ds);
+            vhost_user_gpu_shm_release(g, m->scanout_id);
         } else {
             dpy_gfx_update(con, m->x, m->y, m->width, m->height);
         }
@@ -519,6 +676,7 @@ vhost_user_gpu_reset(VirtIODevice *vdev)
 {
     VhostUserGPU *g = VHOST_USER_GPU(vdev);
 
+    vhost_user_gpu_shm_release_all(g);
     virtio_gpu_base_reset(VIRTIO_GPU_BASE(vdev));
 
     vhost_user_backend_stop(g->vhost);
@@ -565,6 +723,15 @@ vhost_user_gpu_device_realize(DeviceState *qdev, Error **errp)
     g->vhost_gpu_fd = -1;
 }
 
+static void
+vhost_user_gpu_device_unrealize(DeviceState *qdev)
+{
+    VhostUserGPU *g = VHOST_USER_GPU(qdev);
+
+    vhost_user_gpu_shm_release_all(g);
+    virtio_gpu_base_device_unrealize(qdev);
+}
+
 static Property vhost_user_gpu_properties[] = {
     VIRTIO_GPU_BASE_PROPERTIES(VhostUserGPU, parent_obj.conf),
     DEFINE_PROP_END_OF_LIST(),
@@ -580,6 +747,7 @@ vhost_user_gpu_class_init(ObjectClass *klass, void *data)
     vgc->gl_flushed = vhost_user_gpu_gl_flushed;
 
     vdc->realize = vhost_user_gpu_device_realize;
+    vdc->unrealize = vhost_user_gpu_device_unrealize;
     vdc->reset = vhost_user_gpu_reset;
     vdc->set_status   = vhost_user_gpu_set_status;
     vdc->guest_notifier_mask = vhost_user_gpu_guest_notifier_mask;
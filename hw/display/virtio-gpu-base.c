@@ -57,6 +57,12 @@ static void virtio_gpu_invalidate_display(void *opaque)
 
 static void virtio_gpu_update_display(void *opaque)
 {
+    VirtIOGPUBase *g = opaque;
+    VirtIOGPUBaseClass *vgc = VIRTIO_GPU_BASE_GET_CLASS(g);
+
+    if (vgc->gfx_update) {
+        vgc->gfx_update(g);
+    }
 }
 
 static void virtio_gpu_text_update(void *opaque, console_ch_t *chardata)
@@ -231,7 +237,7 @@ virtio_gpu_base_set_features(VirtIODevice *vdev, uint64_t features)
     trace_virtio_gpu_features(((features & virgl) == virgl));
 }
 
-static void
+void
 virtio_gpu_base_device_unrealize(DeviceState *qdev)
 {
     VirtIOGPUBase *g = VIRTIO_GPU_BASE(qdev);
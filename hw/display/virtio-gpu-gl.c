@@ -15,6 +15,7 @@
 #include "qemu/iov.h"
 #include "qemu/module.h"
 #include "qemu/error-report.h"
+#include "qemu/timer.h"
 #include "qapi/error.h"
 #include "sysemu/sysemu.h"
 #include "hw/virtio/virtio.h"
@@ -69,7 +70,8 @@ static void virtio_gpu_gl_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
         virtio_gpu_virgl_init(g);
         gl->renderer_inited = true;
     }
-    if (gl->renderer_reset) {
+    /* not while blobs of the old renderer may still be in use */
+    if (gl->renderer_reset && !g->hostmem_unmapping) {
         gl->renderer_reset = false;
         virtio_gpu_virgl_reset(g);
     }
@@ -79,6 +81,8 @@ static void virtio_gpu_gl_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
         cmd->vq = vq;
         cmd->error = 0;
         cmd->finished = false;
+        cmd->suspended = false;
+        cmd->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
         QTAILQ_INSERT_TAIL(&g->cmdq, cmd, next);
         cmd = virtqueue_pop(vq, sizeof(struct virtio_gpu_ctrl_command));
     }
@@ -92,6 +96,8 @@ static void virtio_gpu_gl_reset(VirtIODevice *vdev)
     VirtIOGPU *g = VIRTIO_GPU(vdev);
     VirtIOGPUGL *gl = VIRTIO_GPU_GL(vdev);
 
+    /* blobs leave the BAR before their resources are dropped */
+    virtio_gpu_virgl_reset_hostmem(g);
     virtio_gpu_reset(vdev);
 
     /*
@@ -130,9 +136,23 @@ static void virtio_gpu_gl_device_realize(DeviceState *qdev, Error **errp)
     virtio_gpu_device_realize(qdev, errp);
 }
 
+static void virtio_gpu_gl_device_unrealize(DeviceState *qdev)
+{
+    VirtIOGPU *g = VIRTIO_GPU(qdev);
+    VirtIOGPUGL *gl = VIRTIO_GPU_GL(qdev);
+
+    if (gl->renderer_inited) {
+        virtio_gpu_virgl_deinit(g);
+        gl->renderer_inited = false;
+    }
+    virtio_gpu_device_unrealize(qdev);
+}
+
 static Property virtio_gpu_gl_properties[] = {
     DEFINE_PROP_BIT("stats", VirtIOGPU, parent_obj.conf.flags,
                     VIRTIO_GPU_FLAG_STATS_ENABLED, false),
+    DEFINE_PROP_BIT("x-thread-sync", VirtIOGPU, parent_obj.conf.flags,
+                    VIRTIO_GPU_FLAG_THREAD_SYNC_ENABLED, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -149,6 +169,7 @@ static void virtio_gpu_gl_class_init(ObjectClass *klass, void *data)
     vgc->update_cursor_data = virtio_gpu_gl_update_cursor_data;
 
     vdc->realize = virtio_gpu_gl_device_realize;
+    vdc->unrealize = virtio_gpu_gl_device_unrealize;
     vdc->reset = virtio_gpu_gl_reset;
     device_class_set_props(dc, virtio_gpu_gl_properties);
 }
@@ -0,0 +1,128 @@
+/*
+ * Virtio GPU Device statistics
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Lives outside of the virtio-gpu module so the QMP command is always
+ * available; it only looks at device state.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/qapi-commands-misc.h"
+#include "qapi/util.h"
+#include "qemu/timer.h"
+#include "hw/qdev-core.h"
+#include "hw/virtio/virtio-gpu.h"
+
+#define VIRTIO_GPU_CMD_NAME(_type, _name) \
+    [VIRTIO_GPU_STATS_SLOT(_type)] = _name
+
+static const char *const virtio_gpu_cmd_names[VIRTIO_GPU_STATS_SLOTS] = {
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_GET_DISPLAY_INFO, "get-display-info"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_RESOURCE_CREATE_2D,
+                        "resource-create-2d"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_RESOURCE_UNREF, "resource-unref"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_SET_SCANOUT, "set-scanout"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_RESOURCE_FLUSH, "resource-flush"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_TRANSFER_TO_HOST_2D,
+                        "transfer-to-host-2d"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_RESOURCE_ATTACH_BACKING,
+                        "resource-attach-backing"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_RESOURCE_DETACH_BACKING,
+                        "resource-detach-backing"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_GET_CAPSET_INFO, "get-capset-info"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_GET_CAPSET, "get-capset"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_GET_EDID, "get-edid"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_RESOURCE_ASSIGN_UUID,
+                        "resource-assign-uuid"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_RESOURCE_CREATE_BLOB,
+                        "resource-create-blob"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_SET_SCANOUT_BLOB, "set-scanout-blob"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_CTX_CREATE, "ctx-create"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_CTX_DESTROY, "ctx-destroy"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_CTX_ATTACH_RESOURCE,
+                        "ctx-attach-resource"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_CTX_DETACH_RESOURCE,
+                        "ctx-detach-resource"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_RESOURCE_CREATE_3D,
+                        "resource-create-3d"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_TRANSFER_TO_HOST_3D,
+                        "transfer-to-host-3d"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_TRANSFER_FROM_HOST_3D,
+                        "transfer-from-host-3d"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_SUBMIT_3D, "submit-3d"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_RESOURCE_MAP_BLOB,
+                        "resource-map-blob"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_RESOURCE_UNMAP_BLOB,
+                        "resource-unmap-blob"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_UPDATE_CURSOR, "update-cursor"),
+    VIRTIO_GPU_CMD_NAME(VIRTIO_GPU_CMD_MOVE_CURSOR, "move-cursor"),
+    [VIRTIO_GPU_STATS_SLOTS - 1] = "other",
+};
+
+static VirtioGpuLatencyHistogram *
+virtio_gpu_latency_histogram(VirtIOGPUCmdStats *st)
+{
+    VirtioGpuLatencyHistogram *hist = g_new0(VirtioGpuLatencyHistogram, 1);
+    uint64List **boundaries = &hist->boundaries;
+    uint64List **bins = &hist->bins;
+    int i;
+
+    for (i = 0; i < VIRTIO_GPU_LATENCY_BINS; i++) {
+        if (i < VIRTIO_GPU_LATENCY_BINS - 1) {
+            QAPI_LIST_APPEND(boundaries, (uint64_t)SCALE_US << i);
+        }
+        QAPI_LIST_APPEND(bins, st->latency[i]);
+    }
+    return hist;
+}
+
+static int virtio_gpu_query_stats_one(Object *obj, void *opaque)
+{
+    VirtioGpuStatsList ***tail = opaque;
+    VirtioGpuCommandStatsList **cmd_tail;
+    VirtioGpuCommandStats *cmd;
+    VirtioGpuStats *stats;
+    VirtIOGPU *g;
+    int i;
+
+    g = (VirtIOGPU *)object_dynamic_cast(obj, TYPE_VIRTIO_GPU);
+    if (!g || !DEVICE(g)->realized) {
+        return 0;
+    }
+
+    stats = g_new0(VirtioGpuStats, 1);
+    stats->qom_path = object_get_canonical_path(obj);
+    cmd_tail = &stats->commands;
+
+    aio_context_acquire(g->ctx);
+    stats->resources = g_hash_table_size(g->resource_table);
+    stats->inflight = g->inflight;
+    for (i = 0; i < VIRTIO_GPU_STATS_SLOTS; i++) {
+        VirtIOGPUCmdStats *st = &g->cmd_stats[i];
+
+        if (!st->count) {
+            continue;
+        }
+        cmd = g_new0(VirtioGpuCommandStats, 1);
+        cmd->command = g_strdup(virtio_gpu_cmd_names[i] ?: "other");
+        cmd->count = st->count;
+        cmd->bytes = st->bytes;
+        cmd->latency = virtio_gpu_latency_histogram(st);
+        QAPI_LIST_APPEND(cmd_tail, cmd);
+    }
+    aio_context_release(g->ctx);
+
+    QAPI_LIST_APPEND(*tail, stats);
+    return 0;
+}
+
+VirtioGpuStatsList *qmp_query_virtio_gpu_stats(Error **errp)
+{
+    VirtioGpuStatsList *head = NULL, **tail = &head;
+
+    object_child_foreach_recursive(object_get_root(),
+                                   virtio_gpu_query_stats_one, &tail);
+    return head;
+}
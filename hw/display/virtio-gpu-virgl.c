@@ -13,6 +13,8 @@
 
 #include "qemu/osdep.h"
 #include "qemu/iov.h"
+#include "qemu/units.h"
+#include "qemu/main-loop.h"
 #include "trace.h"
 #include "hw/virtio/virtio.h"
 #include "hw/virtio/virtio-gpu.h"
@@ -71,9 +73,111 @@ static void virgl_cmd_create_resource_3d(VirtIOGPU *g,
     virgl_renderer_resource_create(&args, NULL, 0);
 }
 
+/*
+ * Adding a blob to the hostmem BAR or removing it is a memory transaction,
+ * which rebuilds the flat views and updates the KVM memory slots.  Guests
+ * that map and unmap buffers every frame spend most of their time there,
+ * so a blob stays in the BAR when the guest unmaps it, and mapping it
+ * again at the same offset costs nothing.  It is only taken out when a
+ * new mapping overlaps it or its resource is destroyed, and everything
+ * moving for one map is done in a single transaction.
+ */
+
+/*
+ * Flat views from before the transaction that took a blob out of the BAR
+ * may still point into it until the next RCU grace period, so the
+ * renderer mapping is only released when the region is freed.  The
+ * command queue is blocked until then.
+ */
+typedef struct VirglHostmemRegion {
+    MemoryRegion mr;
+    VirtIOGPU *g;
+    uint32_t ctx_id;
+    uint32_t resource_id;
+} VirglHostmemRegion;
+
+static void virgl_hostmem_unmap_bh(void *opaque)
+{
+    VirglHostmemRegion *vmr = opaque;
+    VirtIOGPU *g = vmr->g;
+
+    trace_virtio_gpu_hostmem_unmap(vmr->resource_id);
+    virgl_renderer_resource_unmap(vmr->ctx_id, vmr->resource_id);
+    g_free(vmr);
+
+    g->hostmem_unmapping--;
+    g->parent_obj.renderer_blocked--;
+    /* through handle_ctrl, a renderer reset may have been held back */
+    qemu_bh_schedule(g->ctrl_bh);
+}
+
+/* From the RCU thread, unless no flat view held on to the region */
+static void virgl_hostmem_region_free(void *obj)
+{
+    VirglHostmemRegion *vmr = container_of((MemoryRegion *)obj,
+                                           VirglHostmemRegion, mr);
+
+    /* the renderer must only be called with the GL context */
+    aio_bh_schedule_oneshot(vmr->g->ctx, virgl_hostmem_unmap_bh, vmr);
+}
+
+/* Call outside of the transaction that removed the region */
+static void virgl_hostmem_release(VirtIOGPU *g,
+                                  struct virtio_gpu_simple_resource *res)
+{
+    g->hostmem_unmapping++;
+    g->parent_obj.renderer_blocked++;
+    object_unparent(OBJECT(res->hostmem_mr));
+    res->hostmem_mr = NULL;
+    res->hostmem_mapped = false;
+}
+
+static void virgl_hostmem_remove(VirtIOGPU *g,
+                                 struct virtio_gpu_simple_resource *res)
+{
+    trace_virtio_gpu_hostmem_evict(res->resource_id, res->hostmem_offset);
+    memory_region_del_subregion(&g->parent_obj.hostmem, res->hostmem_mr);
+    QTAILQ_REMOVE(&g->hostmem_list, res, hostmem_next);
+}
+
+/* Returns whether the renderer still has to unmap the blob */
+static bool virgl_hostmem_drop(VirtIOGPU *g,
+                               struct virtio_gpu_simple_resource *res)
+{
+    if (!res->hostmem_mr) {
+        return false;
+    }
+    if (res->hostmem_mr->container) {
+        virgl_hostmem_remove(g, res);
+    }
+    virgl_hostmem_release(g, res);
+    return true;
+}
+
+void virtio_gpu_virgl_reset_hostmem(VirtIOGPU *g)
+{
+    struct virtio_gpu_simple_resource *res, *tmp;
+    QTAILQ_HEAD(, virtio_gpu_simple_resource) evicted =
+        QTAILQ_HEAD_INITIALIZER(evicted);
+
+    if (QTAILQ_EMPTY(&g->hostmem_list)) {
+        return;
+    }
+    memory_region_transaction_begin();
+    QTAILQ_FOREACH_SAFE(res, &g->hostmem_list, hostmem_next, tmp) {
+        virgl_hostmem_remove(g, res);
+        QTAILQ_INSERT_TAIL(&evicted, res, hostmem_next);
+    }
+    memory_region_transaction_commit();
+    QTAILQ_FOREACH_SAFE(res, &evicted, hostmem_next, tmp) {
+        virgl_hostmem_release(g, res);
+    }
+}
+
 static void virgl_cmd_resource_unref(VirtIOGPU *g,
                                      struct virtio_gpu_ctrl_command *cmd)
 {
+    struct virtio_gpu_simple_resource *res;
     struct virtio_gpu_resource_unref unref;
     struct iovec *res_iovs = NULL;
     int num_iovs = 0;
@@ -81,13 +185,34 @@ static void virgl_cmd_resource_unref(VirtIOGPU *g,
     VIRTIO_GPU_FILL_CMD(unref);
     trace_virtio_gpu_cmd_res_unref(unref.resource_id);
 
+    res = virtio_gpu_find_resource(g, unref.resource_id);
+
+    if (res && virgl_hostmem_drop(g, res)) {
+        /* run again once the renderer has unmapped the blob */
+        cmd->suspended = true;
+        return;
+    }
     virgl_renderer_resource_detach_iov(unref.resource_id,
                                        &res_iovs,
                                        &num_iovs);
     if (res_iovs != NULL && num_iovs != 0) {
         virtio_gpu_cleanup_mapping_iov(g, res_iovs, num_iovs);
+        if (res && res->iov == res_iovs) {
+            res->iov = NULL;
+        }
     }
     virgl_renderer_resource_unref(unref.resource_id);
+
+    /* blob resources are also tracked on the qemu side */
+    if (res) {
+        if (res->iov) {
+            virtio_gpu_cleanup_mapping_iov(g, res->iov, res->iov_cnt);
+        }
+        virtio_gpu_fini_udmabuf(res);
+        virtio_gpu_resource_remove(g, res);
+        g_free(res->addrs);
+        g_free(res);
+    }
 }
 
 static void virgl_cmd_context_create(VirtIOGPU *g,
@@ -194,35 +319,54 @@ static void virgl_cmd_set_scanout(VirtIOGPU *g,
     g->parent_obj.scanout[ss.scanout_id].resource_id = ss.resource_id;
 }
 
+/*
+ * Command streams are copied into a per-device arena, never handed to the
+ * renderer in place: the guest could rewrite them while virglrenderer
+ * validates and decodes.  The arena grows to the biggest stream, and goes
+ * back down to VIRGL_SUBMIT_BUF_MAX once that many submissions in a row
+ * fitted there.
+ */
+#define VIRGL_SUBMIT_BUF_MAX    (1 * MiB)
+#define VIRGL_SUBMIT_BUF_SHRINK 64
+
 static void virgl_cmd_submit_3d(VirtIOGPU *g,
                                 struct virtio_gpu_ctrl_command *cmd)
 {
     struct virtio_gpu_cmd_submit cs;
-    void *buf;
     size_t s;
 
     VIRTIO_GPU_FILL_CMD(cs);
     trace_virtio_gpu_cmd_ctx_submit(cs.hdr.ctx_id, cs.size);
 
-    buf = g_malloc(cs.size);
-    s = iov_to_buf(cmd->elem.out_sg, cmd->elem.out_num,
-                   sizeof(cs), buf, cs.size);
-    if (s != cs.size) {
+    /* before allocating anything for it */
+    s = iov_size(cmd->elem.out_sg, cmd->elem.out_num) - sizeof(cs);
+    if (s < cs.size) {
         qemu_log_mask(LOG_GUEST_ERROR, "%s: size mismatch (%zd/%d)",
                       __func__, s, cs.size);
         cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
-        goto out;
+        return;
+    }
+
+    if (cs.size > VIRGL_SUBMIT_BUF_MAX) {
+        g->submit_buf_fitted = 0;
+    } else if (g->submit_buf_size > VIRGL_SUBMIT_BUF_MAX &&
+               ++g->submit_buf_fitted >= VIRGL_SUBMIT_BUF_SHRINK) {
+        g->submit_buf = g_realloc(g->submit_buf, VIRGL_SUBMIT_BUF_MAX);
+        g->submit_buf_size = VIRGL_SUBMIT_BUF_MAX;
     }
+    if (g->submit_buf_size < cs.size) {
+        g->submit_buf = g_realloc(g->submit_buf, cs.size);
+        g->submit_buf_size = cs.size;
+    }
+    iov_to_buf(cmd->elem.out_sg, cmd->elem.out_num, sizeof(cs),
+               g->submit_buf, cs.size);
 
     if (virtio_gpu_stats_enabled(g->parent_obj.conf)) {
         g->stats.req_3d++;
         g->stats.bytes_3d += cs.size;
     }
 
-    virgl_renderer_submit_cmd(buf, cs.hdr.ctx_id, cs.size / 4);
-
-out:
-    g_free(buf);
+    virgl_renderer_submit_cmd(g->submit_buf, cs.hdr.ctx_id, cs.size / 4);
 }
 
 static void virgl_cmd_transfer_to_host_2d(VirtIOGPU *g,
@@ -459,7 +603,7 @@ static void virgl_cmd_resource_create_blob(VirtIOGPU *g,
     if (cblob.blob_mem == VIRTIO_GPU_BLOB_MEM_GUEST) {
         virtio_gpu_init_udmabuf(res);
     }
-    QTAILQ_INSERT_HEAD(&g->reslist, res, next);
+    virtio_gpu_resource_insert(g, res);
 
     const struct virgl_renderer_resource_create_blob_args virgl_args = {
         .res_handle = cblob.resource_id,
@@ -480,13 +624,17 @@ static void virgl_cmd_resource_create_blob(VirtIOGPU *g,
 static void virgl_cmd_resource_map_blob(VirtIOGPU *g,
                                         struct virtio_gpu_ctrl_command *cmd)
 {
-    struct virtio_gpu_simple_resource *res;
+    struct virtio_gpu_simple_resource *res, *other, *tmp;
     struct virtio_gpu_resource_map_blob mblob;
-    int ret;
-    void *data;
-    uint64_t size;
-    MemoryRegion *region;
     struct virtio_gpu_resp_map_info resp;
+    QTAILQ_HEAD(, virtio_gpu_simple_resource) evicted =
+        QTAILQ_HEAD_INITIALIZER(evicted);
+    MemoryRegion *hostmem = &g->parent_obj.hostmem;
+    MemoryRegion *region;
+    VirglHostmemRegion *vmr;
+    uint64_t size;
+    void *data;
+    int ret;
 
     VIRTIO_GPU_FILL_CMD(mblob);
     virtio_gpu_map_blob_bswap(&mblob);
@@ -506,16 +654,83 @@ static void virgl_cmd_resource_map_blob(VirtIOGPU *g,
         return;
     }
 
-    ret = virgl_renderer_resource_map(mblob.hdr.ctx_id, res->resource_id, &data, &size);
-    if (ret) {
-        g_print("Virgl blob resource map error: %s\n", strerror(-ret));
+    if (res->hostmem_mr && res->hostmem_offset == mblob.offset) {
+        trace_virtio_gpu_cmd_res_map_blob(res->resource_id, mblob.offset,
+                                          true);
+        res->hostmem_mapped = true;
+        goto out;
+    }
+    if (res->hostmem_mapped) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: resource %d already mapped\n",
+                      __func__, mblob.resource_id);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+        return;
+    }
+    trace_virtio_gpu_cmd_res_map_blob(res->resource_id, mblob.offset, false);
+
+    if (!res->hostmem_mr) {
+        ret = virgl_renderer_resource_map(mblob.hdr.ctx_id, res->resource_id,
+                                          &data, &size);
+        if (ret) {
+            qemu_log_mask(LOG_GUEST_ERROR, "%s: resource %d map error: %s\n",
+                          __func__, mblob.resource_id, strerror(-ret));
+            cmd->error = VIRTIO_GPU_RESP_ERR_UNSPEC;
+            return;
+        }
+        vmr = g_new0(VirglHostmemRegion, 1);
+        vmr->g = g;
+        vmr->ctx_id = mblob.hdr.ctx_id;
+        vmr->resource_id = res->resource_id;
+        memory_region_init_ram_device_ptr(&vmr->mr, OBJECT(&vmr->mr),
+                                          "virtio-gpu-blob", size, data);
+        OBJECT(&vmr->mr)->free = virgl_hostmem_region_free;
+        res->hostmem_mr = &vmr->mr;
+    }
+    region = res->hostmem_mr;
+    size = memory_region_size(region);
+
+    if (mblob.offset > memory_region_size(hostmem) ||
+        size > memory_region_size(hostmem) - mblob.offset) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: resource %d does not fit at"
+                      " 0x%" PRIx64 "\n", __func__, mblob.resource_id,
+                      mblob.offset);
+        if (!region->container) {
+            virgl_hostmem_release(g, res);
+        }
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+        return;
     }
 
-    region = g_new0(MemoryRegion, 1);
-    memory_region_init_ram_device_ptr(region, OBJECT(g), NULL, size, data);
-    memory_region_add_subregion(&g->parent_obj.hostmem, mblob.offset, region);
-    memory_region_set_enabled(region, true);
+    memory_region_transaction_begin();
+    if (region->container) {
+        /* still mapped elsewhere from an earlier map, move it */
+        virgl_hostmem_remove(g, res);
+    }
+    QTAILQ_FOREACH_SAFE(other, &g->hostmem_list, hostmem_next, tmp) {
+        if (other->hostmem_offset < mblob.offset + size &&
+            mblob.offset < other->hostmem_offset +
+                           memory_region_size(other->hostmem_mr)) {
+            if (other->hostmem_mapped) {
+                qemu_log_mask(LOG_GUEST_ERROR, "%s: resource %d overlaps"
+                              " mapped resource %d\n", __func__,
+                              mblob.resource_id, other->resource_id);
+            }
+            virgl_hostmem_remove(g, other);
+            QTAILQ_INSERT_TAIL(&evicted, other, hostmem_next);
+        }
+    }
+    res->hostmem_offset = mblob.offset;
+    memory_region_add_subregion(hostmem, mblob.offset, region);
+    QTAILQ_INSERT_TAIL(&g->hostmem_list, res, hostmem_next);
+    memory_region_transaction_commit();
+
+    /* nothing points to them anymore */
+    QTAILQ_FOREACH_SAFE(other, &evicted, hostmem_next, tmp) {
+        virgl_hostmem_release(g, other);
+    }
+    res->hostmem_mapped = true;
 
+out:
     memset(&resp, 0, sizeof(resp));
     resp.hdr.type = VIRTIO_GPU_RESP_OK_MAP_INFO;
     virgl_renderer_resource_get_map_info(mblob.resource_id, &resp.map_info);
@@ -545,7 +760,9 @@ static void virgl_cmd_resource_unmap_blob(VirtIOGPU *g,
         return;
     }
 
-    virgl_renderer_resource_unmap(ublob.hdr.ctx_id, ublob.resource_id);
+    trace_virtio_gpu_cmd_res_unmap_blob(ublob.resource_id);
+    /* the blob stays in the BAR, see above */
+    res->hostmem_mapped = false;
 }
 
 void virtio_gpu_virgl_process_cmd(VirtIOGPU *g,
@@ -631,7 +848,7 @@ void virtio_gpu_virgl_process_cmd(VirtIOGPU *g,
         break;
     }
 
-    if (cmd->finished) {
+    if (cmd->finished || cmd->suspended) {
         return;
     }
     if (cmd->error) {
@@ -667,9 +884,7 @@ static void virgl_write_fence(void *opaque, uint32_t fence)
         QTAILQ_REMOVE(&g->fenceq, cmd, next);
         g_free(cmd);
         g->inflight--;
-        if (virtio_gpu_stats_enabled(g->parent_obj.conf)) {
-            fprintf(stderr, "inflight: %3d (-)\r", g->inflight);
-        }
+        trace_virtio_gpu_inflight(g->inflight);
     }
 }
 
@@ -719,15 +934,19 @@ static void virtio_gpu_print_stats(void *opaque)
     VirtIOGPU *g = opaque;
 
     if (g->stats.requests) {
-        fprintf(stderr, "stats: vq req %4d, %3d -- 3D %4d (%5d)\n",
+        fprintf(stderr, "stats: vq req %4d, %3d -- 3D %4d (%5d)"
+                " -- res %4d (%5d lookups)\n",
                 g->stats.requests,
                 g->stats.max_inflight,
                 g->stats.req_3d,
-                g->stats.bytes_3d);
+                g->stats.bytes_3d,
+                g_hash_table_size(g->resource_table),
+                g->stats.lookups);
         g->stats.requests     = 0;
         g->stats.max_inflight = 0;
         g->stats.req_3d       = 0;
         g->stats.bytes_3d     = 0;
+        g->stats.lookups      = 0;
     } else {
         fprintf(stderr, "stats: idle\r");
     }
@@ -740,6 +959,15 @@ static void virtio_gpu_fence_poll(void *opaque)
 
     virgl_renderer_poll();
     virtio_gpu_process_cmdq(g);
+
+    /*
+     * With a renderer poll fd the fence completions wake us up and
+     * blocked commands are restarted by gl_flushed, so the timer is
+     * only needed without one.
+     */
+    if (g->fence_fd >= 0) {
+        return;
+    }
     if (!QTAILQ_EMPTY(&g->cmdq) || !QTAILQ_EMPTY(&g->fenceq)) {
         timer_mod(g->fence_poll, qemu_clock_get_ms(QEMU_CLOCK_VIRTUAL) + 10);
     }
@@ -760,16 +988,59 @@ void virtio_gpu_virgl_reset_scanout(VirtIOGPU *g)
     }
 }
 
+/*
+ * Only with x-thread-sync: the renderer then waits for fences in a thread
+ * of its own, which makes the GL context current there, and not every
+ * display backend copes with that.
+ */
+static void virtio_gpu_virgl_watch_fences(VirtIOGPU *g)
+{
+    g->fence_fd = -1;
+#ifdef VIRGL_RENDERER_THREAD_SYNC
+    if (virtio_gpu_thread_sync_enabled(g->parent_obj.conf)) {
+        g->fence_fd = virgl_renderer_get_poll_fd();
+    }
+#endif
+    if (g->fence_fd >= 0) {
+        qemu_set_fd_handler(g->fence_fd, virtio_gpu_fence_poll, NULL, g);
+    }
+}
+
+/* fence_poll goes back to the timer */
+static void virtio_gpu_virgl_unwatch_fences(VirtIOGPU *g)
+{
+    if (g->fence_fd >= 0) {
+        qemu_set_fd_handler(g->fence_fd, NULL, NULL, NULL);
+        g->fence_fd = -1;
+    }
+}
+
 void virtio_gpu_virgl_reset(VirtIOGPU *g)
 {
+    /* the renderer may tear down its fence thread and poll fd */
+    virtio_gpu_virgl_unwatch_fences(g);
     virgl_renderer_reset();
+    virtio_gpu_virgl_watch_fences(g);
+
+    g_free(g->submit_buf);
+    g->submit_buf = NULL;
+    g->submit_buf_size = 0;
+    g->submit_buf_fitted = 0;
 }
 
 int virtio_gpu_virgl_init(VirtIOGPU *g)
 {
+    int flags = 0;
     int ret;
 
-    ret = virgl_renderer_init(g, 0, &virtio_gpu_3d_cbs);
+#ifdef VIRGL_RENDERER_THREAD_SYNC
+    if (virtio_gpu_thread_sync_enabled(g->parent_obj.conf)) {
+        /* let the renderer signal fence completion through an eventfd */
+        flags |= VIRGL_RENDERER_THREAD_SYNC;
+    }
+#endif
+
+    ret = virgl_renderer_init(g, flags, &virtio_gpu_3d_cbs);
     if (ret != 0) {
         return ret;
     }
@@ -777,6 +1048,8 @@ int virtio_gpu_virgl_init(VirtIOGPU *g)
     g->fence_poll = timer_new_ms(QEMU_CLOCK_VIRTUAL,
                                  virtio_gpu_fence_poll, g);
 
+    virtio_gpu_virgl_watch_fences(g);
+
     if (virtio_gpu_stats_enabled(g->parent_obj.conf)) {
         g->print_stats = timer_new_ms(QEMU_CLOCK_VIRTUAL,
                                       virtio_gpu_print_stats, g);
@@ -785,6 +1058,21 @@ int virtio_gpu_virgl_init(VirtIOGPU *g)
     return 0;
 }
 
+void virtio_gpu_virgl_deinit(VirtIOGPU *g)
+{
+    virtio_gpu_virgl_unwatch_fences(g);
+    timer_free(g->fence_poll);
+    g->fence_poll = NULL;
+    if (g->print_stats) {
+        timer_free(g->print_stats);
+        g->print_stats = NULL;
+    }
+    virgl_renderer_cleanup(g);
+    g_free(g->submit_buf);
+    g->submit_buf = NULL;
+    g->submit_buf_size = 0;
+}
+
 int virtio_gpu_virgl_get_num_capsets(VirtIOGPU *g)
 {
     uint32_t capset2_max_ver, capset2_max_size, num_capsets;
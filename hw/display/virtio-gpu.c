@@ -14,12 +14,16 @@
 #include "qemu/osdep.h"
 #include "qemu/units.h"
 #include "qemu/iov.h"
+#include "qemu/bitmap.h"
+#include "qemu/host-utils.h"
+#include "qemu/timer.h"
 #include "ui/console.h"
 #include "trace.h"
 #include "sysemu/dma.h"
 #include "sysemu/sysemu.h"
 #include "hw/virtio/virtio.h"
 #include "migration/qemu-file-types.h"
+#include "migration/register.h"
 #include "hw/virtio/virtio-gpu.h"
 #include "hw/virtio/virtio-gpu-bswap.h"
 #include "hw/virtio/virtio-gpu-pixman.h"
@@ -27,6 +31,7 @@
 #include "hw/display/edid.h"
 #include "hw/qdev-properties.h"
 #include "qemu/log.h"
+#include "qemu/main-loop.h"
 #include "qemu/module.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
@@ -41,6 +46,243 @@ virtio_gpu_find_check_resource(VirtIOGPU *g, uint32_t resource_id,
 static void virtio_gpu_cleanup_mapping(VirtIOGPU *g,
                                        struct virtio_gpu_simple_resource *res);
 
+static void virtio_gpu_unshare_backing(VirtIOGPU *g,
+                                       struct virtio_gpu_simple_resource *res);
+
+/*
+ * The console layer and the virtio irq code need the BQL.  When the
+ * queues are processed in an iothread, record what has to be done and
+ * let console_bh apply it from the main loop.
+ */
+static bool virtio_gpu_defer_console(VirtIOGPU *g)
+{
+    return g->iothread && !qemu_mutex_iothread_locked();
+}
+
+/*
+ * Until console_bh swaps the surfaces, the console keeps showing the old
+ * ones, and with zero copy those point straight into guest backing.
+ */
+static bool virtio_gpu_console_pending(VirtIOGPU *g)
+{
+    int i;
+
+    if (!virtio_gpu_defer_console(g)) {
+        return false;
+    }
+    for (i = 0; i < g->parent_obj.conf.max_outputs; i++) {
+        if (g->console[i].replace) {
+            return true;
+        }
+    }
+    return false;
+}
+
+typedef struct VirtIOGPUStaleMapping {
+    struct iovec *iov;
+    uint32_t iov_cnt;
+} VirtIOGPUStaleMapping;
+
+static void virtio_gpu_release_stale_mappings(VirtIOGPU *g)
+{
+    VirtIOGPUStaleMapping *m;
+    GSList *l;
+
+    for (l = g->stale_mappings; l; l = l->next) {
+        m = l->data;
+        virtio_gpu_cleanup_mapping_iov(g, m->iov, m->iov_cnt);
+        g_free(m);
+    }
+    g_slist_free(g->stale_mappings);
+    g->stale_mappings = NULL;
+}
+
+static void virtio_gpu_notify(VirtIOGPU *g, VirtQueue *vq)
+{
+    if (virtio_gpu_defer_console(g)) {
+        g->notify_vqs |= 1 << virtio_get_queue_index(vq);
+        qemu_bh_schedule(g->console_bh);
+        return;
+    }
+    virtio_notify(VIRTIO_DEVICE(g), vq);
+}
+
+static void virtio_gpu_replace_surface(VirtIOGPU *g, uint32_t scanout_id,
+                                       DisplaySurface *ds)
+{
+    struct virtio_gpu_scanout *scanout = &g->parent_obj.scanout[scanout_id];
+
+    if (g->console[scanout_id].replace) {
+        /* the console never saw the pending surface, drop it */
+        qemu_free_displaysurface(scanout->ds);
+        g->console[scanout_id].replace = false;
+    }
+    scanout->ds = ds;
+    /* a new surface is redrawn in full anyway */
+    pixman_region_clear(&g->console[scanout_id].damage);
+
+    if (virtio_gpu_defer_console(g)) {
+        g->console[scanout_id].replace = true;
+        qemu_bh_schedule(g->console_bh);
+        return;
+    }
+    dpy_gfx_replace_surface(scanout->con, ds);
+}
+
+/*
+ * With pace_flush the damage is only collected here and handed to the
+ * console on the next display refresh, or once the guest goes idle.
+ */
+static void virtio_gpu_update_console(VirtIOGPU *g, uint32_t scanout_id,
+                                      int x, int y, int w, int h)
+{
+    pixman_region16_t *damage = &g->console[scanout_id].damage;
+
+    if (g->pace_flush || virtio_gpu_defer_console(g)) {
+        pixman_region_union_rect(damage, damage, x, y, w, h);
+        if (!g->pace_flush) {
+            qemu_bh_schedule(g->console_bh);
+        }
+        return;
+    }
+    dpy_gfx_update(g->parent_obj.scanout[scanout_id].con, x, y, w, h);
+}
+
+/* Beyond this many rectangles a single bounding box is cheaper */
+#define VIRTIO_GPU_DAMAGE_RECTS 16
+
+static void virtio_gpu_flush_damage(VirtIOGPU *g, uint32_t scanout_id)
+{
+    pixman_region16_t *damage = &g->console[scanout_id].damage;
+    QemuConsole *con = g->parent_obj.scanout[scanout_id].con;
+    pixman_box16_t *rects;
+    int i, n;
+
+    if (!pixman_region_not_empty(damage)) {
+        return;
+    }
+
+    rects = pixman_region_rectangles(damage, &n);
+    if (n > VIRTIO_GPU_DAMAGE_RECTS) {
+        rects = pixman_region_extents(damage);
+        n = 1;
+    }
+    trace_virtio_gpu_flush_damage(scanout_id, n);
+    for (i = 0; i < n; i++) {
+        dpy_gfx_update(con, rects[i].x1, rects[i].y1,
+                       rects[i].x2 - rects[i].x1,
+                       rects[i].y2 - rects[i].y1);
+    }
+    pixman_region_clear(damage);
+}
+
+/*
+ * The guest counts as idle once no command arrived for this long.  Then
+ * the damage collected so far goes out without waiting for the display
+ * refresh; a guest that keeps submitting is paced by the refresh alone.
+ */
+#define VIRTIO_GPU_IDLE_MS 8
+
+static void virtio_gpu_flush_on_idle(void *opaque)
+{
+    VirtIOGPU *g = opaque;
+    int i;
+
+    aio_context_acquire(g->ctx);
+    if (virtio_gpu_defer_console(g)) {
+        g->flush_damage = true;
+        qemu_bh_schedule(g->console_bh);
+    } else {
+        for (i = 0; i < g->parent_obj.conf.max_outputs; i++) {
+            virtio_gpu_flush_damage(g, i);
+        }
+    }
+    aio_context_release(g->ctx);
+}
+
+/* Called when the command queue drains, (re)starts the idle period */
+static void virtio_gpu_arm_idle(VirtIOGPU *g)
+{
+    int i;
+
+    if (!g->pace_flush || !g->flush_on_idle) {
+        return;
+    }
+    for (i = 0; i < g->parent_obj.conf.max_outputs; i++) {
+        if (pixman_region_not_empty(&g->console[i].damage)) {
+            timer_mod(g->idle_timer,
+                      qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                      VIRTIO_GPU_IDLE_MS);
+            return;
+        }
+    }
+}
+
+static void virtio_gpu_gfx_update(VirtIOGPUBase *b)
+{
+    VirtIOGPU *g = VIRTIO_GPU(b);
+    int i;
+
+    aio_context_acquire(g->ctx);
+    for (i = 0; i < b->conf.max_outputs; i++) {
+        virtio_gpu_flush_damage(g, i);
+    }
+    aio_context_release(g->ctx);
+}
+
+static void virtio_gpu_account_cmd(VirtIOGPU *g, uint32_t type,
+                                   VirtQueueElement *elem, int64_t start_ns)
+{
+    VirtIOGPUCmdStats *st = &g->cmd_stats[VIRTIO_GPU_STATS_SLOT(type)];
+    int64_t us = (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns) / SCALE_US;
+    int bin = us > 0 ? 64 - clz64(us) : 0;
+
+    st->count++;
+    st->bytes += iov_size(elem->out_sg, elem->out_num);
+    st->latency[MIN(bin, VIRTIO_GPU_LATENCY_BINS - 1)]++;
+}
+
+static void virtio_gpu_console_bh(void *opaque)
+{
+    VirtIOGPU *g = opaque;
+    VirtIODevice *vdev = VIRTIO_DEVICE(g);
+    struct virtio_gpu_scanout *s;
+    int i;
+
+    aio_context_acquire(g->ctx);
+    for (i = 0; i < g->parent_obj.conf.max_outputs; i++) {
+        s = &g->parent_obj.scanout[i];
+
+        if (g->console[i].replace) {
+            g->console[i].replace = false;
+            dpy_gfx_replace_surface(s->con, s->ds);
+        }
+        if (!g->pace_flush || g->flush_damage) {
+            virtio_gpu_flush_damage(g, i);
+        }
+        if (g->console[i].cursor_define && s->current_cursor) {
+            dpy_cursor_define(s->con, s->current_cursor);
+        }
+        if (g->console[i].mouse_set) {
+            dpy_mouse_set(s->con, s->cursor.pos.x, s->cursor.pos.y,
+                          g->console[i].mouse_visible);
+        }
+        g->console[i].cursor_define = false;
+        g->console[i].mouse_set = false;
+    }
+    g->flush_damage = false;
+    /* the consoles are off the old surfaces now */
+    virtio_gpu_release_stale_mappings(g);
+
+    for (i = 0; i < 2; i++) {
+        if (g->notify_vqs & (1 << i)) {
+            virtio_notify(vdev, virtio_get_queue(vdev, i));
+        }
+    }
+    g->notify_vqs = 0;
+    aio_context_release(g->ctx);
+}
+
 void virtio_gpu_update_cursor_data(VirtIOGPU *g,
                                    struct virtio_gpu_scanout *s,
                                    uint32_t resource_id)
@@ -102,13 +344,25 @@ static void update_cursor(VirtIOGPU *g, struct virtio_gpu_update_cursor *cursor)
         if (cursor->resource_id > 0) {
             vgc->update_cursor_data(g, s, cursor->resource_id);
         }
-        dpy_cursor_define(s->con, s->current_cursor);
+        if (virtio_gpu_defer_console(g)) {
+            g->console[cursor->pos.scanout_id].cursor_define = true;
+        } else {
+            dpy_cursor_define(s->con, s->current_cursor);
+        }
 
         s->cursor = *cursor;
     } else {
         s->cursor.pos.x = cursor->pos.x;
         s->cursor.pos.y = cursor->pos.y;
     }
+
+    if (virtio_gpu_defer_console(g)) {
+        g->console[cursor->pos.scanout_id].mouse_set = true;
+        g->console[cursor->pos.scanout_id].mouse_visible =
+            cursor->resource_id ? 1 : 0;
+        qemu_bh_schedule(g->console_bh);
+        return;
+    }
     dpy_mouse_set(s->con, cursor->pos.x, cursor->pos.y,
                   cursor->resource_id ? 1 : 0);
 }
@@ -116,14 +370,34 @@ static void update_cursor(VirtIOGPU *g, struct virtio_gpu_update_cursor *cursor)
 struct virtio_gpu_simple_resource *
 virtio_gpu_find_resource(VirtIOGPU *g, uint32_t resource_id)
 {
-    struct virtio_gpu_simple_resource *res;
-
-    QTAILQ_FOREACH(res, &g->reslist, next) {
-        if (res->resource_id == resource_id) {
-            return res;
-        }
+    if (virtio_gpu_stats_enabled(g->parent_obj.conf)) {
+        g->stats.lookups++;
     }
-    return NULL;
+    return g_hash_table_lookup(g->resource_table,
+                               GUINT_TO_POINTER(resource_id));
+}
+
+void virtio_gpu_resource_insert(VirtIOGPU *g,
+                                struct virtio_gpu_simple_resource *res)
+{
+    QTAILQ_INSERT_HEAD(&g->reslist, res, next);
+    g_hash_table_insert(g->resource_table,
+                        GUINT_TO_POINTER(res->resource_id), res);
+}
+
+void virtio_gpu_resource_remove(VirtIOGPU *g,
+                                struct virtio_gpu_simple_resource *res)
+{
+    g_hash_table_remove(g->resource_table,
+                        GUINT_TO_POINTER(res->resource_id));
+    QTAILQ_REMOVE(&g->reslist, res, next);
+}
+
+static void virtio_gpu_track_rows(struct virtio_gpu_simple_resource *res)
+{
+    g_free(res->dirty_rows);
+    res->dirty_rows = bitmap_new(res->height);
+    bitmap_set(res->dirty_rows, 0, res->height);
 }
 
 static struct virtio_gpu_simple_resource *
@@ -170,6 +444,7 @@ void virtio_gpu_ctrl_response(VirtIOGPU *g,
         resp->ctx_id = cmd->cmd_hdr.ctx_id;
     }
     virtio_gpu_ctrl_hdr_bswap(resp);
+    virtio_gpu_account_cmd(g, cmd->cmd_hdr.type, &cmd->elem, cmd->start_ns);
     s = iov_from_buf(cmd->elem.in_sg, cmd->elem.in_num, 0, resp, resp_len);
     if (s != resp_len) {
         qemu_log_mask(LOG_GUEST_ERROR,
@@ -177,7 +452,7 @@ void virtio_gpu_ctrl_response(VirtIOGPU *g,
                       __func__, s, resp_len);
     }
     virtqueue_push(cmd->vq, &cmd->elem, s);
-    virtio_notify(VIRTIO_DEVICE(g), cmd->vq);
+    virtio_gpu_notify(g, cmd->vq);
     cmd->finished = true;
 }
 
@@ -282,6 +557,13 @@ static void virtio_gpu_resource_create_2d(VirtIOGPU *g,
         return;
     }
 
+    if (c2d.width == 0 || c2d.height == 0) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: resource %d has no pixels\n",
+                      __func__, c2d.resource_id);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+        return;
+    }
+
     res = g_new0(struct virtio_gpu_simple_resource, 1);
 
     res->width = c2d.width;
@@ -316,8 +598,11 @@ static void virtio_gpu_resource_create_2d(VirtIOGPU *g,
         return;
     }
 
-    QTAILQ_INSERT_HEAD(&g->reslist, res, next);
+    virtio_gpu_resource_insert(g, res);
     g->hostmem += res->hostmem;
+    if (g->migration.tracking) {
+        virtio_gpu_track_rows(res);
+    }
 }
 
 static void virtio_gpu_resource_create_blob(VirtIOGPU *g,
@@ -367,7 +652,7 @@ static void virtio_gpu_resource_create_blob(VirtIOGPU *g,
     }
 
     virtio_gpu_init_udmabuf(res);
-    QTAILQ_INSERT_HEAD(&g->reslist, res, next);
+    virtio_gpu_resource_insert(g, res);
 }
 
 static void virtio_gpu_disable_scanout(VirtIOGPU *g, int scanout_id)
@@ -384,9 +669,8 @@ static void virtio_gpu_disable_scanout(VirtIOGPU *g, int scanout_id)
         res->scanout_bitmask &= ~(1 << scanout_id);
     }
 
-    dpy_gfx_replace_surface(scanout->con, NULL);
+    virtio_gpu_replace_surface(g, scanout_id, NULL);
     scanout->resource_id = 0;
-    scanout->ds = NULL;
     scanout->width = 0;
     scanout->height = 0;
 }
@@ -405,8 +689,10 @@ static void virtio_gpu_resource_destroy(VirtIOGPU *g,
     }
 
     qemu_pixman_image_unref(res->image);
+    qemu_pixman_image_unref(res->shadow);
+    g_free(res->dirty_rows);
     virtio_gpu_cleanup_mapping(g, res);
-    QTAILQ_REMOVE(&g->reslist, res, next);
+    virtio_gpu_resource_remove(g, res);
     g->hostmem -= res->hostmem;
     g_free(res);
 }
@@ -469,6 +755,19 @@ static void virtio_gpu_transfer_to_host_2d(VirtIOGPU *g,
     bpp = DIV_ROUND_UP(PIXMAN_FORMAT_BPP(format), 8);
     stride = pixman_image_get_stride(res->image);
 
+    if (res->dirty_rows) {
+        bitmap_set(res->dirty_rows, t2d.r.y, t2d.r.height);
+    }
+
+    if (res->zero_copy) {
+        if (t2d.offset == (uint64_t)t2d.r.y * stride + t2d.r.x * bpp) {
+            /* the image is the backing storage, nothing to copy */
+            return;
+        }
+        /* guest uses a different layout, go back to copying */
+        virtio_gpu_unshare_backing(g, res);
+    }
+
     if (t2d.offset || t2d.r.x || t2d.r.y ||
         t2d.r.width != pixman_image_get_width(res->image)) {
         void *img_data = pixman_image_get_data(res->image);
@@ -554,10 +853,10 @@ static void virtio_gpu_resource_flush(VirtIOGPU *g,
         pixman_region_translate(&finalregion, -scanout->x, -scanout->y);
         extents = pixman_region_extents(&finalregion);
         /* work out the area we need to update for each console */
-        dpy_gfx_update(g->parent_obj.scanout[i].con,
-                       extents->x1, extents->y1,
-                       extents->x2 - extents->x1,
-                       extents->y2 - extents->y1);
+        virtio_gpu_update_console(g, i,
+                                  extents->x1, extents->y1,
+                                  extents->x2 - extents->x1,
+                                  extents->y2 - extents->y1);
 
         pixman_region_fini(&region);
         pixman_region_fini(&finalregion);
@@ -643,6 +942,7 @@ static void virtio_gpu_do_set_scanout(VirtIOGPU *g,
         scanout->width != r->width ||
         scanout->height != r->height) {
         pixman_image_t *rect;
+        DisplaySurface *ds;
         void *ptr = data + fb->offset;
         rect = pixman_image_create_bits(fb->format, r->width, r->height,
                                         ptr, fb->stride);
@@ -654,15 +954,14 @@ static void virtio_gpu_do_set_scanout(VirtIOGPU *g,
         }
 
         /* realloc the surface ptr */
-        scanout->ds = qemu_create_displaysurface_pixman(rect);
-        if (!scanout->ds) {
+        ds = qemu_create_displaysurface_pixman(rect);
+        if (!ds) {
             *error = VIRTIO_GPU_RESP_ERR_UNSPEC;
             return;
         }
 
         pixman_image_unref(rect);
-        dpy_gfx_replace_surface(g->parent_obj.scanout[scanout_id].con,
-                                scanout->ds);
+        virtio_gpu_replace_surface(g, scanout_id, ds);
     }
 
     virtio_gpu_update_scanout(g, scanout_id, res, r);
@@ -867,7 +1166,17 @@ void virtio_gpu_cleanup_mapping_iov(VirtIOGPU *g,
 static void virtio_gpu_cleanup_mapping(VirtIOGPU *g,
                                        struct virtio_gpu_simple_resource *res)
 {
-    virtio_gpu_cleanup_mapping_iov(g, res->iov, res->iov_cnt);
+    VirtIOGPUStaleMapping *m;
+
+    if (res->iov && virtio_gpu_console_pending(g)) {
+        /* keep it mapped until console_bh has swapped the surfaces */
+        m = g_new(VirtIOGPUStaleMapping, 1);
+        m->iov = res->iov;
+        m->iov_cnt = res->iov_cnt;
+        g->stale_mappings = g_slist_prepend(g->stale_mappings, m);
+    } else {
+        virtio_gpu_cleanup_mapping_iov(g, res->iov, res->iov_cnt);
+    }
     res->iov = NULL;
     res->iov_cnt = 0;
     g_free(res->addrs);
@@ -878,6 +1187,116 @@ static void virtio_gpu_cleanup_mapping(VirtIOGPU *g,
     }
 }
 
+static void *
+virtio_gpu_contiguous_backing(struct virtio_gpu_simple_resource *res,
+                              size_t size)
+{
+    uint8_t *base;
+    size_t len;
+    int i;
+
+    if (!res->iov_cnt) {
+        return NULL;
+    }
+
+    base = res->iov[0].iov_base;
+    len = res->iov[0].iov_len;
+    for (i = 1; i < res->iov_cnt && len < size; i++) {
+        if (res->iov[i].iov_base != base + len) {
+            return NULL;
+        }
+        len += res->iov[i].iov_len;
+    }
+
+    if (len < size || !QEMU_PTR_IS_ALIGNED(base, sizeof(uint32_t))) {
+        return NULL;
+    }
+    return base;
+}
+
+/* Re-create the surfaces of all scanouts showing res after an image swap. */
+static void virtio_gpu_rebind_scanouts(VirtIOGPU *g,
+                                       struct virtio_gpu_simple_resource *res)
+{
+    struct virtio_gpu_framebuffer fb = { 0 };
+    struct virtio_gpu_scanout *scanout;
+    struct virtio_gpu_rect r;
+    uint32_t error = 0;
+    int i;
+
+    fb.format = pixman_image_get_format(res->image);
+    fb.bytes_pp = DIV_ROUND_UP(PIXMAN_FORMAT_BPP(fb.format), 8);
+    fb.width = pixman_image_get_width(res->image);
+    fb.height = pixman_image_get_height(res->image);
+    fb.stride = pixman_image_get_stride(res->image);
+
+    for (i = 0; i < g->parent_obj.conf.max_outputs; i++) {
+        if (!(res->scanout_bitmask & (1 << i))) {
+            continue;
+        }
+        scanout = &g->parent_obj.scanout[i];
+        r.x = scanout->x;
+        r.y = scanout->y;
+        r.width = scanout->width;
+        r.height = scanout->height;
+        fb.offset = r.x * fb.bytes_pp + r.y * fb.stride;
+        virtio_gpu_do_set_scanout(g, i, &fb, res, &r, &error);
+    }
+}
+
+/*
+ * Map the image straight onto the backing storage if the guest pages are
+ * contiguous in host memory.  TRANSFER_TO_HOST_2D then has nothing to
+ * copy.  The private image is kept (and stays accounted in hostmem) so
+ * detaching the backing can always fall back to it.
+ */
+static void virtio_gpu_share_backing(VirtIOGPU *g,
+                                     struct virtio_gpu_simple_resource *res)
+{
+    pixman_image_t *image;
+    uint32_t stride;
+    void *data;
+
+    if (res->blob || !res->image || res->zero_copy) {
+        return;
+    }
+
+    stride = pixman_image_get_stride(res->image);
+    data = virtio_gpu_contiguous_backing(res, (size_t)stride * res->height);
+    if (!data) {
+        return;
+    }
+
+    image = pixman_image_create_bits(pixman_image_get_format(res->image),
+                                     res->width, res->height, data, stride);
+    if (!image) {
+        return;
+    }
+
+    res->shadow = res->image;
+    res->image = image;
+    res->zero_copy = true;
+    virtio_gpu_rebind_scanouts(g, res);
+}
+
+static void virtio_gpu_unshare_backing(VirtIOGPU *g,
+                                       struct virtio_gpu_simple_resource *res)
+{
+    if (!res->zero_copy) {
+        return;
+    }
+
+    memcpy(pixman_image_get_data(res->shadow),
+           pixman_image_get_data(res->image),
+           pixman_image_get_stride(res->image) * res->height);
+
+    pixman_image_unref(res->image);
+    res->image = res->shadow;
+    res->shadow = NULL;
+    res->zero_copy = false;
+    virtio_gpu_rebind_scanouts(g, res);
+}
+
 static void
 virtio_gpu_resource_attach_backing(VirtIOGPU *g,
                                    struct virtio_gpu_ctrl_command *cmd)
@@ -909,6 +1328,8 @@ virtio_gpu_resource_attach_backing(VirtIOGPU *g,
         cmd->error = VIRTIO_GPU_RESP_ERR_UNSPEC;
         return;
     }
+
+    virtio_gpu_share_backing(g, res);
 }
 
 static void
@@ -927,6 +1348,7 @@ virtio_gpu_resource_detach_backing(VirtIOGPU *g,
     if (!res) {
         return;
     }
+    virtio_gpu_unshare_backing(g, res);
     virtio_gpu_cleanup_mapping(g, res);
 }
 
@@ -1045,6 +1467,12 @@ void virtio_gpu_process_cmdq(VirtIOGPU *g)
         /* process command */
         vgc->process_cmd(g, cmd);
 
+        if (cmd->suspended) {
+            /* it blocked the renderer, and runs again once unblocked */
+            cmd->suspended = false;
+            break;
+        }
+
         QTAILQ_REMOVE(&g->cmdq, cmd, next);
         if (virtio_gpu_stats_enabled(g->parent_obj.conf)) {
             g->stats.requests++;
@@ -1057,13 +1485,17 @@ void virtio_gpu_process_cmdq(VirtIOGPU *g)
                 if (g->stats.max_inflight < g->inflight) {
                     g->stats.max_inflight = g->inflight;
                 }
-                fprintf(stderr, "inflight: %3d (+)\r", g->inflight);
             }
+            trace_virtio_gpu_inflight(g->inflight);
         } else {
             g_free(cmd);
         }
     }
     g->processing_cmdq = false;
+
+    if (QTAILQ_EMPTY(&g->cmdq)) {
+        virtio_gpu_arm_idle(g);
+    }
 }
 
 static void virtio_gpu_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
@@ -1080,6 +1512,8 @@ static void virtio_gpu_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
         cmd->vq = vq;
         cmd->error = 0;
         cmd->finished = false;
+        cmd->suspended = false;
+        cmd->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
         QTAILQ_INSERT_TAIL(&g->cmdq, cmd, next);
         cmd = virtqueue_pop(vq, sizeof(struct virtio_gpu_ctrl_command));
     }
@@ -1091,8 +1525,14 @@ static void virtio_gpu_ctrl_bh(void *opaque)
 {
     VirtIOGPU *g = opaque;
     VirtIOGPUClass *vgc = VIRTIO_GPU_GET_CLASS(g);
+    VirtIODevice *vdev = VIRTIO_DEVICE(g);
 
-    vgc->handle_ctrl(&g->parent_obj.parent_obj, g->ctrl_vq);
+    aio_context_acquire(g->ctx);
+    /* a reset may have raced with the kick, see virtio_gpu_reset() */
+    if (!g->iothread || (vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+        vgc->handle_ctrl(vdev, g->ctrl_vq);
+    }
+    aio_context_release(g->ctx);
 }
 
 static void virtio_gpu_handle_cursor(VirtIODevice *vdev, VirtQueue *vq)
@@ -1101,6 +1541,7 @@ static void virtio_gpu_handle_cursor(VirtIODevice *vdev, VirtQueue *vq)
     VirtQueueElement *elem;
     size_t s;
     struct virtio_gpu_update_cursor cursor_info;
+    int64_t start_ns;
 
     if (!virtio_queue_ready(vq)) {
         return;
@@ -1110,6 +1551,7 @@ static void virtio_gpu_handle_cursor(VirtIODevice *vdev, VirtQueue *vq)
         if (!elem) {
             break;
         }
+        start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
 
         s = iov_to_buf(elem->out_sg, elem->out_num, 0,
                        &cursor_info, sizeof(cursor_info));
@@ -1120,9 +1562,10 @@ static void virtio_gpu_handle_cursor(VirtIODevice *vdev, VirtQueue *vq)
         } else {
             virtio_gpu_bswap_32(&cursor_info, sizeof(cursor_info));
             update_cursor(g, &cursor_info);
+            virtio_gpu_account_cmd(g, cursor_info.hdr.type, elem, start_ns);
         }
         virtqueue_push(vq, elem, 0);
-        virtio_notify(vdev, vq);
+        virtio_gpu_notify(g, vq);
         g_free(elem);
     }
 }
@@ -1130,7 +1573,13 @@ static void virtio_gpu_handle_cursor(VirtIODevice *vdev, VirtQueue *vq)
 static void virtio_gpu_cursor_bh(void *opaque)
 {
     VirtIOGPU *g = opaque;
-    virtio_gpu_handle_cursor(&g->parent_obj.parent_obj, g->cursor_vq);
+    VirtIODevice *vdev = VIRTIO_DEVICE(g);
+
+    aio_context_acquire(g->ctx);
+    if (!g->iothread || (vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+        virtio_gpu_handle_cursor(vdev, g->cursor_vq);
+    }
+    aio_context_release(g->ctx);
 }
 
 static const VMStateDescription vmstate_virtio_gpu_scanout = {
@@ -1171,7 +1620,9 @@ static int virtio_gpu_save(QEMUFile *f, void *opaque, size_t size,
 {
     VirtIOGPU *g = opaque;
     struct virtio_gpu_simple_resource *res;
-    int i;
+    int i, ret;
+
+    aio_context_acquire(g->ctx);
 
     /* in 2d mode we should never find unprocessed commands here */
     assert(QTAILQ_EMPTY(&g->cmdq));
@@ -1186,12 +1637,41 @@ static int virtio_gpu_save(QEMUFile *f, void *opaque, size_t size,
             qemu_put_be64(f, res->addrs[i]);
             qemu_put_be32(f, res->iov[i].iov_len);
         }
-        qemu_put_buffer(f, (void *)pixman_image_get_data(res->image),
-                        pixman_image_get_stride(res->image) * res->height);
+        if (!g->live_migration) {
+            qemu_put_buffer(f, (void *)pixman_image_get_data(res->image),
+                            pixman_image_get_stride(res->image) * res->height);
+        }
     }
     qemu_put_be32(f, 0); /* end of list */
 
-    return vmstate_save_state(f, &vmstate_virtio_gpu_scanouts, g, NULL);
+    ret = vmstate_save_state(f, &vmstate_virtio_gpu_scanouts, g, NULL);
+    aio_context_release(g->ctx);
+    return ret;
+}
+
+static pixman_image_t *
+virtio_gpu_take_incoming_image(VirtIOGPU *g,
+                               struct virtio_gpu_simple_resource *res,
+                               pixman_format_code_t pformat)
+{
+    gpointer key = GUINT_TO_POINTER(res->resource_id);
+    pixman_image_t *image;
+
+    image = g_hash_table_lookup(g->migration.images, key);
+    if (!image) {
+        /* a resource without rows has nothing to send */
+        return res->height ? NULL :
+            pixman_image_create_bits(pformat, res->width, 0, NULL, 0);
+    }
+
+    g_hash_table_steal(g->migration.images, key);
+    if (pixman_image_get_width(image) != res->width ||
+        pixman_image_get_height(image) != res->height ||
+        pixman_image_get_format(image) != pformat) {
+        pixman_image_unref(image);
+        return NULL;
+    }
+    return image;
 }
 
 static int virtio_gpu_load(QEMUFile *f, void *opaque, size_t size,
@@ -1225,9 +1705,14 @@ static int virtio_gpu_load(QEMUFile *f, void *opaque, size_t size,
             g_free(res);
             return -EINVAL;
         }
-        res->image = pixman_image_create_bits(pformat,
-                                              res->width, res->height,
-                                              NULL, 0);
+        if (g->live_migration) {
+            /* the contents came ahead of us in the iterative section */
+            res->image = virtio_gpu_take_incoming_image(g, res, pformat);
+        } else {
+            res->image = pixman_image_create_bits(pformat,
+                                                  res->width, res->height,
+                                                  NULL, 0);
+        }
         if (!res->image) {
             g_free(res);
             return -EINVAL;
@@ -1243,8 +1728,10 @@ static int virtio_gpu_load(QEMUFile *f, void *opaque, size_t size,
             res->addrs[i] = qemu_get_be64(f);
             res->iov[i].iov_len = qemu_get_be32(f);
         }
-        qemu_get_buffer(f, (void *)pixman_image_get_data(res->image),
-                        pixman_image_get_stride(res->image) * res->height);
+        if (!g->live_migration) {
+            qemu_get_buffer(f, (void *)pixman_image_get_data(res->image),
+                            pixman_image_get_stride(res->image) * res->height);
+        }
 
         /* restore mapping */
         for (i = 0; i < res->iov_cnt; i++) {
@@ -1271,12 +1758,18 @@ static int virtio_gpu_load(QEMUFile *f, void *opaque, size_t size,
             }
         }
 
-        QTAILQ_INSERT_HEAD(&g->reslist, res, next);
+        virtio_gpu_resource_insert(g, res);
         g->hostmem += res->hostmem;
+        virtio_gpu_share_backing(g, res);
 
         resource_id = qemu_get_be32(f);
     }
 
+    if (g->live_migration) {
+        /* whatever is left belongs to resources destroyed meanwhile */
+        g_hash_table_remove_all(g->migration.images);
+    }
+
     /* load & apply scanout state */
     vmstate_load_state(f, &vmstate_virtio_gpu_scanouts, g, 1);
     for (i = 0; i < g->parent_obj.conf.max_outputs; i++) {
@@ -1304,10 +1797,270 @@ static int virtio_gpu_load(QEMUFile *f, void *opaque, size_t size,
     return 0;
 }
 
+/*
+ * With live_migration the pixels of 2D resources travel in an iterative
+ * section: everything is queued at setup, then only the rows rewritten
+ * by TRANSFER_TO_HOST_2D since they were last sent.  The device state
+ * above carries the resource metadata only.
+ */
+#define VIRTIO_GPU_MIGRATION_CHUNK (256 * KiB)
+
+/*
+ * The iterative handlers run in the migration thread, which does not
+ * hold the BQL unless this is a savevm.
+ */
+static bool virtio_gpu_migration_lock(VirtIOGPU *g)
+{
+    bool bql = !qemu_mutex_iothread_locked();
+
+    if (bql) {
+        qemu_mutex_lock_iothread();
+    }
+    aio_context_acquire(g->ctx);
+    return bql;
+}
+
+static void virtio_gpu_migration_unlock(VirtIOGPU *g, bool bql)
+{
+    aio_context_release(g->ctx);
+    if (bql) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
+/* Pick the next run of dirty rows, at most a chunk, and mark it clean */
+static struct virtio_gpu_simple_resource *
+virtio_gpu_next_dirty_rows(VirtIOGPU *g, uint32_t *y, uint32_t *rows)
+{
+    struct virtio_gpu_simple_resource *res;
+    unsigned long start, end;
+    uint32_t stride;
+
+    QTAILQ_FOREACH(res, &g->reslist, next) {
+        if (!res->dirty_rows) {
+            continue;
+        }
+        stride = pixman_image_get_stride(res->image);
+        if (!stride) {
+            /* no pixels, possible for resources migrated from older QEMU */
+            bitmap_zero(res->dirty_rows, res->height);
+            continue;
+        }
+        start = find_first_bit(res->dirty_rows, res->height);
+        if (start >= res->height) {
+            continue;
+        }
+        end = find_next_zero_bit(res->dirty_rows, res->height, start);
+
+        *y = start;
+        *rows = MIN(end - start, MAX(VIRTIO_GPU_MIGRATION_CHUNK / stride, 1));
+        bitmap_clear(res->dirty_rows, *y, *rows);
+        trace_virtio_gpu_migration_rows(res->resource_id, *y, *rows);
+        return res;
+    }
+    return NULL;
+}
+
+static void virtio_gpu_put_rows_header(QEMUFile *f,
+                                       struct virtio_gpu_simple_resource *res,
+                                       uint32_t y, uint32_t rows)
+{
+    qemu_put_be32(f, res->resource_id);
+    qemu_put_be32(f, res->width);
+    qemu_put_be32(f, res->height);
+    qemu_put_be32(f, res->format);
+    qemu_put_be32(f, y);
+    qemu_put_be32(f, rows);
+}
+
+static int virtio_gpu_save_setup(QEMUFile *f, void *opaque)
+{
+    VirtIOGPU *g = opaque;
+    struct virtio_gpu_simple_resource *res;
+    bool bql;
+
+    bql = virtio_gpu_migration_lock(g);
+    g->migration.tracking = true;
+    QTAILQ_FOREACH(res, &g->reslist, next) {
+        if (res->image) {
+            virtio_gpu_track_rows(res);
+        }
+    }
+    virtio_gpu_migration_unlock(g, bql);
+
+    qemu_put_be32(f, 0); /* end of list */
+    return 0;
+}
+
+static int virtio_gpu_save_live_iterate(QEMUFile *f, void *opaque)
+{
+    VirtIOGPU *g = opaque;
+    struct virtio_gpu_simple_resource *res;
+    struct virtio_gpu_simple_resource hdr = {};
+    uint32_t y = 0, rows = 0, stride;
+    size_t len = 0;
+    bool bql;
+
+    /* copy out under the lock, send without it */
+    while (!qemu_file_rate_limit(f)) {
+        bql = virtio_gpu_migration_lock(g);
+        res = virtio_gpu_next_dirty_rows(g, &y, &rows);
+        if (res) {
+            hdr = *res;
+            stride = pixman_image_get_stride(res->image);
+            len = (size_t)rows * stride;
+            if (len > g->migration.buf_size) {
+                g->migration.buf = g_realloc(g->migration.buf, len);
+                g->migration.buf_size = len;
+            }
+            memcpy(g->migration.buf,
+                   (uint8_t *)pixman_image_get_data(res->image) + y * stride,
+                   len);
+        }
+        virtio_gpu_migration_unlock(g, bql);
+
+        if (!res) {
+            qemu_put_be32(f, 0); /* end of list */
+            return 1;
+        }
+        virtio_gpu_put_rows_header(f, &hdr, y, rows);
+        qemu_put_buffer(f, g->migration.buf, len);
+    }
+
+    qemu_put_be32(f, 0); /* end of list */
+    return 0;
+}
+
+static int virtio_gpu_save_live_complete_precopy(QEMUFile *f, void *opaque)
+{
+    VirtIOGPU *g = opaque;
+    struct virtio_gpu_simple_resource *res;
+    uint32_t y, rows, stride;
+
+    aio_context_acquire(g->ctx);
+    while ((res = virtio_gpu_next_dirty_rows(g, &y, &rows))) {
+        stride = pixman_image_get_stride(res->image);
+        virtio_gpu_put_rows_header(f, res, y, rows);
+        qemu_put_buffer(f,
+                        (uint8_t *)pixman_image_get_data(res->image)
+                        + y * stride,
+                        (size_t)rows * stride);
+    }
+    aio_context_release(g->ctx);
+
+    qemu_put_be32(f, 0); /* end of list */
+    return 0;
+}
+
+static void virtio_gpu_save_live_pending(QEMUFile *f, void *opaque,
+                                         uint64_t threshold_size,
+                                         uint64_t *res_precopy_only,
+                                         uint64_t *res_compatible,
+                                         uint64_t *res_postcopy_only)
+{
+    VirtIOGPU *g = opaque;
+    struct virtio_gpu_simple_resource *res;
+    uint64_t pending = 0;
+    bool bql;
+
+    bql = virtio_gpu_migration_lock(g);
+    QTAILQ_FOREACH(res, &g->reslist, next) {
+        if (res->dirty_rows) {
+            pending += (uint64_t)bitmap_count_one(res->dirty_rows,
+                                                  res->height) *
+                pixman_image_get_stride(res->image);
+        }
+    }
+    virtio_gpu_migration_unlock(g, bql);
+
+    *res_precopy_only += pending;
+}
+
+static void virtio_gpu_save_cleanup(void *opaque)
+{
+    VirtIOGPU *g = opaque;
+    struct virtio_gpu_simple_resource *res;
+
+    aio_context_acquire(g->ctx);
+    g->migration.tracking = false;
+    QTAILQ_FOREACH(res, &g->reslist, next) {
+        g_free(res->dirty_rows);
+        res->dirty_rows = NULL;
+    }
+    aio_context_release(g->ctx);
+
+    g_free(g->migration.buf);
+    g->migration.buf = NULL;
+    g->migration.buf_size = 0;
+}
+
+static int virtio_gpu_load_live(QEMUFile *f, void *opaque, int version_id)
+{
+    VirtIOGPU *g = opaque;
+    uint32_t resource_id, width, height, format, y, rows;
+    pixman_format_code_t pformat;
+    pixman_image_t *image;
+    gpointer key;
+    size_t stride;
+
+    if (version_id != 1) {
+        return -EINVAL;
+    }
+
+    resource_id = qemu_get_be32(f);
+    while (resource_id != 0) {
+        width = qemu_get_be32(f);
+        height = qemu_get_be32(f);
+        format = qemu_get_be32(f);
+        y = qemu_get_be32(f);
+        rows = qemu_get_be32(f);
+
+        pformat = virtio_gpu_get_pixman_format(format);
+        if (!pformat || !width || !height || y > height || rows > height - y) {
+            return -EINVAL;
+        }
+
+        /* the id may have been reused for a different resource */
+        key = GUINT_TO_POINTER(resource_id);
+        image = g_hash_table_lookup(g->migration.images, key);
+        if (image && (pixman_image_get_width(image) != width ||
+                      pixman_image_get_height(image) != height ||
+                      pixman_image_get_format(image) != pformat)) {
+            g_hash_table_remove(g->migration.images, key);
+            image = NULL;
+        }
+        if (!image) {
+            image = pixman_image_create_bits(pformat, width, height, NULL, 0);
+            if (!image) {
+                return -EINVAL;
+            }
+            g_hash_table_insert(g->migration.images, key, image);
+        }
+
+        stride = pixman_image_get_stride(image);
+        qemu_get_buffer(f, (uint8_t *)pixman_image_get_data(image)
+                        + y * stride, rows * stride);
+
+        resource_id = qemu_get_be32(f);
+    }
+
+    return qemu_file_get_error(f);
+}
+
+static SaveVMHandlers savevm_virtio_gpu_resources = {
+    .save_setup = virtio_gpu_save_setup,
+    .save_live_iterate = virtio_gpu_save_live_iterate,
+    .save_live_complete_precopy = virtio_gpu_save_live_complete_precopy,
+    .save_live_pending = virtio_gpu_save_live_pending,
+    .save_cleanup = virtio_gpu_save_cleanup,
+    .load_state = virtio_gpu_load_live,
+};
+
 void virtio_gpu_device_realize(DeviceState *qdev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(qdev);
     VirtIOGPU *g = VIRTIO_GPU(qdev);
+    int i;
 
     if (virtio_gpu_blob_enabled(g->parent_obj.conf)) {
         if (!virtio_gpu_have_udmabuf()) {
@@ -1316,6 +2069,21 @@ void virtio_gpu_device_realize(DeviceState *qdev, Error **errp)
         }
     }
 
+    if (g->iothread) {
+        /* GL contexts and dmabuf scanouts are bound to the main thread */
+        if (virtio_gpu_virgl_enabled(g->parent_obj.conf)) {
+            error_setg(errp, "iothread is not supported with virgl");
+            return;
+        }
+        if (virtio_gpu_blob_enabled(g->parent_obj.conf)) {
+            error_setg(errp, "iothread is not supported with blob resources");
+            return;
+        }
+        g->ctx = iothread_get_aio_context(g->iothread);
+    } else {
+        g->ctx = qemu_get_aio_context();
+    }
+
     if (!virtio_gpu_base_device_realize(qdev,
                                         virtio_gpu_handle_ctrl_cb,
                                         virtio_gpu_handle_cursor_cb,
@@ -1325,11 +2093,78 @@ void virtio_gpu_device_realize(DeviceState *qdev, Error **errp)
 
     g->ctrl_vq = virtio_get_queue(vdev, 0);
     g->cursor_vq = virtio_get_queue(vdev, 1);
-    g->ctrl_bh = qemu_bh_new(virtio_gpu_ctrl_bh, g);
-    g->cursor_bh = qemu_bh_new(virtio_gpu_cursor_bh, g);
+    g->ctrl_bh = aio_bh_new(g->ctx, virtio_gpu_ctrl_bh, g);
+    g->cursor_bh = aio_bh_new(g->ctx, virtio_gpu_cursor_bh, g);
+    g->console_bh = qemu_bh_new(virtio_gpu_console_bh, g);
+    g->idle_timer = aio_timer_new(g->ctx, QEMU_CLOCK_REALTIME, SCALE_MS,
+                                  virtio_gpu_flush_on_idle, g);
+    for (i = 0; i < VIRTIO_GPU_MAX_SCANOUTS; i++) {
+        pixman_region_init(&g->console[i].damage);
+    }
     QTAILQ_INIT(&g->reslist);
+    QTAILQ_INIT(&g->hostmem_list);
+    g->resource_table = g_hash_table_new(NULL, NULL);
     QTAILQ_INIT(&g->cmdq);
     QTAILQ_INIT(&g->fenceq);
+
+    if (g->live_migration) {
+        g_autofree char *path = qdev_get_dev_path(qdev);
+        g_autofree char *idstr = path ?
+            g_strdup_printf("%s/virtio-gpu-resources", path) :
+            g_strdup("virtio-gpu-resources");
+
+        g->migration.images =
+            g_hash_table_new_full(NULL, NULL, NULL,
+                                  (GDestroyNotify)pixman_image_unref);
+        register_savevm_live(idstr, VMSTATE_INSTANCE_ID_ANY, 1,
+                             &savevm_virtio_gpu_resources, g);
+    }
+}
+
+void virtio_gpu_device_unrealize(DeviceState *qdev)
+{
+    VirtIOGPU *g = VIRTIO_GPU(qdev);
+    struct virtio_gpu_simple_resource *res, *tmp;
+    struct virtio_gpu_ctrl_command *cmd;
+    int i;
+
+    if (g->live_migration) {
+        unregister_savevm(VMSTATE_IF(qdev), "virtio-gpu-resources", g);
+
+        QTAILQ_FOREACH(res, &g->reslist, next) {
+            g_free(res->dirty_rows);
+            res->dirty_rows = NULL;
+        }
+        g->migration.tracking = false;
+        g_free(g->migration.buf);
+        g->migration.buf = NULL;
+        g->migration.buf_size = 0;
+        g_hash_table_destroy(g->migration.images);
+        g->migration.images = NULL;
+    }
+
+    QTAILQ_FOREACH_SAFE(res, &g->reslist, next, tmp) {
+        virtio_gpu_resource_destroy(g, res);
+    }
+    g_hash_table_destroy(g->resource_table);
+    while ((cmd = QTAILQ_FIRST(&g->cmdq))) {
+        QTAILQ_REMOVE(&g->cmdq, cmd, next);
+        g_free(cmd);
+    }
+    while ((cmd = QTAILQ_FIRST(&g->fenceq))) {
+        QTAILQ_REMOVE(&g->fenceq, cmd, next);
+        g_free(cmd);
+    }
+
+    qemu_bh_delete(g->ctrl_bh);
+    qemu_bh_delete(g->cursor_bh);
+    qemu_bh_delete(g->console_bh);
+    virtio_gpu_release_stale_mappings(g);
+    for (i = 0; i < VIRTIO_GPU_MAX_SCANOUTS; i++) {
+        pixman_region_fini(&g->console[i].damage);
+    }
+    timer_free(g->idle_timer);
+    virtio_gpu_base_device_unrealize(qdev);
 }
 
 void virtio_gpu_reset(VirtIODevice *vdev)
@@ -1338,6 +2173,13 @@ void virtio_gpu_reset(VirtIODevice *vdev)
     struct virtio_gpu_simple_resource *res, *tmp;
     struct virtio_gpu_ctrl_command *cmd;
 
+    /*
+     * The status is already cleared, so once we own the context the
+     * iothread will not touch the queues or resources anymore.
+     */
+    aio_context_acquire(g->ctx);
+
+    timer_del(g->idle_timer);
     QTAILQ_FOREACH_SAFE(res, &g->reslist, next, tmp) {
         virtio_gpu_resource_destroy(g, res);
     }
@@ -1356,6 +2198,7 @@ void virtio_gpu_reset(VirtIODevice *vdev)
     }
 
     virtio_gpu_base_reset(VIRTIO_GPU_BASE(vdev));
+    aio_context_release(g->ctx);
 }
 
 static void
@@ -1412,6 +2255,11 @@ static Property virtio_gpu_properties[] = {
     DEFINE_PROP_BIT("blob", VirtIOGPU, parent_obj.conf.flags,
                     VIRTIO_GPU_FLAG_BLOB_ENABLED, false),
     DEFINE_PROP_SIZE("hostmem", VirtIOGPU, parent_obj.conf.hostmem, 0),
+    DEFINE_PROP_LINK("iothread", VirtIOGPU, iothread, TYPE_IOTHREAD,
+                     IOThread *),
+    DEFINE_PROP_BOOL("x-live-migration", VirtIOGPU, live_migration, true),
+    DEFINE_PROP_BOOL("pace-flush", VirtIOGPU, pace_flush, true),
+    DEFINE_PROP_BOOL("flush-on-idle", VirtIOGPU, flush_on_idle, true),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -1419,13 +2267,16 @@ static void virtio_gpu_class_init(ObjectClass *klass, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(klass);
     VirtioDeviceClass *vdc = VIRTIO_DEVICE_CLASS(klass);
+    VirtIOGPUBaseClass *vbc = VIRTIO_GPU_BASE_CLASS(klass);
     VirtIOGPUClass *vgc = VIRTIO_GPU_CLASS(klass);
 
+    vbc->gfx_update = virtio_gpu_gfx_update;
     vgc->handle_ctrl = virtio_gpu_handle_ctrl;
     vgc->process_cmd = virtio_gpu_simple_process_cmd;
     vgc->update_cursor_data = virtio_gpu_update_cursor_data;
 
     vdc->realize = virtio_gpu_device_realize;
+    vdc->unrealize = virtio_gpu_device_unrealize;
     vdc->reset = virtio_gpu_reset;
     vdc->get_config = virtio_gpu_get_config;
     vdc->set_config = virtio_gpu_set_config;
@@ -1949,6 +1949,25 @@ bool memory_region_snapshot_get_dirty(MemoryRegion *mr,
                                       DirtyBitmapSnapshot *snap,
                                       hwaddr addr, hwaddr size);
 
+/**
+ * memory_region_snapshot_next_dirty: Find the first dirty byte of a range
+ *                                    in the specified dirty bitmap snapshot.
+ *
+ * Returns @addr if the page holding it is dirty, the start of the first
+ * dirty page after it otherwise, or @addr + @size if the whole range is
+ * clean.  Clean stretches of the snapshot are skipped a bitmap long at a
+ * time, so walking a mostly clean framebuffer with this is cheaper than
+ * testing it scanline by scanline.
+ *
+ * @mr: the memory region being queried.
+ * @snap: the dirty bitmap snapshot
+ * @addr: the address (relative to the start of the region) being queried.
+ * @size: the size of the range being queried.
+ */
+hwaddr memory_region_snapshot_next_dirty(MemoryRegion *mr,
+                                         DirtyBitmapSnapshot *snap,
+                                         hwaddr addr, hwaddr size);
+
 /**
  * memory_region_reset_dirty: Mark a range of pages as clean, for a specified
  *                            client.
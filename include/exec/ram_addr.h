@@ -429,6 +429,10 @@ bool cpu_physical_memory_snapshot_get_dirty(DirtyBitmapSnapshot *snap,
                                             ram_addr_t start,
                                             ram_addr_t length);
 
+ram_addr_t cpu_physical_memory_snapshot_next_dirty(DirtyBitmapSnapshot *snap,
+                                                   ram_addr_t start,
+                                                   ram_addr_t length);
+
 static inline void cpu_physical_memory_clear_dirty_range(ram_addr_t start,
                                                          ram_addr_t length)
 {
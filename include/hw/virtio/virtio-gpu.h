@@ -20,6 +20,7 @@
 #include "hw/virtio/virtio.h"
 #include "qemu/log.h"
 #include "sysemu/vhost-user-backend.h"
+#include "sysemu/iothread.h"
 
 #include "standard-headers/linux/virtio_gpu.h"
 #include "qom/object.h"
@@ -51,11 +52,31 @@ struct virtio_gpu_simple_resource {
     pixman_image_t *image;
     uint64_t hostmem;
 
+    /*
+     * When the backing storage is contiguous in host memory, image
+     * points to guest memory and the private copy is parked in shadow.
+     */
+    bool zero_copy;
+    pixman_image_t *shadow;
+
+    /* rows not yet sent to the migration stream, NULL when not migrating */
+    unsigned long *dirty_rows;
+
     uint64_t blob_size;
     void *blob;
     int dmabuf_fd;
     uint8_t *remapped;
 
+    /*
+     * virgl blob mapped into the hostmem BAR at hostmem_offset.  It stays
+     * there after the guest unmaps it (hostmem_mapped false) until the
+     * place is needed or the resource goes away.
+     */
+    MemoryRegion *hostmem_mr;
+    uint64_t hostmem_offset;
+    bool hostmem_mapped;
+    QTAILQ_ENTRY(virtio_gpu_simple_resource) hostmem_next;
+
     QTAILQ_ENTRY(virtio_gpu_simple_resource) next;
 };
 
@@ -90,6 +111,7 @@ enum virtio_gpu_base_conf_flags {
     VIRTIO_GPU_FLAG_EDID_ENABLED,
     VIRTIO_GPU_FLAG_DMABUF_ENABLED,
     VIRTIO_GPU_FLAG_BLOB_ENABLED,
+    VIRTIO_GPU_FLAG_THREAD_SYNC_ENABLED,
 };
 
 #define virtio_gpu_virgl_enabled(_cfg) \
@@ -102,6 +124,8 @@ enum virtio_gpu_base_conf_flags {
     (_cfg.flags & (1 << VIRTIO_GPU_FLAG_DMABUF_ENABLED))
 #define virtio_gpu_blob_enabled(_cfg) \
     (_cfg.flags & (1 << VIRTIO_GPU_FLAG_BLOB_ENABLED))
+#define virtio_gpu_thread_sync_enabled(_cfg) \
+    (_cfg.flags & (1 << VIRTIO_GPU_FLAG_THREAD_SYNC_ENABLED))
 #define virtio_gpu_hostmem_enabled(_cfg) \
     (_cfg.hostmem > 0)
 
@@ -119,6 +143,9 @@ struct virtio_gpu_ctrl_command {
     struct virtio_gpu_ctrl_hdr cmd_hdr;
     uint32_t error;
     bool finished;
+    /* not done, run it again once the renderer is unblocked */
+    bool suspended;
+    int64_t start_ns;
     QTAILQ_ENTRY(virtio_gpu_ctrl_command) next;
 };
 
@@ -146,6 +173,7 @@ struct VirtIOGPUBaseClass {
     VirtioDeviceClass parent;
 
     void (*gl_flushed)(VirtIOGPUBase *g);
+    void (*gfx_update)(VirtIOGPUBase *g);
 };
 
 #define VIRTIO_GPU_BASE_PROPERTIES(_state, _conf)                       \
@@ -155,6 +183,23 @@ struct VirtIOGPUBaseClass {
     DEFINE_PROP_UINT32("xres", _state, _conf.xres, 1024), \
     DEFINE_PROP_UINT32("yres", _state, _conf.yres, 768)
 
+/*
+ * Per command type statistics.  2D, 3D and cursor commands get 16 slots
+ * each, the last slot counts everything else.  Latency bin n holds
+ * commands that took [2^(n-1), 2^n) microseconds, bin 0 less than 1us.
+ */
+#define VIRTIO_GPU_STATS_SLOT(type)                                     \
+    (((type) >= 0x100 && (type) < 0x400 && ((type) & 0xff) < 16) ?      \
+     (((type) >> 8) - 1) * 16 + ((type) & 0xff) : 48)
+#define VIRTIO_GPU_STATS_SLOTS  49
+#define VIRTIO_GPU_LATENCY_BINS 20
+
+typedef struct VirtIOGPUCmdStats {
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t latency[VIRTIO_GPU_LATENCY_BINS];
+} VirtIOGPUCmdStats;
+
 typedef struct VGPUDMABuf {
     QemuDmaBuf buf;
     uint32_t scanout_id;
@@ -165,30 +210,78 @@ struct VirtIOGPU {
     VirtIOGPUBase parent_obj;
 
     uint64_t conf_max_hostmem;
+    IOThread *iothread;
+    AioContext *ctx;
 
     VirtQueue *ctrl_vq;
     VirtQueue *cursor_vq;
 
     QEMUBH *ctrl_bh;
     QEMUBH *cursor_bh;
+    QEMUBH *console_bh;
 
+    /*
+     * Console and irq work queued by the iothread, applied by
+     * console_bh in the main loop.  Protected by the ctx lock.
+     */
+    struct {
+        bool replace;
+        bool cursor_define;
+        bool mouse_set;
+        int mouse_visible;
+        pixman_region16_t damage;
+    } console[VIRTIO_GPU_MAX_SCANOUTS];
+    uint32_t notify_vqs;
+    bool flush_damage;
+    /* backing the console may still show, unmapped after the swap */
+    GSList *stale_mappings;
+
+    /* coalesce RESOURCE_FLUSH damage up to the display refresh */
+    bool pace_flush;
+    bool flush_on_idle;
+    QEMUTimer *idle_timer;
+
+    /* reslist keeps creation order, resource_table indexes it by id */
     QTAILQ_HEAD(, virtio_gpu_simple_resource) reslist;
+    GHashTable *resource_table;
     QTAILQ_HEAD(, virtio_gpu_ctrl_command) cmdq;
     QTAILQ_HEAD(, virtio_gpu_ctrl_command) fenceq;
+    /* resources with a blob in the hostmem BAR */
+    QTAILQ_HEAD(, virtio_gpu_simple_resource) hostmem_list;
+    /* blobs out of the BAR that the renderer hasn't unmapped yet */
+    uint32_t hostmem_unmapping;
 
     uint64_t hostmem;
 
     bool processing_cmdq;
     QEMUTimer *fence_poll;
+    int fence_fd;
+
+    /* private copy of SUBMIT_3D streams, see virgl_cmd_submit_3d() */
+    void *submit_buf;
+    size_t submit_buf_size;
+    unsigned submit_buf_fitted;
     QEMUTimer *print_stats;
 
+    /* 2D resource contents are sent by an iterative section */
+    bool live_migration;
+    struct {
+        bool tracking;
+        void *buf;
+        size_t buf_size;
+        /* incoming contents keyed by resource id, consumed by load */
+        GHashTable *images;
+    } migration;
+
     uint32_t inflight;
     struct {
         uint32_t max_inflight;
         uint32_t requests;
         uint32_t req_3d;
         uint32_t bytes_3d;
+        uint32_t lookups;
     } stats;
+    VirtIOGPUCmdStats cmd_stats[VIRTIO_GPU_STATS_SLOTS];
 
     struct {
         QTAILQ_HEAD(, VGPUDMABuf) bufs;
@@ -220,6 +313,12 @@ struct VhostUserGPU {
     int vhost_gpu_fd; /* closed by the chardev */
     CharBackend vhost_chr;
     QemuDmaBuf dmabuf[VIRTIO_GPU_MAX_SCANOUTS];
+    /* backend memory mapped as a scanout surface */
+    struct {
+        void *ptr;
+        size_t size;
+        DisplaySurface *ds;
+    } shm[VIRTIO_GPU_MAX_SCANOUTS];
     bool backend_blocked;
 };
 
@@ -240,6 +339,7 @@ bool virtio_gpu_base_device_realize(DeviceState *qdev,
                                     VirtIOHandleOutput ctrl_cb,
                                     VirtIOHandleOutput cursor_cb,
                                     Error **errp);
+void virtio_gpu_base_device_unrealize(DeviceState *qdev);
 void virtio_gpu_base_reset(VirtIOGPUBase *g);
 void virtio_gpu_base_fill_display_info(VirtIOGPUBase *g,
                         struct virtio_gpu_resp_display_info *dpy_info);
@@ -247,6 +347,10 @@ void virtio_gpu_base_fill_display_info(VirtIOGPUBase *g,
 /* virtio-gpu.c */
 struct virtio_gpu_simple_resource *
 virtio_gpu_find_resource(VirtIOGPU *g, uint32_t resource_id);
+void virtio_gpu_resource_insert(VirtIOGPU *g,
+                                struct virtio_gpu_simple_resource *res);
+void virtio_gpu_resource_remove(VirtIOGPU *g,
+                                struct virtio_gpu_simple_resource *res);
 
 void virtio_gpu_ctrl_response(VirtIOGPU *g,
                               struct virtio_gpu_ctrl_command *cmd,
@@ -270,6 +374,7 @@ void virtio_gpu_resource_assign_uuid(VirtIOGPU *g,
                                      struct virtio_gpu_ctrl_command *cmd);
 void virtio_gpu_process_cmdq(VirtIOGPU *g);
 void virtio_gpu_device_realize(DeviceState *qdev, Error **errp);
+void virtio_gpu_device_unrealize(DeviceState *qdev);
 void virtio_gpu_reset(VirtIODevice *vdev);
 void virtio_gpu_simple_process_cmd(VirtIOGPU *g, struct virtio_gpu_ctrl_command *cmd);
 void virtio_gpu_update_cursor_data(VirtIOGPU *g,
@@ -291,7 +396,9 @@ void virtio_gpu_virgl_process_cmd(VirtIOGPU *g,
 void virtio_gpu_virgl_fence_poll(VirtIOGPU *g);
 void virtio_gpu_virgl_reset_scanout(VirtIOGPU *g);
 void virtio_gpu_virgl_reset(VirtIOGPU *g);
+void virtio_gpu_virgl_reset_hostmem(VirtIOGPU *g);
 int virtio_gpu_virgl_init(VirtIOGPU *g);
+void virtio_gpu_virgl_deinit(VirtIOGPU *g);
 int virtio_gpu_virgl_get_num_capsets(VirtIOGPU *g);
 
 #endif
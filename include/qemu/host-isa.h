@@ -0,0 +1,56 @@
+/*
+ * Run time selection of vector code
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_HOST_ISA_H
+#define QEMU_HOST_ISA_H
+
+/* x86 vector extensions the host can actually use */
+#define HOST_ISA_SSE2       (1 << 0)
+#define HOST_ISA_SSSE3      (1 << 1)
+#define HOST_ISA_SSE4_1     (1 << 2)
+#define HOST_ISA_AVX2       (1 << 3)
+
+/*
+ * HOST_ISA_* bits for the host.  Always 0 unless QEMU was built with
+ * the vector code (CONFIG_AVX2_OPT).
+ */
+unsigned host_isa_flags(void);
+
+/*
+ * For modules carrying vector versions of their loops: a table of
+ * implementations, usually a struct of function pointers each, most
+ * preferred first.  The last one is the plain C code and needs no
+ * HOST_ISA_* bits.
+ */
+typedef struct HostIsaImpl {
+    unsigned isa;
+    const void *impl;
+} HostIsaImpl;
+
+#define HOST_ISA_MAX_IMPLS  4
+
+/* The implementations out of such a table the host can run */
+typedef struct HostIsaDispatch {
+    const void *impls[HOST_ISA_MAX_IMPLS];
+    int nr, cur;
+} HostIsaDispatch;
+
+void host_isa_dispatch_init(HostIsaDispatch *d, const HostIsaImpl *impls,
+                            int nr_impls);
+
+static inline const void *host_isa_dispatch_get(const HostIsaDispatch *d)
+{
+    return d->impls[d->cur];
+}
+
+/*
+ * For tests: switch to the next less preferred implementation, false
+ * once the plain C one is in use.
+ */
+bool host_isa_dispatch_next(HostIsaDispatch *d);
+
+#endif
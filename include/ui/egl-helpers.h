@@ -29,6 +29,31 @@ void egl_fb_setup_new_tex(egl_fb *fb, int width, int height);
 void egl_fb_blit(egl_fb *dst, egl_fb *src, bool flip);
 void egl_fb_read(DisplaySurface *dst, egl_fb *src);
 
+/*
+ * Asynchronous readback: the pixels are read into one of two pixel
+ * buffer objects and copied to the DisplaySurface once the GPU is done,
+ * typically when the next frame comes in.
+ */
+typedef struct egl_readback_buf {
+    GLuint pbo;
+    size_t size;
+    GLsync fence;               /* non-zero while a readback is pending */
+    int x, y, w, h;
+} egl_readback_buf;
+
+typedef struct egl_readback {
+    egl_readback_buf buf[2];
+    int next;
+} egl_readback;
+
+bool egl_readback_supported(void);
+void egl_readback_destroy(egl_readback *rb);
+int egl_readback_pending(egl_readback *rb);
+void egl_fb_read_rect_async(egl_readback *rb, egl_fb *src,
+                            int x, int y, int w, int h);
+bool egl_readback_finish(egl_readback *rb, DisplaySurface *dst,
+                         int *x, int *y, int *w, int *h);
+
 void egl_texture_blit(QemuGLShader *gls, egl_fb *dst, egl_fb *src, bool flip);
 void egl_texture_blend(QemuGLShader *gls, egl_fb *dst, egl_fb *src, bool flip,
                        int x, int y, double scale_x, double scale_y);
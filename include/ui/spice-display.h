@@ -98,6 +98,15 @@ struct SimpleSpiceDisplay {
     QXLRect dirty;
     int notify;
 
+    /*
+     * zero-copy: drawables point into the mirror instead of owning a
+     * copy of their pixels.  Parts of the mirror still referenced by a
+     * drawable in flight are not overwritten, changes there are sent from
+     * a private copy and collected in stale until the mirror can catch up.
+     */
+    bool zero_copy;
+    QXLRect stale;
+
     /*
      * All struct members below this comment can be accessed from
      * both spice server and qemu (iothread) context and any access
@@ -105,6 +114,7 @@ struct SimpleSpiceDisplay {
      */
     QemuMutex lock;
     QTAILQ_HEAD(, SimpleSpiceUpdate) updates;
+    QTAILQ_HEAD(, SimpleSpiceUpdate) inflight;
 
     /* cursor (without qxl): displaychangelistener -> spice server */
     SimpleSpiceCursor *ptr_define;
@@ -142,7 +152,9 @@ struct SimpleSpiceUpdate {
     QXLImage image;
     QXLCommandExt ext;
     uint8_t *bitmap;
+    pixman_image_t *mirror;     /* zero-copy: the image bitmap points into */
     QTAILQ_ENTRY(SimpleSpiceUpdate) next;
+    QTAILQ_ENTRY(SimpleSpiceUpdate) inflight_next;
 };
 
 struct SimpleSpiceCursor {
@@ -152,6 +164,7 @@ struct SimpleSpiceCursor {
 };
 
 extern bool spice_opengl;
+extern bool spice_zero_copy;
 
 int qemu_spice_rect_is_empty(const QXLRect* r);
 void qemu_spice_rect_union(QXLRect *dest, const QXLRect *r);
@@ -1733,9 +1733,21 @@ hmp_screendump(Monitor *mon, const QDict *qdict)
     const char *filename = qdict_get_str(qdict, "filename");
     const char *id = qdict_get_try_str(qdict, "device");
     int64_t head = qdict_get_try_int(qdict, "head", 0);
+    bool png = qdict_get_try_bool(qdict, "png", false);
     Error *err = NULL;
 
-    qmp_screendump(filename, id != NULL, id, id != NULL, head, &err);
+#ifdef CONFIG_PNG
+    qmp_screendump(filename, id != NULL, id, id != NULL, head,
+                   true, png ? IMAGE_FORMAT_PNG : IMAGE_FORMAT_PPM,
+                   false, 0, &err);
+#else
+    if (png) {
+        monitor_printf(mon, "PNG support is not available\n");
+        return;
+    }
+    qmp_screendump(filename, id != NULL, id, id != NULL, head,
+                   false, 0, false, 0, &err);
+#endif
     hmp_handle_error(mon, err);
 }
 
@@ -2008,7 +2008,7 @@ DEF("spice", HAS_ARG, QEMU_OPTION_spice,
     "       [,streaming-video=[off|all|filter]][,disable-copy-paste=on|off]\n"
     "       [,disable-agent-file-xfer=on|off][,agent-mouse=[on|off]]\n"
     "       [,playback-compression=[on|off]][,seamless-migration=[on|off]]\n"
-    "       [,gl=[on|off]][,rendernode=<file>]\n"
+    "       [,zero-copy=[on|off]][,gl=[on|off]][,rendernode=<file>]\n"
     "   enable spice\n"
     "   at least one of {port, tls-port} is mandatory\n",
     QEMU_ARCH_ALL)
@@ -2102,6 +2102,12 @@ SRST
     ``seamless-migration=[on|off]``
         Enable/disable spice seamless migration. Default is off.
 
+    ``zero-copy=[on|off]``
+        Let the display updates QEMU generates from the framebuffer (for
+        all display adapters but QXL in native mode) reference the copy of
+        the framebuffer it keeps, instead of copying every updated
+        rectangle once more. Default is off.
+
     ``gl=[on|off]``
         Enable/disable OpenGL context. Default is off.
 
@@ -2372,6 +2378,21 @@ SRST
     ``power-control=on|off``
         Permit the remote client to issue shutdown, reboot or reset power
         control requests.
+
+    ``tile-encoding=on|off``
+        Choose the encoding per 64x64 tile of each update from its
+        content (number of colours, smoothness and update frequency)
+        among the encodings the client supports, rather than sending
+        the whole update with the client's preferred encoding. Tiles
+        are only sent with JPEG if ``lossy`` is enabled and the client
+        asked for a JPEG quality level. Default is off.
+
+    ``encode-threads=n``
+        Number of threads encoding framebuffer updates, shared by all
+        VNC displays. Updates of different clients are encoded in
+        parallel; with the raw and hextile encodings large updates of
+        a single client are split across the threads as well. Default
+        is 1.
 ERST
 
 ARCHHEADING(, QEMU_ARCH_I386)
@@ -2232,6 +2232,17 @@ bool memory_region_snapshot_get_dirty(MemoryRegion *mr, DirtyBitmapSnapshot *sna
                 memory_region_get_ram_addr(mr) + addr, size);
 }
 
+hwaddr memory_region_snapshot_next_dirty(MemoryRegion *mr,
+                                         DirtyBitmapSnapshot *snap,
+                                         hwaddr addr, hwaddr size)
+{
+    ram_addr_t base = memory_region_get_ram_addr(mr);
+
+    assert(mr->ram_block);
+    return cpu_physical_memory_snapshot_next_dirty(snap, base + addr,
+                                                   size) - base;
+}
+
 void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
 {
     if (mr->readonly != readonly) {
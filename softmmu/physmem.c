@@ -1130,13 +1130,27 @@ bool cpu_physical_memory_snapshot_get_dirty(DirtyBitmapSnapshot *snap,
     end = TARGET_PAGE_ALIGN(start + length - snap->start) >> TARGET_PAGE_BITS;
     page = (start - snap->start) >> TARGET_PAGE_BITS;
 
-    while (page < end) {
-        if (test_bit(page, snap->dirty)) {
-            return true;
-        }
-        page++;
+    return find_next_bit(snap->dirty, end, page) < end;
+}
+
+ram_addr_t cpu_physical_memory_snapshot_next_dirty(DirtyBitmapSnapshot *snap,
+                                                   ram_addr_t start,
+                                                   ram_addr_t length)
+{
+    unsigned long page, end;
+
+    assert(start >= snap->start);
+    assert(start + length <= snap->end);
+
+    end = TARGET_PAGE_ALIGN(start + length - snap->start) >> TARGET_PAGE_BITS;
+    page = (start - snap->start) >> TARGET_PAGE_BITS;
+
+    /* clean words, i.e. runs of BITS_PER_LONG clean pages, cost one test */
+    page = find_next_bit(snap->dirty, end, page);
+    if (page >= end) {
+        return start + length;
     }
-    return false;
+    return MAX(start, snap->start + ((ram_addr_t)page << TARGET_PAGE_BITS));
 }
 
 /* Called from RCU critical section */
@@ -0,0 +1,105 @@
+/*
+ * QEMU display scanline conversion speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ *
+ * Converts a framebuffer from every guest format hw/display/pixconv.c
+ * knows to 32 bpp, line by line as the display devices do, with every
+ * accelerator available on the host.  tests/unit/test-pixconv.c checks
+ * that they all produce the same output.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "hw/display/pixconv.h"
+
+#define WIDTH 1024
+#define HEIGHT 768
+/* roughly how much output every converter produces */
+#define TOTAL (256 * MiB)
+
+typedef struct Format {
+    const char *name;
+    int bpp;
+    void (*conv)(uint8_t *d, const uint8_t *s, int width, int flags);
+    int flags;
+} Format;
+
+static Format formats[] = {
+    { "pal8", 1, NULL, 0 },
+    { "555", 2, pixconv_555, 0 },
+    { "555-be", 2, pixconv_555, PIXCONV_BE },
+    { "565", 2, pixconv_565, 0 },
+    { "565-rgb", 2, pixconv_565, PIXCONV_SWAP_RB },
+    { "888", 3, pixconv_888, 0 },
+    { "888-be", 3, pixconv_888, PIXCONV_BE },
+    { "8888", 4, pixconv_8888, 0 },
+    { "8888-be", 4, pixconv_8888, PIXCONV_BE },
+    { "8888-rgb", 4, pixconv_8888, PIXCONV_SWAP_RB },
+};
+
+static uint8_t *src;
+static uint32_t palette[256];
+
+static void convert_frame(Format *f, uint32_t *dst)
+{
+    const uint8_t *s = src;
+    uint8_t *d = (uint8_t *)dst;
+    int y;
+
+    for (y = 0; y < HEIGHT; y++) {
+        if (f->conv) {
+            f->conv(d, s, WIDTH, f->flags);
+        } else {
+            pixconv_pal8(d, s, WIDTH, palette);
+        }
+        s += WIDTH * f->bpp;
+        d += WIDTH * 4;
+    }
+}
+
+static void bench_format(Format *f)
+{
+    int iterations = MAX(1, TOTAL / (WIDTH * HEIGHT * 4));
+    g_autofree uint32_t *dst = g_new(uint32_t, WIDTH * HEIGHT);
+    double mpix = (double)WIDTH * HEIGHT * iterations / 1000000;
+    int i;
+
+    g_test_timer_start();
+    for (i = 0; i < iterations; i++) {
+        convert_frame(f, dst);
+    }
+    g_test_message("%s %s: %.2f Mpixels/sec", pixconv_accel(), f->name,
+                   mpix / g_test_timer_elapsed());
+}
+
+static void test_pixconv_speed(void)
+{
+    int i;
+
+    do {
+        for (i = 0; i < ARRAY_SIZE(formats); i++) {
+            bench_format(&formats[i]);
+        }
+    } while (pixconv_next_accel());
+}
+
+int main(int argc, char **argv)
+{
+    size_t i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    src = g_malloc(WIDTH * HEIGHT * 4);
+    for (i = 0; i < WIDTH * HEIGHT * 4; i++) {
+        src[i] = g_test_rand_int();
+    }
+    for (i = 0; i < ARRAY_SIZE(palette); i++) {
+        palette[i] = g_test_rand_int() & 0xffffff;
+    }
+
+    g_test_add_func("/display/pixconv/speed", test_pixconv_speed);
+
+    return g_test_run();
+}
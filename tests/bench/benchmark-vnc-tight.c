@@ -0,0 +1,268 @@
+/*
+ * QEMU VNC tight encoder filter speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ *
+ * Runs the palette detection, gradient filter and 24 bit packing kernels
+ * of every accelerator available on the host over a few framebuffers.
+ * Besides the synthetic ones, frames recorded with the monitor
+ * "screendump" command can be given as a colon separated list of PPM
+ * files in QEMU_BENCH_VNC_FRAMES.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "ui/vnc-enc-tight.h"
+
+/* the tight encoder works on rectangles of at most 64K pixels */
+#define TILE 64
+/* roughly how much pixel data every kernel goes through */
+#define TOTAL (256 * MiB)
+
+typedef struct Tile {
+    uint32_t *data;
+    int w, h;
+} Tile;
+
+typedef struct Frame {
+    char *name;
+    uint32_t *pixels;       /* the frame cut in contiguous TILE x TILE tiles */
+    size_t size;            /* pixels */
+    Tile *tiles;
+    int nr_tiles;
+    /* results of the first accelerator, the others must match */
+    uint64_t palette;
+    uint8_t *packed;
+    uint8_t *gradient;
+} Frame;
+
+static GPtrArray *frames;
+
+static void frame_add(const char *name, int w, int h, const uint32_t *fb)
+{
+    Frame *f = g_new0(Frame, 1);
+    uint32_t *dst;
+    int tx, ty, tw, th, y;
+
+    f->name = g_strdup(name);
+    f->size = (size_t)w * h;
+    f->pixels = dst = g_new(uint32_t, f->size);
+    f->tiles = g_new(Tile, DIV_ROUND_UP(w, TILE) * DIV_ROUND_UP(h, TILE));
+    for (ty = 0; ty < h; ty += TILE) {
+        th = MIN(TILE, h - ty);
+        for (tx = 0; tx < w; tx += TILE) {
+            tw = MIN(TILE, w - tx);
+            f->tiles[f->nr_tiles++] = (Tile) { dst, tw, th };
+            for (y = 0; y < th; y++) {
+                memcpy(dst, fb + (size_t)(ty + y) * w + tx, tw * 4);
+                dst += tw;
+            }
+        }
+    }
+    g_ptr_array_add(frames, f);
+}
+
+static void frames_synthetic(void)
+{
+    int w = 1024, h = 768, x, y;
+    uint32_t *fb = g_new(uint32_t, w * h);
+
+    /* a desktop: flat background, windows and text-like strokes */
+    for (y = 0; y < h; y++) {
+        for (x = 0; x < w; x++) {
+            uint32_t pix = 0x3a6ea5;
+
+            if (x > 100 && x < 900 && y > 80 && y < 700) {
+                pix = y < 110 ? 0x0a246a : 0xffffff;
+                if (y >= 120 && (y % 16) < 10 && ((x * 7 + y * 3) % 11) < 4) {
+                    pix = 0x000000;
+                }
+            }
+            fb[y * w + x] = pix;
+        }
+    }
+    frame_add("desktop", w, h, fb);
+
+    /* a smooth image */
+    for (y = 0; y < h; y++) {
+        for (x = 0; x < w; x++) {
+            fb[y * w + x] = (x * 255 / w) << 16 | (y * 255 / h) << 8 |
+                ((x + y) * 255 / (w + h));
+        }
+    }
+    frame_add("gradient", w, h, fb);
+
+    /* video-like noise */
+    for (y = 0; y < h; y++) {
+        for (x = 0; x < w; x++) {
+            fb[y * w + x] = g_test_rand_int() & 0xffffff;
+        }
+    }
+    frame_add("noise", w, h, fb);
+
+    g_free(fb);
+}
+
+static bool frame_load_ppm(const char *path)
+{
+    g_autofree char *data = NULL;
+    g_autofree uint32_t *fb = NULL;
+    g_autofree char *name = NULL;
+    gsize len;
+    int w, h, max, off, i;
+
+    if (!g_file_get_contents(path, &data, &len, NULL)) {
+        return false;
+    }
+    if (sscanf(data, "P6 %d %d %d%n", &w, &h, &max, &off) != 3 ||
+        max != 255 || w <= 0 || h <= 0 ||
+        len < off + 1 + (size_t)w * h * 3) {
+        return false;
+    }
+
+    fb = g_new(uint32_t, (size_t)w * h);
+    for (i = 0; i < w * h; i++) {
+        const uint8_t *p = (uint8_t *)data + off + 1 + i * 3;
+        fb[i] = p[0] << 16 | p[1] << 8 | p[2];
+    }
+    name = g_path_get_basename(path);
+    frame_add(name, w, h, fb);
+    return true;
+}
+
+/* what tight_fill_palette32 does, up to 256 colour changes per tile */
+static uint64_t run_palette(Frame *f)
+{
+    uint64_t result = 0;
+    int k;
+
+    for (k = 0; k < f->nr_tiles; k++) {
+        const uint32_t *t = f->tiles[k].data;
+        size_t count = f->tiles[k].w * f->tiles[k].h, i, n0, runs;
+        uint32_t c;
+
+        i = vnc_tight_skip32(t, 1, count, t[0]);
+        if (i >= count) {
+            result += 1;
+            continue;
+        }
+        n0 = i;
+        i = vnc_tight_skip2_32(t, i + 1, count, t[0], t[i], &n0);
+        result += n0;
+        for (runs = 0; i < count && runs < 256; runs++) {
+            c = t[i];
+            i = vnc_tight_skip32(t, i + 1, count, c);
+        }
+        result += runs;
+    }
+    return result;
+}
+
+static void run_pack24(Frame *f, uint8_t *out)
+{
+    int k;
+
+    for (k = 0; k < f->nr_tiles; k++) {
+        Tile *t = &f->tiles[k];
+
+        vnc_tight_pack24(out, (uint8_t *)t->data, t->w * t->h, 16, 8, 0);
+        out += t->w * t->h * 3;
+    }
+}
+
+static void run_gradient(Frame *f, uint8_t *work, uint8_t *out, void *scratch)
+{
+    int k;
+
+    for (k = 0; k < f->nr_tiles; k++) {
+        Tile *t = &f->tiles[k];
+
+        memcpy(work, t->data, t->w * t->h * 4);
+        vnc_tight_gradient24(work, scratch, t->w, t->h, 16, 8, 0);
+        memcpy(out, work, t->w * t->h * 3);
+        out += t->w * t->h * 3;
+    }
+}
+
+static void bench_frame(Frame *f, bool reference)
+{
+    int iterations = MAX(1, TOTAL / (f->size * 4));
+    g_autofree uint8_t *packed = g_malloc(f->size * 3);
+    g_autofree uint8_t *gradient = g_malloc(f->size * 3);
+    g_autofree uint8_t *work = g_malloc(TILE * TILE * 4);
+    g_autofree uint32_t *scratch = g_new(uint32_t, 2 * (TILE + 1));
+    double mb = (double)f->size * 4 * iterations / MiB;
+    uint64_t palette = 0;
+    int i;
+
+    g_test_timer_start();
+    for (i = 0; i < iterations; i++) {
+        palette = run_palette(f);
+    }
+    g_test_message("%s %s: palette %.2f MB/sec", vnc_tight_filters_accel(),
+                   f->name, mb / g_test_timer_elapsed());
+
+    g_test_timer_start();
+    for (i = 0; i < iterations; i++) {
+        run_pack24(f, packed);
+    }
+    g_test_message("%s %s: pack24 %.2f MB/sec", vnc_tight_filters_accel(),
+                   f->name, mb / g_test_timer_elapsed());
+
+    /* includes copying the tiles in and out, as the encoder does */
+    g_test_timer_start();
+    for (i = 0; i < iterations; i++) {
+        run_gradient(f, work, gradient, scratch);
+    }
+    g_test_message("%s %s: gradient %.2f MB/sec", vnc_tight_filters_accel(),
+                   f->name, mb / g_test_timer_elapsed());
+
+    if (reference) {
+        f->palette = palette;
+        f->packed = g_steal_pointer(&packed);
+        f->gradient = g_steal_pointer(&gradient);
+    } else {
+        g_assert_cmpuint(palette, ==, f->palette);
+        g_assert(memcmp(packed, f->packed, f->size * 3) == 0);
+        g_assert(memcmp(gradient, f->gradient, f->size * 3) == 0);
+    }
+}
+
+static void test_tight_filters_speed(void)
+{
+    bool reference = true;
+    int i;
+
+    do {
+        for (i = 0; i < frames->len; i++) {
+            bench_frame(g_ptr_array_index(frames, i), reference);
+        }
+        reference = false;
+    } while (vnc_tight_filters_next_accel());
+}
+
+int main(int argc, char **argv)
+{
+    const char *list = g_getenv("QEMU_BENCH_VNC_FRAMES");
+
+    g_test_init(&argc, &argv, NULL);
+
+    frames = g_ptr_array_new();
+    frames_synthetic();
+    if (list) {
+        g_auto(GStrv) paths = g_strsplit(list, ":", -1);
+        int i;
+
+        for (i = 0; paths[i]; i++) {
+            if (*paths[i] && !frame_load_ppm(paths[i])) {
+                g_printerr("%s: not a binary PPM file\n", paths[i]);
+                return 1;
+            }
+        }
+    }
+
+    g_test_add_func("/vnc/tight/filters/speed", test_tight_filters_speed);
+
+    return g_test_run();
+}
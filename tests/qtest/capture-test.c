@@ -0,0 +1,210 @@
+/*
+ * QTest testcase for capture-start / capture-stop
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Puts the standard VGA into a 32 bpp VBE mode with a known pixel,
+ * captures it to a file and to a FIFO whose reader goes away, and checks
+ * the errors of capture-start.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "libqtest.h"
+#include "qapi/qmp/qdict.h"
+
+#define VBE_DISPI_IOPORT_INDEX  0x01ce
+#define VBE_DISPI_IOPORT_DATA   0x01cf
+#define VBE_DISPI_INDEX_XRES    0x1
+#define VBE_DISPI_INDEX_YRES    0x2
+#define VBE_DISPI_INDEX_BPP     0x3
+#define VBE_DISPI_INDEX_ENABLE  0x4
+#define VBE_DISPI_ENABLED       0x01
+
+/* attribute controller index, bit 5 turns the display on */
+#define VGA_ATT_W               0x3c0
+#define VGA_AR_ENABLE_DISPLAY   0x20
+
+#define WIDTH                   640
+#define HEIGHT                  480
+#define FRAME_SIZE              (WIDTH * HEIGHT * 4)
+#define PIXEL                   0x00ff8040
+
+/* how long to wait for the capture, in 10 ms steps */
+#define TIMEOUT                 1000
+
+static char *tmpdir;
+
+static void vbe_write(QTestState *qts, uint16_t index, uint16_t val)
+{
+    qtest_outw(qts, VBE_DISPI_IOPORT_INDEX, index);
+    qtest_outw(qts, VBE_DISPI_IOPORT_DATA, val);
+}
+
+static QTestState *start_vga(void)
+{
+    QTestState *qts = qtest_init("-vga std");
+
+    vbe_write(qts, VBE_DISPI_INDEX_XRES, WIDTH);
+    vbe_write(qts, VBE_DISPI_INDEX_YRES, HEIGHT);
+    vbe_write(qts, VBE_DISPI_INDEX_BPP, 32);
+    vbe_write(qts, VBE_DISPI_INDEX_ENABLE, VBE_DISPI_ENABLED);
+    qtest_outb(qts, VGA_ATT_W, VGA_AR_ENABLE_DISPLAY);
+
+    /* first pixel, through the banked window */
+    qtest_writel(qts, 0xa0000, PIXEL);
+    return qts;
+}
+
+static QDict *capture_start(QTestState *qts, const char *id,
+                            const char *filename)
+{
+    return qtest_qmp(qts, "{ 'execute': 'capture-start', 'arguments': "
+                     "{ 'id': %s, 'filename': %s, 'fps': 60 } }",
+                     id, filename);
+}
+
+static void capture_start_ok(QTestState *qts, const char *id,
+                             const char *filename)
+{
+    QDict *rsp = capture_start(qts, id, filename);
+
+    g_assert(qdict_haskey(rsp, "return"));
+    qobject_unref(rsp);
+}
+
+static void capture_start_err(QTestState *qts, const char *id,
+                              const char *filename)
+{
+    QDict *rsp = capture_start(qts, id, filename);
+
+    g_assert(qdict_haskey(rsp, "error"));
+    qobject_unref(rsp);
+}
+
+static void capture_stop(QTestState *qts, const char *id, bool ok)
+{
+    QDict *rsp = qtest_qmp(qts, "{ 'execute': 'capture-stop', 'arguments': "
+                           "{ 'id': %s } }", id);
+
+    g_assert(qdict_haskey(rsp, ok ? "return" : "error"));
+    qobject_unref(rsp);
+}
+
+static void test_capture_file(void)
+{
+    g_autofree char *path = g_strdup_printf("%s/frames.raw", tmpdir);
+    g_autofree uint8_t *data = NULL;
+    QTestState *qts = start_vga();
+    struct stat st;
+    gsize len;
+    int i;
+
+    capture_start_ok(qts, "cap0", path);
+    for (i = 0; i < TIMEOUT; i++) {
+        if (stat(path, &st) == 0 && st.st_size >= FRAME_SIZE) {
+            break;
+        }
+        g_usleep(10 * 1000);
+    }
+    g_assert_cmpint(i, <, TIMEOUT);
+
+    capture_stop(qts, "cap0", true);
+    capture_stop(qts, "cap0", false);
+
+    g_assert(g_file_get_contents(path, (char **)&data, &len, NULL));
+    g_assert_cmpuint(len, >=, FRAME_SIZE);
+    g_assert_cmpuint(len % FRAME_SIZE, ==, 0);
+    g_assert_cmphex(ldl_le_p(data + len - FRAME_SIZE) & 0xffffff, ==,
+                    PIXEL);
+
+    unlink(path);
+    qtest_quit(qts);
+}
+
+static void test_capture_errors(void)
+{
+    g_autofree char *path = g_strdup_printf("%s/frames.raw", tmpdir);
+    g_autofree char *nodir = g_strdup_printf("%s/nodir/frames.raw", tmpdir);
+    QTestState *qts = start_vga();
+
+    capture_start_err(qts, "cap0", nodir);
+    capture_stop(qts, "cap0", false);
+
+    capture_start_ok(qts, "cap0", path);
+    capture_start_err(qts, "cap0", path);
+    capture_stop(qts, "cap0", true);
+
+    unlink(path);
+    qtest_quit(qts);
+}
+
+static void test_capture_fifo(void)
+{
+    g_autofree char *fifo = g_strdup_printf("%s/frames.fifo", tmpdir);
+    g_autofree char *path = g_strdup_printf("%s/frames.raw", tmpdir);
+    QTestState *qts = start_vga();
+    uint32_t pixel;
+    QDict *rsp;
+    int fd, i;
+
+    g_assert_cmpint(mkfifo(fifo, 0600), ==, 0);
+
+    /* nobody reading yet */
+    capture_start_err(qts, "cap0", fifo);
+
+    fd = open(fifo, O_RDONLY | O_NONBLOCK);
+    g_assert_cmpint(fd, >=, 0);
+    capture_start_ok(qts, "cap0", fifo);
+    for (i = 0; i < TIMEOUT; i++) {
+        if (read(fd, &pixel, sizeof(pixel)) == sizeof(pixel)) {
+            break;
+        }
+        g_usleep(10 * 1000);
+    }
+    g_assert_cmpint(i, <, TIMEOUT);
+    g_assert_cmphex(le32_to_cpu(pixel) & 0xffffff, ==, PIXEL);
+
+    /*
+     * A frame doesn't fit into the pipe, so the capture is still busy
+     * with it when the reader goes away.  It must stop by itself and
+     * free its name.
+     */
+    close(fd);
+    for (i = 0; i < TIMEOUT; i++) {
+        rsp = capture_start(qts, "cap0", path);
+        if (qdict_haskey(rsp, "return")) {
+            qobject_unref(rsp);
+            break;
+        }
+        qobject_unref(rsp);
+        g_usleep(10 * 1000);
+    }
+    g_assert_cmpint(i, <, TIMEOUT);
+    capture_stop(qts, "cap0", true);
+
+    unlink(path);
+    unlink(fifo);
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    tmpdir = g_dir_make_tmp("qemu-capture-test.XXXXXX", NULL);
+    g_assert(tmpdir);
+
+    qtest_add_func("/capture/file", test_capture_file);
+    qtest_add_func("/capture/errors", test_capture_errors);
+    qtest_add_func("/capture/fifo", test_capture_fifo);
+
+    ret = g_test_run();
+
+    rmdir(tmpdir);
+    g_free(tmpdir);
+    return ret;
+}
@@ -0,0 +1,245 @@
+/*
+ * QTest testcase for the cirrus blitter
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Runs the same raster operations, transparent blits, colour expansions
+ * and fills once with the blitter fast paths and once with the byte by
+ * byte loops (x-blitter-accel=off), checks that video memory ends up the
+ * same, and reports how long each blit took both ways.  Run with
+ * "-m perf" for more iterations.
+ */
+
+#include "qemu/osdep.h"
+#include "hw/pci/pci_ids.h"
+#include "libqos/libqos-pc.h"
+
+#define CIRRUS_ID_CLGD5446  0x00b8
+
+/* BAR1 offset of the blitter registers */
+#define MMIO_BLT            0x100
+#define BLTBGCOLOR          0x00
+#define BLTFGCOLOR          0x04
+#define BLTWIDTH            0x08
+#define BLTHEIGHT           0x0a
+#define BLTDESTPITCH        0x0c
+#define BLTSRCPITCH         0x0e
+#define BLTDESTADDR         0x10
+#define BLTSRCADDR          0x14
+#define BLTWRITEMASK        0x17
+#define BLTMODE             0x18
+#define BLTROP              0x1a
+#define BLTMODEEXT          0x1b
+#define BLTTRANSPARENTCOLOR 0x1c
+#define BLTSTATUS           0x40
+
+/* BAR0 offset of the system to screen aperture */
+#define BLT_APERTURE        0x1000000
+
+#define MODE_BACKWARDS      0x01
+#define MODE_MEMSYSSRC      0x04
+#define MODE_TRANSPARENT    0x08
+#define MODE_PATTERNCOPY    0x40
+#define MODE_COLOREXPAND    0x80
+#define MODE_PIXELWIDTH16   0x10
+#define MODE_PIXELWIDTH32   0x30
+#define MODEEXT_SOLIDFILL   0x04
+#define STATUS_START        0x02
+
+#define ROP_NOTSRC_AND_DST  0x50
+#define ROP_SRC             0x0d
+#define ROP_SRC_XOR_DST     0x59
+#define ROP_SRC_OR_DST      0x6d
+
+/* the part of video memory the blits work on */
+#define AREA                (512 * 1024)
+#define PITCH               1024
+
+typedef struct BltCase {
+    const char *name;
+    uint8_t mode, modeext, rop, writemask;
+    uint16_t width, height;
+    int16_t dstpitch, srcpitch;
+    uint32_t dstaddr, srcaddr;
+    uint16_t transp;
+    /* bytes to feed through the aperture for system memory sources */
+    uint32_t sysmem;
+} BltCase;
+
+static const BltCase cases[] = {
+    { "fwd src", 0, 0, ROP_SRC, 0,
+      1000, 100, PITCH, PITCH, 0, 128 * 1024 + 3 },
+    { "fwd xor overlapping", 0, 0, ROP_SRC_XOR_DST, 0,
+      1000, 100, PITCH, PITCH, 0, 4 },
+    { "bkwd src", MODE_BACKWARDS, 0, ROP_SRC, 0,
+      1000, 100, PITCH, PITCH, 200 * 1024 + 99 * PITCH + 999,
+      300 * 1024 + 99 * PITCH + 999 },
+    { "bkwd notsrc and dst", MODE_BACKWARDS, 0, ROP_NOTSRC_AND_DST, 0,
+      997, 100, PITCH, PITCH, 200 * 1024 + 99 * PITCH + 996,
+      200 * 1024 + 98 * PITCH + 990 },
+    { "fwd transparent 8", MODE_TRANSPARENT, 0, ROP_SRC, 0,
+      1000, 100, PITCH, PITCH, 0, 256 * 1024, 0x07 },
+    { "bkwd transparent 16", MODE_TRANSPARENT | MODE_BACKWARDS |
+      MODE_PIXELWIDTH16, 0, ROP_SRC_OR_DST, 0,
+      1000, 100, PITCH, PITCH, 200 * 1024 + 99 * PITCH + 999,
+      300 * 1024 + 99 * PITCH + 999, 0x0305 },
+    { "colour expand 8", MODE_COLOREXPAND, 0, ROP_SRC, 0,
+      1000, 100, PITCH, 0, 0, 400 * 1024 },
+    { "colour expand 16 transparent", MODE_COLOREXPAND | MODE_TRANSPARENT |
+      MODE_PIXELWIDTH16, 0, ROP_SRC_XOR_DST, 3,
+      1000, 100, PITCH, 0, 0, 400 * 1024 },
+    { "colour expand 32", MODE_COLOREXPAND | MODE_PIXELWIDTH32, 0,
+      ROP_SRC, 0,
+      1000, 100, PITCH, 0, 0, 400 * 1024 },
+    { "pattern expand 16 transparent", MODE_PATTERNCOPY | MODE_COLOREXPAND |
+      MODE_TRANSPARENT | MODE_PIXELWIDTH16, 0, ROP_SRC, 5,
+      1000, 100, PITCH, 0, 0, 400 * 1024 },
+    { "solid fill 32", MODE_PATTERNCOPY | MODE_COLOREXPAND |
+      MODE_PIXELWIDTH32, MODEEXT_SOLIDFILL, ROP_SRC_XOR_DST, 0,
+      1000, 100, PITCH, 0, 0, 0 },
+    { "system to screen src", MODE_MEMSYSSRC, 0, ROP_SRC, 0,
+      256, 16, PITCH, 0, 100 * 1024 + 1, 0, 0, 256 * 16 },
+};
+
+typedef struct BltTest {
+    QOSState *qs;
+    QPCIDevice *dev;
+    QPCIBar lfb;
+    QPCIBar mmio;
+} BltTest;
+
+static uint8_t *area_init;
+static uint8_t *results[ARRAY_SIZE(cases)];
+static double times[2][ARRAY_SIZE(cases)];
+
+static void save_fn(QPCIDevice *dev, int devfn, void *data)
+{
+    QPCIDevice **pdev = (QPCIDevice **) data;
+
+    *pdev = dev;
+}
+
+static void blt_writeb(BltTest *t, int reg, uint8_t val)
+{
+    qpci_io_writeb(t->dev, t->mmio, MMIO_BLT + reg, val);
+}
+
+static void blt_write(BltTest *t, int reg, uint32_t val, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        blt_writeb(t, reg + i, val >> (i * 8));
+    }
+}
+
+static void blt_start(BltTest *t, const BltCase *c)
+{
+    g_autofree uint8_t *sysmem = NULL;
+    uint32_t i;
+
+    blt_writeb(t, BLTSTATUS, STATUS_START);
+    if (c->sysmem) {
+        sysmem = g_malloc(c->sysmem);
+        for (i = 0; i < c->sysmem; i++) {
+            sysmem[i] = i * 7 + (i >> 8);
+        }
+        qpci_memwrite(t->dev, t->lfb, BLT_APERTURE, sysmem, c->sysmem);
+    }
+}
+
+static void blt_setup(BltTest *t, const BltCase *c)
+{
+    blt_write(t, BLTBGCOLOR, 0x12345678, 4);
+    blt_write(t, BLTFGCOLOR, 0x9abcdef0, 4);
+    blt_write(t, BLTWIDTH, c->width - 1, 2);
+    blt_write(t, BLTHEIGHT, c->height - 1, 2);
+    blt_write(t, BLTDESTPITCH, c->dstpitch, 2);
+    blt_write(t, BLTSRCPITCH, c->srcpitch, 2);
+    blt_write(t, BLTDESTADDR, c->dstaddr, 3);
+    blt_write(t, BLTSRCADDR, c->srcaddr, 3);
+    blt_writeb(t, BLTWRITEMASK, c->writemask);
+    blt_writeb(t, BLTMODE, c->mode);
+    blt_writeb(t, BLTROP, c->rop);
+    blt_writeb(t, BLTMODEEXT, c->modeext);
+    blt_write(t, BLTTRANSPARENTCOLOR, c->transp, 2);
+}
+
+static void blt_boot(BltTest *t, bool accel)
+{
+    t->qs = qtest_pc_boot("-vga none -device cirrus-vga,x-blitter-accel=%s",
+                          accel ? "on" : "off");
+    t->dev = NULL;
+    qpci_device_foreach(t->qs->pcibus, PCI_VENDOR_ID_CIRRUS,
+                        CIRRUS_ID_CLGD5446, save_fn, &t->dev);
+    g_assert(t->dev);
+    qpci_device_enable(t->dev);
+    t->lfb = qpci_iomap(t->dev, 0, NULL);
+    t->mmio = qpci_iomap(t->dev, 1, NULL);
+
+    /* 8 bpp extended mode, plain copies are ignored in text mode */
+    qtest_outb(t->qs->qts, 0x3c4, 0x07);
+    qtest_outb(t->qs->qts, 0x3c5, 0x01);
+}
+
+static void blt_run(bool accel)
+{
+    int iterations = g_test_perf() ? 1000 : 20;
+    BltTest t;
+    int i, j;
+
+    blt_boot(&t, accel);
+    for (i = 0; i < ARRAY_SIZE(cases); i++) {
+        g_autofree uint8_t *area = g_malloc(AREA);
+
+        qpci_memwrite(t.dev, t.lfb, 0, area_init, AREA);
+        blt_setup(&t, &cases[i]);
+        blt_start(&t, &cases[i]);
+        qpci_memread(t.dev, t.lfb, 0, area, AREA);
+
+        if (!results[i]) {
+            results[i] = g_steal_pointer(&area);
+        } else if (memcmp(area, results[i], AREA)) {
+            g_test_message("%s: video memory differs", cases[i].name);
+            g_test_fail();
+        }
+
+        g_test_timer_start();
+        for (j = 0; j < iterations; j++) {
+            blt_start(&t, &cases[i]);
+        }
+        times[accel][i] = g_test_timer_elapsed() / iterations;
+    }
+    qtest_shutdown(t.qs);
+}
+
+static void test_cirrus_blt(void)
+{
+    int i;
+
+    area_init = g_malloc(AREA);
+    for (i = 0; i < AREA; i++) {
+        /* few distinct values, so that transparency kicks in */
+        area_init[i] = (i * 2654435761u) >> 28;
+    }
+
+    blt_run(false);
+    blt_run(true);
+
+    for (i = 0; i < ARRAY_SIZE(cases); i++) {
+        g_test_message("%s: %.1f us, byte by byte %.1f us", cases[i].name,
+                       times[true][i] * 1e6, times[false][i] * 1e6);
+        g_free(results[i]);
+    }
+    g_free(area_init);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/cirrus/blt", test_cirrus_blt);
+
+    return g_test_run();
+}
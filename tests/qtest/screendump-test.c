@@ -0,0 +1,162 @@
+/*
+ * QTest testcase for screendump
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Puts the standard VGA into a 32 bpp VBE mode with a known pixel, dumps
+ * it as PPM and PNG and checks the headers, and checks that a dump which
+ * can't be written fails.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "libqtest.h"
+#include "qapi/qmp/qdict.h"
+
+#define VBE_DISPI_IOPORT_INDEX  0x01ce
+#define VBE_DISPI_IOPORT_DATA   0x01cf
+#define VBE_DISPI_INDEX_XRES    0x1
+#define VBE_DISPI_INDEX_YRES    0x2
+#define VBE_DISPI_INDEX_BPP     0x3
+#define VBE_DISPI_INDEX_ENABLE  0x4
+#define VBE_DISPI_ENABLED       0x01
+
+/* attribute controller index, bit 5 turns the display on */
+#define VGA_ATT_W               0x3c0
+#define VGA_AR_ENABLE_DISPLAY   0x20
+
+#define WIDTH                   640
+#define HEIGHT                  480
+#define PIXEL                   0x00ff8040
+
+static char *tmpdir;
+
+static void vbe_write(QTestState *qts, uint16_t index, uint16_t val)
+{
+    qtest_outw(qts, VBE_DISPI_IOPORT_INDEX, index);
+    qtest_outw(qts, VBE_DISPI_IOPORT_DATA, val);
+}
+
+static QTestState *start_vga(void)
+{
+    QTestState *qts = qtest_init("-vga std");
+
+    vbe_write(qts, VBE_DISPI_INDEX_XRES, WIDTH);
+    vbe_write(qts, VBE_DISPI_INDEX_YRES, HEIGHT);
+    vbe_write(qts, VBE_DISPI_INDEX_BPP, 32);
+    vbe_write(qts, VBE_DISPI_INDEX_ENABLE, VBE_DISPI_ENABLED);
+    qtest_outb(qts, VGA_ATT_W, VGA_AR_ENABLE_DISPLAY);
+
+    /* first pixel, through the banked window */
+    qtest_writel(qts, 0xa0000, PIXEL);
+    return qts;
+}
+
+static bool screendump(QTestState *qts, const char *filename,
+                       const char *format)
+{
+    QDict *rsp;
+    bool ok;
+
+    rsp = qtest_qmp(qts, "{ 'execute': 'screendump', 'arguments': "
+                    "{ 'filename': %s, 'format': %s } }", filename, format);
+    ok = qdict_haskey(rsp, "return");
+    g_assert(ok || qdict_haskey(rsp, "error"));
+    qobject_unref(rsp);
+    return ok;
+}
+
+static void test_screendump_ppm(void)
+{
+    g_autofree char *path = g_strdup_printf("%s/dump.ppm", tmpdir);
+    g_autofree char *header = g_strdup_printf("P6\n%d %d\n255\n",
+                                              WIDTH, HEIGHT);
+    g_autofree uint8_t *data = NULL;
+    size_t hlen = strlen(header);
+    QTestState *qts = start_vga();
+    gsize len;
+
+    g_assert(screendump(qts, path, "ppm"));
+
+    g_assert(g_file_get_contents(path, (char **)&data, &len, NULL));
+    g_assert_cmpuint(len, ==, hlen + WIDTH * HEIGHT * 3);
+    g_assert_cmpmem(data, hlen, header, hlen);
+    g_assert_cmpmem(data + hlen, 3, "\xff\x80\x40", 3);
+
+    unlink(path);
+    qtest_quit(qts);
+}
+
+#ifdef CONFIG_PNG
+static void test_screendump_png(void)
+{
+    g_autofree char *path = g_strdup_printf("%s/dump.png", tmpdir);
+    g_autofree uint8_t *data = NULL;
+    QTestState *qts = start_vga();
+    gsize len;
+
+    g_assert(screendump(qts, path, "png"));
+
+    /* signature, then the IHDR chunk with the size */
+    g_assert(g_file_get_contents(path, (char **)&data, &len, NULL));
+    g_assert_cmpuint(len, >, 33);
+    g_assert_cmpmem(data, 8, "\x89PNG\r\n\x1a\n", 8);
+    g_assert_cmpmem(data + 12, 4, "IHDR", 4);
+    g_assert_cmpuint(ldl_be_p(data + 16), ==, WIDTH);
+    g_assert_cmpuint(ldl_be_p(data + 20), ==, HEIGHT);
+
+    unlink(path);
+    qtest_quit(qts);
+}
+#endif
+
+static void test_screendump_errors(void)
+{
+    g_autofree char *nodir = g_strdup_printf("%s/nodir/dump", tmpdir);
+    g_autofree char *full = g_strdup_printf("%s/full", tmpdir);
+    QTestState *qts = start_vga();
+    const char *format = "ppm";
+
+#ifdef CONFIG_PNG
+    format = "png";
+#endif
+
+    /* can't be created */
+    g_assert(!screendump(qts, nodir, format));
+
+    /*
+     * Opens fine, but the worker can't write.  The failed dump is
+     * removed, which only takes the link away.
+     */
+    if (access("/dev/full", W_OK) == 0 &&
+        symlink("/dev/full", full) == 0) {
+        g_assert(!screendump(qts, full, format));
+        g_assert(!g_file_test(full, G_FILE_TEST_IS_SYMLINK));
+        unlink(full);
+    }
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    tmpdir = g_dir_make_tmp("qemu-screendump-test.XXXXXX", NULL);
+    g_assert(tmpdir);
+
+    qtest_add_func("/screendump/ppm", test_screendump_ppm);
+#ifdef CONFIG_PNG
+    qtest_add_func("/screendump/png", test_screendump_png);
+#endif
+    qtest_add_func("/screendump/errors", test_screendump_errors);
+
+    ret = g_test_run();
+
+    rmdir(tmpdir);
+    g_free(tmpdir);
+    return ret;
+}
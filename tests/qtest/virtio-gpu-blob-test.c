@@ -0,0 +1,309 @@
+/*
+ * QTest testcase for virtio-gpu blob mapping
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Maps host visible blobs into the hostmem BAR and unmaps them again in a
+ * loop, the way GL and Vulkan guests do for every frame, and reports what
+ * a map/unmap pair costs on top of a plain command round trip.  Run with
+ * "-m perf" for longer storms.
+ *
+ * This needs a render node for the egl-headless display and a renderer
+ * that can map blobs; the test is skipped otherwise.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "hw/pci/pci_ids.h"
+#include "libqos/libqos-pc.h"
+#include "libqos/virtio.h"
+#include "libqos/virtio-pci.h"
+#include "standard-headers/linux/virtio_gpu.h"
+#include "standard-headers/linux/virtio_ids.h"
+#include "standard-headers/linux/virtio_config.h"
+
+#define GPU_TIMEOUT_US  (30 * 1000 * 1000)
+#define HOSTMEM_SIZE    (16 * 1024 * 1024)
+#define BLOB_SIZE       (64 * 1024)
+#define CTX_ID          1
+
+/* from virglrenderer's virgl_protocol.h and virgl_hw.h */
+#define VIRGL_CCMD_PIPE_RESOURCE_CREATE     48
+#define VIRGL_PIPE_RES_CREATE_SIZE          11
+#define VIRGL_FORMAT_R8_UNORM               64
+#define VIRGL_BIND_VERTEX_BUFFER            (1 << 4)
+#define VIRGL_RESOURCE_FLAG_MAP_PERSISTENT  (1 << 0)
+#define VIRGL_RESOURCE_FLAG_MAP_COHERENT    (1 << 1)
+
+typedef struct GpuTest {
+    QOSState *qs;
+    QVirtioPCIDevice *dev;
+    QPCIBar hostmem;
+    QVirtQueue *vq;
+    uint64_t req;
+    uint64_t resp;
+} GpuTest;
+
+static void save_fn(QPCIDevice *dev, int devfn, void *data)
+{
+    QPCIDevice **pdev = (QPCIDevice **) data;
+
+    *pdev = dev;
+}
+
+/* returns the response type */
+static uint32_t gpu_cmd(GpuTest *t, const void *req, size_t len,
+                        size_t resp_len)
+{
+    QTestState *qts = t->qs->qts;
+    struct virtio_gpu_ctrl_hdr hdr;
+    uint32_t free_head;
+
+    qtest_memwrite(qts, t->req, req, len);
+    free_head = qvirtqueue_add(qts, t->vq, t->req, len, false, true);
+    qvirtqueue_add(qts, t->vq, t->resp, resp_len, true, false);
+    qvirtqueue_kick(qts, &t->dev->vdev, t->vq, free_head);
+    qvirtio_wait_used_elem(qts, &t->dev->vdev, t->vq, free_head, NULL,
+                           GPU_TIMEOUT_US);
+
+    qtest_memread(qts, t->resp, &hdr, sizeof(hdr));
+    return le32_to_cpu(hdr.type);
+}
+
+static void gpu_hdr(struct virtio_gpu_ctrl_hdr *hdr, uint32_t type)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->type = cpu_to_le32(type);
+    hdr->ctx_id = cpu_to_le32(CTX_ID);
+}
+
+static uint32_t gpu_nop(GpuTest *t)
+{
+    struct virtio_gpu_ctrl_hdr hdr;
+
+    gpu_hdr(&hdr, VIRTIO_GPU_CMD_GET_DISPLAY_INFO);
+    return gpu_cmd(t, &hdr, sizeof(hdr),
+                   sizeof(struct virtio_gpu_resp_display_info));
+}
+
+static void gpu_create_blob(GpuTest *t, uint32_t id)
+{
+    struct {
+        struct virtio_gpu_cmd_submit submit;
+        uint32_t cmd[1 + VIRGL_PIPE_RES_CREATE_SIZE];
+    } QEMU_PACKED sub = {};
+    struct virtio_gpu_resource_create_blob blob = {};
+    uint32_t cmd[] = {
+        VIRGL_CCMD_PIPE_RESOURCE_CREATE | VIRGL_PIPE_RES_CREATE_SIZE << 16,
+        VIRGL_FORMAT_R8_UNORM, VIRGL_BIND_VERTEX_BUFFER, 0 /* buffer */,
+        BLOB_SIZE, 1, 1, 1, 0, 0,
+        VIRGL_RESOURCE_FLAG_MAP_PERSISTENT | VIRGL_RESOURCE_FLAG_MAP_COHERENT,
+        id /* blob id */
+    };
+    int i;
+
+    gpu_hdr(&sub.submit.hdr, VIRTIO_GPU_CMD_SUBMIT_3D);
+    sub.submit.size = cpu_to_le32(sizeof(sub.cmd));
+    for (i = 0; i < ARRAY_SIZE(cmd); i++) {
+        sub.cmd[i] = cpu_to_le32(cmd[i]);
+    }
+    g_assert_cmpuint(gpu_cmd(t, &sub, sizeof(sub),
+                             sizeof(struct virtio_gpu_ctrl_hdr)),
+                     ==, VIRTIO_GPU_RESP_OK_NODATA);
+
+    gpu_hdr(&blob.hdr, VIRTIO_GPU_CMD_RESOURCE_CREATE_BLOB);
+    blob.resource_id = cpu_to_le32(id);
+    blob.blob_mem = cpu_to_le32(VIRTIO_GPU_BLOB_MEM_HOST3D);
+    blob.blob_flags = cpu_to_le32(VIRTIO_GPU_BLOB_FLAG_USE_MAPPABLE);
+    blob.blob_id = cpu_to_le64(id);
+    blob.size = cpu_to_le64(BLOB_SIZE);
+    g_assert_cmpuint(gpu_cmd(t, &blob, sizeof(blob),
+                             sizeof(struct virtio_gpu_ctrl_hdr)),
+                     ==, VIRTIO_GPU_RESP_OK_NODATA);
+}
+
+static uint32_t gpu_map(GpuTest *t, uint32_t id, uint64_t offset)
+{
+    struct virtio_gpu_resource_map_blob map = {};
+
+    gpu_hdr(&map.hdr, VIRTIO_GPU_CMD_RESOURCE_MAP_BLOB);
+    map.resource_id = cpu_to_le32(id);
+    map.offset = cpu_to_le64(offset);
+    return gpu_cmd(t, &map, sizeof(map),
+                   sizeof(struct virtio_gpu_resp_map_info));
+}
+
+static void gpu_unmap(GpuTest *t, uint32_t id)
+{
+    struct virtio_gpu_resource_unmap_blob unmap = {};
+
+    gpu_hdr(&unmap.hdr, VIRTIO_GPU_CMD_RESOURCE_UNMAP_BLOB);
+    unmap.resource_id = cpu_to_le32(id);
+    g_assert_cmpuint(gpu_cmd(t, &unmap, sizeof(unmap),
+                             sizeof(struct virtio_gpu_ctrl_hdr)),
+                     ==, VIRTIO_GPU_RESP_OK_NODATA);
+}
+
+static bool gpu_start(GpuTest *t)
+{
+    struct virtio_gpu_ctx_create ctx = {};
+    QPCIDevice *pdev = NULL;
+    QPCIAddress addr;
+    uint64_t features;
+
+    if (!g_file_test("/dev/dri/renderD128", G_FILE_TEST_EXISTS)) {
+        g_test_skip("no render node");
+        return false;
+    }
+
+    t->qs = qtest_pc_boot("-vga none -display egl-headless "
+                          "-device virtio-gpu-gl-pci,blob=on,hostmem=%d",
+                          HOSTMEM_SIZE);
+    qpci_device_foreach(t->qs->pcibus, PCI_VENDOR_ID_REDHAT_QUMRANET,
+                        0x1040 + VIRTIO_ID_GPU, save_fn, &pdev);
+    g_assert(pdev);
+    addr.devfn = pdev->devfn;
+    g_free(pdev);
+
+    t->dev = virtio_pci_new(t->qs->pcibus, &addr);
+    qvirtio_pci_device_enable(t->dev);
+    t->hostmem = qpci_iomap(t->dev->pdev, 4, NULL);
+    qvirtio_start_device(&t->dev->vdev);
+
+    features = qvirtio_get_features(&t->dev->vdev);
+    g_assert(features & (1u << VIRTIO_GPU_F_VIRGL));
+    g_assert(features & (1u << VIRTIO_GPU_F_RESOURCE_BLOB));
+    qvirtio_set_features(&t->dev->vdev,
+                         features & ((1u << VIRTIO_GPU_F_VIRGL) |
+                                     (1u << VIRTIO_GPU_F_RESOURCE_BLOB) |
+                                     (1ull << VIRTIO_F_VERSION_1)));
+    t->vq = qvirtqueue_setup(&t->dev->vdev, &t->qs->alloc, 0);
+    qvirtio_set_driver_ok(&t->dev->vdev);
+
+    t->req = guest_alloc(&t->qs->alloc, 4096);
+    t->resp = guest_alloc(&t->qs->alloc, 4096);
+
+    gpu_hdr(&ctx.hdr, VIRTIO_GPU_CMD_CTX_CREATE);
+    g_assert_cmpuint(gpu_cmd(t, &ctx, sizeof(ctx),
+                             sizeof(struct virtio_gpu_ctrl_hdr)),
+                     ==, VIRTIO_GPU_RESP_OK_NODATA);
+
+    gpu_create_blob(t, 1);
+    gpu_create_blob(t, 2);
+    if (gpu_map(t, 1, 0) != VIRTIO_GPU_RESP_OK_MAP_INFO) {
+        g_test_skip("the renderer cannot map blobs");
+        return false;
+    }
+    gpu_unmap(t, 1);
+    return true;
+}
+
+static void gpu_stop(GpuTest *t)
+{
+    if (!t->qs) {
+        return;
+    }
+    if (t->vq) {
+        qvirtqueue_cleanup(t->dev->vdev.bus, t->vq, &t->qs->alloc);
+    }
+    qos_object_destroy(&t->dev->obj);
+    qtest_shutdown(t->qs);
+}
+
+static void test_blob_remap(void)
+{
+    GpuTest t = {};
+
+    if (!gpu_start(&t)) {
+        gpu_stop(&t);
+        return;
+    }
+
+    /* contents follow the blob around the BAR */
+    g_assert_cmpuint(gpu_map(&t, 1, 0), ==, VIRTIO_GPU_RESP_OK_MAP_INFO);
+    qpci_io_writel(t.dev->pdev, t.hostmem, 0, 0x12345678);
+    gpu_unmap(&t, 1);
+    g_assert_cmpuint(gpu_map(&t, 1, BLOB_SIZE), ==,
+                     VIRTIO_GPU_RESP_OK_MAP_INFO);
+    g_assert_cmphex(qpci_io_readl(t.dev->pdev, t.hostmem, BLOB_SIZE), ==,
+                    0x12345678);
+
+    /* mapped twice */
+    g_assert_cmpuint(gpu_map(&t, 1, 0), ==,
+                     VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER);
+    gpu_unmap(&t, 1);
+
+    /* a blob left in the BAR makes room for a new one */
+    g_assert_cmpuint(gpu_map(&t, 2, BLOB_SIZE / 2), ==,
+                     VIRTIO_GPU_RESP_OK_MAP_INFO);
+    qpci_io_writel(t.dev->pdev, t.hostmem, BLOB_SIZE / 2, 0x9abcdef0);
+    gpu_unmap(&t, 2);
+    g_assert_cmpuint(gpu_map(&t, 1, 0), ==, VIRTIO_GPU_RESP_OK_MAP_INFO);
+    g_assert_cmphex(qpci_io_readl(t.dev->pdev, t.hostmem, 0), ==,
+                    0x12345678);
+    gpu_unmap(&t, 1);
+
+    /* out of the BAR */
+    g_assert_cmpuint(gpu_map(&t, 2, HOSTMEM_SIZE - BLOB_SIZE / 2), ==,
+                     VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER);
+
+    gpu_stop(&t);
+}
+
+static void test_blob_storm(void)
+{
+    int iterations = g_test_perf() ? 100000 : 1000;
+    double nop, same, moving;
+    GpuTest t = {};
+    int i;
+
+    if (!gpu_start(&t)) {
+        gpu_stop(&t);
+        return;
+    }
+
+    g_test_timer_start();
+    for (i = 0; i < iterations; i++) {
+        gpu_nop(&t);
+        gpu_nop(&t);
+    }
+    nop = g_test_timer_elapsed();
+
+    /* what most guests do: the same buffers at the same offsets */
+    g_test_timer_start();
+    for (i = 0; i < iterations; i++) {
+        g_assert_cmpuint(gpu_map(&t, 1 + i % 2, (i % 2) * BLOB_SIZE), ==,
+                         VIRTIO_GPU_RESP_OK_MAP_INFO);
+        gpu_unmap(&t, 1 + i % 2);
+    }
+    same = g_test_timer_elapsed();
+
+    /* the buffers swap places every time */
+    g_test_timer_start();
+    for (i = 0; i < iterations; i++) {
+        g_assert_cmpuint(gpu_map(&t, 1 + i % 2, (i / 2 % 2) * BLOB_SIZE), ==,
+                         VIRTIO_GPU_RESP_OK_MAP_INFO);
+        gpu_unmap(&t, 1 + i % 2);
+    }
+    moving = g_test_timer_elapsed();
+
+    g_test_message("command round trip %.2f us",
+                   nop * 1e6 / (iterations * 2));
+    g_test_message("map/unmap, same offset: %.2f us over the round trips",
+                   (same - nop) * 1e6 / iterations);
+    g_test_message("map/unmap, moving: %.2f us over the round trips",
+                   (moving - nop) * 1e6 / iterations);
+
+    gpu_stop(&t);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/virtio-gpu/blob/remap", test_blob_remap);
+    qtest_add_func("/virtio-gpu/blob/storm", test_blob_storm);
+
+    return g_test_run();
+}
@@ -0,0 +1,277 @@
+/*
+ * egl-helpers asynchronous readback test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Needs nothing but an EGL implementation with the surfaceless platform,
+ * such as Mesa's llvmpipe (LIBGL_ALWAYS_SOFTWARE=1), so it runs without a
+ * GPU.  The tests are skipped when no such context can be created.
+ */
+
+#include "qemu/osdep.h"
+#include "ui/console.h"
+#include "ui/egl-helpers.h"
+
+#define WIDTH  256
+#define HEIGHT 128
+
+static bool have_egl;
+static egl_fb fb;
+
+static bool egl_setup(void)
+{
+#ifdef EGL_MESA_platform_surfaceless
+    static const EGLint conf_att[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE,
+    };
+    static const EGLint ctx_att[] = {
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+        EGL_CONTEXT_MINOR_VERSION_KHR, 2,
+        EGL_NONE,
+    };
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplayEXT;
+    EGLContext ctx;
+    EGLint n;
+
+    if (!epoxy_has_egl_extension(NULL, "EGL_MESA_platform_surfaceless")) {
+        return false;
+    }
+    getPlatformDisplayEXT =
+        (void *) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (!getPlatformDisplayEXT) {
+        return false;
+    }
+    qemu_egl_display = getPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA,
+                                             EGL_DEFAULT_DISPLAY, NULL);
+    if (qemu_egl_display == EGL_NO_DISPLAY ||
+        !eglInitialize(qemu_egl_display, NULL, NULL) ||
+        !eglBindAPI(EGL_OPENGL_API) ||
+        !eglChooseConfig(qemu_egl_display, conf_att,
+                         &qemu_egl_config, 1, &n) || n != 1) {
+        return false;
+    }
+    ctx = eglCreateContext(qemu_egl_display, qemu_egl_config,
+                           EGL_NO_CONTEXT, ctx_att);
+    if (ctx == EGL_NO_CONTEXT) {
+        return false;
+    }
+    return eglMakeCurrent(qemu_egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                          ctx);
+#else
+    return false;
+#endif
+}
+
+static bool check_egl(void)
+{
+    if (!have_egl) {
+        g_test_skip("no surfaceless EGL display");
+        return false;
+    }
+    if (!egl_readback_supported()) {
+        g_test_skip("needs GL 3.2");
+        return false;
+    }
+    return true;
+}
+
+static uint32_t pattern(int x, int y, int frame)
+{
+    return 0xff000000 | (frame * 0x40) << 16 | (y & 0xff) << 8 | (x & 0xff);
+}
+
+/* Render a frame, which the readback sees with y = 0 at the bottom */
+static void draw_frame(int frame)
+{
+    g_autofree uint32_t *data = g_new(uint32_t, WIDTH * HEIGHT);
+    int x, y;
+
+    for (y = 0; y < HEIGHT; y++) {
+        for (x = 0; x < WIDTH; x++) {
+            data[y * WIDTH + x] = pattern(x, y, frame);
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, fb.texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, WIDTH, HEIGHT,
+                    GL_BGRA, GL_UNSIGNED_BYTE, data);
+}
+
+static DisplaySurface *surface_new(int width, int height)
+{
+    DisplaySurface *surface = g_new0(DisplaySurface, 1);
+
+    surface->format = PIXMAN_x8r8g8b8;
+    surface->image = pixman_image_create_bits(PIXMAN_x8r8g8b8, width, height,
+                                              NULL, width * 4);
+    return surface;
+}
+
+static void surface_free(DisplaySurface *surface)
+{
+    pixman_image_unref(surface->image);
+    g_free(surface);
+}
+
+/*
+ * Check that the rectangle holds the given frame and everything else is
+ * still zero.
+ */
+static void check_surface(DisplaySurface *surface, int frame,
+                          int rx, int ry, int rw, int rh)
+{
+    uint32_t *data = (uint32_t *)surface_data(surface);
+    int x, y;
+
+    for (y = 0; y < surface_height(surface); y++) {
+        for (x = 0; x < surface_width(surface); x++) {
+            bool in = x >= rx && x < rx + rw && y >= ry && y < ry + rh;
+
+            g_assert_cmphex(data[y * surface_width(surface) + x], ==,
+                            in ? pattern(x, y, frame) : 0);
+        }
+    }
+}
+
+static void test_readback_sync(void)
+{
+    DisplaySurface *surface;
+
+    if (!check_egl()) {
+        return;
+    }
+
+    /* the synchronous path is the reference for the rest */
+    surface = surface_new(WIDTH, HEIGHT);
+    draw_frame(1);
+    egl_fb_read(surface, &fb);
+    check_surface(surface, 1, 0, 0, WIDTH, HEIGHT);
+    surface_free(surface);
+}
+
+static void test_readback_rect(void)
+{
+    egl_readback rb = {};
+    DisplaySurface *surface;
+    int x, y, w, h;
+
+    if (!check_egl()) {
+        return;
+    }
+
+    surface = surface_new(WIDTH, HEIGHT);
+    draw_frame(1);
+    egl_fb_read_rect_async(&rb, &fb, 10, 20, 100, 50);
+    g_assert_cmpint(egl_readback_pending(&rb), ==, 1);
+
+    /* only the damaged rectangle is read back */
+    g_assert_true(egl_readback_finish(&rb, surface, &x, &y, &w, &h));
+    g_assert_cmpint(x, ==, 10);
+    g_assert_cmpint(y, ==, 20);
+    g_assert_cmpint(w, ==, 100);
+    g_assert_cmpint(h, ==, 50);
+    check_surface(surface, 1, 10, 20, 100, 50);
+
+    g_assert_cmpint(egl_readback_pending(&rb), ==, 0);
+    g_assert_false(egl_readback_finish(&rb, surface, &x, &y, &w, &h));
+
+    egl_readback_destroy(&rb);
+    surface_free(surface);
+}
+
+static void test_readback_double_buffer(void)
+{
+    egl_readback rb = {};
+    DisplaySurface *surface;
+    int x, y, w, h;
+
+    if (!check_egl()) {
+        return;
+    }
+
+    surface = surface_new(WIDTH, HEIGHT);
+
+    /* two frames in flight, each must keep its own contents */
+    draw_frame(1);
+    egl_fb_read_rect_async(&rb, &fb, 0, 0, WIDTH, HEIGHT / 2);
+    draw_frame(2);
+    egl_fb_read_rect_async(&rb, &fb, 0, HEIGHT / 2, WIDTH, HEIGHT / 2);
+    g_assert_cmpint(egl_readback_pending(&rb), ==, 2);
+
+    /* they complete oldest first */
+    g_assert_true(egl_readback_finish(&rb, surface, &x, &y, &w, &h));
+    g_assert_cmpint(y, ==, 0);
+    check_surface(surface, 1, 0, 0, WIDTH, HEIGHT / 2);
+    g_assert_cmpint(egl_readback_pending(&rb), ==, 1);
+
+    g_assert_true(egl_readback_finish(&rb, surface, &x, &y, &w, &h));
+    g_assert_cmpint(y, ==, HEIGHT / 2);
+    g_assert_cmphex(((uint32_t *)surface_data(surface))[HEIGHT / 2 * WIDTH],
+                    ==, pattern(0, HEIGHT / 2, 2));
+    g_assert_cmpint(egl_readback_pending(&rb), ==, 0);
+
+    /* the buffers are reused for the next frames */
+    draw_frame(3);
+    egl_fb_read_rect_async(&rb, &fb, 0, 0, WIDTH, HEIGHT);
+    g_assert_true(egl_readback_finish(&rb, surface, &x, &y, &w, &h));
+    check_surface(surface, 3, 0, 0, WIDTH, HEIGHT);
+
+    egl_readback_destroy(&rb);
+    surface_free(surface);
+}
+
+static void test_readback_switch(void)
+{
+    egl_readback rb = {};
+    DisplaySurface *surface;
+    int x, y, w, h;
+
+    if (!check_egl()) {
+        return;
+    }
+
+    /* the surface shrank while the readback was in flight: clip */
+    surface = surface_new(WIDTH / 2, HEIGHT / 2);
+    draw_frame(1);
+    egl_fb_read_rect_async(&rb, &fb, 16, 16, WIDTH - 32, HEIGHT - 32);
+    g_assert_true(egl_readback_finish(&rb, surface, &x, &y, &w, &h));
+    g_assert_cmpint(w, ==, WIDTH / 2 - 16);
+    g_assert_cmpint(h, ==, HEIGHT / 2 - 16);
+    check_surface(surface, 1, 16, 16, WIDTH / 2 - 16, HEIGHT / 2 - 16);
+
+    /* nothing left to show, but the readback is retired all the same */
+    egl_fb_read_rect_async(&rb, &fb, WIDTH - 16, HEIGHT - 16, 16, 16);
+    g_assert_false(egl_readback_finish(&rb, surface, &x, &y, &w, &h));
+    g_assert_cmpint(egl_readback_pending(&rb), ==, 0);
+
+    egl_readback_destroy(&rb);
+    surface_free(surface);
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    have_egl = egl_setup();
+    if (have_egl) {
+        egl_fb_setup_new_tex(&fb, WIDTH, HEIGHT);
+    }
+
+    g_test_add_func("/egl/readback/sync", test_readback_sync);
+    g_test_add_func("/egl/readback/rect", test_readback_rect);
+    g_test_add_func("/egl/readback/double-buffer",
+                    test_readback_double_buffer);
+    g_test_add_func("/egl/readback/switch", test_readback_switch);
+
+    ret = g_test_run();
+
+    if (have_egl) {
+        egl_fb_destroy(&fb);
+    }
+    return ret;
+}
@@ -0,0 +1,143 @@
+/*
+ * QEMU display scanline conversion test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ *
+ * Converts random lines from every guest format hw/display/pixconv.c
+ * knows with every accelerator available on the host, and checks that
+ * they all give what the plain C version gives.  Widths go around the
+ * vector block sizes, and lines start at odd addresses too.
+ */
+#include "qemu/osdep.h"
+#include "ui/pixel_ops.h"
+#include "hw/display/pixconv.h"
+
+#define MAX_W 67
+/* leave room for misaligned lines and for catching stray stores */
+#define SLACK 16
+
+typedef struct Format {
+    const char *name;
+    int bpp;
+    void (*conv)(uint8_t *d, const uint8_t *s, int width, int flags);
+    int flags;
+} Format;
+
+static const Format formats[] = {
+    { "pal8", 1, NULL, 0 },
+    { "555", 2, pixconv_555, 0 },
+    { "555-be", 2, pixconv_555, PIXCONV_BE },
+    { "555-bgr", 2, pixconv_555, PIXCONV_SWAP_RB },
+    { "565", 2, pixconv_565, 0 },
+    { "565-be", 2, pixconv_565, PIXCONV_BE },
+    { "565-rgb", 2, pixconv_565, PIXCONV_SWAP_RB },
+    { "888", 3, pixconv_888, 0 },
+    { "888-be", 3, pixconv_888, PIXCONV_BE },
+    { "888-rgb", 3, pixconv_888, PIXCONV_SWAP_RB },
+    { "8888", 4, pixconv_8888, 0 },
+    { "8888-be", 4, pixconv_8888, PIXCONV_BE },
+    { "8888-rgb", 4, pixconv_8888, PIXCONV_SWAP_RB },
+    { "8888-be-rgb", 4, pixconv_8888, PIXCONV_BE | PIXCONV_SWAP_RB },
+};
+
+static uint8_t src[MAX_W * 4 + SLACK];
+static uint32_t palette[256];
+
+static void convert(const Format *f, uint8_t *d, const uint8_t *s, int w)
+{
+    if (f->conv) {
+        f->conv(d, s, w, f->flags);
+    } else {
+        pixconv_pal8(d, s, w, palette);
+    }
+}
+
+static GByteArray *run_formats(void)
+{
+    GByteArray *out = g_byte_array_new();
+    uint8_t dst[MAX_W * 4 + SLACK];
+    int i, w, off;
+
+    for (i = 0; i < ARRAY_SIZE(formats); i++) {
+        for (w = 1; w <= MAX_W; w++) {
+            for (off = 0; off < 4; off++) {
+                /* and nothing written past the line */
+                memset(dst, 0x55, sizeof(dst));
+                convert(&formats[i], dst + off, src + off, w);
+                g_byte_array_append(out, dst, sizeof(dst));
+            }
+        }
+    }
+    return out;
+}
+
+static void test_pixconv_values(void)
+{
+    static const uint8_t s565[] = { 0x00, 0xf8, 0xe0, 0x07, 0x1f, 0x00 };
+    static const uint8_t s888[] = { 0x33, 0x22, 0x11 };
+    static const uint8_t s8888be[] = { 0x00, 0x11, 0x22, 0x33 };
+    static const uint8_t s8[] = { 2 };
+    uint32_t d[3];
+
+    pixconv_565((uint8_t *)d, s565, 3, 0);
+    g_assert_cmphex(d[0], ==, rgb_to_pixel32(0xf8, 0, 0));
+    g_assert_cmphex(d[1], ==, rgb_to_pixel32(0, 0xfc, 0));
+    g_assert_cmphex(d[2], ==, rgb_to_pixel32(0, 0, 0xf8));
+
+    pixconv_565((uint8_t *)d, s565, 1, PIXCONV_SWAP_RB);
+    g_assert_cmphex(d[0], ==, rgb_to_pixel32(0, 0, 0xf8));
+
+    pixconv_888((uint8_t *)d, s888, 1, 0);
+    g_assert_cmphex(d[0], ==, rgb_to_pixel32(0x11, 0x22, 0x33));
+
+    pixconv_8888((uint8_t *)d, s8888be, 1, PIXCONV_BE);
+    g_assert_cmphex(d[0], ==, rgb_to_pixel32(0x11, 0x22, 0x33));
+
+    pixconv_pal8((uint8_t *)d, s8, 1, palette);
+    g_assert_cmphex(d[0], ==, palette[2]);
+}
+
+static void test_pixconv_accels(void)
+{
+    g_autoptr(GPtrArray) results =
+        g_ptr_array_new_with_free_func((GDestroyNotify)g_byte_array_unref);
+    g_autoptr(GPtrArray) names = g_ptr_array_new();
+    GByteArray *ref;
+    int i;
+
+    do {
+        g_ptr_array_add(names, (gpointer)pixconv_accel());
+        g_ptr_array_add(results, run_formats());
+    } while (pixconv_next_accel());
+
+    /* the plain C version comes last */
+    ref = g_ptr_array_index(results, results->len - 1);
+    for (i = 0; i < results->len - 1; i++) {
+        GByteArray *r = g_ptr_array_index(results, i);
+
+        g_test_message("%s", (char *)g_ptr_array_index(names, i));
+        g_assert_cmpmem(r->data, r->len, ref->data, ref->len);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(src); i++) {
+        src[i] = g_test_rand_int();
+    }
+    for (i = 0; i < ARRAY_SIZE(palette); i++) {
+        palette[i] = g_test_rand_int() & 0xffffff;
+    }
+
+    /* runs first, while the most preferred accelerator is in use */
+    g_test_add_func("/display/pixconv/values", test_pixconv_values);
+    g_test_add_func("/display/pixconv/accels", test_pixconv_accels);
+
+    return g_test_run();
+}
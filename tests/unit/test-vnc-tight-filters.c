@@ -0,0 +1,181 @@
+/*
+ * QEMU VNC tight encoder filter test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ *
+ * Runs the filters with every accelerator available on the host and
+ * checks that they all give what the plain C version gives, on widths
+ * around the vector block sizes.
+ */
+#include "qemu/osdep.h"
+#include "ui/vnc-enc-tight.h"
+
+#define MAX_W 65
+#define MAX_H 5
+
+static const int widths[] = {
+    1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65
+};
+static const int heights[] = { 1, 2, 3, MAX_H };
+
+/* 24 bit true colour, either order, and one the vector code can't do */
+static const int shifts[][3] = {
+    { 16, 8, 0 }, { 0, 8, 16 }, { 24, 16, 8 }, { 10, 5, 0 },
+};
+
+static uint32_t noise[MAX_W * MAX_H];
+static uint32_t runs[MAX_W * MAX_H];
+
+static void fill_input(void)
+{
+    static const uint32_t colours[] = { 0x000000, 0xffffff, 0x3a6ea5 };
+    int i, n;
+    uint32_t c;
+
+    for (i = 0; i < ARRAY_SIZE(noise); i++) {
+        noise[i] = g_test_rand_int();
+    }
+    /* short runs of a few colours, as the palette detection sees them */
+    for (i = 0; i < ARRAY_SIZE(runs); ) {
+        c = colours[g_test_rand_int_range(0, ARRAY_SIZE(colours))];
+        for (n = g_test_rand_int_range(1, 12); n && i < ARRAY_SIZE(runs);
+             n--) {
+            runs[i++] = c;
+        }
+    }
+}
+
+static void append_size(GByteArray *out, size_t v)
+{
+    uint64_t v64 = v;
+
+    g_byte_array_append(out, (uint8_t *)&v64, sizeof(v64));
+}
+
+static void run_skip(GByteArray *out, const uint32_t *data, size_t count)
+{
+    size_t i, n0;
+
+    for (i = 0; i < MIN(count, 10); i++) {
+        append_size(out, vnc_tight_skip32(data, i, count, data[i]));
+        append_size(out, vnc_tight_skip32(data, i, count, data[0]));
+
+        n0 = 0;
+        append_size(out, vnc_tight_skip2_32(data, i, count, data[i],
+                                            data[count - 1], &n0));
+        append_size(out, n0);
+    }
+}
+
+static void run_pack24(GByteArray *out, const uint32_t *data, size_t count,
+                       const int *shift)
+{
+    uint8_t dst[MAX_W * MAX_H * 3 + 16];
+    uint8_t buf[MAX_W * MAX_H * 4];
+
+    /* and nothing written past the packed pixels */
+    memset(dst, 0x55, sizeof(dst));
+    vnc_tight_pack24(dst, (const uint8_t *)data, count,
+                     shift[0], shift[1], shift[2]);
+    g_byte_array_append(out, dst, count * 3 + 16);
+
+    /* in place, as the encoder does it */
+    memcpy(buf, data, count * 4);
+    vnc_tight_pack24(buf, buf, count, shift[0], shift[1], shift[2]);
+    g_byte_array_append(out, buf, count * 3);
+}
+
+static void run_gradient24(GByteArray *out, const uint32_t *data,
+                           int w, int h, const int *shift)
+{
+    uint8_t buf[MAX_W * MAX_H * 4];
+    uint32_t scratch[2 * (MAX_W + 1)];
+
+    memcpy(buf, data, w * h * 4);
+    vnc_tight_gradient24(buf, scratch, w, h, shift[0], shift[1], shift[2]);
+    g_byte_array_append(out, buf, w * h * 3);
+}
+
+static GByteArray *run_filters(void)
+{
+    const uint32_t *inputs[] = { noise, runs };
+    GByteArray *out = g_byte_array_new();
+    int i, x, y, s;
+
+    for (i = 0; i < ARRAY_SIZE(inputs); i++) {
+        for (y = 0; y < ARRAY_SIZE(heights); y++) {
+            for (x = 0; x < ARRAY_SIZE(widths); x++) {
+                int w = widths[x], h = heights[y];
+
+                run_skip(out, inputs[i], w * h);
+                for (s = 0; s < ARRAY_SIZE(shifts); s++) {
+                    run_pack24(out, inputs[i], w * h, shifts[s]);
+                    run_gradient24(out, inputs[i], w, h, shifts[s]);
+                }
+            }
+        }
+    }
+    return out;
+}
+
+static void test_tight_filters_values(void)
+{
+    uint32_t pix[5] = { 0x00112233, 0x00112233, 0x00445566, 0x00112233,
+                        0x00778899 };
+    uint32_t scratch[2 * 3];
+    size_t n0 = 0;
+    uint8_t buf[8];
+
+    g_assert_cmpuint(vnc_tight_skip32(pix, 1, 5, pix[0]), ==, 2);
+    g_assert_cmpuint(vnc_tight_skip2_32(pix, 2, 5, pix[0], pix[2], &n0),
+                     ==, 4);
+    g_assert_cmpuint(n0, ==, 1);
+
+    vnc_tight_pack24(buf, (uint8_t *)pix, 1, 16, 8, 0);
+    g_assert_cmpmem(buf, 3, "\x11\x22\x33", 3);
+    vnc_tight_pack24(buf, (uint8_t *)pix, 1, 0, 8, 16);
+    g_assert_cmpmem(buf, 3, "\x33\x22\x11", 3);
+
+    /* with nothing to the left or above, the prediction is 0 */
+    memcpy(buf, pix, 8);
+    vnc_tight_gradient24(buf, scratch, 2, 1, 16, 8, 0);
+    g_assert_cmpmem(buf, 6, "\x11\x22\x33\x00\x00\x00", 6);
+}
+
+static void test_tight_filters_accels(void)
+{
+    g_autoptr(GPtrArray) results =
+        g_ptr_array_new_with_free_func((GDestroyNotify)g_byte_array_unref);
+    g_autoptr(GPtrArray) names = g_ptr_array_new();
+    GByteArray *ref;
+    int i;
+
+    do {
+        g_ptr_array_add(names, (gpointer)vnc_tight_filters_accel());
+        g_ptr_array_add(results, run_filters());
+    } while (vnc_tight_filters_next_accel());
+
+    /* the plain C version comes last */
+    ref = g_ptr_array_index(results, results->len - 1);
+    for (i = 0; i < results->len - 1; i++) {
+        GByteArray *r = g_ptr_array_index(results, i);
+
+        g_test_message("%s", (char *)g_ptr_array_index(names, i));
+        g_assert_cmpmem(r->data, r->len, ref->data, ref->len);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    fill_input();
+
+    /* runs first, while the most preferred accelerator is in use */
+    g_test_add_func("/vnc/tight/filters/values", test_tight_filters_values);
+    g_test_add_func("/vnc/tight/filters/accels", test_tight_filters_accels);
+
+    return g_test_run();
+}
@@ -0,0 +1,169 @@
+/*
+ * vhost-user-gpu buffer pool test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Runs the bo pool on the plain memory backend, memfd backed where the
+ * host supports it, so no GPU is needed.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/memfd.h"
+#include "qemu/units.h"
+#include "contrib/vhost-user-gpu/vugbm.h"
+
+/* 100x100 and 101x99 both land in this size class */
+static size_t class_size;
+
+static void device_init(struct vugbm_device *dev, size_t pool_max)
+{
+    memset(dev, 0, sizeof(*dev));
+    vugbm_device_init_mem(dev);
+    vugbm_device_set_pool_size(dev, pool_max);
+}
+
+static void test_pool_reuse(void)
+{
+    struct vugbm_device dev;
+    struct vugbm_buffer buf;
+    uint8_t *mmap;
+
+    device_init(&dev, 4 * class_size);
+
+    g_assert_true(vugbm_buffer_create(&buf, &dev, 100, 100));
+    g_assert_cmpuint(buf.size, ==, class_size);
+    g_assert_cmpuint(dev.pool_misses, ==, 1);
+    memset(buf.mmap, 0xaa, buf.stride * buf.height);
+    mmap = buf.mmap;
+    vugbm_buffer_destroy(&buf);
+    g_assert_cmpuint(dev.pool_size, ==, class_size);
+
+    /* a different size in the same class gets the released bo back */
+    g_assert_true(vugbm_buffer_create(&buf, &dev, 101, 99));
+    g_assert_cmpuint(dev.pool_hits, ==, 1);
+    g_assert_cmpuint(dev.pool_misses, ==, 1);
+    g_assert_cmpuint(dev.pool_size, ==, 0);
+    g_assert_true(buf.mmap == mmap);
+    g_assert_cmpuint(buf.width, ==, 101);
+    g_assert_cmpuint(buf.height, ==, 99);
+    g_assert_cmpuint(buf.stride, ==, 101 * 4);
+    /* and none of the previous contents */
+    g_assert_true(buffer_is_zero(buf.mmap, buf.stride * buf.height));
+
+    /* another class does not match */
+    vugbm_buffer_destroy(&buf);
+    g_assert_true(vugbm_buffer_create(&buf, &dev, 200, 200));
+    g_assert_cmpuint(buf.size, >, class_size);
+    g_assert_cmpuint(dev.pool_hits, ==, 1);
+    g_assert_cmpuint(dev.pool_misses, ==, 2);
+    g_assert_cmpuint(dev.pool_size, ==, class_size);
+
+    vugbm_buffer_destroy(&buf);
+    vugbm_device_destroy(&dev);
+}
+
+static void test_pool_trim(void)
+{
+    struct vugbm_device dev;
+    struct vugbm_buffer buf[4];
+    uint8_t *mmap[4];
+    int i;
+
+    device_init(&dev, 3 * class_size);
+
+    for (i = 0; i < 4; i++) {
+        g_assert_true(vugbm_buffer_create(&buf[i], &dev, 100, 100));
+        mmap[i] = buf[i].mmap;
+    }
+    g_assert_cmpuint(dev.pool_misses, ==, 4);
+
+    /* releasing the fourth one goes over the cap, the oldest is dropped */
+    for (i = 0; i < 4; i++) {
+        vugbm_buffer_destroy(&buf[i]);
+    }
+    g_assert_cmpuint(dev.pool_size, ==, 3 * class_size);
+
+    /* most recently released first */
+    for (i = 3; i > 0; i--) {
+        g_assert_true(vugbm_buffer_create(&buf[i], &dev, 100, 100));
+        g_assert_true(buf[i].mmap == mmap[i]);
+    }
+    g_assert_cmpuint(dev.pool_hits, ==, 3);
+    g_assert_cmpuint(dev.pool_size, ==, 0);
+
+    g_assert_true(vugbm_buffer_create(&buf[0], &dev, 100, 100));
+    g_assert_cmpuint(dev.pool_hits, ==, 3);
+    g_assert_cmpuint(dev.pool_misses, ==, 5);
+
+    for (i = 0; i < 4; i++) {
+        vugbm_buffer_destroy(&buf[i]);
+    }
+    g_assert_cmpuint(dev.pool_size, ==, 3 * class_size);
+
+    /* lowering the cap trims right away */
+    vugbm_device_set_pool_size(&dev, class_size);
+    g_assert_cmpuint(dev.pool_size, ==, class_size);
+    vugbm_device_set_pool_size(&dev, 0);
+    g_assert_cmpuint(dev.pool_size, ==, 0);
+    g_assert_true(QTAILQ_EMPTY(&dev.pool));
+
+    /* with the pool off, buffers are freed on release */
+    g_assert_true(vugbm_buffer_create(&buf[0], &dev, 100, 100));
+    vugbm_buffer_destroy(&buf[0]);
+    g_assert_cmpuint(dev.pool_size, ==, 0);
+    g_assert_cmpuint(dev.pool_misses, ==, 6);
+
+    vugbm_device_destroy(&dev);
+}
+
+static void test_pool_memfd(void)
+{
+    struct vugbm_device dev;
+    struct vugbm_buffer buf;
+    int fd, seals;
+
+    if (!qemu_memfd_check(MFD_ALLOW_SEALING)) {
+        g_test_skip("no memfd sealing");
+        return;
+    }
+
+    device_init(&dev, 4 * class_size);
+
+    /* pooled buffers keep their sealed memfd, for shm scanouts */
+    g_assert_true(vugbm_buffer_create(&buf, &dev, 100, 100));
+    vugbm_buffer_destroy(&buf);
+    g_assert_true(vugbm_buffer_create(&buf, &dev, 100, 100));
+    g_assert_cmpuint(dev.pool_hits, ==, 1);
+
+    g_assert_true(vugbm_buffer_get_shm_fd(&buf, &fd));
+    seals = fcntl(fd, F_GET_SEALS);
+    g_assert_cmpint(seals, >=, 0);
+    g_assert_true(seals & F_SEAL_SHRINK);
+
+    /* the frontend may still map it, don't hand it out again */
+    vugbm_buffer_destroy(&buf);
+    g_assert_cmpuint(dev.pool_size, ==, 0);
+    g_assert_true(vugbm_buffer_create(&buf, &dev, 100, 100));
+    g_assert_cmpuint(dev.pool_hits, ==, 1);
+    g_assert_cmpuint(dev.pool_misses, ==, 2);
+
+    vugbm_buffer_destroy(&buf);
+    g_assert_cmpuint(dev.pool_size, ==, class_size);
+    vugbm_device_destroy(&dev);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    class_size = ROUND_UP(100 * 100 * 4,
+                          MAX(8 * KiB, qemu_real_host_page_size));
+
+    g_test_add_func("/vugbm/pool/reuse", test_pool_reuse);
+    g_test_add_func("/vugbm/pool/trim", test_pool_trim);
+    g_test_add_func("/vugbm/pool/memfd", test_pool_memfd);
+
+    return g_test_run();
+}
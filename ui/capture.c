@@ -0,0 +1,560 @@
+/*
+ * QEMU console frame capture
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * Streams what a graphic console shows to a file or pipe, as a display
+ * change listener of its own.  Only the tiles the device reported as
+ * damaged are looked at, frames without any change are dropped and at
+ * most "fps" frames a second are written.  Writes never block, frames
+ * are also dropped while the reader hasn't taken the previous one yet.
+ *
+ * Formats:
+ *
+ *  - raw: every frame as x8r8g8b8 (little endian BGRx) pixels, rows top
+ *    down without padding.  There is no header, a mode switch changes
+ *    the frame size.
+ *
+ *  - y4m: YUV4MPEG2 with 4:4:4 BT.601 frames.  The stream keeps the size
+ *    of the first frame, larger modes are cropped and smaller ones padded
+ *    with black.
+ *
+ *  - delta: a frame is a header
+ *      "QCDF", le32 width, le32 height, le64 time (ns), le32 tiles
+ *    followed by that many changed tiles
+ *      le16 x, le16 y, le16 w, le16 h, le32 length
+ *    and length bytes of zlib compressed tile pixels (BGRx, rows top
+ *    down), XORed with the previous content of the tile.  The first frame
+ *    and the first one after a size change are complete and relative to
+ *    an all zero frame.
+ */
+
+#include "qemu/osdep.h"
+#include <zlib.h>
+#include "qapi/error.h"
+#include "qapi/qapi-commands-ui.h"
+#include "qemu/bitmap.h"
+#include "qemu/buffer.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "qemu/queue.h"
+#include "qemu/timer.h"
+#include "io/channel-file.h"
+#include "ui/console.h"
+#include "trace.h"
+
+#define CAPTURE_TILE        64
+#define CAPTURE_DEFAULT_FPS 10
+#define CAPTURE_MAX_FPS     60
+
+typedef struct Capture {
+    char *id;
+    DisplayChangeListener dcl;
+    DisplaySurface *ds;
+    QIOChannel *ioc;
+    CaptureFormat format;
+    int fps;
+    int64_t interval;
+    int64_t start;
+    int64_t next;
+    bool failed;
+    QEMUBH *stop_bh;
+
+    /* not yet accepted by the (non-blocking) target, and its watch */
+    Buffer pending;
+    guint watch;
+
+    /* what was sent last, x8r8g8b8 */
+    pixman_image_t *prev;
+    int width, height;
+    pixman_image_t *linebuf;
+
+    /* tiles damaged since the last frame */
+    unsigned long *dirty;
+    int tiles_x, tiles_y;
+
+    /* y4m: planes of the last frame */
+    uint8_t *yuv;
+    /* delta: the frame being encoded and a scratch tile */
+    Buffer out;
+    uint8_t *tile;
+    uint8_t *ztile;
+    uLong ztile_size;
+
+    QLIST_ENTRY(Capture) next;
+} Capture;
+
+static QLIST_HEAD(, Capture) captures = QLIST_HEAD_INITIALIZER(captures);
+
+static Capture *capture_find(const char *id)
+{
+    Capture *c;
+
+    QLIST_FOREACH(c, &captures, next) {
+        if (!strcmp(c->id, id)) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static void capture_mark_dirty(Capture *c, int x, int y, int w, int h)
+{
+    int tx, ty;
+
+    x = MAX(x, 0);
+    y = MAX(y, 0);
+    w = MIN(x + w, c->width) - x;
+    h = MIN(y + h, c->height) - y;
+    if (w <= 0 || h <= 0) {
+        return;
+    }
+    for (ty = y / CAPTURE_TILE; ty <= (y + h - 1) / CAPTURE_TILE; ty++) {
+        tx = x / CAPTURE_TILE;
+        bitmap_set(c->dirty, ty * c->tiles_x + tx,
+                   (x + w - 1) / CAPTURE_TILE - tx + 1);
+    }
+}
+
+static void capture_free(Capture *c);
+
+static void capture_stop_bh(void *opaque)
+{
+    Capture *c = opaque;
+
+    QLIST_REMOVE(c, next);
+    capture_free(c);
+}
+
+/*
+ * Can run from the refresh callback of the listener, so it is taken off
+ * the console from a bottom half.
+ */
+static void capture_fail(Capture *c, Error *err)
+{
+    error_prepend(&err, "capture '%s' stopped: ", c->id);
+    error_report_err(err);
+    c->failed = true;
+    buffer_reset(&c->pending);
+    qemu_bh_schedule(c->stop_bh);
+}
+
+static gboolean capture_flush(QIOChannel *ioc, GIOCondition condition,
+                              void *opaque)
+{
+    Capture *c = opaque;
+    Error *err = NULL;
+    ssize_t ret;
+
+    ret = qio_channel_write(ioc, (char *)c->pending.buffer,
+                            c->pending.offset, &err);
+    if (ret == QIO_CHANNEL_ERR_BLOCK) {
+        return G_SOURCE_CONTINUE;
+    }
+    if (ret < 0) {
+        capture_fail(c, err);
+    } else {
+        buffer_advance(&c->pending, ret);
+        if (!buffer_empty(&c->pending)) {
+            return G_SOURCE_CONTINUE;
+        }
+    }
+    c->watch = 0;
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * Never waits for the target, whatever it doesn't take right away is
+ * queued and written from the main loop once it is writable again.
+ */
+static bool capture_write(Capture *c, const void *data, size_t len)
+{
+    Error *err = NULL;
+    ssize_t ret = 0;
+
+    if (c->failed) {
+        return false;
+    }
+    if (buffer_empty(&c->pending)) {
+        ret = qio_channel_write(c->ioc, data, len, &err);
+        if (ret == QIO_CHANNEL_ERR_BLOCK) {
+            ret = 0;
+        } else if (ret < 0) {
+            capture_fail(c, err);
+            return false;
+        }
+    }
+    if ((size_t)ret < len) {
+        buffer_append(&c->pending, (const char *)data + ret, len - ret);
+        if (!c->watch) {
+            /* a FIFO whose reader left only reports an error */
+            c->watch = qio_channel_add_watch(c->ioc,
+                                             G_IO_OUT | G_IO_ERR | G_IO_HUP,
+                                             capture_flush, c, NULL);
+        }
+    }
+    return true;
+}
+
+static void capture_resize(Capture *c, int width, int height)
+{
+    g_autofree char *header = NULL;
+
+    if (c->prev && c->format == CAPTURE_FORMAT_Y4M) {
+        /* fixed size, start over from black */
+        width = c->width;
+        height = c->height;
+    }
+
+    qemu_pixman_image_unref(c->prev);
+    c->prev = pixman_image_create_bits(PIXMAN_x8r8g8b8, width, height,
+                                       NULL, width * 4);
+    c->width = width;
+    c->height = height;
+    c->tiles_x = DIV_ROUND_UP(width, CAPTURE_TILE);
+    c->tiles_y = DIV_ROUND_UP(height, CAPTURE_TILE);
+    g_free(c->dirty);
+    c->dirty = bitmap_new(c->tiles_x * c->tiles_y);
+    bitmap_set(c->dirty, 0, c->tiles_x * c->tiles_y);
+    qemu_pixman_image_unref(c->linebuf);
+    c->linebuf = qemu_pixman_linebuf_create(PIXMAN_x8r8g8b8, CAPTURE_TILE);
+
+    if (c->format == CAPTURE_FORMAT_Y4M) {
+        if (!c->yuv) {
+            header = g_strdup_printf("YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+                                     width, height, c->fps);
+            capture_write(c, header, strlen(header));
+            c->yuv = g_malloc(width * height * 3);
+        }
+        /* black, like prev */
+        memset(c->yuv, 16, width * height);
+        memset(c->yuv + width * height, 128, width * height * 2);
+    }
+}
+
+static void capture_yuv_tile(Capture *c, int x, int y, int w, int h)
+{
+    int size = c->width * c->height;
+    int i, j;
+
+    for (j = y; j < y + h; j++) {
+        uint32_t *src = (uint32_t *)pixman_image_get_data(c->prev) +
+            j * c->width;
+        uint8_t *py = c->yuv + j * c->width;
+        uint8_t *pu = py + size;
+        uint8_t *pv = pu + size;
+
+        for (i = x; i < x + w; i++) {
+            int r = (src[i] >> 16) & 0xff;
+            int g = (src[i] >> 8) & 0xff;
+            int b = src[i] & 0xff;
+
+            py[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+            pu[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+            pv[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+        }
+    }
+}
+
+static void capture_delta_tile(Capture *c, int x, int y, int w, int h)
+{
+    uLongf len = c->ztile_size;
+    uint16_t rect[4] = {
+        cpu_to_le16(x), cpu_to_le16(y), cpu_to_le16(w), cpu_to_le16(h)
+    };
+    uint32_t len32;
+
+    if (compress2(c->ztile, &len, c->tile, w * h * 4, Z_BEST_SPEED) != Z_OK) {
+        len = 0;
+    }
+    len32 = cpu_to_le32(len);
+    buffer_append(&c->out, rect, sizeof(rect));
+    buffer_append(&c->out, &len32, sizeof(len32));
+    buffer_append(&c->out, c->ztile, len);
+}
+
+/*
+ * Bring a tile of prev up to date with the surface.  For delta, the XOR
+ * of old and new content is left in c->tile.
+ */
+static bool capture_tile(Capture *c, int x, int y, int w, int h)
+{
+    pixman_image_t *image = c->ds->image;
+    bool native = surface_format(c->ds) == PIXMAN_x8r8g8b8;
+    bool changed = false;
+    int sw = MIN(w, surface_width(c->ds) - x);
+    int row, i;
+
+    for (row = 0; row < h; row++) {
+        uint32_t *dst = (uint32_t *)pixman_image_get_data(c->prev) +
+            (y + row) * c->width + x;
+        uint32_t *tile = (uint32_t *)c->tile + row * w;
+        uint32_t *src;
+
+        if (sw <= 0 || y + row >= surface_height(c->ds)) {
+            /* y4m padding */
+            continue;
+        }
+        if (native) {
+            src = (uint32_t *)(surface_data(c->ds) +
+                               (y + row) * surface_stride(c->ds)) + x;
+        } else {
+            qemu_pixman_linebuf_fill(c->linebuf, image, sw, x, y + row);
+            src = pixman_image_get_data(c->linebuf);
+        }
+        if (memcmp(dst, src, sw * 4) == 0) {
+            if (c->format == CAPTURE_FORMAT_DELTA) {
+                memset(tile, 0, w * 4);
+            }
+            continue;
+        }
+        changed = true;
+        if (c->format == CAPTURE_FORMAT_DELTA) {
+            for (i = 0; i < sw; i++) {
+                tile[i] = dst[i] ^ src[i];
+            }
+            memset(tile + sw, 0, (w - sw) * 4);
+        }
+        memcpy(dst, src, sw * 4);
+    }
+    return changed;
+}
+
+static void capture_frame(Capture *c, int64_t now)
+{
+    struct {
+        char magic[4];
+        uint32_t width, height;
+        uint64_t time;
+        uint32_t tiles;
+    } QEMU_PACKED header = { .magic = "QCDF" };
+    int nr = c->tiles_x * c->tiles_y;
+    int tiles = 0, t, x, y, w, h;
+
+    if (c->format == CAPTURE_FORMAT_DELTA) {
+        buffer_reset(&c->out);
+        buffer_reserve(&c->out, sizeof(header));
+        c->out.offset = sizeof(header);
+    }
+
+    for (t = find_first_bit(c->dirty, nr); t < nr;
+         t = find_next_bit(c->dirty, nr, t + 1)) {
+        x = (t % c->tiles_x) * CAPTURE_TILE;
+        y = (t / c->tiles_x) * CAPTURE_TILE;
+        w = MIN(CAPTURE_TILE, c->width - x);
+        h = MIN(CAPTURE_TILE, c->height - y);
+        if (!capture_tile(c, x, y, w, h)) {
+            continue;
+        }
+        tiles++;
+        if (c->format == CAPTURE_FORMAT_Y4M) {
+            capture_yuv_tile(c, x, y, w, h);
+        } else if (c->format == CAPTURE_FORMAT_DELTA) {
+            capture_delta_tile(c, x, y, w, h);
+        }
+    }
+    bitmap_zero(c->dirty, nr);
+
+    if (!tiles) {
+        trace_capture_drop(c->id);
+        return;
+    }
+    trace_capture_frame(c->id, tiles);
+    /* keep the pace of the refresh timer, but don't catch up after idling */
+    c->next = MAX(c->next, now - c->interval) + c->interval;
+
+    switch (c->format) {
+    case CAPTURE_FORMAT_RAW:
+        capture_write(c, pixman_image_get_data(c->prev),
+                      c->width * c->height * 4);
+        break;
+    case CAPTURE_FORMAT_Y4M:
+        if (capture_write(c, "FRAME\n", 6)) {
+            capture_write(c, c->yuv, c->width * c->height * 3);
+        }
+        break;
+    case CAPTURE_FORMAT_DELTA:
+        header.width = cpu_to_le32(c->width);
+        header.height = cpu_to_le32(c->height);
+        header.time = cpu_to_le64(now - c->start);
+        header.tiles = cpu_to_le32(tiles);
+        memcpy(c->out.buffer, &header, sizeof(header));
+        capture_write(c, c->out.buffer, c->out.offset);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void capture_refresh(DisplayChangeListener *dcl)
+{
+    Capture *c = container_of(dcl, Capture, dcl);
+    int64_t now;
+
+    graphic_hw_update(dcl->con);
+
+    now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    if (!c->ds || c->failed || now < c->next) {
+        return;
+    }
+    if (!buffer_empty(&c->pending)) {
+        /*
+         * The target is still busy with the previous frame, skip this
+         * one.  The damage stays and goes into the next frame.
+         */
+        trace_capture_busy(c->id, c->pending.offset);
+        return;
+    }
+    capture_frame(c, now);
+}
+
+static void capture_gfx_update(DisplayChangeListener *dcl,
+                               int x, int y, int w, int h)
+{
+    Capture *c = container_of(dcl, Capture, dcl);
+
+    capture_mark_dirty(c, x, y, w, h);
+}
+
+static void capture_gfx_switch(DisplayChangeListener *dcl,
+                               DisplaySurface *new_surface)
+{
+    Capture *c = container_of(dcl, Capture, dcl);
+
+    c->ds = new_surface;
+    if (!new_surface) {
+        return;
+    }
+    if (!c->prev || c->format == CAPTURE_FORMAT_Y4M ||
+        surface_width(new_surface) != c->width ||
+        surface_height(new_surface) != c->height) {
+        capture_resize(c, surface_width(new_surface),
+                       surface_height(new_surface));
+    } else {
+        bitmap_set(c->dirty, 0, c->tiles_x * c->tiles_y);
+    }
+}
+
+static const DisplayChangeListenerOps capture_ops = {
+    .dpy_name       = "capture",
+    .dpy_refresh    = capture_refresh,
+    .dpy_gfx_update = capture_gfx_update,
+    .dpy_gfx_switch = capture_gfx_switch,
+};
+
+static void capture_free(Capture *c)
+{
+    if (c->dcl.ops) {
+        unregister_displaychangelistener(&c->dcl);
+    }
+    if (c->watch) {
+        g_source_remove(c->watch);
+    }
+    qemu_bh_delete(c->stop_bh);
+    if (c->ioc) {
+        object_unref(OBJECT(c->ioc));
+    }
+    qemu_pixman_image_unref(c->prev);
+    qemu_pixman_image_unref(c->linebuf);
+    buffer_free(&c->out);
+    buffer_free(&c->pending);
+    g_free(c->dirty);
+    g_free(c->yuv);
+    g_free(c->tile);
+    g_free(c->ztile);
+    g_free(c->id);
+    g_free(c);
+}
+
+void qmp_capture_start(const char *id, const char *filename,
+                       bool has_format, CaptureFormat format,
+                       bool has_fps, int64_t fps,
+                       bool has_device, const char *device,
+                       bool has_head, int64_t head, Error **errp)
+{
+    QemuConsole *con;
+    Capture *c;
+    int fd;
+
+    if (capture_find(id)) {
+        error_setg(errp, "capture '%s' already exists", id);
+        return;
+    }
+    if (!has_fps) {
+        fps = CAPTURE_DEFAULT_FPS;
+    } else if (fps < 1 || fps > CAPTURE_MAX_FPS) {
+        error_setg(errp, "'fps' must be between 1 and %d", CAPTURE_MAX_FPS);
+        return;
+    }
+
+    if (has_device) {
+        con = qemu_console_lookup_by_device_name(device, has_head ? head : 0,
+                                                 errp);
+        if (!con) {
+            return;
+        }
+    } else {
+        if (has_head) {
+            error_setg(errp, "'head' must be specified together with 'device'");
+            return;
+        }
+        con = qemu_console_lookup_by_index(0);
+        if (!con) {
+            error_setg(errp, "There is no console to capture");
+            return;
+        }
+    }
+    if (!qemu_console_is_graphic(con)) {
+        error_setg(errp, "Only graphic consoles can be captured");
+        return;
+    }
+
+    /*
+     * Runs with the BQL held, so don't wait for a reader to show up on a
+     * FIFO; the fd stays non-blocking for the writes, too.
+     */
+    fd = qemu_create(filename, O_WRONLY | O_TRUNC | O_BINARY | O_NONBLOCK,
+                     0666, errp);
+    if (fd == -1) {
+        if (errno == ENXIO) {
+            error_append_hint(errp, "A FIFO must be opened for reading "
+                              "before the capture is started\n");
+        }
+        return;
+    }
+
+    c = g_new0(Capture, 1);
+    c->id = g_strdup(id);
+    c->ioc = QIO_CHANNEL(qio_channel_file_new_fd(fd));
+    c->format = has_format ? format : CAPTURE_FORMAT_RAW;
+    c->fps = fps;
+    c->interval = NANOSECONDS_PER_SECOND / fps;
+    c->start = c->next = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    c->stop_bh = qemu_bh_new(capture_stop_bh, c);
+    buffer_init(&c->out, "capture-%s", id);
+    buffer_init(&c->pending, "capture-%s-pending", id);
+    c->tile = g_malloc(CAPTURE_TILE * CAPTURE_TILE * 4);
+    c->ztile_size = compressBound(CAPTURE_TILE * CAPTURE_TILE * 4);
+    c->ztile = g_malloc(c->ztile_size);
+
+    c->dcl.con = con;
+    c->dcl.ops = &capture_ops;
+    register_displaychangelistener(&c->dcl);
+    update_displaychangelistener(&c->dcl, 1000 / fps);
+    QLIST_INSERT_HEAD(&captures, c, next);
+}
+
+void qmp_capture_stop(const char *id, Error **errp)
+{
+    Capture *c = capture_find(id);
+
+    if (!c) {
+        error_setg(errp, "capture '%s' not found", id);
+        return;
+    }
+    QLIST_REMOVE(c, next);
+    capture_free(c);
+}
@@ -35,6 +35,11 @@
 #include "exec/memory.h"
 #include "io/channel-file.h"
 #include "qom/object.h"
+#include "block/aio.h"
+#include "block/thread-pool.h"
+#ifdef CONFIG_PNG
+#include <png.h>
+#endif
 
 #define DEFAULT_BACKSCROLL 512
 #define CONSOLE_CURSOR_PERIOD 500
@@ -353,20 +358,137 @@ static bool ppm_save(int fd, pixman_image_t *image, Error **errp)
     return true;
 }
 
+#ifdef CONFIG_PNG
+typedef struct PngWriter {
+    QIOChannel *ioc;
+    Error **errp;
+} PngWriter;
+
+static void png_write_data(png_structp png_ptr, png_bytep data, size_t len)
+{
+    PngWriter *w = png_get_io_ptr(png_ptr);
+
+    if (qio_channel_write_all(w->ioc, (char *)data, len, w->errp) < 0) {
+        png_error(png_ptr, "write failed");
+    }
+}
+
+static void png_flush_data(png_structp png_ptr)
+{
+}
+
+static bool png_save(int fd, pixman_image_t *image, int level, Error **errp)
+{
+    int width = pixman_image_get_width(image);
+    int height = pixman_image_get_height(image);
+    g_autoptr(Object) ioc = OBJECT(qio_channel_file_new_fd(fd));
+    g_autoptr(pixman_image_t) linebuf = NULL;
+    PngWriter w = { .ioc = QIO_CHANNEL(ioc), .errp = errp };
+    png_structp png_ptr;
+    png_infop info_ptr;
+    int y;
+
+    trace_png_save(fd, image, level);
+
+    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
+                                      NULL, NULL, NULL);
+    if (!png_ptr) {
+        error_setg(errp, "PNG creation failed");
+        return false;
+    }
+    info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr) {
+        png_destroy_write_struct(&png_ptr, NULL);
+        error_setg(errp, "PNG creation failed");
+        return false;
+    }
+
+    linebuf = qemu_pixman_linebuf_create(PIXMAN_BE_r8g8b8, width);
+
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        png_destroy_write_struct(&png_ptr, &info_ptr);
+        if (!*errp) {
+            error_setg(errp, "PNG encoding failed");
+        }
+        return false;
+    }
+
+    png_set_write_fn(png_ptr, &w, png_write_data, png_flush_data);
+    if (level >= 0) {
+        png_set_compression_level(png_ptr, level);
+    }
+    png_set_IHDR(png_ptr, info_ptr, width, height, 8, PNG_COLOR_TYPE_RGB,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+                 PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png_ptr, info_ptr);
+
+    for (y = 0; y < height; y++) {
+        qemu_pixman_linebuf_fill(linebuf, image, width, 0, y);
+        png_write_row(png_ptr, (png_bytep)pixman_image_get_data(linebuf));
+    }
+
+    png_write_end(png_ptr, NULL);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    return true;
+}
+#endif /* CONFIG_PNG */
+
 static void graphic_hw_update_bh(void *con)
 {
     graphic_hw_update(con);
 }
 
+typedef struct ScreendumpJob {
+    pixman_image_t *image;
+    int fd;
+    ImageFormat format;
+    int level;
+    Error *err;
+} ScreendumpJob;
+
+/* Runs in a worker thread, only touches the snapshot */
+static int screendump_worker(void *opaque)
+{
+    ScreendumpJob *job = opaque;
+
+    switch (job->format) {
+#ifdef CONFIG_PNG
+    case IMAGE_FORMAT_PNG:
+        return png_save(job->fd, job->image, job->level, &job->err) ? 0 : -1;
+#endif
+    case IMAGE_FORMAT_PPM:
+    default:
+        return ppm_save(job->fd, job->image, &job->err) ? 0 : -1;
+    }
+}
+
 /* Safety: coroutine-only, concurrent-coroutine safe, main thread only */
 void coroutine_fn
 qmp_screendump(const char *filename, bool has_device, const char *device,
-               bool has_head, int64_t head, Error **errp)
-{
-    g_autoptr(pixman_image_t) image = NULL;
+               bool has_head, int64_t head,
+               bool has_format, ImageFormat format,
+               bool has_compression_level, int64_t compression_level,
+               Error **errp)
+{
+    ScreendumpJob job = {
+        .format = has_format ? format : IMAGE_FORMAT_PPM,
+        .level = -1,
+    };
     QemuConsole *con;
     DisplaySurface *surface;
-    int fd;
+    int width, height;
+
+    if (has_compression_level) {
+        if (job.format == IMAGE_FORMAT_PPM) {
+            error_setg(errp, "'compression-level' is only valid for PNG");
+            return;
+        }
+        if (compression_level < 0 || compression_level > 9) {
+            error_setg(errp, "'compression-level' must be between 0 and 9");
+            return;
+        }
+        job.level = compression_level;
+    }
 
     if (has_device) {
         con = qemu_console_lookup_by_device_name(device, has_head ? head : 0,
@@ -396,30 +518,36 @@ qmp_screendump(const char *filename, bool has_device, const char *device,
     /*
      * All pending coroutines are woken up, while the BQL is held.  No
      * further graphic update are possible until it is released.  Take
-     * an image ref before that.
+     * a snapshot before that, the worker thread encodes from it while
+     * the guest goes on updating the surface.
      */
     surface = qemu_console_surface(con);
     if (!surface) {
         error_setg(errp, "no surface");
         return;
     }
-    image = pixman_image_ref(surface->image);
+    width = surface_width(surface);
+    height = surface_height(surface);
+    job.image = pixman_image_create_bits(surface_format(surface),
+                                         width, height, NULL, 0);
+    pixman_image_composite(PIXMAN_OP_SRC, surface->image, NULL, job.image,
+                           0, 0, 0, 0, 0, 0, width, height);
 
-    fd = qemu_open_old(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
-    if (fd == -1) {
+    job.fd = qemu_open_old(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY,
+                           0666);
+    if (job.fd == -1) {
         error_setg(errp, "failed to open file '%s': %s", filename,
                    strerror(errno));
+        pixman_image_unref(job.image);
         return;
     }
 
-    /*
-     * The image content could potentially be updated as the coroutine
-     * yields and releases the BQL. It could produce corrupted dump, but
-     * it should be otherwise safe.
-     */
-    if (!ppm_save(fd, image, errp)) {
+    if (thread_pool_submit_co(aio_get_thread_pool(qemu_get_aio_context()),
+                              screendump_worker, &job) < 0) {
+        error_propagate(errp, job.err);
         qemu_unlink(filename);
     }
+    pixman_image_unref(job.image);
 }
 
 void graphic_hw_text_update(QemuConsole *con, console_ch_t *chardata)
@@ -13,6 +13,7 @@ typedef struct egl_dpy {
     egl_fb guest_fb;
     egl_fb cursor_fb;
     egl_fb blit_fb;
+    egl_readback readback;
     bool y_0_top;
     uint32_t pos_x;
     uint32_t pos_y;
@@ -20,9 +21,32 @@ typedef struct egl_dpy {
 
 /* ------------------------------------------------------------------ */
 
+static void egl_readback_flush(egl_dpy *edpy)
+{
+    int x, y, w, h;
+
+    /* finish() retires a readback even when it has nothing to show */
+    while (egl_readback_pending(&edpy->readback)) {
+        if (egl_readback_finish(&edpy->readback, edpy->ds, &x, &y, &w, &h)) {
+            dpy_gfx_update(edpy->dcl.con, x, y, w, h);
+        }
+    }
+}
+
 static void egl_refresh(DisplayChangeListener *dcl)
 {
+    egl_dpy *edpy = container_of(dcl, egl_dpy, dcl);
+
     graphic_hw_update(dcl->con);
+
+    /*
+     * Don't leave the last frame behind when no new one pushes it out.
+     * The renderer keeps its context current, that is all we need.
+     */
+    if (egl_readback_pending(&edpy->readback) && edpy->ds &&
+        eglGetCurrentContext() != EGL_NO_CONTEXT) {
+        egl_readback_flush(edpy);
+    }
 }
 
 static void egl_gfx_update(DisplayChangeListener *dcl,
@@ -52,6 +76,7 @@ static void egl_scanout_disable(DisplayChangeListener *dcl)
 
     egl_fb_destroy(&edpy->guest_fb);
     egl_fb_destroy(&edpy->blit_fb);
+    egl_readback_destroy(&edpy->readback);
 }
 
 static void egl_scanout_texture(DisplayChangeListener *dcl,
@@ -129,6 +154,7 @@ static void egl_scanout_flush(DisplayChangeListener *dcl,
                               uint32_t w, uint32_t h)
 {
     egl_dpy *edpy = container_of(dcl, egl_dpy, dcl);
+    int rx, ry, rw, rh;
 
     if (!edpy->guest_fb.texture || !edpy->ds) {
         return;
@@ -147,8 +173,29 @@ static void egl_scanout_flush(DisplayChangeListener *dcl,
         egl_fb_blit(&edpy->blit_fb, &edpy->guest_fb, edpy->y_0_top);
     }
 
-    egl_fb_read(edpy->ds, &edpy->blit_fb);
-    dpy_gfx_update(edpy->dcl.con, x, y, w, h);
+    if (!egl_readback_supported()) {
+        egl_fb_read(edpy->ds, &edpy->blit_fb);
+        dpy_gfx_update(edpy->dcl.con, x, y, w, h);
+        return;
+    }
+
+    /*
+     * Read back only the damaged rectangle, without waiting for it.  The
+     * previous frame is complete by now most of the time, hand that one
+     * to the display instead.
+     */
+    rx = MIN(x, edpy->blit_fb.width);
+    ry = MIN(y, edpy->blit_fb.height);
+    rw = MIN(w, edpy->blit_fb.width - rx);
+    rh = MIN(h, edpy->blit_fb.height - ry);
+    if (rw > 0 && rh > 0) {
+        egl_fb_read_rect_async(&edpy->readback, &edpy->blit_fb,
+                               rx, ry, rw, rh);
+    }
+    if (egl_readback_pending(&edpy->readback) == 2 &&
+        egl_readback_finish(&edpy->readback, edpy->ds, &rx, &ry, &rw, &rh)) {
+        dpy_gfx_update(edpy->dcl.con, rx, ry, rw, rh);
+    }
 }
 
 static const DisplayChangeListenerOps egl_ops = {
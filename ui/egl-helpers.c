@@ -17,6 +17,7 @@
 #include "qemu/osdep.h"
 #include "qemu/drm.h"
 #include "qemu/error-report.h"
+#include "qemu/timer.h"
 #include "ui/console.h"
 #include "ui/egl-helpers.h"
 
@@ -110,6 +111,127 @@ void egl_fb_read(DisplaySurface *dst, egl_fb *src)
                  GL_BGRA, GL_UNSIGNED_BYTE, surface_data(dst));
 }
 
+bool egl_readback_supported(void)
+{
+    static int supported = -1;
+
+    if (supported < 0) {
+        /* pixel buffer objects, glMapBufferRange and fence sync objects */
+        supported = epoxy_is_desktop_gl() ?
+            epoxy_gl_version() >= 32 : epoxy_gl_version() >= 30;
+    }
+    return supported;
+}
+
+static void egl_readback_buf_reset(egl_readback_buf *buf)
+{
+    if (buf->fence) {
+        glDeleteSync(buf->fence);
+        buf->fence = 0;
+    }
+}
+
+void egl_readback_destroy(egl_readback *rb)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(rb->buf); i++) {
+        egl_readback_buf_reset(&rb->buf[i]);
+        if (rb->buf[i].pbo) {
+            glDeleteBuffers(1, &rb->buf[i].pbo);
+        }
+    }
+    memset(rb, 0, sizeof(*rb));
+}
+
+/* Number of readbacks in flight */
+int egl_readback_pending(egl_readback *rb)
+{
+    return !!rb->buf[0].fence + !!rb->buf[1].fence;
+}
+
+/*
+ * Start reading the rectangle back.  At most one readback may be in
+ * flight already.
+ */
+void egl_fb_read_rect_async(egl_readback *rb, egl_fb *src,
+                            int x, int y, int w, int h)
+{
+    egl_readback_buf *buf = &rb->buf[rb->next];
+    size_t size = (size_t)w * h * 4;
+
+    assert(!buf->fence);
+    if (!buf->pbo) {
+        glGenBuffers(1, &buf->pbo);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buf->pbo);
+    if (buf->size < size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        buf->size = size;
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, src->framebuffer);
+    glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+    glReadPixels(x, y, w, h, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    buf->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    buf->x = x;
+    buf->y = y;
+    buf->w = w;
+    buf->h = h;
+    rb->next ^= 1;
+}
+
+/*
+ * Copy the oldest pending readback to the surface, waiting for the GPU
+ * if needed, and return the rectangle it covered.
+ */
+bool egl_readback_finish(egl_readback *rb, DisplaySurface *dst,
+                         int *x, int *y, int *w, int *h)
+{
+    egl_readback_buf *buf = &rb->buf[rb->next];
+    uint8_t *map;
+    int row, bw, bh;
+
+    if (!buf->fence) {
+        buf = &rb->buf[rb->next ^ 1];
+        if (!buf->fence) {
+            return false;
+        }
+    }
+
+    glClientWaitSync(buf->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                     NANOSECONDS_PER_SECOND);
+    egl_readback_buf_reset(buf);
+
+    /* the surface may have been switched meanwhile */
+    bw = MIN(buf->w, surface_width(dst) - buf->x);
+    bh = MIN(buf->h, surface_height(dst) - buf->y);
+    if (bw <= 0 || bh <= 0) {
+        return false;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buf->pbo);
+    map = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                           (size_t)buf->w * buf->h * 4, GL_MAP_READ_BIT);
+    if (map) {
+        for (row = 0; row < bh; row++) {
+            memcpy(surface_data(dst) + (buf->y + row) * surface_stride(dst) +
+                   buf->x * 4, map + row * buf->w * 4, bw * 4);
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    *x = buf->x;
+    *y = buf->y;
+    *w = bw;
+    *h = bh;
+    return map != NULL;
+}
+
 void egl_texture_blit(QemuGLShader *gls, egl_fb *dst, egl_fb *src, bool flip)
 {
     glBindFramebuffer(GL_FRAMEBUFFER_EXT, dst->framebuffer);
@@ -485,6 +485,9 @@ static QemuOptsList qemu_spice_opts = {
         },{
             .name = "head",
             .type = QEMU_OPT_NUMBER,
+        },{
+            .name = "zero-copy",
+            .type = QEMU_OPT_BOOL,
 #ifdef HAVE_SPICE_GL
         },{
             .name = "gl",
@@ -817,6 +820,8 @@ static void qemu_spice_init(void)
 
     seamless_migration = qemu_opt_get_bool(opts, "seamless-migration", 0);
     spice_server_set_seamless_migration(spice_server, seamless_migration);
+
+    spice_zero_copy = qemu_opt_get_bool(opts, "zero-copy", 0);
     spice_server_set_sasl_appname(spice_server, "qemu");
     if (spice_server_init(spice_server, &core_interface) != 0) {
         error_report("failed to initialize spice server");
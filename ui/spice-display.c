@@ -28,12 +28,19 @@
 #include "ui/spice-display.h"
 
 bool spice_opengl;
+bool spice_zero_copy;
 
 int qemu_spice_rect_is_empty(const QXLRect* r)
 {
     return r->top == r->bottom || r->left == r->right;
 }
 
+static bool qemu_spice_rect_intersects(const QXLRect *a, const QXLRect *b)
+{
+    return a->left < b->right && b->left < a->right &&
+        a->top < b->bottom && b->top < a->bottom;
+}
+
 void qemu_spice_rect_union(QXLRect *dest, const QXLRect *r)
 {
     if (qemu_spice_rect_is_empty(r)) {
@@ -116,6 +123,24 @@ void qemu_spice_wakeup(SimpleSpiceDisplay *ssd)
     spice_qxl_wakeup(&ssd->qxl);
 }
 
+/*
+ * Whether a zero-copy drawable the spice server has not released yet
+ * still shows this part of the mirror.  Called with ssd->lock held.
+ */
+static bool qemu_spice_rect_inflight(SimpleSpiceDisplay *ssd,
+                                     const QXLRect *rect)
+{
+    SimpleSpiceUpdate *update;
+
+    QTAILQ_FOREACH(update, &ssd->inflight, inflight_next) {
+        if (update->mirror == ssd->mirror &&
+            qemu_spice_rect_intersects(&update->drawable.bbox, rect)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static void qemu_spice_create_one_update(SimpleSpiceDisplay *ssd,
                                          QXLRect *rect)
 {
@@ -123,9 +148,10 @@ static void qemu_spice_create_one_update(SimpleSpiceDisplay *ssd,
     QXLDrawable *drawable;
     QXLImage *image;
     QXLCommand *cmd;
-    int bw, bh;
+    int bw, bh, stride;
     struct timespec time_space;
     pixman_image_t *dest;
+    bool zero_copy = false, fallback = false;
 
     trace_qemu_spice_create_update(
            rect->left, rect->right,
@@ -138,7 +164,17 @@ static void qemu_spice_create_one_update(SimpleSpiceDisplay *ssd,
 
     bw       = rect->right - rect->left;
     bh       = rect->bottom - rect->top;
-    update->bitmap = g_malloc(bw * bh * 4);
+
+    if (ssd->zero_copy &&
+        pixman_image_get_format(ssd->mirror) == PIXMAN_LE_x8r8g8b8) {
+        fallback = qemu_spice_rect_inflight(ssd, rect);
+        zero_copy = !fallback;
+        if (fallback) {
+            trace_qemu_spice_zero_copy_fallback(ssd->qxl.id,
+                                                rect->left, rect->right,
+                                                rect->top, rect->bottom);
+        }
+    }
 
     drawable->bbox            = *rect;
     drawable->clip.type       = SPICE_CLIP_TYPE_NONE;
@@ -161,22 +197,51 @@ static void qemu_spice_create_one_update(SimpleSpiceDisplay *ssd,
     QXL_SET_IMAGE_ID(image, QXL_IMAGE_GROUP_DEVICE, ssd->unique++);
     image->descriptor.type   = SPICE_IMAGE_TYPE_BITMAP;
     image->bitmap.flags      = QXL_BITMAP_DIRECT | QXL_BITMAP_TOP_DOWN;
-    image->bitmap.stride     = bw * 4;
     image->descriptor.width  = image->bitmap.x = bw;
     image->descriptor.height = image->bitmap.y = bh;
-    image->bitmap.data = (uintptr_t)(update->bitmap);
     image->bitmap.palette = 0;
     image->bitmap.format = SPICE_BITMAP_FMT_32BIT;
 
-    dest = pixman_image_create_bits(PIXMAN_LE_x8r8g8b8, bw, bh,
-                                    (void *)update->bitmap, bw * 4);
-    pixman_image_composite(PIXMAN_OP_SRC, ssd->surface, NULL, ssd->mirror,
-                           rect->left, rect->top, 0, 0,
-                           rect->left, rect->top, bw, bh);
-    pixman_image_composite(PIXMAN_OP_SRC, ssd->mirror, NULL, dest,
-                           rect->left, rect->top, 0, 0,
-                           0, 0, bw, bh);
-    pixman_image_unref(dest);
+    if (zero_copy) {
+        /*
+         * The host memslot covers the mirror, so the drawable can point
+         * right into it.  It stays alive until the spice server releases
+         * the drawable, even across a mode switch.
+         */
+        pixman_image_composite(PIXMAN_OP_SRC, ssd->surface, NULL, ssd->mirror,
+                               rect->left, rect->top, 0, 0,
+                               rect->left, rect->top, bw, bh);
+        stride = pixman_image_get_stride(ssd->mirror);
+        update->mirror = pixman_image_ref(ssd->mirror);
+        image->bitmap.stride = stride;
+        image->bitmap.data = (uintptr_t)
+            ((uint8_t *)pixman_image_get_data(ssd->mirror) +
+             rect->top * stride + rect->left * 4);
+        QTAILQ_INSERT_TAIL(&ssd->inflight, update, inflight_next);
+    } else {
+        update->bitmap = g_malloc(bw * bh * 4);
+        image->bitmap.stride = bw * 4;
+        image->bitmap.data = (uintptr_t)(update->bitmap);
+
+        dest = pixman_image_create_bits(PIXMAN_LE_x8r8g8b8, bw, bh,
+                                        (void *)update->bitmap, bw * 4);
+        if (fallback) {
+            /* leave the mirror alone, it is resynced once released */
+            pixman_image_composite(PIXMAN_OP_SRC, ssd->surface, NULL, dest,
+                                   rect->left, rect->top, 0, 0,
+                                   0, 0, bw, bh);
+            qemu_spice_rect_union(&ssd->stale, rect);
+        } else {
+            pixman_image_composite(PIXMAN_OP_SRC, ssd->surface, NULL,
+                                   ssd->mirror,
+                                   rect->left, rect->top, 0, 0,
+                                   rect->left, rect->top, bw, bh);
+            pixman_image_composite(PIXMAN_OP_SRC, ssd->mirror, NULL, dest,
+                                   rect->left, rect->top, 0, 0,
+                                   0, 0, bw, bh);
+        }
+        pixman_image_unref(dest);
+    }
 
     cmd->type = QXL_CMD_DRAW;
     cmd->data = (uintptr_t)drawable;
@@ -193,6 +258,13 @@ static void qemu_spice_create_update(SimpleSpiceDisplay *ssd)
     int bpp = surface_bytes_per_pixel(ssd->ds);
     uint8_t *guest, *mirror;
 
+    /* the mirror is behind where changes were sent from a private copy */
+    if (!qemu_spice_rect_is_empty(&ssd->stale) &&
+        !qemu_spice_rect_inflight(ssd, &ssd->stale)) {
+        qemu_spice_rect_union(&ssd->dirty, &ssd->stale);
+        memset(&ssd->stale, 0, sizeof(ssd->stale));
+    }
+
     if (qemu_spice_rect_is_empty(&ssd->dirty)) {
         return;
     };
@@ -300,9 +372,17 @@ qemu_spice_create_cursor_update(SimpleSpiceDisplay *ssd,
  * We do *not* hold the global qemu mutex here, so extra care is needed
  * when calling qemu functions.  QEMU interfaces used:
  *    - g_free (underlying glibc free is re-entrant).
+ *    - the mirror reference of zero-copy updates, like all references
+ *      to the mirror, is only dropped with sdpy->lock held.
  */
 void qemu_spice_destroy_update(SimpleSpiceDisplay *sdpy, SimpleSpiceUpdate *update)
 {
+    if (update->mirror) {
+        qemu_mutex_lock(&sdpy->lock);
+        QTAILQ_REMOVE(&sdpy->inflight, update, inflight_next);
+        pixman_image_unref(update->mirror);
+        qemu_mutex_unlock(&sdpy->lock);
+    }
     g_free(update->bitmap);
     g_free(update);
 }
@@ -356,6 +436,8 @@ void qemu_spice_display_init_common(SimpleSpiceDisplay *ssd)
 {
     qemu_mutex_init(&ssd->lock);
     QTAILQ_INIT(&ssd->updates);
+    QTAILQ_INIT(&ssd->inflight);
+    ssd->zero_copy = spice_zero_copy;
     ssd->mouse_x = -1;
     ssd->mouse_y = -1;
     if (ssd->num_surfaces == 0) {
@@ -385,6 +467,7 @@ void qemu_spice_display_update(SimpleSpiceDisplay *ssd,
 void qemu_spice_display_switch(SimpleSpiceDisplay *ssd,
                                DisplaySurface *surface)
 {
+    QTAILQ_HEAD(, SimpleSpiceUpdate) updates = QTAILQ_HEAD_INITIALIZER(updates);
     SimpleSpiceUpdate *update;
     bool need_destroy;
 
@@ -415,6 +498,8 @@ void qemu_spice_display_switch(SimpleSpiceDisplay *ssd,
                                      false);
 
     memset(&ssd->dirty, 0, sizeof(ssd->dirty));
+    memset(&ssd->stale, 0, sizeof(ssd->stale));
+    qemu_mutex_lock(&ssd->lock);
     if (ssd->surface) {
         pixman_image_unref(ssd->surface);
         ssd->surface = NULL;
@@ -422,14 +507,17 @@ void qemu_spice_display_switch(SimpleSpiceDisplay *ssd,
         ssd->mirror = NULL;
     }
 
-    qemu_mutex_lock(&ssd->lock);
     need_destroy = (ssd->ds != NULL);
     ssd->ds = surface;
     while ((update = QTAILQ_FIRST(&ssd->updates)) != NULL) {
         QTAILQ_REMOVE(&ssd->updates, update, next);
-        qemu_spice_destroy_update(ssd, update);
+        QTAILQ_INSERT_TAIL(&updates, update, next);
     }
     qemu_mutex_unlock(&ssd->lock);
+    while ((update = QTAILQ_FIRST(&updates)) != NULL) {
+        QTAILQ_REMOVE(&updates, update, next);
+        qemu_spice_destroy_update(ssd, update);
+    }
     if (need_destroy) {
         qemu_spice_destroy_host_primary(ssd);
     }
@@ -0,0 +1,212 @@
+/*
+ * QEMU VNC display driver: compare and copy of dirty framebuffer chunks
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitops.h"
+#include "qemu/host-isa.h"
+#include "vnc.h"
+
+/* The chunk size of a dirty bit on the server surface */
+#define VNC_CMP_CHUNK (VNC_DIRTY_PIXELS_PER_BIT * VNC_SERVER_FB_BYTES)
+
+typedef int (*vnc_cmp_copy_fn)(uint8_t *dst, const uint8_t *src,
+                               long nr, unsigned long *changed);
+
+static bool cmp_copy_bytes(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    if (memcmp(dst, src, len) == 0) {
+        return false;
+    }
+    memcpy(dst, src, len);
+    return true;
+}
+
+static int cmp_copy_int(uint8_t *dst, const uint8_t *src, long nr,
+                        size_t chunk, unsigned long *changed)
+{
+    int copied = 0;
+    long i;
+
+    for (i = 0; i < nr; i++, dst += chunk, src += chunk) {
+        if (cmp_copy_bytes(dst, src, chunk)) {
+            set_bit(i, changed);
+            copied++;
+        }
+    }
+    return copied;
+}
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+
+static int
+cmp_copy_neon(uint8_t *dst, const uint8_t *src, long nr, unsigned long *changed)
+{
+    int copied = 0;
+    long i;
+
+    for (i = 0; i < nr; i++, dst += VNC_CMP_CHUNK, src += VNC_CMP_CHUNK) {
+        uint8x16_t s0 = vld1q_u8(src);
+        uint8x16_t s1 = vld1q_u8(src + 16);
+        uint8x16_t s2 = vld1q_u8(src + 32);
+        uint8x16_t s3 = vld1q_u8(src + 48);
+        uint8x16_t eq;
+
+        eq = vandq_u8(vandq_u8(vceqq_u8(s0, vld1q_u8(dst)),
+                               vceqq_u8(s1, vld1q_u8(dst + 16))),
+                      vandq_u8(vceqq_u8(s2, vld1q_u8(dst + 32)),
+                               vceqq_u8(s3, vld1q_u8(dst + 48))));
+        if (likely(vminvq_u8(eq) == 0xff)) {
+            continue;
+        }
+        vst1q_u8(dst, s0);
+        vst1q_u8(dst + 16, s1);
+        vst1q_u8(dst + 32, s2);
+        vst1q_u8(dst + 48, s3);
+        set_bit(i, changed);
+        copied++;
+    }
+    return copied;
+}
+
+static vnc_cmp_copy_fn cmp_copy_accel = cmp_copy_neon;
+
+#elif defined(CONFIG_AVX2_OPT) || defined(__SSE2__)
+/* Do not use push_options pragmas unnecessarily, because clang
+ * does not support them.
+ */
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+#include <emmintrin.h>
+
+static int
+cmp_copy_sse2(uint8_t *dst, const uint8_t *src, long nr, unsigned long *changed)
+{
+    int copied = 0;
+    long i;
+
+    for (i = 0; i < nr; i++, dst += VNC_CMP_CHUNK, src += VNC_CMP_CHUNK) {
+        __m128i s0 = _mm_loadu_si128((const __m128i *)src);
+        __m128i s1 = _mm_loadu_si128((const __m128i *)(src + 16));
+        __m128i s2 = _mm_loadu_si128((const __m128i *)(src + 32));
+        __m128i s3 = _mm_loadu_si128((const __m128i *)(src + 48));
+        __m128i eq;
+
+        eq = _mm_and_si128(
+            _mm_and_si128(
+                _mm_cmpeq_epi8(s0, _mm_loadu_si128((__m128i *)dst)),
+                _mm_cmpeq_epi8(s1, _mm_loadu_si128((__m128i *)(dst + 16)))),
+            _mm_and_si128(
+                _mm_cmpeq_epi8(s2, _mm_loadu_si128((__m128i *)(dst + 32))),
+                _mm_cmpeq_epi8(s3, _mm_loadu_si128((__m128i *)(dst + 48)))));
+        if (likely(_mm_movemask_epi8(eq) == 0xFFFF)) {
+            continue;
+        }
+        _mm_storeu_si128((__m128i *)dst, s0);
+        _mm_storeu_si128((__m128i *)(dst + 16), s1);
+        _mm_storeu_si128((__m128i *)(dst + 32), s2);
+        _mm_storeu_si128((__m128i *)(dst + 48), s3);
+        set_bit(i, changed);
+        copied++;
+    }
+    return copied;
+}
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static int
+cmp_copy_avx2(uint8_t *dst, const uint8_t *src, long nr, unsigned long *changed)
+{
+    int copied = 0;
+    long i;
+
+    for (i = 0; i < nr; i++, dst += VNC_CMP_CHUNK, src += VNC_CMP_CHUNK) {
+        __m256i s0 = _mm256_loadu_si256((const __m256i *)src);
+        __m256i s1 = _mm256_loadu_si256((const __m256i *)(src + 32));
+        __m256i eq;
+
+        eq = _mm256_and_si256(
+            _mm256_cmpeq_epi8(s0, _mm256_loadu_si256((__m256i *)dst)),
+            _mm256_cmpeq_epi8(s1, _mm256_loadu_si256((__m256i *)(dst + 32))));
+        if (likely(_mm256_movemask_epi8(eq) == -1)) {
+            continue;
+        }
+        _mm256_storeu_si256((__m256i *)dst, s0);
+        _mm256_storeu_si256((__m256i *)(dst + 32), s1);
+        set_bit(i, changed);
+        copied++;
+    }
+    return copied;
+}
+#pragma GCC pop_options
+
+static int
+cmp_copy_int64(uint8_t *dst, const uint8_t *src, long nr, unsigned long *changed)
+{
+    return cmp_copy_int(dst, src, nr, VNC_CMP_CHUNK, changed);
+}
+
+static vnc_cmp_copy_fn cmp_copy_accel = cmp_copy_int64;
+
+static void __attribute__((constructor)) vnc_cmp_copy_init(void)
+{
+    unsigned isa = host_isa_flags();
+
+    if (isa & HOST_ISA_AVX2) {
+        cmp_copy_accel = cmp_copy_avx2;
+    } else if (isa & HOST_ISA_SSE2) {
+        cmp_copy_accel = cmp_copy_sse2;
+    }
+}
+#else
+static vnc_cmp_copy_fn cmp_copy_accel = cmp_copy_sse2;
+#endif /* CONFIG_AVX2_OPT */
+
+#else
+#define cmp_copy_accel(dst, src, nr, changed) \
+    cmp_copy_int(dst, src, nr, VNC_CMP_CHUNK, changed)
+#endif
+
+int vnc_cmp_copy(void *dst, const void *src, size_t len, size_t chunk,
+                 unsigned long *changed)
+{
+    long nr = len / chunk;
+    size_t tail = len % chunk;
+    int copied;
+
+    if (likely(chunk == VNC_CMP_CHUNK)) {
+        copied = cmp_copy_accel(dst, src, nr, changed);
+    } else {
+        copied = cmp_copy_int(dst, src, nr, chunk, changed);
+    }
+    if (tail && cmp_copy_bytes(dst + nr * chunk, src + nr * chunk, tail)) {
+        set_bit(nr, changed);
+        copied++;
+    }
+    return copied;
+}
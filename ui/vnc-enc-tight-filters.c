@@ -0,0 +1,443 @@
+/*
+ * QEMU VNC display driver: accelerated tight encoding filters
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * The pixel loops of the tight encoder that dominate its profile, kept
+ * free of VncState so that tests/bench can run them on their own:
+ *
+ *  - colour run skipping for the palette detection,
+ *  - the gradient filter for 24 bit true colour,
+ *  - packing of 32 bit pixels into 24 bit RGB.
+ *
+ * The vector versions need the colour channels to be whole bytes, which
+ * is what 24 bit true colour clients use; anything else takes the plain
+ * C path.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/host-utils.h"
+#include "qemu/host-isa.h"
+#include "vnc-enc-tight.h"
+
+typedef struct VncTightAccel {
+    const char *name;
+    size_t (*skip32)(const uint32_t *data, size_t i, size_t count,
+                     uint32_t c);
+    size_t (*skip2_32)(const uint32_t *data, size_t i, size_t count,
+                       uint32_t c0, uint32_t c1, size_t *n0);
+    void (*pack24)(uint8_t *dst, const uint8_t *src, size_t count,
+                   const uint8_t *shuf);
+    void (*gradient24)(uint8_t *buf, uint32_t *cur, uint32_t *prev,
+                       int w, int y, const uint8_t *shuf);
+} VncTightAccel;
+
+static size_t skip32_int(const uint32_t *data, size_t i, size_t count,
+                         uint32_t c)
+{
+    while (i < count && data[i] == c) {
+        i++;
+    }
+    return i;
+}
+
+static size_t skip2_32_int(const uint32_t *data, size_t i, size_t count,
+                           uint32_t c0, uint32_t c1, size_t *n0)
+{
+    for (; i < count; i++) {
+        if (data[i] == c0) {
+            (*n0)++;
+        } else if (data[i] != c1) {
+            break;
+        }
+    }
+    return i;
+}
+
+/*
+ * shuf[c] is the byte of a little endian pixel holding channel c, as set
+ * up by vnc_tight_shuffle().  The plain C versions below cope with any
+ * shift and get the shifts themselves in shuf[4..6] instead.
+ */
+static void pack24_int(uint8_t *dst, const uint8_t *src, size_t count,
+                       const uint8_t *shuf)
+{
+    uint32_t pix;
+
+    while (count--) {
+        pix = ldl_he_p(src);
+        *dst++ = (char)(pix >> shuf[4]);
+        *dst++ = (char)(pix >> shuf[5]);
+        *dst++ = (char)(pix >> shuf[6]);
+        src += 4;
+    }
+}
+
+static void gradient24_row_int(uint8_t *out, const uint32_t *cur,
+                               const uint32_t *prev, int x, int w,
+                               const uint8_t *shuf)
+{
+    int c, here, left, upper, upperleft, prediction;
+
+    for (; x < w; x++) {
+        for (c = 0; c < 3; c++) {
+            here = cur[x] >> shuf[4 + c] & 0xFF;
+            left = cur[x - 1] >> shuf[4 + c] & 0xFF;
+            upper = prev[x] >> shuf[4 + c] & 0xFF;
+            upperleft = prev[x - 1] >> shuf[4 + c] & 0xFF;
+
+            prediction = left + upper - upperleft;
+            if (prediction < 0) {
+                prediction = 0;
+            } else if (prediction > 0xFF) {
+                prediction = 0xFF;
+            }
+            *out++ = (char)(here - prediction);
+        }
+    }
+}
+
+static void gradient24_int(uint8_t *buf, uint32_t *cur, uint32_t *prev,
+                           int w, int y, const uint8_t *shuf)
+{
+    gradient24_row_int(buf + 3 * w * y, cur, prev, 0, w, shuf);
+}
+
+static const VncTightAccel accel_int = {
+    .name = "int",
+    .skip32 = skip32_int,
+    .skip2_32 = skip2_32_int,
+    .pack24 = pack24_int,
+    .gradient24 = gradient24_int,
+};
+
+#ifdef CONFIG_AVX2_OPT
+/* Note that due to restrictions/bugs wrt __builtin functions in gcc <= 4.8,
+ * the includes have to be within the corresponding push_options region, and
+ * therefore the regions themselves have to be ordered with increasing ISA.
+ */
+#pragma GCC push_options
+#pragma GCC target("ssse3")
+#include <tmmintrin.h>
+
+static inline void store12(uint8_t *dst, __m128i v)
+{
+    _mm_storel_epi64((__m128i *)dst, v);
+    stl_he_p(dst + 8, _mm_cvtsi128_si32(_mm_srli_si128(v, 8)));
+}
+
+/* per channel clamp(left + upper - upperleft) subtracted from here */
+static inline __m128i gradient_sse(__m128i here, __m128i left,
+                                   __m128i upper, __m128i upperleft)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo, hi;
+
+    lo = _mm_sub_epi16(_mm_add_epi16(_mm_unpacklo_epi8(left, zero),
+                                     _mm_unpacklo_epi8(upper, zero)),
+                       _mm_unpacklo_epi8(upperleft, zero));
+    hi = _mm_sub_epi16(_mm_add_epi16(_mm_unpackhi_epi8(left, zero),
+                                     _mm_unpackhi_epi8(upper, zero)),
+                       _mm_unpackhi_epi8(upperleft, zero));
+    return _mm_sub_epi8(here, _mm_packus_epi16(lo, hi));
+}
+
+static size_t skip32_ssse3(const uint32_t *data, size_t i, size_t count,
+                           uint32_t c)
+{
+    __m128i vc = _mm_set1_epi32(c);
+    int mask;
+
+    for (; i + 4 <= count; i += 4) {
+        mask = _mm_movemask_ps(_mm_castsi128_ps(
+            _mm_cmpeq_epi32(_mm_loadu_si128((__m128i *)(data + i)), vc)));
+        if (mask != 0xf) {
+            return i + ctz32(~mask);
+        }
+    }
+    return skip32_int(data, i, count, c);
+}
+
+static size_t skip2_32_ssse3(const uint32_t *data, size_t i, size_t count,
+                             uint32_t c0, uint32_t c1, size_t *n0)
+{
+    __m128i v0 = _mm_set1_epi32(c0);
+    __m128i v1 = _mm_set1_epi32(c1);
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((__m128i *)(data + i));
+        __m128i eq0 = _mm_cmpeq_epi32(v, v0);
+        __m128i eq1 = _mm_cmpeq_epi32(v, v1);
+
+        if (_mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(eq0, eq1))) != 0xf) {
+            break;
+        }
+        *n0 += ctpop32(_mm_movemask_ps(_mm_castsi128_ps(eq0)));
+    }
+    return skip2_32_int(data, i, count, c0, c1, n0);
+}
+
+static void pack24_ssse3(uint8_t *dst, const uint8_t *src, size_t count,
+                         const uint8_t *shuf)
+{
+    __m128i mask = _mm_loadu_si128((__m128i *)(shuf + 8));
+
+    /* in place packing is fine, stores stay behind the loads */
+    for (; count >= 4; count -= 4, src += 16, dst += 12) {
+        store12(dst, _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)src), mask));
+    }
+    pack24_int(dst, src, count, shuf);
+}
+
+static void gradient24_ssse3(uint8_t *buf, uint32_t *cur, uint32_t *prev,
+                             int w, int y, const uint8_t *shuf)
+{
+    __m128i mask = _mm_loadu_si128((__m128i *)(shuf + 8));
+    uint8_t *out = buf + 3 * w * y;
+    int x;
+
+    for (x = 0; x + 4 <= w; x += 4, out += 12) {
+        __m128i diff = gradient_sse(_mm_loadu_si128((__m128i *)(cur + x)),
+                                    _mm_loadu_si128((__m128i *)(cur + x - 1)),
+                                    _mm_loadu_si128((__m128i *)(prev + x)),
+                                    _mm_loadu_si128((__m128i *)(prev + x - 1)));
+        store12(out, _mm_shuffle_epi8(diff, mask));
+    }
+    gradient24_row_int(out, cur, prev, x, w, shuf);
+}
+
+static const VncTightAccel accel_ssse3 = {
+    .name = "ssse3",
+    .skip32 = skip32_ssse3,
+    .skip2_32 = skip2_32_ssse3,
+    .pack24 = pack24_ssse3,
+    .gradient24 = gradient24_ssse3,
+};
+
+#pragma GCC pop_options
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static size_t skip32_avx2(const uint32_t *data, size_t i, size_t count,
+                          uint32_t c)
+{
+    __m256i vc = _mm256_set1_epi32(c);
+    int mask;
+
+    for (; i + 8 <= count; i += 8) {
+        mask = _mm256_movemask_ps(_mm256_castsi256_ps(
+            _mm256_cmpeq_epi32(_mm256_loadu_si256((__m256i *)(data + i)),
+                               vc)));
+        if (mask != 0xff) {
+            return i + ctz32(~mask);
+        }
+    }
+    return skip32_int(data, i, count, c);
+}
+
+static size_t skip2_32_avx2(const uint32_t *data, size_t i, size_t count,
+                            uint32_t c0, uint32_t c1, size_t *n0)
+{
+    __m256i v0 = _mm256_set1_epi32(c0);
+    __m256i v1 = _mm256_set1_epi32(c1);
+
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256((__m256i *)(data + i));
+        __m256i eq0 = _mm256_cmpeq_epi32(v, v0);
+        __m256i eq1 = _mm256_cmpeq_epi32(v, v1);
+
+        if (_mm256_movemask_ps(_mm256_castsi256_ps(
+                _mm256_or_si256(eq0, eq1))) != 0xff) {
+            break;
+        }
+        *n0 += ctpop32(_mm256_movemask_ps(_mm256_castsi256_ps(eq0)));
+    }
+    return skip2_32_int(data, i, count, c0, c1, n0);
+}
+
+static void pack24_avx2(uint8_t *dst, const uint8_t *src, size_t count,
+                        const uint8_t *shuf)
+{
+    __m256i mask = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((__m128i *)(shuf + 8)));
+
+    for (; count >= 8; count -= 8, src += 32, dst += 24) {
+        __m256i v = _mm256_shuffle_epi8(
+            _mm256_loadu_si256((__m256i *)src), mask);
+
+        store12(dst, _mm256_castsi256_si128(v));
+        store12(dst + 12, _mm256_extracti128_si256(v, 1));
+    }
+    pack24_ssse3(dst, src, count, shuf);
+}
+
+static void gradient24_avx2(uint8_t *buf, uint32_t *cur, uint32_t *prev,
+                            int w, int y, const uint8_t *shuf)
+{
+    __m256i mask = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((__m128i *)(shuf + 8)));
+    __m256i zero = _mm256_setzero_si256();
+    uint8_t *out = buf + 3 * w * y;
+    int x;
+
+    for (x = 0; x + 8 <= w; x += 8, out += 24) {
+        __m256i here = _mm256_loadu_si256((__m256i *)(cur + x));
+        __m256i left = _mm256_loadu_si256((__m256i *)(cur + x - 1));
+        __m256i upper = _mm256_loadu_si256((__m256i *)(prev + x));
+        __m256i upperleft = _mm256_loadu_si256((__m256i *)(prev + x - 1));
+        __m256i lo, hi, diff;
+
+        /* unpack and packus work per 128 bit lane, so pixels stay put */
+        lo = _mm256_sub_epi16(
+            _mm256_add_epi16(_mm256_unpacklo_epi8(left, zero),
+                             _mm256_unpacklo_epi8(upper, zero)),
+            _mm256_unpacklo_epi8(upperleft, zero));
+        hi = _mm256_sub_epi16(
+            _mm256_add_epi16(_mm256_unpackhi_epi8(left, zero),
+                             _mm256_unpackhi_epi8(upper, zero)),
+            _mm256_unpackhi_epi8(upperleft, zero));
+        diff = _mm256_shuffle_epi8(
+            _mm256_sub_epi8(here, _mm256_packus_epi16(lo, hi)), mask);
+
+        store12(out, _mm256_castsi256_si128(diff));
+        store12(out + 12, _mm256_extracti128_si256(diff, 1));
+    }
+    gradient24_row_int(out, cur, prev, x, w, shuf);
+}
+
+static const VncTightAccel accel_avx2 = {
+    .name = "avx2",
+    .skip32 = skip32_avx2,
+    .skip2_32 = skip2_32_avx2,
+    .pack24 = pack24_avx2,
+    .gradient24 = gradient24_avx2,
+};
+
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+static const HostIsaImpl tight_impls[] = {
+#ifdef CONFIG_AVX2_OPT
+    { HOST_ISA_AVX2, &accel_avx2 },
+    { HOST_ISA_SSSE3, &accel_ssse3 },
+#endif
+    { 0, &accel_int },
+};
+
+static HostIsaDispatch tight_dispatch;
+
+static void __attribute__((constructor)) init_tight_accel(void)
+{
+    host_isa_dispatch_init(&tight_dispatch, tight_impls,
+                           ARRAY_SIZE(tight_impls));
+}
+
+#define ACCEL ((const VncTightAccel *)host_isa_dispatch_get(&tight_dispatch))
+
+/*
+ * Describe the 24 bit layout.  The vector code needs whole byte channels,
+ * shuf[0] tells whether they are.
+ */
+static void vnc_tight_shuffle(uint8_t *shuf, int rshift, int gshift,
+                              int bshift)
+{
+    int shift[3] = { rshift, gshift, bshift };
+    int p, c;
+
+    memset(shuf, 0x80, 24);
+    shuf[0] = true;
+    for (c = 0; c < 3; c++) {
+        shuf[4 + c] = shift[c];
+        if (shift[c] % 8 || shift[c] > 24) {
+            shuf[0] = false;
+        }
+    }
+    for (p = 0; p < 4; p++) {
+        for (c = 0; c < 3; c++) {
+            shuf[8 + p * 3 + c] = p * 4 + shift[c] / 8;
+        }
+    }
+}
+
+size_t vnc_tight_skip32(const uint32_t *data, size_t i, size_t count,
+                        uint32_t c)
+{
+    return ACCEL->skip32(data, i, count, c);
+}
+
+size_t vnc_tight_skip2_32(const uint32_t *data, size_t i, size_t count,
+                          uint32_t c0, uint32_t c1, size_t *n0)
+{
+    return ACCEL->skip2_32(data, i, count, c0, c1, n0);
+}
+
+void vnc_tight_pack24(uint8_t *dst, const uint8_t *src, size_t count,
+                      int rshift, int gshift, int bshift)
+{
+    uint8_t shuf[24];
+
+    vnc_tight_shuffle(shuf, rshift, gshift, bshift);
+    if (shuf[0]) {
+        ACCEL->pack24(dst, src, count, shuf);
+    } else {
+        pack24_int(dst, src, count, shuf);
+    }
+}
+
+void vnc_tight_gradient24(uint8_t *buf, void *scratch, int w, int h,
+                          int rshift, int gshift, int bshift)
+{
+    uint32_t *cur = (uint32_t *)scratch + 1;
+    uint32_t *prev = cur + w + 1;
+    uint32_t *tmp;
+    uint8_t shuf[24];
+    int y;
+
+    vnc_tight_shuffle(shuf, rshift, gshift, bshift);
+
+    /* one leading zero pixel in front of both rows */
+    cur[-1] = prev[-1] = 0;
+    memset(prev, 0, w * 4);
+    for (y = 0; y < h; y++) {
+        /* the filtered row is written over the input, keep the original */
+        memcpy(cur, buf + 4 * w * y, w * 4);
+        if (shuf[0]) {
+            ACCEL->gradient24(buf, cur, prev, w, y, shuf);
+        } else {
+            gradient24_int(buf, cur, prev, w, y, shuf);
+        }
+        tmp = prev;
+        prev = cur;
+        cur = tmp;
+    }
+}
+
+bool vnc_tight_filters_next_accel(void)
+{
+    return host_isa_dispatch_next(&tight_dispatch);
+}
+
+const char *vnc_tight_filters_accel(void)
+{
+    return ACCEL->name;
+}
@@ -338,6 +338,38 @@ tight_detect_smooth_image(VncState *vs, int w, int h)
     return (errors < tight_conf[compression].gradient_threshold);
 }
 
+/*
+ * Skip a run of pixels of colour c, or of colours c0 and c1 counting the
+ * c0 ones.  The 32 bit versions live in vnc-enc-tight-filters.c.
+ */
+#define DEFINE_SKIP_FUNCTIONS(bpp)                                      \
+                                                                        \
+    static size_t                                                       \
+    tight_skip##bpp(const uint##bpp##_t *data, size_t i, size_t count,  \
+                    uint##bpp##_t c) {                                  \
+        while (i < count && data[i] == c)                               \
+            i++;                                                        \
+        return i;                                                       \
+    }                                                                   \
+                                                                        \
+    static size_t                                                       \
+    tight_skip2_##bpp(const uint##bpp##_t *data, size_t i, size_t count, \
+                      uint##bpp##_t c0, uint##bpp##_t c1, size_t *n0) { \
+        for (; i < count; i++) {                                        \
+            if (data[i] == c0) {                                        \
+                (*n0)++;                                                \
+            } else if (data[i] != c1) {                                 \
+                break;                                                  \
+            }                                                           \
+        }                                                               \
+        return i;                                                       \
+    }
+
+DEFINE_SKIP_FUNCTIONS(8)
+DEFINE_SKIP_FUNCTIONS(16)
+#define tight_skip32 vnc_tight_skip32
+#define tight_skip2_32 vnc_tight_skip2_32
+
 /*
  * Code to determine how many different colors used in rectangle.
  */
@@ -350,14 +382,12 @@ tight_detect_smooth_image(VncState *vs, int w, int h)
                             VncPalette *palette) {                      \
         uint##bpp##_t *data;                                            \
         uint##bpp##_t c0, c1, ci;                                       \
-        int i, n0, n1;                                                  \
+        size_t i, n0, n1, start;                                        \
                                                                         \
         data = (uint##bpp##_t *)vs->tight->tight.buffer;                \
                                                                         \
         c0 = data[0];                                                   \
-        i = 1;                                                          \
-        while (i < count && data[i] == c0)                              \
-            i++;                                                        \
+        i = tight_skip##bpp(data, 1, count, c0);                        \
         if (i >= count) {                                               \
             *bg = *fg = c0;                                             \
             return 1;                                                   \
@@ -369,16 +399,9 @@ tight_detect_smooth_image(VncState *vs, int w, int h)
                                                                         \
         n0 = i;                                                         \
         c1 = data[i];                                                   \
-        n1 = 0;                                                         \
-        for (i++; i < count; i++) {                                     \
-            ci = data[i];                                               \
-            if (ci == c0) {                                             \
-                n0++;                                                   \
-            } else if (ci == c1) {                                      \
-                n1++;                                                   \
-            } else                                                      \
-                break;                                                  \
-        }                                                               \
+        start = i + 1;                                                  \
+        i = tight_skip2_##bpp(data, start, count, c0, c1, &n0);         \
+        n1 = (i - start) - (n0 - (start - 1));                          \
         if (i >= count) {                                               \
             if (n0 > n1) {                                              \
                 *bg = (uint32_t)c0;                                     \
@@ -394,19 +417,20 @@ tight_detect_smooth_image(VncState *vs, int w, int h)
             return 0;                                                   \
         }                                                               \
                                                                         \
+        ci = data[i];                                                   \
         palette_init(palette, max, bpp);                                \
         palette_put(palette, c0);                                       \
         palette_put(palette, c1);                                       \
         palette_put(palette, ci);                                       \
                                                                         \
         for (i++; i < count; i++) {                                     \
-            if (data[i] == ci) {                                        \
-                continue;                                               \
-            } else {                                                    \
-                ci = data[i];                                           \
-                if (!palette_put(palette, (uint32_t)ci)) {              \
-                    return 0;                                           \
-                }                                                       \
+            i = tight_skip##bpp(data, i, count, ci);                    \
+            if (i >= count) {                                           \
+                break;                                                  \
+            }                                                           \
+            ci = data[i];                                               \
+            if (!palette_put(palette, (uint32_t)ci)) {                  \
+                return 0;                                               \
             }                                                           \
         }                                                               \
                                                                         \
@@ -549,55 +573,11 @@ DEFINE_MONO_ENCODE_FUNCTION(32)
 static void
 tight_filter_gradient24(VncState *vs, uint8_t *buf, int w, int h)
 {
-    uint32_t *buf32;
-    uint32_t pix32;
-    int shift[3];
-    int *prev;
-    int here[3], upper[3], left[3], upperleft[3];
-    int prediction;
-    int x, y, c;
-
-    buf32 = (uint32_t *)buf;
-    memset(vs->tight->gradient.buffer, 0, w * 3 * sizeof(int));
-
-    if (1 /* FIXME */) {
-        shift[0] = vs->client_pf.rshift;
-        shift[1] = vs->client_pf.gshift;
-        shift[2] = vs->client_pf.bshift;
-    } else {
-        shift[0] = 24 - vs->client_pf.rshift;
-        shift[1] = 24 - vs->client_pf.gshift;
-        shift[2] = 24 - vs->client_pf.bshift;
-    }
-
-    for (y = 0; y < h; y++) {
-        for (c = 0; c < 3; c++) {
-            upper[c] = 0;
-            here[c] = 0;
-        }
-        prev = (int *)vs->tight->gradient.buffer;
-        for (x = 0; x < w; x++) {
-            pix32 = *buf32++;
-            for (c = 0; c < 3; c++) {
-                upperleft[c] = upper[c];
-                left[c] = here[c];
-                upper[c] = *prev;
-                here[c] = (int)(pix32 >> shift[c] & 0xFF);
-                *prev++ = here[c];
-
-                prediction = left[c] + upper[c] - upperleft[c];
-                if (prediction < 0) {
-                    prediction = 0;
-                } else if (prediction > 0xFF) {
-                    prediction = 0xFF;
-                }
-                *buf++ = (char)(here[c] - prediction);
-            }
-        }
-    }
+    vnc_tight_gradient24(buf, vs->tight->gradient.buffer, w, h,
+                         vs->client_pf.rshift, vs->client_pf.gshift,
+                         vs->client_pf.bshift);
 }
 
-
 /*
  * ``Gradient'' filter for other color depths.
  */
@@ -885,33 +865,12 @@ static int tight_compress_data(VncState *vs, int stream_id, size_t bytes,
  */
 static void tight_pack24(VncState *vs, uint8_t *buf, size_t count, size_t *ret)
 {
-    uint8_t *buf8;
-    uint32_t pix;
-    int rshift, gshift, bshift;
-
-    buf8 = buf;
-
-    if (1 /* FIXME */) {
-        rshift = vs->client_pf.rshift;
-        gshift = vs->client_pf.gshift;
-        bshift = vs->client_pf.bshift;
-    } else {
-        rshift = 24 - vs->client_pf.rshift;
-        gshift = 24 - vs->client_pf.gshift;
-        bshift = 24 - vs->client_pf.bshift;
-    }
-
     if (ret) {
         *ret = count * 3;
     }
 
-    while (count--) {
-        pix = ldl_he_p(buf8);
-        *buf++ = (char)(pix >> rshift);
-        *buf++ = (char)(pix >> gshift);
-        *buf++ = (char)(pix >> bshift);
-        buf8 += 4;
-    }
+    vnc_tight_pack24(buf, buf, count, vs->client_pf.rshift,
+                     vs->client_pf.gshift, vs->client_pf.bshift);
 }
 
 static int send_full_color_rect(VncState *vs, int x, int y, int w, int h)
@@ -1051,7 +1010,7 @@ static bool send_gradient_rect(VncState *vs, int x, int y, int w, int h)
     vnc_write_u8(vs, (stream | VNC_TIGHT_EXPLICIT_FILTER) << 4);
     vnc_write_u8(vs, VNC_TIGHT_FILTER_GRADIENT);
 
-    buffer_reserve(&vs->tight->gradient, w * 3 * sizeof(int));
+    buffer_reserve(&vs->tight->gradient, (w + 1) * 3 * sizeof(int));
 
     if (vs->tight->pixel24) {
         tight_filter_gradient24(vs, vs->tight->tight.buffer, w, h);
@@ -1489,7 +1448,8 @@ static int send_sub_rect(VncState *vs, int x, int y, int w, int h)
     vnc_tight_stop(vs);
 
 #ifdef CONFIG_VNC_JPEG
-    if (!vs->vd->non_adaptive && vs->tight->quality != (uint8_t)-1) {
+    if (!vs->vd->non_adaptive && !vs->lossless &&
+        vs->tight->quality != (uint8_t)-1) {
         double freq = vnc_update_freq(vs, x, y, w, h);
 
         if (freq < tight_jpeg_conf[vs->tight->quality].jpeg_freq_min) {
@@ -1505,7 +1465,7 @@ static int send_sub_rect(VncState *vs, int x, int y, int w, int h)
     colors = tight_fill_palette(vs, x, y, w * h, &bg, &fg, color_count_palette);
 
 #ifdef CONFIG_VNC_JPEG
-    if (allow_jpeg && vs->tight->quality != (uint8_t)-1) {
+    if (allow_jpeg && !vs->lossless && vs->tight->quality != (uint8_t)-1) {
         ret = send_sub_rect_jpeg(vs, x, y, w, h, bg, fg, colors,
                                  color_count_palette, force_jpeg);
     } else {
@@ -1656,7 +1616,7 @@ static int tight_send_framebuffer_update(VncState *vs, int x, int y,
     }
 
 #ifdef CONFIG_VNC_JPEG
-    if (vs->tight->quality != (uint8_t)-1) {
+    if (!vs->lossless && vs->tight->quality != (uint8_t)-1) {
         double freq = vnc_update_freq(vs, x, y, w, h);
 
         if (freq > tight_jpeg_conf[vs->tight->quality].jpeg_freq_threshold) {
@@ -180,4 +180,17 @@
 #define VNC_TIGHT_DETECT_MIN_WIDTH           8
 #define VNC_TIGHT_DETECT_MIN_HEIGHT          8
 
+/* vnc-enc-tight-filters.c */
+size_t vnc_tight_skip32(const uint32_t *data, size_t i, size_t count,
+                        uint32_t c);
+size_t vnc_tight_skip2_32(const uint32_t *data, size_t i, size_t count,
+                          uint32_t c0, uint32_t c1, size_t *n0);
+void vnc_tight_pack24(uint8_t *dst, const uint8_t *src, size_t count,
+                      int rshift, int gshift, int bshift);
+/* scratch must hold 2 * (w + 1) pixels */
+void vnc_tight_gradient24(uint8_t *buf, void *scratch, int w, int h,
+                          int rshift, int gshift, int bshift);
+bool vnc_tight_filters_next_accel(void);
+const char *vnc_tight_filters_accel(void);
+
 #endif /* VNC_ENC_TIGHT_H */
@@ -0,0 +1,206 @@
+/*
+ * QEMU VNC display driver: per tile encoding selection
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * With tile-encoding=on an update is cut along the VNC_STAT_RECT grid and
+ * every tile is sent with the encoding that suits its content, among those
+ * the client announced:
+ *
+ *  - few colours (text, UI): tight, whose palette and mono filters handle
+ *    them best, or ZRLE;
+ *  - many colours and smooth, or updated often: tight with JPEG when the
+ *    client accepts lossy updates, lossless tight or ZRLE otherwise;
+ *  - many colours and noisy: raw for clients preferring raw or hextile,
+ *    which compression would not help much, ZRLE otherwise.
+ */
+
+#include "qemu/osdep.h"
+#include "vnc.h"
+#include "trace.h"
+
+/* Colours are only counted up to this */
+#define VNC_TILE_MAX_COLORS     256
+/* At most this many colours make a tile palette friendly */
+#define VNC_TILE_PALETTE_COLORS 16
+/* Mean gradient predictor error per channel above which a tile is noisy */
+#define VNC_TILE_NOISE          24
+/* Update frequency (Hz) from which lossy encoding is preferred */
+#define VNC_TILE_FREQ           5.0
+
+typedef enum VncTileEncoding {
+    VNC_TILE_RAW,
+    VNC_TILE_HEXTILE,
+    VNC_TILE_TIGHT,
+    VNC_TILE_TIGHT_JPEG,
+    VNC_TILE_ZRLE,
+} VncTileEncoding;
+
+typedef struct VncTileInfo {
+    int colors;     /* VNC_TILE_MAX_COLORS + 1 if more */
+    int error;      /* mean gradient predictor error per channel */
+    double freq;
+} VncTileInfo;
+
+static int vnc_tile_count_colors(VncDisplay *vd, int x, int y, int w, int h)
+{
+    uint32_t table[VNC_TILE_MAX_COLORS * 2];
+    bool used[VNC_TILE_MAX_COLORS * 2] = {};
+    int colors = 0, i, j;
+
+    for (j = 0; j < h; j++) {
+        uint32_t *row = vnc_server_fb_ptr(vd, x, y + j);
+
+        for (i = 0; i < w; i++) {
+            uint32_t pix = row[i] & 0xffffff;
+            unsigned slot = (pix * 2654435761u) >> 23;
+
+            while (used[slot] && table[slot] != pix) {
+                slot = (slot + 1) % ARRAY_SIZE(table);
+            }
+            if (used[slot]) {
+                continue;
+            }
+            if (++colors > VNC_TILE_MAX_COLORS) {
+                return colors;
+            }
+            used[slot] = true;
+            table[slot] = pix;
+        }
+    }
+    return colors;
+}
+
+static int vnc_tile_gradient_error(VncDisplay *vd, int x, int y, int w, int h)
+{
+    uint64_t error = 0;
+    int i, j, c;
+
+    if (w < 2 || h < 2) {
+        return 0;
+    }
+    for (j = 1; j < h; j++) {
+        uint8_t *above = vnc_server_fb_ptr(vd, x, y + j - 1);
+        uint8_t *row = vnc_server_fb_ptr(vd, x, y + j);
+
+        for (i = 4; i < w * 4; i += 4) {
+            for (c = 0; c < 3; c++) {
+                int pred = row[i - 4 + c] + above[i + c] - above[i - 4 + c];
+
+                error += abs(row[i + c] - MAX(0, MIN(255, pred)));
+            }
+        }
+    }
+    return error / ((uint64_t)(w - 1) * (h - 1) * 3);
+}
+
+static bool vnc_tile_lossy(VncState *vs)
+{
+#ifdef CONFIG_VNC_JPEG
+    return vs->vd->lossy && vnc_has_feature(vs, VNC_FEATURE_TIGHT) &&
+        vs->tight->quality != (uint8_t)-1;
+#else
+    return false;
+#endif
+}
+
+static VncTileEncoding vnc_tile_choose(VncState *vs, VncTileInfo *info)
+{
+    bool tight = vnc_has_feature(vs, VNC_FEATURE_TIGHT);
+    bool zrle = vnc_has_feature(vs, VNC_FEATURE_ZRLE);
+    bool hextile = vnc_has_feature(vs, VNC_FEATURE_HEXTILE);
+
+    if (info->colors <= VNC_TILE_PALETTE_COLORS) {
+        return tight ? VNC_TILE_TIGHT :
+            zrle ? VNC_TILE_ZRLE :
+            hextile ? VNC_TILE_HEXTILE : VNC_TILE_RAW;
+    }
+
+    if (vnc_tile_lossy(vs) &&
+        (info->freq >= VNC_TILE_FREQ ||
+         (info->colors > VNC_TILE_MAX_COLORS &&
+          info->error < VNC_TILE_NOISE))) {
+        return VNC_TILE_TIGHT_JPEG;
+    }
+
+    if (info->error >= VNC_TILE_NOISE) {
+        if (vs->vnc_encoding == VNC_ENCODING_RAW ||
+            vs->vnc_encoding == VNC_ENCODING_HEXTILE) {
+            return VNC_TILE_RAW;
+        }
+        return zrle ? VNC_TILE_ZRLE :
+            tight ? VNC_TILE_TIGHT : VNC_TILE_RAW;
+    }
+
+    return tight ? VNC_TILE_TIGHT :
+        zrle ? VNC_TILE_ZRLE :
+        hextile ? VNC_TILE_HEXTILE : VNC_TILE_RAW;
+}
+
+static int vnc_tile_send(VncState *vs, int x, int y, int w, int h)
+{
+    VncTileInfo info;
+    VncTileEncoding enc;
+    int n;
+
+    info.colors = vnc_tile_count_colors(vs->vd, x, y, w, h);
+    info.error = info.colors > VNC_TILE_PALETTE_COLORS ?
+        vnc_tile_gradient_error(vs->vd, x, y, w, h) : 0;
+    info.freq = vs->vd->non_adaptive ? 0 : vnc_update_freq(vs, x, y, w, h);
+
+    enc = vnc_tile_choose(vs, &info);
+    trace_vnc_tile_encoding(vs, x, y, w, h, info.colors, info.error, enc);
+
+    switch (enc) {
+    case VNC_TILE_HEXTILE:
+        vnc_framebuffer_update(vs, x, y, w, h, VNC_ENCODING_HEXTILE);
+        return vnc_hextile_send_framebuffer_update(vs, x, y, w, h);
+    case VNC_TILE_TIGHT:
+        vs->lossless = true;
+        n = vnc_tight_send_framebuffer_update(vs, x, y, w, h);
+        vs->lossless = false;
+        return n;
+    case VNC_TILE_TIGHT_JPEG:
+        return vnc_tight_send_framebuffer_update(vs, x, y, w, h);
+    case VNC_TILE_ZRLE:
+        return vnc_zrle_send_framebuffer_update(vs, x, y, w, h);
+    case VNC_TILE_RAW:
+    default:
+        vnc_framebuffer_update(vs, x, y, w, h, VNC_ENCODING_RAW);
+        return vnc_raw_send_framebuffer_update(vs, x, y, w, h);
+    }
+}
+
+int vnc_tile_send_framebuffer_update(VncState *vs, int x, int y, int w, int h)
+{
+    int tx, ty, tw, th, n = 0;
+
+    for (ty = y; ty < y + h; ty += th) {
+        th = MIN(QEMU_ALIGN_DOWN(ty + VNC_STAT_RECT, VNC_STAT_RECT),
+                 y + h) - ty;
+        for (tx = x; tx < x + w; tx += tw) {
+            tw = MIN(QEMU_ALIGN_DOWN(tx + VNC_STAT_RECT, VNC_STAT_RECT),
+                     x + w) - tx;
+            n += vnc_tile_send(vs, tx, ty, tw, th);
+        }
+    }
+    return n;
+}
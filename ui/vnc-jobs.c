@@ -35,6 +35,15 @@
 #include "trace.h"
 
 /*
+ * Workers:
+ *
+ * A pool of worker threads serves the jobs of all clients.  Jobs of one
+ * client are encoded one at a time and in order, since most encodings
+ * keep state (zlib streams) across updates, but jobs of different
+ * clients run in parallel.  With the stateless raw and hextile encodings
+ * a worker also splits large updates into bands, which idle workers
+ * encode into separate buffers that are then appended in order.
+ *
  * Locking:
  *
  * There are three levels of locking:
@@ -53,19 +62,36 @@
  * and copy its output buffer in vs->output.
  */
 
+typedef struct VncTileTask {
+    VncState *orig;
+    VncRect *rects;
+    int nr_rects;
+    int n_rectangles;
+    Buffer output;
+    bool started;
+    bool done;
+    QTAILQ_ENTRY(VncTileTask) next;
+} VncTileTask;
+
 struct VncJobQueue {
     QemuCond cond;
     QemuMutex mutex;
-    QemuThread thread;
+    int nr_workers;
     bool exit;
     QTAILQ_HEAD(, VncJob) jobs;
+    QTAILQ_HEAD(, VncTileTask) tiles;
 };
 
 typedef struct VncJobQueue VncJobQueue;
 
+/* Height of the bands large updates are split into, a hextile multiple */
+#define VNC_TILE_ROWS 64
+/* Updates smaller than this are not worth splitting */
+#define VNC_TILE_MIN_PIXELS (256 * 256)
+
 /*
- * We use a single global queue, but most of the functions are
- * already reentrant, so we can easily add more than one encoding thread
+ * A single global queue is shared by all displays and served by
+ * the whole worker pool.
  */
 static VncJobQueue *queue;
 
@@ -111,7 +137,8 @@ int vnc_job_add_rect(VncJob *job, int x, int y, int w, int h)
 void vnc_job_push(VncJob *job)
 {
     vnc_lock_queue(queue);
-    if (queue->exit || QLIST_EMPTY(&job->rectangles)) {
+    if (queue->exit ||
+        (QLIST_EMPTY(&job->rectangles) && !job->copy.pending)) {
         g_free(job);
     } else {
         QTAILQ_INSERT_TAIL(&queue->jobs, job, next);
@@ -142,6 +169,16 @@ void vnc_jobs_join(VncState *vs)
     vnc_jobs_consume_buffer(vs);
 }
 
+bool vnc_has_job(VncState *vs)
+{
+    bool ret;
+
+    vnc_lock_queue(queue);
+    ret = vnc_has_job_locked(vs);
+    vnc_unlock_queue(queue);
+    return ret;
+}
+
 void vnc_jobs_consume_buffer(VncState *vs)
 {
     bool flush;
@@ -235,27 +272,193 @@ static bool vnc_worker_clamp_rect(VncState *vs, VncJob *job, VncRect *rect)
     return false;
 }
 
+/* Encodings without state carried from one rectangle to the next */
+static bool vnc_encoding_is_stateless(int encoding)
+{
+    switch (encoding) {
+    case VNC_ENCODING_ZLIB:
+    case VNC_ENCODING_TIGHT:
+    case VNC_ENCODING_TIGHT_PNG:
+    case VNC_ENCODING_ZRLE:
+    case VNC_ENCODING_ZYWRLE:
+        return false;
+    default:
+        return true;
+    }
+}
+
+static void vnc_tile_task_run(VncTileTask *task)
+{
+    VncState vs = {};
+    int i, n;
+
+    vnc_async_encoding_start(task->orig, &vs);
+    vs.magic = VNC_MAGIC;
+
+    for (i = 0; i < task->nr_rects; i++) {
+        n = vnc_send_framebuffer_update(&vs, task->rects[i].x,
+                                        task->rects[i].y,
+                                        task->rects[i].w,
+                                        task->rects[i].h);
+        if (n >= 0) {
+            task->n_rectangles += n;
+        }
+    }
+
+    buffer_move(&task->output, &vs.output);
+    buffer_free(&vs.output);
+    vs.magic = 0;
+}
+
+static bool vnc_tile_task_claim_locked(VncJobQueue *queue, VncTileTask *task)
+{
+    if (task->started) {
+        return false;
+    }
+    task->started = true;
+    QTAILQ_REMOVE(&queue->tiles, task, next);
+    return true;
+}
+
+/*
+ * Encode the rectangles of a job in bands spread over the worker pool,
+ * appending the results to vs->output in the original order.  Called
+ * with the display lock held, which covers the helpers as well.
+ */
+static int vnc_worker_encode_tiles(VncJobQueue *queue, VncJob *job,
+                                   VncState *vs)
+{
+    g_autoptr(GArray) bands = g_array_new(false, false, sizeof(VncRect));
+    VncRectEntry *entry, *tmp;
+    VncTileTask *tasks;
+    int64_t pixels = 0;
+    int i, ntasks, per_task, n_rectangles = 0;
+    VncRect band;
+
+    QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
+        if (vnc_worker_clamp_rect(vs, job, &entry->rect)) {
+            band = entry->rect;
+            for (band.y = entry->rect.y;
+                 band.y < entry->rect.y + entry->rect.h;
+                 band.y += VNC_TILE_ROWS) {
+                band.h = MIN(VNC_TILE_ROWS,
+                             entry->rect.y + entry->rect.h - band.y);
+                g_array_append_val(bands, band);
+            }
+            pixels += entry->rect.w * entry->rect.h;
+        }
+        QLIST_REMOVE(entry, next);
+        g_free(entry);
+    }
+
+    vnc_lock_queue(queue);
+    ntasks = MIN(queue->nr_workers, bands->len);
+    vnc_unlock_queue(queue);
+    if (pixels < VNC_TILE_MIN_PIXELS) {
+        ntasks = MIN(ntasks, 1);
+    }
+    if (!ntasks) {
+        return 0;
+    }
+
+    tasks = g_new0(VncTileTask, ntasks);
+    per_task = DIV_ROUND_UP(bands->len, ntasks);
+    for (i = 0; i < ntasks; i++) {
+        tasks[i].orig = vs;
+        tasks[i].rects = &g_array_index(bands, VncRect, i * per_task);
+        tasks[i].nr_rects = MIN(per_task, (int)bands->len - i * per_task);
+    }
+
+    vnc_lock_queue(queue);
+    for (i = 1; i < ntasks; i++) {
+        QTAILQ_INSERT_TAIL(&queue->tiles, &tasks[i], next);
+    }
+    qemu_cond_broadcast(&queue->cond);
+    vnc_unlock_queue(queue);
+
+    vnc_tile_task_run(&tasks[0]);
+
+    /* run whatever the other workers have not picked up yet */
+    vnc_lock_queue(queue);
+    for (i = 1; i < ntasks; i++) {
+        if (vnc_tile_task_claim_locked(queue, &tasks[i])) {
+            vnc_unlock_queue(queue);
+            vnc_tile_task_run(&tasks[i]);
+            vnc_lock_queue(queue);
+            tasks[i].done = true;
+        }
+        while (!tasks[i].done) {
+            qemu_cond_wait(&queue->cond, &queue->mutex);
+        }
+    }
+    vnc_unlock_queue(queue);
+
+    for (i = 0; i < ntasks; i++) {
+        buffer_move(&vs->output, &tasks[i].output);
+        n_rectangles += tasks[i].n_rectangles;
+    }
+    trace_vnc_job_tiles(vs, job, bands->len, ntasks);
+    g_free(tasks);
+    return n_rectangles;
+}
+
+/* The oldest job not queued behind another one of the same client */
+static VncJob *vnc_next_job_locked(VncJobQueue *queue)
+{
+    VncJob *job, *prev;
+
+    QTAILQ_FOREACH(job, &queue->jobs, next) {
+        if (job->running) {
+            continue;
+        }
+        QTAILQ_FOREACH(prev, &queue->jobs, next) {
+            if (prev == job || prev->vs == job->vs) {
+                break;
+            }
+        }
+        if (prev == job) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
 static int vnc_worker_thread_loop(VncJobQueue *queue)
 {
     VncJob *job;
+    VncTileTask *task;
     VncRectEntry *entry, *tmp;
     VncState vs = {};
     int n_rectangles;
     int saved_offset;
 
     vnc_lock_queue(queue);
-    while (QTAILQ_EMPTY(&queue->jobs) && !queue->exit) {
+    for (;;) {
+        if (queue->exit) {
+            vnc_unlock_queue(queue);
+            return -1;
+        }
+        /* help with a split update first, its owner is waiting */
+        task = QTAILQ_FIRST(&queue->tiles);
+        if (task) {
+            vnc_tile_task_claim_locked(queue, task);
+            vnc_unlock_queue(queue);
+            vnc_tile_task_run(task);
+            vnc_lock_queue(queue);
+            task->done = true;
+            qemu_cond_broadcast(&queue->cond);
+            continue;
+        }
+        job = vnc_next_job_locked(queue);
+        if (job) {
+            break;
+        }
         qemu_cond_wait(&queue->cond, &queue->mutex);
     }
-    /* Here job can only be NULL if queue->exit is true */
-    job = QTAILQ_FIRST(&queue->jobs);
+    job->running = true;
     vnc_unlock_queue(queue);
     assert(job->vs->magic == VNC_MAGIC);
 
-    if (queue->exit) {
-        return -1;
-    }
-
     vnc_lock_output(job->vs);
     if (job->vs->ioc == NULL || job->vs->abort == true) {
         vnc_unlock_output(job->vs);
@@ -282,7 +485,26 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     saved_offset = vs.output.offset;
     vnc_write_u16(&vs, 0);
 
+    /* the rectangles are relative to the content after the copy */
+    if (job->copy.pending) {
+        vnc_framebuffer_update(&vs, job->copy.dst.x, job->copy.dst.y,
+                               job->copy.dst.w, job->copy.dst.h,
+                               VNC_ENCODING_COPYRECT);
+        vnc_write_u16(&vs, job->copy.src_x);
+        vnc_write_u16(&vs, job->copy.src_y);
+        n_rectangles++;
+    }
+
     vnc_lock_display(job->vs->vd);
+    if (vnc_encoding_is_stateless(vs.vnc_encoding) &&
+        !vs.vd->tile_encoding && queue->nr_workers > 1) {
+        if (job->vs->ioc == NULL) {
+            vnc_unlock_display(job->vs->vd);
+            vnc_async_encoding_end(job->vs, &vs);
+            goto disconnected;
+        }
+        n_rectangles += vnc_worker_encode_tiles(queue, job, &vs);
+    }
     QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
         int n;
 
@@ -341,6 +563,7 @@ static VncJobQueue *vnc_queue_init(void)
     qemu_cond_init(&queue->cond);
     qemu_mutex_init(&queue->mutex);
     QTAILQ_INIT(&queue->jobs);
+    QTAILQ_INIT(&queue->tiles);
     return queue;
 }
 
@@ -355,28 +578,33 @@ static void vnc_queue_clear(VncJobQueue *q)
 static void *vnc_worker_thread(void *arg)
 {
     VncJobQueue *queue = arg;
-
-    qemu_thread_get_self(&queue->thread);
+    bool last;
 
     while (!vnc_worker_thread_loop(queue)) ;
-    vnc_queue_clear(queue);
-    return NULL;
-}
 
-static bool vnc_worker_thread_running(void)
-{
-    return queue; /* Check global queue */
+    vnc_lock_queue(queue);
+    last = --queue->nr_workers == 0;
+    vnc_unlock_queue(queue);
+    if (last) {
+        vnc_queue_clear(queue);
+    }
+    return NULL;
 }
 
-void vnc_start_worker_thread(void)
+/* Grow the pool to at least nr_workers threads */
+void vnc_start_worker_thread(int nr_workers)
 {
-    VncJobQueue *q;
+    QemuThread thread;
 
-    if (vnc_worker_thread_running())
-        return ;
+    if (!queue) {
+        queue = vnc_queue_init(); /* Set global queue */
+    }
 
-    q = vnc_queue_init();
-    qemu_thread_create(&q->thread, "vnc_worker", vnc_worker_thread, q,
-                       QEMU_THREAD_DETACHED);
-    queue = q; /* Set global queue */
+    vnc_lock_queue(queue);
+    while (queue->nr_workers < nr_workers) {
+        queue->nr_workers++;
+        qemu_thread_create(&thread, "vnc_worker", vnc_worker_thread, queue,
+                           QEMU_THREAD_DETACHED);
+    }
+    vnc_unlock_queue(queue);
 }
@@ -35,9 +35,12 @@ VncJob *vnc_job_new(VncState *vs);
 int vnc_job_add_rect(VncJob *job, int x, int y, int w, int h);
 void vnc_job_push(VncJob *job);
 void vnc_jobs_join(VncState *vs);
+bool vnc_has_job(VncState *vs);
 
 void vnc_jobs_consume_buffer(VncState *vs);
-void vnc_start_worker_thread(void);
+#define VNC_MAX_ENCODE_THREADS 64
+
+void vnc_start_worker_thread(int nr_workers);
 
 /* Locks */
 static inline int vnc_trylock_display(VncDisplay *vd)
@@ -52,6 +52,7 @@
 #include "crypto/random.h"
 #include "crypto/secret_common.h"
 #include "qom/object_interfaces.h"
+#include "qemu/bswap.h"
 #include "qemu/cutils.h"
 #include "qemu/help_option.h"
 #include "io/dns-resolver.h"
@@ -648,13 +649,56 @@ static int vnc_height(VncDisplay *vd)
     return MIN(VNC_MAX_HEIGHT, surface_height(vd->ds));
 }
 
-static void vnc_set_area_dirty(DECLARE_BITMAP(dirty[VNC_MAX_HEIGHT],
-                               VNC_MAX_WIDTH / VNC_DIRTY_PIXELS_PER_BIT),
-                               VncDisplay *vd,
-                               int x, int y, int w, int h)
+static void vnc_dirty_map_resize(VncDirtyMap *map, int width, int height)
 {
-    int width = vnc_width(vd);
-    int height = vnc_height(vd);
+    int bpl = ROUND_UP(DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT),
+                       BITS_PER_LONG);
+
+    if (map->bpl != bpl || map->height != height) {
+        g_free(map->bits);
+        g_free(map->summary);
+        map->bits = bitmap_new((long)bpl * height);
+        map->summary = bitmap_new(height);
+        map->bpl = bpl;
+        map->height = height;
+    } else {
+        bitmap_zero(map->bits, (long)bpl * height);
+        bitmap_zero(map->summary, height);
+    }
+    map->width = ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
+}
+
+static void vnc_dirty_map_free(VncDirtyMap *map)
+{
+    g_free(map->bits);
+    g_free(map->summary);
+    memset(map, 0, sizeof(*map));
+}
+
+static void vnc_dirty_map_set(VncDirtyMap *map, int y, long x, long nr)
+{
+    bitmap_set(vnc_dirty_row(map, y), x, nr);
+    set_bit(y, map->summary);
+}
+
+/* First row at or after y with dirty bits, map->height if there is none */
+static int vnc_dirty_map_next_row(VncDirtyMap *map, int y)
+{
+    for (y = find_next_bit(map->summary, map->height, y);
+         y < map->height;
+         y = find_next_bit(map->summary, map->height, y + 1)) {
+        if (find_first_bit(vnc_dirty_row(map, y), map->bpl) < map->bpl) {
+            break;
+        }
+        clear_bit(y, map->summary);
+    }
+    return y;
+}
+
+static void vnc_set_area_dirty(VncDirtyMap *map, int x, int y, int w, int h)
+{
+    int width = map->width;
+    int height = map->height;
 
     /* this is needed this to ensure we updated all affected
      * blocks if x % VNC_DIRTY_PIXELS_PER_BIT != 0 */
@@ -667,8 +711,8 @@ static void vnc_set_area_dirty(DECLARE_BITMAP(dirty[VNC_MAX_HEIGHT],
     h = MIN(y + h, height);
 
     for (; y < h; y++) {
-        bitmap_set(dirty[y], x / VNC_DIRTY_PIXELS_PER_BIT,
-                   DIV_ROUND_UP(w, VNC_DIRTY_PIXELS_PER_BIT));
+        vnc_dirty_map_set(map, y, x / VNC_DIRTY_PIXELS_PER_BIT,
+                          DIV_ROUND_UP(w, VNC_DIRTY_PIXELS_PER_BIT));
     }
 }
 
@@ -678,7 +722,7 @@ static void vnc_dpy_update(DisplayChangeListener *dcl,
     VncDisplay *vd = container_of(dcl, VncDisplay, dcl);
     struct VncSurface *s = &vd->guest;
 
-    vnc_set_area_dirty(s->dirty, vd, x, y, w, h);
+    vnc_set_area_dirty(&s->dirty, x, y, w, h);
 }
 
 void vnc_framebuffer_update(VncState *vs, int x, int y, int w, int h,
@@ -814,9 +858,38 @@ static void vnc_update_server_surface(VncDisplay *vd)
                                           width, height,
                                           NULL, 0);
 
-    memset(vd->guest.dirty, 0x00, sizeof(vd->guest.dirty));
-    vnc_set_area_dirty(vd->guest.dirty, vd, 0, 0,
-                       width, height);
+    vnc_dirty_map_resize(&vd->guest.dirty, width, height);
+    vnc_set_area_dirty(&vd->guest.dirty, 0, 0, width, height);
+}
+
+static void vnc_resize_stats(VncDisplay *vd)
+{
+    int rows = MAX(1, DIV_ROUND_UP(vnc_height(vd), VNC_STAT_RECT));
+    int cols = MAX(1, DIV_ROUND_UP(vnc_width(vd), VNC_STAT_RECT));
+
+    if (rows == vd->guest.stat_rows && cols == vd->guest.stat_cols) {
+        return;
+    }
+    g_free(vd->guest.stats);
+    vd->guest.stats = g_new0(VncRectStat, rows * cols);
+    vd->guest.stat_rows = rows;
+    vd->guest.stat_cols = cols;
+}
+
+static void vnc_alloc_lossy_rect(VncState *vs)
+{
+    struct VncSurface *s = &vs->vd->guest;
+    uint8_t *row;
+    int i;
+
+    /* row pointers followed by the rows themselves */
+    g_free(vs->lossy_rect);
+    vs->lossy_rect = g_malloc0(s->stat_rows *
+                               (sizeof(*vs->lossy_rect) + s->stat_cols));
+    row = (uint8_t *)(vs->lossy_rect + s->stat_rows);
+    for (i = 0; i < s->stat_rows; i++) {
+        vs->lossy_rect[i] = row + i * s->stat_cols;
+    }
 }
 
 static bool vnc_check_pageflip(DisplaySurface *s1,
@@ -851,7 +924,7 @@ static void vnc_dpy_switch(DisplayChangeListener *dcl,
                                       surface_width(surface),
                                       surface_height(surface),
                                       surface_format(surface));
-        vnc_set_area_dirty(vd->guest.dirty, vd, 0, 0,
+        vnc_set_area_dirty(&vd->guest.dirty, 0, 0,
                            surface_width(surface),
                            surface_height(surface));
         return;
@@ -862,14 +935,19 @@ static void vnc_dpy_switch(DisplayChangeListener *dcl,
                                   surface_height(surface),
                                   surface_format(surface));
     /* server surface */
+    vnc_dirty_map_resize(&vd->guest.dirty, vnc_width(vd), vnc_height(vd));
+    vnc_resize_stats(vd);
     vnc_update_server_surface(vd);
 
     QTAILQ_FOREACH(vs, &vd->clients, next) {
         vnc_colordepth(vs);
         vnc_desktop_resize(vs);
         vnc_cursor_define(vs);
-        memset(vs->dirty, 0x00, sizeof(vs->dirty));
-        vnc_set_area_dirty(vs->dirty, vd, 0, 0,
+        vnc_alloc_lossy_rect(vs);
+        vnc_dirty_map_resize(&vs->dirty, vnc_width(vd), vnc_height(vd));
+        /* a copy within the old surface; all of it is resent anyway */
+        vs->copy.pending = false;
+        vnc_set_area_dirty(&vs->dirty, 0, 0,
                            vnc_width(vd),
                            vnc_height(vd));
         vnc_update_throttle_offset(vs);
@@ -962,6 +1040,10 @@ int vnc_send_framebuffer_update(VncState *vs, int x, int y, int w, int h)
 {
     int n = 0;
 
+    if (vs->vd->tile_encoding) {
+        return vnc_tile_send_framebuffer_update(vs, x, y, w, h);
+    }
+
     switch(vs->vnc_encoding) {
         case VNC_ENCODING_ZLIB:
             n = vnc_zlib_send_framebuffer_update(vs, x, y, w, h);
@@ -1059,10 +1141,12 @@ static int find_and_clear_dirty_height(VncState *vs,
     int h;
 
     for (h = 1; h < (height - y); h++) {
-        if (!test_bit(last_x, vs->dirty[y + h])) {
+        unsigned long *row = vnc_dirty_row(&vs->dirty, y + h);
+
+        if (!test_bit(last_x, row)) {
             break;
         }
-        bitmap_clear(vs->dirty[y + h], last_x, x - last_x);
+        bitmap_clear(row, last_x, x - last_x);
     }
 
     return h;
@@ -1173,7 +1257,8 @@ static int vnc_update_client(VncState *vs, int has_dirty)
         return 0;
     }
 
-    if (!vs->has_dirty && vs->update != VNC_STATE_UPDATE_FORCE) {
+    if (!vs->has_dirty && !vs->copy.pending &&
+        vs->update != VNC_STATE_UPDATE_FORCE) {
         return 0;
     }
 
@@ -1184,26 +1269,29 @@ static int vnc_update_client(VncState *vs, int has_dirty)
      * send them to the client.
      */
     job = vnc_job_new(vs);
+    if (vs->copy.pending) {
+        job->copy = vs->copy;
+        vs->copy.pending = false;
+        n++;
+    }
 
-    height = pixman_image_get_height(vd->server);
+    height = MIN(pixman_image_get_height(vd->server), vs->dirty.height);
     width = pixman_image_get_width(vd->server);
 
     y = 0;
     for (;;) {
         int x, h;
-        unsigned long x2;
-        unsigned long offset = find_next_bit((unsigned long *) &vs->dirty,
-                                             height * VNC_DIRTY_BPL(vs),
-                                             y * VNC_DIRTY_BPL(vs));
-        if (offset == height * VNC_DIRTY_BPL(vs)) {
+        unsigned long x2, *row;
+
+        y = vnc_dirty_map_next_row(&vs->dirty, y);
+        if (y >= height) {
             /* no more dirty bits */
             break;
         }
-        y = offset / VNC_DIRTY_BPL(vs);
-        x = offset % VNC_DIRTY_BPL(vs);
-        x2 = find_next_zero_bit((unsigned long *) &vs->dirty[y],
-                                VNC_DIRTY_BPL(vs), x);
-        bitmap_clear(vs->dirty[y], x, x2 - x);
+        row = vnc_dirty_row(&vs->dirty, y);
+        x = find_first_bit(row, vs->dirty.bpl);
+        x2 = find_next_zero_bit(row, vs->dirty.bpl, x);
+        bitmap_clear(row, x, x2 - x);
         h = find_and_clear_dirty_height(vs, y, x, x2, height);
         x2 = MIN(x2, width / VNC_DIRTY_PIXELS_PER_BIT);
         if (x2 > x) {
@@ -1322,8 +1410,6 @@ static void vnc_disconnect_start(VncState *vs)
 
 void vnc_disconnect_finish(VncState *vs)
 {
-    int i;
-
     trace_vnc_client_disconnect_finish(vs, vs->ioc);
 
     vnc_jobs_join(vs); /* Wait encoding jobs */
@@ -1366,10 +1452,8 @@ void vnc_disconnect_finish(VncState *vs)
     }
     buffer_free(&vs->jobs_buffer);
 
-    for (i = 0; i < VNC_STAT_ROWS; ++i) {
-        g_free(vs->lossy_rect[i]);
-    }
     g_free(vs->lossy_rect);
+    vnc_dirty_map_free(&vs->dirty);
 
     object_unref(OBJECT(vs->ioc));
     vs->ioc = NULL;
@@ -2089,7 +2173,7 @@ static void framebuffer_update_request(VncState *vs, int incremental,
         }
     } else {
         vs->update = VNC_STATE_UPDATE_FORCE;
-        vnc_set_area_dirty(vs->dirty, vs->vd, x, y, w, h);
+        vnc_set_area_dirty(&vs->dirty, x, y, w, h);
         if (vnc_has_feature(vs, VNC_FEATURE_RESIZE_EXT)) {
             vnc_desktop_resize_ext(vs, 0);
         }
@@ -2190,6 +2274,9 @@ static void set_encodings(VncState *vs, int32_t *encodings, size_t n_encodings)
             vs->features |= VNC_FEATURE_ZYWRLE_MASK;
             vs->vnc_encoding = enc;
             break;
+        case VNC_ENCODING_COPYRECT:
+            vs->features |= VNC_FEATURE_COPYRECT_MASK;
+            break;
         case VNC_ENCODING_DESKTOPRESIZE:
             vs->features |= VNC_FEATURE_RESIZE_MASK;
             break;
@@ -2940,16 +3027,19 @@ static int protocol_version(VncState *vs, uint8_t *version, size_t len)
 static VncRectStat *vnc_stat_rect(VncDisplay *vd, int x, int y)
 {
     struct VncSurface *vs = &vd->guest;
+    int row = MIN(y / VNC_STAT_RECT, vs->stat_rows - 1);
+    int col = MIN(x / VNC_STAT_RECT, vs->stat_cols - 1);
 
-    return &vs->stats[y / VNC_STAT_RECT][x / VNC_STAT_RECT];
+    return &vs->stats[row * vs->stat_cols + col];
 }
 
 void vnc_sent_lossy_rect(VncState *vs, int x, int y, int w, int h)
 {
+    struct VncSurface *s = &vs->vd->guest;
     int i, j;
 
-    w = (x + w) / VNC_STAT_RECT;
-    h = (y + h) / VNC_STAT_RECT;
+    w = MIN((x + w) / VNC_STAT_RECT, s->stat_cols - 1);
+    h = MIN((y + h) / VNC_STAT_RECT, s->stat_rows - 1);
     x /= VNC_STAT_RECT;
     y /= VNC_STAT_RECT;
 
@@ -2983,10 +3073,10 @@ static int vnc_refresh_lossy_rect(VncDisplay *vd, int x, int y)
         }
 
         vs->lossy_rect[sty][stx] = 0;
-        for (j = 0; j < VNC_STAT_RECT; ++j) {
-            bitmap_set(vs->dirty[y + j],
-                       x / VNC_DIRTY_PIXELS_PER_BIT,
-                       VNC_STAT_RECT / VNC_DIRTY_PIXELS_PER_BIT);
+        for (j = 0; j < VNC_STAT_RECT && y + j < vs->dirty.height; ++j) {
+            vnc_dirty_map_set(&vs->dirty, y + j,
+                              x / VNC_DIRTY_PIXELS_PER_BIT,
+                              VNC_STAT_RECT / VNC_DIRTY_PIXELS_PER_BIT);
         }
         has_dirty++;
     }
@@ -3087,17 +3177,320 @@ static void vnc_rect_updated(VncDisplay *vd, int x, int y, struct timeval * tv)
     rect->updated = true;
 }
 
+/*
+ * Scroll and move detection
+ *
+ * Guests mostly scroll by repainting, so before the guest dirty map is
+ * folded into the server surface look for a block of dirty rows whose
+ * new content is the old server content shifted vertically or
+ * horizontally.  Candidate shifts are found by hashing rows (vertical)
+ * or by locating a run of old pixels in the new row (horizontal), then
+ * verified with a full compare.  A match is applied to the server surface
+ * and sent as CopyRect to the clients that can take it; the regular
+ * compare pass afterwards only finds what the move did not explain.
+ */
+#define VNC_COPY_MIN_ROWS   16
+#define VNC_COPY_MIN_WIDTH  64
+#define VNC_COPY_SAMPLES    16
+#define VNC_COPY_ANCHOR     8   /* pixels */
+
+typedef struct VncCopyRow {
+    uint64_t hash;
+    int y;
+} VncCopyRow;
+
+static uint64_t vnc_copy_hash(const uint8_t *p, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        h = (h ^ ldq_he_p(p + i)) * 0x100000001b3ULL;
+    }
+    for (; i < len; i++) {
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    }
+    return h ^ (h >> 29);
+}
+
+static int vnc_copy_row_cmp(const void *a, const void *b)
+{
+    const VncCopyRow *ra = a, *rb = b;
+
+    return ra->hash < rb->hash ? -1 : ra->hash > rb->hash;
+}
+
+static uint8_t *vnc_guest_ptr(VncDisplay *vd, int x, int y)
+{
+    return (uint8_t *)pixman_image_get_data(vd->guest.fb) +
+        y * pixman_image_get_stride(vd->guest.fb) + x * VNC_SERVER_FB_BYTES;
+}
+
+/* Add a vote for shift d, returns the number of votes it has now */
+static int vnc_copy_vote(int *shift, int *votes, int *n, int d)
+{
+    int i;
+
+    for (i = 0; i < *n; i++) {
+        if (shift[i] == d) {
+            return ++votes[i];
+        }
+    }
+    if (*n < VNC_COPY_SAMPLES) {
+        shift[*n] = d;
+        votes[(*n)++] = 1;
+    }
+    return 1;
+}
+
+static int vnc_copy_best(int *shift, int *votes, int n)
+{
+    int i, best = -1;
+
+    for (i = 0; i < n; i++) {
+        if (votes[i] >= 2 && (best < 0 || votes[i] > votes[best])) {
+            best = i;
+        }
+    }
+    return best < 0 ? 0 : shift[best];
+}
+
+static int vnc_copy_find_dy(VncDisplay *vd, int xa, int xb, int ya, int yb)
+{
+    size_t bytes = (xb - xa) * VNC_SERVER_FB_BYTES;
+    int n = yb - ya, step = MAX(1, n / VNC_COPY_SAMPLES);
+    int shift[VNC_COPY_SAMPLES], votes[VNC_COPY_SAMPLES], nshift = 0;
+    g_autofree VncCopyRow *old = g_new(VncCopyRow, n);
+    VncCopyRow key, *hit;
+    int y;
+
+    for (y = ya; y < yb; y++) {
+        old[y - ya].hash = vnc_copy_hash(vnc_server_fb_ptr(vd, xa, y), bytes);
+        old[y - ya].y = y;
+    }
+    qsort(old, n, sizeof(*old), vnc_copy_row_cmp);
+
+    for (y = ya + step / 2; y < yb; y += step) {
+        key.hash = vnc_copy_hash(vnc_guest_ptr(vd, xa, y), bytes);
+        hit = bsearch(&key, old, n, sizeof(*old), vnc_copy_row_cmp);
+        if (!hit || hit->y == y) {
+            continue;
+        }
+        /* rows that occur more than once (blank lines) say nothing */
+        if ((hit > old && hit[-1].hash == key.hash) ||
+            (hit < old + n - 1 && hit[1].hash == key.hash)) {
+            continue;
+        }
+        vnc_copy_vote(shift, votes, &nshift, y - hit->y);
+    }
+    return vnc_copy_best(shift, votes, nshift);
+}
+
+static int vnc_copy_find_dx(VncDisplay *vd, int xa, int xb, int ya, int yb)
+{
+    size_t bytes = (xb - xa) * VNC_SERVER_FB_BYTES;
+    size_t anchor_bytes = VNC_COPY_ANCHOR * VNC_SERVER_FB_BYTES;
+    int n = yb - ya, step = MAX(1, n / VNC_COPY_SAMPLES);
+    int shift[VNC_COPY_SAMPLES], votes[VNC_COPY_SAMPLES], nshift = 0;
+    int mid = (xa + xb - VNC_COPY_ANCHOR) / 2;
+    int x, y;
+
+    for (y = ya + step / 2; y < yb; y += step) {
+        uint32_t *anchor = vnc_server_fb_ptr(vd, mid, y);
+        uint32_t *row = (uint32_t *)vnc_guest_ptr(vd, xa, y);
+
+        if (!memcmp(vnc_server_fb_ptr(vd, xa, y), row, bytes)) {
+            continue;
+        }
+        /* a uniform anchor matches anywhere */
+        for (x = 1; x < VNC_COPY_ANCHOR && anchor[x] == anchor[0]; x++) {
+        }
+        if (x == VNC_COPY_ANCHOR) {
+            continue;
+        }
+        for (x = 0; x <= xb - xa - VNC_COPY_ANCHOR; x++) {
+            if (row[x] == anchor[0] && xa + x != mid &&
+                !memcmp(row + x, anchor, anchor_bytes)) {
+                vnc_copy_vote(shift, votes, &nshift, xa + x - mid);
+                break;
+            }
+        }
+    }
+    return vnc_copy_best(shift, votes, nshift);
+}
+
+/*
+ * Longest run of rows in [ya, yb) whose columns [xa, xb) on the guest
+ * surface equal the server surface at (x - dx, y - dy).
+ */
+static int vnc_copy_verify(VncDisplay *vd, int xa, int xb, int ya, int yb,
+                           int dx, int dy, int *start)
+{
+    size_t bytes = (xb - xa) * VNC_SERVER_FB_BYTES;
+    int y, run = ya, best = 0;
+
+    for (y = ya; y <= yb; y++) {
+        if (y < yb && !memcmp(vnc_guest_ptr(vd, xa, y),
+                              vnc_server_fb_ptr(vd, xa - dx, y - dy),
+                              bytes)) {
+            continue;
+        }
+        if (y - run > best) {
+            best = y - run;
+            *start = run;
+        }
+        run = y + 1;
+    }
+    return best;
+}
+
+/* Whether the source of a copy is up to date on the client */
+static bool vnc_copy_possible(VncState *vs, int x, int y, int w, int h)
+{
+    int x0 = x / VNC_DIRTY_PIXELS_PER_BIT;
+    int x1 = (x + w - 1) / VNC_DIRTY_PIXELS_PER_BIT;
+    int j;
+
+    if (!vnc_has_feature(vs, VNC_FEATURE_COPYRECT) ||
+        !vnc_should_update(vs) || vnc_has_job(vs) || vs->copy.pending) {
+        return false;
+    }
+    for (j = y; j < y + h; j++) {
+        if (find_next_bit(vnc_dirty_row(&vs->dirty, j), x1 + 1, x0) <= x1) {
+            return false;
+        }
+    }
+    /* lossy pixels must not spread */
+    for (j = y / VNC_STAT_RECT; j <= (y + h - 1) / VNC_STAT_RECT; j++) {
+        if (memchr(vs->lossy_rect[j] + x / VNC_STAT_RECT, 1,
+                   (x + w - 1) / VNC_STAT_RECT - x / VNC_STAT_RECT + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void vnc_copy_rect(VncDisplay *vd, int src_x, int src_y,
+                          int dst_x, int dst_y, int w, int h)
+{
+    size_t bytes = w * VNC_SERVER_FB_BYTES;
+    VncState *vs;
+    int i, y;
+
+    trace_vnc_copy_rect(vd, src_x, src_y, dst_x, dst_y, w, h);
+
+    /* copy bottom up when moving down */
+    for (i = 0; i < h; i++) {
+        y = dst_y > src_y ? h - 1 - i : i;
+        memmove(vnc_server_fb_ptr(vd, dst_x, dst_y + y),
+                vnc_server_fb_ptr(vd, src_x, src_y + y), bytes);
+    }
+
+    /*
+     * The copy goes out first in the update vnc_update_client() sends
+     * right after this refresh, which is still due as the client has
+     * asked for one.
+     */
+    QTAILQ_FOREACH(vs, &vd->clients, next) {
+        if (vnc_copy_possible(vs, src_x, src_y, w, h) &&
+            MAX(src_x, dst_x) + w <= vs->client_width &&
+            MAX(src_y, dst_y) + h <= vs->client_height) {
+            vs->copy = (VncCopyRect) {
+                .pending = true,
+                .src_x = src_x,
+                .src_y = src_y,
+                .dst = { dst_x, dst_y, w, h },
+            };
+        } else {
+            vnc_set_area_dirty(&vs->dirty, dst_x, dst_y, w, h);
+        }
+    }
+}
+
+static void vnc_detect_copy(VncDisplay *vd, int width, int height)
+{
+    VncDirtyMap *map = &vd->guest.dirty;
+    int nbits = DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
+    int y, ya = 0, yb = 0, xa = nbits, xb = 0;
+    int start, end, first, last, run_xa, run_xb;
+    int dx = 0, dy = 0, cy = 0, rows;
+    VncState *vs;
+
+    QTAILQ_FOREACH(vs, &vd->clients, next) {
+        if (vnc_has_feature(vs, VNC_FEATURE_COPYRECT)) {
+            break;
+        }
+    }
+    if (!vs) {
+        return;
+    }
+
+    /* the longest block of consecutive dirty rows and its columns */
+    y = vnc_dirty_map_next_row(map, 0);
+    while (y < height) {
+        run_xa = nbits;
+        run_xb = 0;
+        for (start = end = y; end < height; end++) {
+            unsigned long *row = vnc_dirty_row(map, end);
+
+            first = find_first_bit(row, nbits);
+            if (first >= nbits) {
+                break;
+            }
+            last = find_last_bit(row, nbits);
+            run_xa = MIN(run_xa, first);
+            run_xb = MAX(run_xb, last + 1);
+        }
+        if (end - start > yb - ya) {
+            ya = start;
+            yb = end;
+            xa = run_xa;
+            xb = run_xb;
+        }
+        y = vnc_dirty_map_next_row(map, end);
+    }
+
+    xa *= VNC_DIRTY_PIXELS_PER_BIT;
+    xb = MIN(xb * VNC_DIRTY_PIXELS_PER_BIT, width);
+    if (yb - ya < 2 * VNC_COPY_MIN_ROWS || xb - xa < VNC_COPY_MIN_WIDTH) {
+        return;
+    }
+
+    dy = vnc_copy_find_dy(vd, xa, xb, ya, yb);
+    if (dy) {
+        rows = vnc_copy_verify(vd, xa, xb, MAX(ya, ya + dy),
+                               MIN(yb, yb + dy), 0, dy, &cy);
+        if (rows >= VNC_COPY_MIN_ROWS) {
+            vnc_copy_rect(vd, xa, cy - dy, xa, cy, xb - xa, rows);
+        }
+        return;
+    }
+
+    dx = vnc_copy_find_dx(vd, xa, xb, ya, yb);
+    if (dx && xb - xa - abs(dx) >= VNC_COPY_MIN_WIDTH) {
+        rows = vnc_copy_verify(vd, MAX(xa, xa + dx), MIN(xb, xb + dx),
+                               ya, yb, dx, 0, &cy);
+        if (rows >= VNC_COPY_MIN_ROWS) {
+            vnc_copy_rect(vd, MAX(xa, xa + dx) - dx, cy, MAX(xa, xa + dx), cy,
+                          xb - xa - abs(dx), rows);
+        }
+    }
+}
+
 static int vnc_refresh_server_surface(VncDisplay *vd)
 {
     int width = MIN(pixman_image_get_width(vd->guest.fb),
                     pixman_image_get_width(vd->server));
-    int height = MIN(pixman_image_get_height(vd->guest.fb),
-                     pixman_image_get_height(vd->server));
+    int height = MIN(MIN(pixman_image_get_height(vd->guest.fb),
+                         pixman_image_get_height(vd->server)),
+                     vd->guest.dirty.height);
+    int nbits = DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
     int cmp_bytes, server_stride, line_bytes, guest_ll, guest_stride, y = 0;
     uint8_t *guest_row0 = NULL, *server_row0;
     VncState *vs;
     int has_dirty = 0;
     pixman_image_t *tmpbuf = NULL;
+    DECLARE_BITMAP(changed, VNC_MAX_WIDTH / VNC_DIRTY_PIXELS_PER_BIT);
 
     struct timeval tv = { 0, 0 };
 
@@ -3129,51 +3522,63 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
     }
     line_bytes = MIN(server_stride, guest_ll);
 
+    if (vd->guest.format == VNC_SERVER_FB_FORMAT) {
+        vnc_detect_copy(vd, width, height);
+    }
+
     for (;;) {
-        int x;
+        int x, x2, i;
+        unsigned long *row;
         uint8_t *guest_ptr, *server_ptr;
-        unsigned long offset = find_next_bit((unsigned long *) &vd->guest.dirty,
-                                             height * VNC_DIRTY_BPL(&vd->guest),
-                                             y * VNC_DIRTY_BPL(&vd->guest));
-        if (offset == height * VNC_DIRTY_BPL(&vd->guest)) {
+        int bytes;
+
+        y = vnc_dirty_map_next_row(&vd->guest.dirty, y);
+        if (y >= height) {
             /* no more dirty bits */
             break;
         }
-        y = offset / VNC_DIRTY_BPL(&vd->guest);
-        x = offset % VNC_DIRTY_BPL(&vd->guest);
+        row = vnc_dirty_row(&vd->guest.dirty, y);
 
-        server_ptr = server_row0 + y * server_stride + x * cmp_bytes;
+        /* compare and copy whole runs of dirty chunks at once */
+        for (x = find_first_bit(row, nbits); x < nbits;
+             x = find_next_bit(row, nbits, x2)) {
+            x2 = find_next_zero_bit(row, nbits, x);
+            bitmap_clear(row, x, x2 - x);
 
-        if (vd->guest.format != VNC_SERVER_FB_FORMAT) {
-            qemu_pixman_linebuf_fill(tmpbuf, vd->guest.fb, width, 0, y);
-            guest_ptr = (uint8_t *)pixman_image_get_data(tmpbuf);
-        } else {
-            guest_ptr = guest_row0 + y * guest_stride;
-        }
-        guest_ptr += x * cmp_bytes;
+            server_ptr = server_row0 + y * server_stride + x * cmp_bytes;
+            bytes = MIN(x2 * cmp_bytes, line_bytes) - x * cmp_bytes;
 
-        for (; x < DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
-             x++, guest_ptr += cmp_bytes, server_ptr += cmp_bytes) {
-            int _cmp_bytes = cmp_bytes;
-            if (!test_and_clear_bit(x, vd->guest.dirty[y])) {
-                continue;
-            }
-            if ((x + 1) * cmp_bytes > line_bytes) {
-                _cmp_bytes = line_bytes - x * cmp_bytes;
+            if (vd->guest.format != VNC_SERVER_FB_FORMAT) {
+                /* only convert the dirty span */
+                int px = x * VNC_DIRTY_PIXELS_PER_BIT;
+                int npx = MIN(x2 * VNC_DIRTY_PIXELS_PER_BIT, width) - px;
+
+                qemu_pixman_linebuf_fill(tmpbuf, vd->guest.fb, npx, px, y);
+                guest_ptr = (uint8_t *)pixman_image_get_data(tmpbuf);
+                bytes = MIN(bytes, npx * VNC_SERVER_FB_BYTES);
+            } else {
+                guest_ptr = guest_row0 + y * guest_stride + x * cmp_bytes;
             }
-            assert(_cmp_bytes >= 0);
-            if (memcmp(server_ptr, guest_ptr, _cmp_bytes) == 0) {
+            if (bytes <= 0) {
                 continue;
             }
-            memcpy(server_ptr, guest_ptr, _cmp_bytes);
-            if (!vd->non_adaptive) {
-                vnc_rect_updated(vd, x * VNC_DIRTY_PIXELS_PER_BIT,
-                                 y, &tv);
+
+            bitmap_zero(changed, x2 - x);
+            if (!vnc_cmp_copy(server_ptr, guest_ptr, bytes, cmp_bytes,
+                              changed)) {
+                continue;
             }
-            QTAILQ_FOREACH(vs, &vd->clients, next) {
-                set_bit(x, vs->dirty[y]);
+            for (i = find_first_bit(changed, x2 - x); i < x2 - x;
+                 i = find_next_bit(changed, x2 - x, i + 1)) {
+                if (!vd->non_adaptive) {
+                    vnc_rect_updated(vd, (x + i) * VNC_DIRTY_PIXELS_PER_BIT,
+                                     y, &tv);
+                }
+                QTAILQ_FOREACH(vs, &vd->clients, next) {
+                    vnc_dirty_map_set(&vs->dirty, y, x + i, 1);
+                }
+                has_dirty++;
             }
-            has_dirty++;
         }
 
         y++;
@@ -3226,7 +3631,6 @@ static void vnc_connect(VncDisplay *vd, QIOChannelSocket *sioc,
 {
     VncState *vs = g_new0(VncState, 1);
     bool first_client = QTAILQ_EMPTY(&vd->clients);
-    int i;
 
     trace_vnc_client_connect(vs, sioc);
     vs->zrle = g_new0(VncZrle, 1);
@@ -3271,10 +3675,8 @@ static void vnc_connect(VncDisplay *vd, QIOChannelSocket *sioc,
     VNC_DEBUG("Client sioc=%p ws=%d auth=%d subauth=%d\n",
               sioc, websocket, vs->auth, vs->subauth);
 
-    vs->lossy_rect = g_malloc0(VNC_STAT_ROWS * sizeof (*vs->lossy_rect));
-    for (i = 0; i < VNC_STAT_ROWS; ++i) {
-        vs->lossy_rect[i] = g_new0(uint8_t, VNC_STAT_COLS);
-    }
+    vnc_alloc_lossy_rect(vs);
+    vnc_dirty_map_resize(&vs->dirty, vnc_width(vd), vnc_height(vd));
 
     VNC_DEBUG("New client on socket %p\n", vs->sioc);
     update_displaychangelistener(&vd->dcl, VNC_REFRESH_INTERVAL_BASE);
@@ -3399,7 +3801,7 @@ void vnc_display_init(const char *id, Error **errp)
     vd->connections_limit = 32;
 
     qemu_mutex_init(&vd->mutex);
-    vnc_start_worker_thread();
+    vnc_start_worker_thread(1);
 
     vd->dcl.ops = &dcl_ops;
     register_displaychangelistener(&vd->dcl);
@@ -3577,6 +3979,12 @@ static QemuOptsList qemu_vnc_opts = {
         },{
             .name = "power-control",
             .type = QEMU_OPT_BOOL,
+        },{
+            .name = "tile-encoding",
+            .type = QEMU_OPT_BOOL,
+        },{
+            .name = "encode-threads",
+            .type = QEMU_OPT_NUMBER,
         },
         { /* end of list */ }
     },
@@ -4005,6 +4413,7 @@ void vnc_display_open(const char *id, Error **errp)
     SocketAddress **saddr = NULL, **wsaddr = NULL;
     size_t nsaddr, nwsaddr;
     const char *share, *device_id;
+    uint64_t encode_threads;
     QemuConsole *con;
     bool password = false;
     bool reverse = false;
@@ -4140,9 +4549,18 @@ void vnc_display_open(const char *id, Error **errp)
     if (!vd->lossy) {
         vd->non_adaptive = true;
     }
+    vd->tile_encoding = qemu_opt_get_bool(opts, "tile-encoding", false);
 
     vd->power_control = qemu_opt_get_bool(opts, "power-control", false);
 
+    encode_threads = qemu_opt_get_number(opts, "encode-threads", 1);
+    if (encode_threads < 1 || encode_threads > VNC_MAX_ENCODE_THREADS) {
+        error_setg(errp, "vnc encode-threads must be between 1 and %d",
+                   VNC_MAX_ENCODE_THREADS);
+        goto fail;
+    }
+    vnc_start_worker_thread(encode_threads);
+
     if (tlsauthz) {
         vd->tlsauthzid = g_strdup(tlsauthz);
     }
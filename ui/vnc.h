@@ -79,21 +79,33 @@ typedef void VncSendHextileTile(VncState *vs,
  * by one bit in the dirty bitmap, should be a power of 2 */
 #define VNC_DIRTY_PIXELS_PER_BIT 16
 
-/* VNC_MAX_WIDTH must be a multiple of VNC_DIRTY_PIXELS_PER_BIT. */
+/* VNC_MAX_WIDTH must be a multiple of VNC_DIRTY_PIXELS_PER_BIT.
+ * The dirty maps are sized from the surface, these only bound it. */
 
-#define VNC_MAX_WIDTH ROUND_UP(2560, VNC_DIRTY_PIXELS_PER_BIT)
-#define VNC_MAX_HEIGHT 2048
-
-/* VNC_DIRTY_BITS is the number of bits in the dirty bitmap. */
-#define VNC_DIRTY_BITS (VNC_MAX_WIDTH / VNC_DIRTY_PIXELS_PER_BIT)
-
-/* VNC_DIRTY_BPL (BPL = bits per line) might be greater than
- * VNC_DIRTY_BITS due to alignment */
-#define VNC_DIRTY_BPL(x) (sizeof((x)->dirty) / VNC_MAX_HEIGHT * BITS_PER_BYTE)
+#define VNC_MAX_WIDTH ROUND_UP(16384, VNC_DIRTY_PIXELS_PER_BIT)
+#define VNC_MAX_HEIGHT 16384
 
 #define VNC_STAT_RECT  64
-#define VNC_STAT_COLS (VNC_MAX_WIDTH / VNC_STAT_RECT)
-#define VNC_STAT_ROWS (VNC_MAX_HEIGHT / VNC_STAT_RECT)
+
+/*
+ * Dirty map of a surface: one bit per VNC_DIRTY_PIXELS_PER_BIT pixels of
+ * each row, plus a summary with one bit per row.  A row bit set implies
+ * the summary bit of its row is set; the converse does not hold, summary
+ * bits are only cleared lazily once their row is found clean.  Scans walk
+ * the summary first so that clean rows are skipped a word at a time.
+ */
+typedef struct VncDirtyMap {
+    unsigned long *bits;
+    unsigned long *summary;
+    int width;      /* in pixels, a multiple of VNC_DIRTY_PIXELS_PER_BIT */
+    int height;
+    int bpl;        /* bits per line, a multiple of BITS_PER_LONG */
+} VncDirtyMap;
+
+static inline unsigned long *vnc_dirty_row(VncDirtyMap *map, int y)
+{
+    return map->bits + y * (map->bpl / BITS_PER_LONG);
+}
 
 #define VNC_AUTH_CHALLENGE_SIZE 16
 
@@ -120,9 +132,10 @@ typedef struct VncRectStat VncRectStat;
 struct VncSurface
 {
     struct timeval last_freq_check;
-    DECLARE_BITMAP(dirty[VNC_MAX_HEIGHT],
-                   VNC_MAX_WIDTH / VNC_DIRTY_PIXELS_PER_BIT);
-    VncRectStat stats[VNC_STAT_ROWS][VNC_STAT_COLS];
+    VncDirtyMap dirty;
+    VncRectStat *stats;
+    int stat_rows;
+    int stat_cols;
     pixman_image_t *fb;
     pixman_format_code_t format;
 };
@@ -178,6 +191,7 @@ struct VncDisplay
     int ws_subauth; /* Used by websockets */
     bool lossy;
     bool non_adaptive;
+    bool tile_encoding;
     bool power_control;
     QCryptoTLSCreds *tlscreds;
     QAuthZ *tlsauthz;
@@ -247,10 +261,20 @@ struct VncRectEntry
     QLIST_ENTRY(VncRectEntry) next;
 };
 
+/* A detected scroll or move, sent ahead of the rectangles of its update */
+typedef struct VncCopyRect {
+    bool pending;
+    int src_x;
+    int src_y;
+    VncRect dst;
+} VncCopyRect;
+
 struct VncJob
 {
     VncState *vs;
+    bool running;
 
+    VncCopyRect copy;
     QLIST_HEAD(, VncRectEntry) rectangles;
     QTAILQ_ENTRY(VncJob) next;
 };
@@ -271,14 +295,16 @@ struct VncState
     guint ioc_tag;
     gboolean disconnecting;
 
-    DECLARE_BITMAP(dirty[VNC_MAX_HEIGHT], VNC_DIRTY_BITS);
+    VncDirtyMap dirty;
     uint8_t **lossy_rect; /* Not an Array to avoid costly memcpy in
-                           * vnc-jobs-async.c */
+                           * vnc-jobs-async.c, sized like guest.stats */
 
     VncDisplay *vd;
     VncStateUpdate update; /* Most recent pending request from client */
     VncStateUpdate job_update; /* Currently processed by job thread */
     int has_dirty;
+    VncCopyRect copy; /* Goes out with the next update */
+    bool lossless; /* Tight may not use JPEG for the current tile */
     uint32_t features;
     int absolute;
     int last_x;
@@ -465,6 +491,7 @@ enum VncFeatures {
     VNC_FEATURE_LED_STATE,
     VNC_FEATURE_XVP,
     VNC_FEATURE_CLIPBOARD_EXT,
+    VNC_FEATURE_COPYRECT,
 };
 
 #define VNC_FEATURE_RESIZE_MASK              (1 << VNC_FEATURE_RESIZE)
@@ -482,6 +509,7 @@ enum VncFeatures {
 #define VNC_FEATURE_LED_STATE_MASK           (1 << VNC_FEATURE_LED_STATE)
 #define VNC_FEATURE_XVP_MASK                 (1 << VNC_FEATURE_XVP)
 #define VNC_FEATURE_CLIPBOARD_EXT_MASK       (1 <<  VNC_FEATURE_CLIPBOARD_EXT)
+#define VNC_FEATURE_COPYRECT_MASK            (1 << VNC_FEATURE_COPYRECT)
 
 
 /* Client -> Server message IDs */
@@ -614,11 +642,17 @@ void vnc_convert_pixel(VncState *vs, uint8_t *buf, uint32_t v);
 double vnc_update_freq(VncState *vs, int x, int y, int w, int h);
 void vnc_sent_lossy_rect(VncState *vs, int x, int y, int w, int h);
 
+/* compare and copy */
+int vnc_cmp_copy(void *dst, const void *src, size_t len, size_t chunk,
+                 unsigned long *changed);
+
 /* Encodings */
 int vnc_send_framebuffer_update(VncState *vs, int x, int y, int w, int h);
 
 int vnc_raw_send_framebuffer_update(VncState *vs, int x, int y, int w, int h);
 
+int vnc_tile_send_framebuffer_update(VncState *vs, int x, int y, int w, int h);
+
 int vnc_hextile_send_framebuffer_update(VncState *vs, int x,
                                          int y, int w, int h);
 void vnc_hextile_set_pixel_conversion(VncState *vs, int generic);
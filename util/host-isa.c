@@ -0,0 +1,90 @@
+/*
+ * Run time selection of vector code
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/host-isa.h"
+
+#ifdef CONFIG_AVX2_OPT
+#include "qemu/cpuid.h"
+
+static unsigned host_isa_detect(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned isa = 0;
+
+    if (max < 1) {
+        return 0;
+    }
+    __cpuid(1, a, b, c, d);
+    if (d & bit_SSE2) {
+        isa |= HOST_ISA_SSE2;
+    }
+    if (c & bit_SSSE3) {
+        isa |= HOST_ISA_SSSE3;
+    }
+    if (c & bit_SSE4_1) {
+        isa |= HOST_ISA_SSE4_1;
+    }
+
+    /* We must check that AVX is not just available, but usable.  */
+    if ((c & bit_OSXSAVE) && (c & bit_AVX) && max >= 7) {
+        int bv;
+        __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+        __cpuid_count(7, 0, a, b, c, d);
+        if ((bv & 0x6) == 0x6 && (b & bit_AVX2)) {
+            isa |= HOST_ISA_AVX2;
+        }
+    }
+    return isa;
+}
+
+unsigned host_isa_flags(void)
+{
+    /*
+     * The callers are constructors of other files, so detect on first
+     * use rather than from a constructor of our own.
+     */
+    static int isa = -1;
+
+    if (isa < 0) {
+        isa = host_isa_detect();
+    }
+    return isa;
+}
+#else
+unsigned host_isa_flags(void)
+{
+    return 0;
+}
+#endif /* CONFIG_AVX2_OPT */
+
+void host_isa_dispatch_init(HostIsaDispatch *d, const HostIsaImpl *impls,
+                            int nr_impls)
+{
+    unsigned isa = host_isa_flags();
+    int i;
+
+    d->nr = d->cur = 0;
+    for (i = 0; i < nr_impls; i++) {
+        if ((impls[i].isa & isa) == impls[i].isa) {
+            assert(d->nr < HOST_ISA_MAX_IMPLS);
+            d->impls[d->nr++] = impls[i].impl;
+        }
+    }
+    /* the plain C version always qualifies */
+    assert(d->nr && impls[nr_impls - 1].isa == 0);
+}
+
+bool host_isa_dispatch_next(HostIsaDispatch *d)
+{
+    if (d->cur + 1 >= d->nr) {
+        return false;
+    }
+    d->cur++;
+    return true;
+}